@@ -18,6 +18,13 @@
  * Strip Android-specific records out of hprof data, back-converting from
  * 1.0.3 to 1.0.2.  This removes some useful information, but allows
  * Android hprof data to be handled by widely-available tools (like "jhat").
+ *
+ * Heap dumps can run to many gigabytes, so the input goes through a fixed
+ * window instead of being read a record at a time.  Records that fit in a
+ * job are gathered into batches and converted on worker threads, and a
+ * writer thread puts the batches out in their original order.  Bigger
+ * records are converted a sub-record at a time as they pass through the
+ * window, so memory use doesn't depend on the size of the dump.
  */
 #include <stdio.h>
 #include <string.h>
@@ -26,6 +33,12 @@
 #include <errno.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/types.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <pthread.h>
+# define HAVE_THREADS 1
+#endif
 
 //#define VERBOSE_DEBUG
 #ifdef VERBOSE_DEBUG
@@ -102,6 +115,13 @@ typedef enum HprofHeapId {
 
 #define kFlagAppOnly 1
 
+#define kWindowSize         (8 * 1024 * 1024)   /* input held in memory */
+#define kJobSize            (1024 * 1024)       /* bigger records are streamed */
+#define kOutputBufferSize   (1024 * 1024)
+#define kSubRecordPeek      64      /* enough for any sub-record header */
+#define kDefaultThreads     4
+#define kMaxThreads         64
+
 /*
  * ===========================================================================
  *      Expanding buffer
@@ -173,15 +193,15 @@ static void ebClear(ExpandBuf* pBuf)
 /*
  * Ensure that the buffer can hold at least "size" additional bytes.
  */
-static int ebEnsureCapacity(ExpandBuf* pBuf, int size)
+static int ebEnsureCapacity(ExpandBuf* pBuf, size_t size)
 {
     assert(size > 0);
 
     if (pBuf->curLen + size > pBuf->maxLen) {
-        int newSize = pBuf->curLen + size + 128;    /* oversize slightly */
+        size_t newSize = pBuf->curLen + size + 128;    /* oversize slightly */
         unsigned char* newStorage = realloc(pBuf->storage, newSize);
         if (newStorage == NULL) {
-            fprintf(stderr, "ERROR: realloc failed on size=%d\n", newSize);
+            fprintf(stderr, "ERROR: realloc failed on size=%zu\n", newSize);
             exit(1);
         }
 
@@ -205,73 +225,227 @@ static int ebAddData(ExpandBuf* pBuf, const void* data, size_t count)
 }
 
 /*
- * Read a NULL-terminated string from the input.
+ * Write some data to the output.
  */
-static int ebReadString(ExpandBuf* pBuf, FILE* in)
+static int writeData(FILE* out, const void* data, size_t count)
 {
-    int ic;
+    size_t actual;
 
-    do {
-        ebEnsureCapacity(pBuf, 1);
+    actual = fwrite(data, 1, count, out);
+    if (actual != count) {
+        fprintf(stderr, "ERROR: write %zu of %zu bytes\n", actual, count);
+        return -1;
+    }
 
-        ic = getc(in);
-        if (feof(in) || ferror(in)) {
-            fprintf(stderr, "ERROR: failed reading input\n");
-            return -1;
-        }
+    return 0;
+}
+
+/*
+ * Write the data from the buffer.  Resets the data count to zero.
+ */
+static int ebWriteData(ExpandBuf* pBuf, FILE* out)
+{
+    assert(pBuf->curLen > 0);
+    assert(pBuf->curLen <= pBuf->maxLen);
 
-        pBuf->storage[pBuf->curLen++] = (unsigned char) ic;
-    } while (ic != 0);
+    if (writeData(out, pBuf->storage, pBuf->curLen) != 0)
+        return -1;
+
+    pBuf->curLen = 0;
 
     return 0;
 }
 
+
 /*
- * Read some data, adding it to the expanding buffer.
- *
- * This will ensure that the buffer has enough space to hold the new data
- * (plus the previous contents).
+ * ===========================================================================
+ *      Input window
+ * ===========================================================================
+ */
+
+/*
+ * The input is read in large chunks into a fixed-size window.  Data is
+ * consumed from the front; whatever is left is moved back to the start
+ * when more is needed.
  */
-static int ebReadData(ExpandBuf* pBuf, FILE* in, size_t count, int eofExpected)
+typedef struct {
+    FILE* fp;
+    unsigned char* storage;
+    size_t start;           /* first unconsumed byte */
+    size_t end;             /* end of the data read so far */
+    off_t filePos;          /* file offset of storage[end], or -1 */
+    int eof;
+} InputWindow;
+
+/*
+ * Set up a window on "fp".
+ */
+static int iwInit(InputWindow* pIn, FILE* fp)
 {
-    size_t actual;
+    pIn->fp = fp;
+    pIn->storage = (unsigned char*) malloc(kWindowSize);
+    pIn->start = pIn->end = 0;
+    pIn->filePos = ftello(fp);
+    pIn->eof = FALSE;
+    if (pIn->storage == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate %d bytes\n", kWindowSize);
+        return -1;
+    }
+    return 0;
+}
 
-    assert(count > 0);
+/*
+ * Release the storage associated with a window.
+ */
+static void iwFree(InputWindow* pIn)
+{
+    free(pIn->storage);
+    pIn->storage = NULL;
+}
 
-    ebEnsureCapacity(pBuf, count);
-    actual = fread(pBuf->storage + pBuf->curLen, 1, count, in);
-    if (actual != count) {
-        if (eofExpected && feof(in) && !ferror(in)) {
-            /* return without reporting an error */
-        } else {
-            fprintf(stderr, "ERROR: read %zu of %zu bytes\n", actual, count);
-            return -1;
+/*
+ * Return a pointer to the unconsumed data.  Only valid until the next
+ * iwFill().
+ */
+static inline unsigned char* iwGetData(InputWindow* pIn)
+{
+    return pIn->storage + pIn->start;
+}
+
+/*
+ * Get the amount of unconsumed data in the window.
+ */
+static inline size_t iwGetLength(InputWindow* pIn)
+{
+    return pIn->end - pIn->start;
+}
+
+/*
+ * Drop "count" bytes from the front of the window.
+ */
+static inline void iwConsume(InputWindow* pIn, size_t count)
+{
+    assert(count <= iwGetLength(pIn));
+    pIn->start += count;
+}
+
+/*
+ * Make at least "count" bytes available, unless the input ends first.
+ * Returns the number of bytes available, or -1 on a read error.
+ */
+static ssize_t iwFill(InputWindow* pIn, size_t count)
+{
+    assert(count <= kWindowSize);
+
+    if (iwGetLength(pIn) >= count)
+        return iwGetLength(pIn);
+
+    memmove(pIn->storage, iwGetData(pIn), iwGetLength(pIn));
+    pIn->end -= pIn->start;
+    pIn->start = 0;
+
+    while (pIn->end < count && !pIn->eof) {
+        size_t wanted = kWindowSize - pIn->end;
+        size_t actual = fread(pIn->storage + pIn->end, 1, wanted, pIn->fp);
+
+        pIn->end += actual;
+        if (pIn->filePos >= 0)
+            pIn->filePos += actual;
+        if (actual != wanted) {
+            if (ferror(pIn->fp)) {
+                fprintf(stderr, "ERROR: failed reading input: %s\n",
+                    strerror(errno));
+                return -1;
+            }
+            pIn->eof = TRUE;
         }
     }
 
-    pBuf->curLen += count;
-    assert(pBuf->curLen <= pBuf->maxLen);
+    return iwGetLength(pIn);
+}
 
-    return 0;
+/*
+ * Get the file offset of the first unconsumed byte, or -1 if the input
+ * isn't seekable.
+ */
+static off_t iwTell(InputWindow* pIn)
+{
+    if (pIn->filePos < 0)
+        return -1;
+    return pIn->filePos - iwGetLength(pIn);
 }
 
 /*
- * Write the data from the buffer.  Resets the data count to zero.
+ * Empty the window and carry on reading from file offset "pos".
  */
-static int ebWriteData(ExpandBuf* pBuf, FILE* out)
+static int iwSeek(InputWindow* pIn, off_t pos)
 {
-    size_t actual;
+    if (fseeko(pIn->fp, pos, SEEK_SET) != 0) {
+        fprintf(stderr, "ERROR: seek failed: %s\n", strerror(errno));
+        return -1;
+    }
+    pIn->start = pIn->end = 0;
+    pIn->filePos = pos;
+    pIn->eof = FALSE;
+    return 0;
+}
 
-    assert(pBuf->curLen > 0);
-    assert(pBuf->curLen <= pBuf->maxLen);
+/*
+ * Consume "count" bytes, writing them to "out" unless it is NULL.
+ */
+static int iwTransfer(InputWindow* pIn, FILE* out, uint64_t count)
+{
+    while (count > 0) {
+        size_t chunk = iwGetLength(pIn);
+
+        if (chunk == 0) {
+            ssize_t avail = iwFill(pIn, 1);
+            if (avail < 0)
+                return -1;
+            if (avail == 0) {
+                fprintf(stderr, "ERROR: unexpected end of input\n");
+                return -1;
+            }
+            chunk = avail;
+        }
+        if (chunk > count)
+            chunk = count;
 
-    actual = fwrite(pBuf->storage, 1, pBuf->curLen, out);
-    if (actual != pBuf->curLen) {
-        fprintf(stderr, "ERROR: write %zu of %zu bytes\n", actual, pBuf->curLen);
-        return -1;
+        if (out != NULL && writeData(out, iwGetData(pIn), chunk) != 0)
+            return -1;
+        iwConsume(pIn, chunk);
+        count -= chunk;
     }
 
-    pBuf->curLen = 0;
+    return 0;
+}
+
+/*
+ * Consume "count" bytes, copying them to "dest".
+ */
+static int iwRead(InputWindow* pIn, unsigned char* dest, size_t count)
+{
+    while (count > 0) {
+        size_t chunk = iwGetLength(pIn);
+
+        if (chunk == 0) {
+            ssize_t avail = iwFill(pIn, 1);
+            if (avail < 0)
+                return -1;
+            if (avail == 0) {
+                fprintf(stderr, "ERROR: unexpected end of input\n");
+                return -1;
+            }
+            chunk = avail;
+        }
+        if (chunk > count)
+            chunk = count;
+
+        memcpy(dest, iwGetData(pIn), chunk);
+        iwConsume(pIn, chunk);
+        dest += chunk;
+        count -= chunk;
+    }
 
     return 0;
 }
@@ -301,7 +475,7 @@ static uint32_t get4BE(const unsigned char* buf)
 {
     uint32_t val;
 
-    val = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+    val = ((uint32_t) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
     return val;
 }
 
@@ -331,295 +505,845 @@ static int computeBasicLen(HprofBasicType basicType)
 }
 
 /*
- * Compute the length of a HPROF_CLASS_DUMP block.
+ * Compute the length of a HPROF_CLASS_DUMP block, of which "len" bytes are
+ * in memory.  Returns -1 if the block is bad, or -2 if it runs past "len".
  */
-static int computeClassDumpLen(const unsigned char* origBuf, int len)
+static int64_t computeClassDumpLen(const unsigned char* buf, size_t len)
 {
-    const unsigned char* buf = origBuf;
-    int blockLen = 0;
+    size_t pos = kIdentSize * 7 + 8;
     int i, count;
 
-    blockLen += kIdentSize * 7 + 8;
-    buf += blockLen;
-    len -= blockLen;
+    if (pos + 2 > len)
+        return -2;
 
-    if (len < 0)
-        return -1;
-
-    count = get2BE(buf);
-    buf += 2;
-    len -= 2;
+    count = get2BE(buf + pos);
+    pos += 2;
     DBUG("CDL: 1st count is %d\n", count);
     for (i = 0; i < count; i++) {
         HprofBasicType basicType;
         int basicLen;
 
-        basicType = buf[2];
+        if (pos + 3 > len)
+            return -2;
+        basicType = buf[pos + 2];
         basicLen = computeBasicLen(basicType);
         if (basicLen < 0) {
             DBUG("ERROR: invalid basicType %d\n", basicType);
             return -1;
         }
 
-        buf += 2 + 1 + basicLen;
-        len -= 2 + 1 + basicLen;
-        if (len < 0)
-            return -1;
+        pos += 2 + 1 + basicLen;
     }
 
-    count = get2BE(buf);
-    buf += 2;
-    len -= 2;
+    if (pos + 2 > len)
+        return -2;
+
+    count = get2BE(buf + pos);
+    pos += 2;
     DBUG("CDL: 2nd count is %d\n", count);
     for (i = 0; i < count; i++) {
         HprofBasicType basicType;
         int basicLen;
 
-        basicType = buf[kIdentSize];
+        if (pos + kIdentSize + 1 > len)
+            return -2;
+        basicType = buf[pos + kIdentSize];
         basicLen = computeBasicLen(basicType);
         if (basicLen < 0) {
             fprintf(stderr, "ERROR: invalid basicType %d\n", basicType);
             return -1;
         }
 
-        buf += kIdentSize + 1 + basicLen;
-        len -= kIdentSize + 1 + basicLen;
-        if (len < 0)
-            return -1;
+        pos += kIdentSize + 1 + basicLen;
     }
 
-    count = get2BE(buf);
-    buf += 2;
-    len -= 2;
+    if (pos + 2 > len)
+        return -2;
+
+    count = get2BE(buf + pos);
+    pos += 2;
     DBUG("CDL: 3rd count is %d\n", count);
-    for (i = 0; i < count; i++) {
-        buf += kIdentSize + 1;
-        len -= kIdentSize + 1;
-        if (len < 0)
-            return -1;
-    }
+    pos += count * (kIdentSize + 1);
+    if (pos > len)
+        return -2;
 
-    DBUG("Total class dump len: %d\n", buf - origBuf);
-    return buf - origBuf;
+    DBUG("Total class dump len: %zu\n", pos);
+    return pos;
 }
 
 /*
  * Compute the length of a HPROF_INSTANCE_DUMP block.
  */
-static int computeInstanceDumpLen(const unsigned char* origBuf, int len ATTRIBUTE_UNUSED)
+static int64_t computeInstanceDumpLen(const unsigned char* origBuf)
 {
-    int extraCount = get4BE(origBuf + kIdentSize * 2 + 4);
-    return kIdentSize * 2 + 8 + extraCount;
+    uint32_t extraCount = get4BE(origBuf + kIdentSize * 2 + 4);
+    return kIdentSize * 2 + 8 + (int64_t) extraCount;
 }
 
 /*
  * Compute the length of a HPROF_OBJECT_ARRAY_DUMP block.
  */
-static int computeObjectArrayDumpLen(const unsigned char* origBuf, int len ATTRIBUTE_UNUSED)
+static int64_t computeObjectArrayDumpLen(const unsigned char* origBuf)
 {
-    int arrayCount = get4BE(origBuf + kIdentSize + 4);
-    return kIdentSize * 2 + 8 + arrayCount * kIdentSize;
+    uint32_t arrayCount = get4BE(origBuf + kIdentSize + 4);
+    return kIdentSize * 2 + 8 + (int64_t) arrayCount * kIdentSize;
 }
 
 /*
  * Compute the length of a HPROF_PRIMITIVE_ARRAY_DUMP block.
  */
-static int computePrimitiveArrayDumpLen(const unsigned char* origBuf, int len ATTRIBUTE_UNUSED)
+static int64_t computePrimitiveArrayDumpLen(const unsigned char* origBuf)
 {
-    int arrayCount = get4BE(origBuf + kIdentSize + 4);
+    uint32_t arrayCount = get4BE(origBuf + kIdentSize + 4);
     HprofBasicType basicType = origBuf[kIdentSize + 8];
     int basicLen = computeBasicLen(basicType);
 
-    return kIdentSize + 9 + arrayCount * basicLen;
+    if (basicLen < 0)
+        return -1;
+    return kIdentSize + 9 + (int64_t) arrayCount * basicLen;
 }
 
 /*
- * Crunch through a heap dump record, writing the original or converted
- * data to "out".
+ * Get the number of bytes at the start of a heap dump sub-record, counting
+ * the type byte, that have to be in memory to convert it.  Class dumps are
+ * handled separately, as the whole thing has to be seen.
  */
-static int processHeapDump(ExpandBuf* pBuf, FILE* out, int flags)
+static size_t computeSubRecordHeaderLen(unsigned char subType)
 {
-    ExpandBuf* pOutBuf = ebAlloc();
-    unsigned char* origBuf = ebGetBuffer(pBuf);
-    unsigned char* buf = origBuf;
-    int len = ebGetLength(pBuf);
-    int result = -1;
-    int heapType = HPROF_HEAP_DEFAULT;
-    int heapIgnore = FALSE;
+    switch (subType) {
+    case HPROF_INSTANCE_DUMP:
+        return 1 + kIdentSize * 2 + 8;
+    case HPROF_OBJECT_ARRAY_DUMP:
+        return 1 + kIdentSize + 8;
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+    case HPROF_PRIMITIVE_ARRAY_NODATA_DUMP:
+        return 1 + kIdentSize + 9;
+    case HPROF_HEAP_DUMP_INFO:
+        return 1 + 4;
+    default:
+        return 1;
+    }
+}
 
-    pBuf = NULL;        /* we just use the raw pointer from here forward */
+/*
+ * Convert the heap dump sub-record at "buf", of which "avail" bytes are in
+ * memory.  The header is rewritten in place, "*pSubLen" is set to the
+ * length of the sub-record (with its type byte), and "*pKeepLen" to the
+ * number of its leading bytes that belong in the output.  "*pHeapIgnore"
+ * carries the effect of HPROF_HEAP_DUMP_INFO from one call to the next.
+ *
+ * Returns 0 on success, 1 if more than "avail" bytes are needed, or -1 if
+ * the sub-record is bad.
+ */
+static int convertSubRecord(unsigned char* buf, size_t avail, int flags,
+    int* pHeapIgnore, uint64_t* pSubLen, uint64_t* pKeepLen)
+{
+    unsigned char subType = buf[0];
+    int justCopy = TRUE;
+    int heapType;
+    int64_t subLen;
+
+    if (avail < computeSubRecordHeaderLen(subType))
+        return 1;
+
+    *pKeepLen = 0;
+
+    DBUG("--- 0x%02x  ", subType);
+    switch (subType) {
+    /* 1.0.2 types */
+    case HPROF_ROOT_UNKNOWN:
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_JNI_GLOBAL:
+        subLen = kIdentSize * 2;
+        break;
+    case HPROF_ROOT_JNI_LOCAL:
+        subLen = kIdentSize + 8;
+        break;
+    case HPROF_ROOT_JAVA_FRAME:
+        subLen = kIdentSize + 8;
+        break;
+    case HPROF_ROOT_NATIVE_STACK:
+        subLen = kIdentSize + 4;
+        break;
+    case HPROF_ROOT_STICKY_CLASS:
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_THREAD_BLOCK:
+        subLen = kIdentSize + 4;
+        break;
+    case HPROF_ROOT_MONITOR_USED:
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_THREAD_OBJECT:
+        subLen = kIdentSize + 8;
+        break;
+    case HPROF_CLASS_DUMP:
+        subLen = computeClassDumpLen(buf+1, avail-1);
+        if (subLen == -2)
+            return 1;
+        break;
+    case HPROF_INSTANCE_DUMP:
+        subLen = computeInstanceDumpLen(buf+1);
+        if (*pHeapIgnore) {
+            justCopy = FALSE;
+        }
+        break;
+    case HPROF_OBJECT_ARRAY_DUMP:
+        subLen = computeObjectArrayDumpLen(buf+1);
+        if (*pHeapIgnore) {
+            justCopy = FALSE;
+        }
+        break;
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+        subLen = computePrimitiveArrayDumpLen(buf+1);
+        if (*pHeapIgnore) {
+            justCopy = FALSE;
+        }
+        break;
+    /* these were added for Android in 1.0.3 */
+    case HPROF_HEAP_DUMP_INFO:
+        heapType = get4BE(buf+1);
+        if ((flags & kFlagAppOnly) != 0
+                && (heapType == HPROF_HEAP_ZYGOTE || heapType == HPROF_HEAP_IMAGE)) {
+            *pHeapIgnore = TRUE;
+        } else {
+            *pHeapIgnore = FALSE;
+        }
+        justCopy = FALSE;
+        subLen = kIdentSize + 4;
+        // no 1.0.2 equivalent for this
+        break;
+    case HPROF_ROOT_INTERNED_STRING:
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_FINALIZING:
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_DEBUGGER:
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_REFERENCE_CLEANUP:
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_VM_INTERNAL:
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        subLen = kIdentSize;
+        break;
+    case HPROF_ROOT_JNI_MONITOR:
+        /* keep the ident, drop the next 8 bytes */
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        justCopy = FALSE;
+        *pKeepLen = 1 + kIdentSize;
+        subLen = kIdentSize + 8;
+        break;
+    case HPROF_UNREACHABLE:
+        buf[0] = HPROF_ROOT_UNKNOWN;
+        subLen = kIdentSize;
+        break;
+    case HPROF_PRIMITIVE_ARRAY_NODATA_DUMP:
+        buf[0] = HPROF_PRIMITIVE_ARRAY_DUMP;
+        buf[5] = buf[6] = buf[7] = buf[8] = 0;  /* set array len to 0 */
+        subLen = kIdentSize + 9;
+        break;
+
+    /* shouldn't get here */
+    default:
+        return -1;
+    }
 
-    /* copy the original header to the output buffer */
-    if (ebAddData(pOutBuf, buf, kRecHdrLen) != 0)
-        goto bail;
+    if (subLen < 0)
+        return -1;
 
-    buf += kRecHdrLen;      /* skip past record header */
-    len -= kRecHdrLen;
+    if (justCopy) {
+        /* copy source data */
+        DBUG("(%lld)\n", (long long) (1 + subLen));
+        *pKeepLen = 1 + subLen;
+    } else {
+        /* the sub-record is cut down or omitted */
+        DBUG("(adv %lld)\n", (long long) (1 + subLen));
+    }
 
-    while (len > 0) {
-        unsigned char subType = buf[0];
-        int justCopy = TRUE;
-        int subLen;
+    *pSubLen = 1 + subLen;
+    return 0;
+}
 
-        DBUG("--- 0x%02x  ", subType);
-        switch (subType) {
-        /* 1.0.2 types */
-        case HPROF_ROOT_UNKNOWN:
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_JNI_GLOBAL:
-            subLen = kIdentSize * 2;
-            break;
-        case HPROF_ROOT_JNI_LOCAL:
-            subLen = kIdentSize + 8;
-            break;
-        case HPROF_ROOT_JAVA_FRAME:
-            subLen = kIdentSize + 8;
-            break;
-        case HPROF_ROOT_NATIVE_STACK:
-            subLen = kIdentSize + 4;
-            break;
-        case HPROF_ROOT_STICKY_CLASS:
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_THREAD_BLOCK:
-            subLen = kIdentSize + 4;
-            break;
-        case HPROF_ROOT_MONITOR_USED:
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_THREAD_OBJECT:
-            subLen = kIdentSize + 8;
-            break;
-        case HPROF_CLASS_DUMP:
-            subLen = computeClassDumpLen(buf+1, len-1);
-            break;
-        case HPROF_INSTANCE_DUMP:
-            subLen = computeInstanceDumpLen(buf+1, len-1);
-            if (heapIgnore) {
-                justCopy = FALSE;
-            }
-            break;
-        case HPROF_OBJECT_ARRAY_DUMP:
-            subLen = computeObjectArrayDumpLen(buf+1, len-1);
-            if (heapIgnore) {
-                justCopy = FALSE;
-            }
-            break;
-        case HPROF_PRIMITIVE_ARRAY_DUMP:
-            subLen = computePrimitiveArrayDumpLen(buf+1, len-1);
-            if (heapIgnore) {
-                justCopy = FALSE;
-            }
-            break;
-        /* these were added for Android in 1.0.3 */
-        case HPROF_HEAP_DUMP_INFO:
-            heapType = get4BE(buf+1);
-            if ((flags & kFlagAppOnly) != 0
-                    && (heapType == HPROF_HEAP_ZYGOTE || heapType == HPROF_HEAP_IMAGE)) {
-                heapIgnore = TRUE;
-            } else {
-                heapIgnore = FALSE;
-            }
-            justCopy = FALSE;
-            subLen = kIdentSize + 4;
-            // no 1.0.2 equivalent for this
-            break;
-        case HPROF_ROOT_INTERNED_STRING:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_FINALIZING:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_DEBUGGER:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_REFERENCE_CLEANUP:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_VM_INTERNAL:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
-        case HPROF_ROOT_JNI_MONITOR:
-            /* keep the ident, drop the next 8 bytes */
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            justCopy = FALSE;
-            ebAddData(pOutBuf, buf, 1 + kIdentSize);
-            subLen = kIdentSize + 8;
-            break;
-        case HPROF_UNREACHABLE:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
-        case HPROF_PRIMITIVE_ARRAY_NODATA_DUMP:
-            buf[0] = HPROF_PRIMITIVE_ARRAY_DUMP;
-            buf[5] = buf[6] = buf[7] = buf[8] = 0;  /* set array len to 0 */
-            subLen = kIdentSize + 9;
-            break;
+/*
+ * Report a sub-record that convertSubRecord() didn't like, or that runs
+ * past the end of its record.
+ */
+static void reportBadSubRecord(unsigned char subType, uint64_t offset)
+{
+    fprintf(stderr, "ERROR: bad or truncated subtype 0x%02x at offset %llu\n",
+        subType, (unsigned long long) offset);
+}
 
-        /* shouldn't get here */
-        default:
-            fprintf(stderr, "ERROR: unexpected subtype 0x%02x at offset %zu\n",
-                subType, (size_t) (buf - origBuf));
-            goto bail;
-        }
+/*
+ * Crunch through a heap dump record that's entirely in memory, adding the
+ * converted data to "pOutBuf".  "buf" starts with the record header.
+ */
+static int convertHeapDump(unsigned char* buf, size_t len, ExpandBuf* pOutBuf,
+    int flags)
+{
+    size_t hdrOffset = ebGetLength(pOutBuf);
+    size_t offset = kRecHdrLen;
+    int heapIgnore = FALSE;
 
-        if (justCopy) {
-            /* copy source data */
-            DBUG("(%d)\n", 1 + subLen);
-            ebAddData(pOutBuf, buf, 1 + subLen);
-        } else {
-            /* other data has been written, or the sub-record omitted */
-            DBUG("(adv %d)\n", 1 + subLen);
+    /* copy the original header to the output buffer */
+    if (ebAddData(pOutBuf, buf, kRecHdrLen) != 0)
+        return -1;
+
+    while (offset < len) {
+        uint64_t subLen, keepLen;
+
+        if (convertSubRecord(buf + offset, len - offset, flags, &heapIgnore,
+                &subLen, &keepLen) != 0 || subLen > len - offset) {
+            reportBadSubRecord(buf[offset], offset);
+            return -1;
         }
 
+        if (keepLen != 0 && ebAddData(pOutBuf, buf + offset, keepLen) != 0)
+            return -1;
+
         /* advance to next entry */
-        buf += 1 + subLen;
-        len -= 1 + subLen;
+        offset += subLen;
     }
 
     /*
      * Update the record length.
      */
-    set4BE(ebGetBuffer(pOutBuf) + 5, ebGetLength(pOutBuf) - kRecHdrLen);
+    set4BE(ebGetBuffer(pOutBuf) + hdrOffset + 5,
+        ebGetLength(pOutBuf) - hdrOffset - kRecHdrLen);
 
-    if (ebWriteData(pOutBuf, out) != 0)
-        goto bail;
+    return 0;
+}
 
-    result = 0;
+/*
+ * Crunch through a heap dump record of "length" bytes as it passes through
+ * the input window.  The record header has been consumed already.  If
+ * "out" is NULL nothing is written, which lets the caller find the length
+ * of the converted record before writing it.  "*pOutLen" is set to that
+ * length.
+ */
+static int streamHeapDump(InputWindow* pIn, uint32_t length, FILE* out,
+    int flags, uint32_t* pOutLen)
+{
+    uint64_t offset = 0;
+    uint32_t outLen = 0;
+    int heapIgnore = FALSE;
+
+    while (offset < length) {
+        uint64_t remaining = length - offset;
+        uint64_t subLen, keepLen;
+        ssize_t avail;
+        int res;
+
+        avail = iwFill(pIn, remaining < kSubRecordPeek ? remaining : kSubRecordPeek);
+        if (avail < 0)
+            return -1;
+        if ((uint64_t) avail > remaining)
+            avail = remaining;
+        if (avail == 0) {
+            fprintf(stderr, "ERROR: unexpected end of input\n");
+            return -1;
+        }
+
+        res = convertSubRecord(iwGetData(pIn), avail, flags, &heapIgnore,
+            &subLen, &keepLen);
+        if (res == 1 && (uint64_t) avail < remaining && avail < kWindowSize) {
+            /* a big class dump; try again with as much as the window holds */
+            avail = iwFill(pIn, remaining < kWindowSize ? remaining : kWindowSize);
+            if (avail < 0)
+                return -1;
+            if ((uint64_t) avail > remaining)
+                avail = remaining;
+            res = convertSubRecord(iwGetData(pIn), avail, flags, &heapIgnore,
+                &subLen, &keepLen);
+        }
+        if (res != 0 || subLen > remaining) {
+            reportBadSubRecord(iwGetData(pIn)[0], kRecHdrLen + offset);
+            return -1;
+        }
+
+        if (iwTransfer(pIn, out, keepLen) != 0)
+            return -1;
+        if (iwTransfer(pIn, NULL, subLen - keepLen) != 0)
+            return -1;
+
+        outLen += keepLen;
+        offset += subLen;
+    }
+
+    *pOutLen = outLen;
+    return 0;
+}
+
+/*
+ * Determine whether we can go back and fix up a record length after
+ * writing the record.
+ */
+static int isOutputPatchable(FILE* out)
+{
+#ifndef _WIN32
+    int fdFlags = fcntl(fileno(out), F_GETFL);
+    if (fdFlags < 0 || (fdFlags & O_APPEND) != 0)
+        return FALSE;
+#endif
+    return ftello(out) >= 0;
+}
+
+/*
+ * Convert a record too big for a job, streaming it through the input
+ * window.  "hdr" is the record header, which has been consumed already.
+ *
+ * Heap dumps shrink in conversion, and the new length has to be written
+ * before the data.  If the output is seekable we go back and fix it up
+ * afterward; otherwise, if the input is seekable, we make a pass over the
+ * record to find the length and then convert it.  If neither is, the
+ * record has to be held in memory.
+ */
+static int convertBigRecord(InputWindow* pIn, unsigned char* hdr, FILE* out,
+    int flags, int outputPatchable)
+{
+    unsigned char type = hdr[0];
+    uint32_t length = get4BE(hdr + 5);
+    uint32_t outLen;
+    off_t hdrPos, endPos, dataPos;
+
+    if (type != HPROF_TAG_HEAP_DUMP && type != HPROF_TAG_HEAP_DUMP_SEGMENT) {
+        /* keep */
+        DBUG("Keeping 0x%02x (%u bytes)\n", type, length);
+        if (writeData(out, hdr, kRecHdrLen) != 0)
+            return -1;
+        return iwTransfer(pIn, out, length);
+    }
+
+    DBUG("Streaming heap dump 0x%02x (%u bytes)\n", type, length);
+    if (outputPatchable && (hdrPos = ftello(out)) >= 0) {
+        if (writeData(out, hdr, kRecHdrLen) != 0)
+            return -1;
+        if (streamHeapDump(pIn, length, out, flags, &outLen) != 0)
+            return -1;
+
+        set4BE(hdr + 5, outLen);
+        endPos = ftello(out);
+        if (endPos < 0 || fseeko(out, hdrPos + 5, SEEK_SET) != 0
+                || writeData(out, hdr + 5, 4) != 0
+                || fseeko(out, endPos, SEEK_SET) != 0) {
+            fprintf(stderr, "ERROR: unable to update record length\n");
+            return -1;
+        }
+    } else if ((dataPos = iwTell(pIn)) >= 0) {
+        if (streamHeapDump(pIn, length, NULL, flags, &outLen) != 0)
+            return -1;
+        if (iwSeek(pIn, dataPos) != 0)
+            return -1;
+
+        set4BE(hdr + 5, outLen);
+        if (writeData(out, hdr, kRecHdrLen) != 0)
+            return -1;
+        if (streamHeapDump(pIn, length, out, flags, &outLen) != 0)
+            return -1;
+    } else {
+        ExpandBuf* pInBuf = ebAlloc();
+        ExpandBuf* pOutBuf = ebAlloc();
+        int result = -1;
+
+        if (pInBuf == NULL || pOutBuf == NULL)
+            goto bail;
+        ebAddData(pInBuf, hdr, kRecHdrLen);
+        ebEnsureCapacity(pInBuf, length);
+        if (iwRead(pIn, ebGetBuffer(pInBuf) + kRecHdrLen, length) != 0)
+            goto bail;
+        if (convertHeapDump(ebGetBuffer(pInBuf), kRecHdrLen + (size_t) length,
+                pOutBuf, flags) != 0)
+            goto bail;
+        if (ebWriteData(pOutBuf, out) != 0)
+            goto bail;
+        result = 0;
 
 bail:
-    ebFree(pOutBuf);
-    return result;
+        ebFree(pInBuf);
+        ebFree(pOutBuf);
+        return result;
+    }
+
+    return 0;
+}
+
+
+/*
+ * ===========================================================================
+ *      Jobs
+ * ===========================================================================
+ */
+
+/*
+ * A run of whole records, converted as a unit.
+ */
+typedef struct {
+    unsigned char* storage;     /* kJobSize bytes of input records */
+    size_t len;
+    ExpandBuf* pOutBuf;
+    int state;
+} Job;
+
+enum {
+    kJobFree,
+    kJobFilled,
+    kJobConverted,
+};
+
+/*
+ * Jobs are filled in turn by the main thread, taken by whichever worker is
+ * free, and written by the writer thread in the order they were filled.
+ * With one thread, jobs are converted and written as they are submitted.
+ */
+typedef struct {
+    FILE* out;
+    int flags;
+    int threadCount;
+    Job* jobs;
+    int jobCount;
+    Job* current;               /* job being filled, or NULL */
+    uint64_t submitted;         /* jobs handed over for conversion */
+    uint64_t taken;             /* jobs taken by workers */
+    uint64_t written;           /* jobs written out */
+    int failed;
+    int stopping;
+#ifdef HAVE_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer;
+    pthread_t workers[kMaxThreads];
+    int started;                /* threads running, counting the writer */
+#endif
+} Pipeline;
+
+/*
+ * Convert the records in a job to pOutBuf.
+ */
+static int convertJob(Job* job, int flags)
+{
+    size_t offset = 0;
+
+    ebClear(job->pOutBuf);
+    while (offset < job->len) {
+        unsigned char* buf = job->storage + offset;
+        unsigned char type = buf[0];
+        size_t len = kRecHdrLen + get4BE(buf + 5);
+
+        if (type == HPROF_TAG_HEAP_DUMP
+                || type == HPROF_TAG_HEAP_DUMP_SEGMENT) {
+            DBUG("Processing heap dump 0x%02x (%zu bytes)\n", type, len);
+            if (convertHeapDump(buf, len, job->pOutBuf, flags) != 0)
+                return -1;
+        } else {
+            /* keep */
+            DBUG("Keeping 0x%02x (%zu bytes)\n", type, len);
+            if (ebAddData(job->pOutBuf, buf, len) != 0)
+                return -1;
+        }
+        offset += len;
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_THREADS
+/*
+ * Worker thread: convert filled jobs.
+ */
+static void* workerMain(void* arg)
+{
+    Pipeline* pPipe = (Pipeline*) arg;
+
+    pthread_mutex_lock(&pPipe->lock);
+    while (1) {
+        Job* job;
+        int res;
+
+        while (pPipe->taken == pPipe->submitted && !pPipe->stopping)
+            pthread_cond_wait(&pPipe->cond, &pPipe->lock);
+        if (pPipe->taken == pPipe->submitted)
+            break;
+
+        job = &pPipe->jobs[pPipe->taken++ % pPipe->jobCount];
+        pthread_mutex_unlock(&pPipe->lock);
+
+        res = convertJob(job, pPipe->flags);
+
+        pthread_mutex_lock(&pPipe->lock);
+        if (res != 0)
+            pPipe->failed = TRUE;
+        job->state = kJobConverted;
+        pthread_cond_broadcast(&pPipe->cond);
+    }
+    pthread_mutex_unlock(&pPipe->lock);
+
+    return NULL;
+}
+
+/*
+ * Writer thread: write converted jobs in order.  After a failure the
+ * remaining jobs are dropped.
+ */
+static void* writerMain(void* arg)
+{
+    Pipeline* pPipe = (Pipeline*) arg;
+
+    pthread_mutex_lock(&pPipe->lock);
+    while (1) {
+        Job* job = &pPipe->jobs[pPipe->written % pPipe->jobCount];
+        int res = 0;
+
+        while (!(pPipe->written < pPipe->submitted && job->state == kJobConverted)
+                && !(pPipe->written == pPipe->submitted && pPipe->stopping))
+            pthread_cond_wait(&pPipe->cond, &pPipe->lock);
+        if (pPipe->written == pPipe->submitted)
+            break;
+
+        if (!pPipe->failed) {
+            pthread_mutex_unlock(&pPipe->lock);
+            res = ebWriteData(job->pOutBuf, pPipe->out);
+            pthread_mutex_lock(&pPipe->lock);
+        }
+
+        if (res != 0)
+            pPipe->failed = TRUE;
+        job->state = kJobFree;
+        pPipe->written++;
+        pthread_cond_broadcast(&pPipe->cond);
+    }
+    pthread_mutex_unlock(&pPipe->lock);
+
+    return NULL;
+}
+#endif
+
+/*
+ * Stop the threads and release everything.
+ */
+static void pipelineFree(Pipeline* pPipe)
+{
+    int i;
+
+#ifdef HAVE_THREADS
+    if (pPipe->threadCount > 1) {
+        pthread_mutex_lock(&pPipe->lock);
+        pPipe->stopping = TRUE;
+        pthread_cond_broadcast(&pPipe->cond);
+        pthread_mutex_unlock(&pPipe->lock);
+
+        for (i = 0; i < pPipe->started; i++) {
+            pthread_join(i == 0 ? pPipe->writer : pPipe->workers[i - 1], NULL);
+        }
+        pthread_cond_destroy(&pPipe->cond);
+        pthread_mutex_destroy(&pPipe->lock);
+    }
+#endif
+
+    if (pPipe->jobs != NULL) {
+        for (i = 0; i < pPipe->jobCount; i++) {
+            free(pPipe->jobs[i].storage);
+            ebFree(pPipe->jobs[i].pOutBuf);
+        }
+        free(pPipe->jobs);
+    }
+}
+
+/*
+ * Set up jobs, and the threads to work on them if there's more than one.
+ */
+static int pipelineInit(Pipeline* pPipe, FILE* out, int flags, int threadCount)
+{
+    int i;
+
+    memset(pPipe, 0, sizeof(*pPipe));
+    pPipe->out = out;
+    pPipe->flags = flags;
+#ifdef HAVE_THREADS
+    pPipe->threadCount = threadCount;
+    pPipe->jobCount = threadCount > 1 ? threadCount * 2 : 1;
+#else
+    pPipe->threadCount = 1;
+    pPipe->jobCount = 1;
+#endif
+
+    pPipe->jobs = (Job*) calloc(pPipe->jobCount, sizeof(Job));
+    if (pPipe->jobs == NULL)
+        goto fail;
+    for (i = 0; i < pPipe->jobCount; i++) {
+        Job* job = &pPipe->jobs[i];
+        job->storage = (unsigned char*) malloc(kJobSize);
+        job->pOutBuf = ebAlloc();
+        if (job->storage == NULL || job->pOutBuf == NULL)
+            goto fail;
+        /* converted records are never longer than the originals */
+        ebEnsureCapacity(job->pOutBuf, kJobSize);
+    }
+
+#ifdef HAVE_THREADS
+    if (pPipe->threadCount > 1) {
+        pthread_mutex_init(&pPipe->lock, NULL);
+        pthread_cond_init(&pPipe->cond, NULL);
+        if (pthread_create(&pPipe->writer, NULL, writerMain, pPipe) != 0)
+            goto fail;
+        pPipe->started++;
+        for (i = 0; i < pPipe->threadCount; i++) {
+            if (pthread_create(&pPipe->workers[i], NULL, workerMain, pPipe) != 0)
+                goto fail;
+            pPipe->started++;
+        }
+    }
+#endif
+
+    return 0;
+
+fail:
+    fprintf(stderr, "ERROR: unable to set up %d conversion jobs\n",
+        pPipe->jobCount);
+    pipelineFree(pPipe);
+    return -1;
+}
+
+/*
+ * Determine whether any job has failed.
+ */
+static int pipelineFailed(Pipeline* pPipe)
+{
+    int failed;
+
+#ifdef HAVE_THREADS
+    if (pPipe->threadCount > 1) {
+        pthread_mutex_lock(&pPipe->lock);
+        failed = pPipe->failed;
+        pthread_mutex_unlock(&pPipe->lock);
+        return failed;
+    }
+#endif
+
+    failed = pPipe->failed;
+    return failed;
+}
+
+/*
+ * Get the job being filled, waiting for a free one if necessary.  Returns
+ * NULL if an earlier job failed.
+ */
+static Job* pipelineGetJob(Pipeline* pPipe)
+{
+    if (pPipe->current == NULL) {
+        Job* job = &pPipe->jobs[pPipe->submitted % pPipe->jobCount];
+
+#ifdef HAVE_THREADS
+        if (pPipe->threadCount > 1) {
+            pthread_mutex_lock(&pPipe->lock);
+            while (job->state != kJobFree && !pPipe->failed)
+                pthread_cond_wait(&pPipe->cond, &pPipe->lock);
+            pthread_mutex_unlock(&pPipe->lock);
+        }
+#endif
+
+        job->len = 0;
+        pPipe->current = job;
+    }
+
+    return pipelineFailed(pPipe) ? NULL : pPipe->current;
+}
+
+/*
+ * Hand over the job being filled, if it has anything in it.
+ */
+static void pipelineSubmit(Pipeline* pPipe)
+{
+    Job* job = pPipe->current;
+
+    if (job == NULL || job->len == 0)
+        return;
+    pPipe->current = NULL;
+
+#ifdef HAVE_THREADS
+    if (pPipe->threadCount > 1) {
+        pthread_mutex_lock(&pPipe->lock);
+        job->state = kJobFilled;
+        pPipe->submitted++;
+        pthread_cond_broadcast(&pPipe->cond);
+        pthread_mutex_unlock(&pPipe->lock);
+        return;
+    }
+#endif
+
+    if (convertJob(job, pPipe->flags) != 0
+            || ebWriteData(job->pOutBuf, pPipe->out) != 0)
+        pPipe->failed = TRUE;
+}
+
+/*
+ * Submit the current job and wait for everything to be written.
+ */
+static int pipelineFlush(Pipeline* pPipe)
+{
+    pipelineSubmit(pPipe);
+
+#ifdef HAVE_THREADS
+    if (pPipe->threadCount > 1) {
+        pthread_mutex_lock(&pPipe->lock);
+        while (pPipe->written != pPipe->submitted)
+            pthread_cond_wait(&pPipe->cond, &pPipe->lock);
+        pthread_mutex_unlock(&pPipe->lock);
+    }
+#endif
+
+    return pipelineFailed(pPipe) ? -1 : 0;
 }
 
 /*
  * Filter an hprof data file.
  */
-static int filterData(FILE* in, FILE* out, int flags)
+static int filterData(FILE* in, FILE* out, int flags, int threadCount)
 {
-    const char *magicString;
-    ExpandBuf* pBuf;
+    InputWindow window;
+    Pipeline pipeline;
+    unsigned char* buf;
+    const unsigned char* nul;
+    int outputPatchable;
+    ssize_t avail;
     int result = -1;
 
-    pBuf = ebAlloc();
-    if (pBuf == NULL)
-        goto bail;
+    if (iwInit(&window, in) != 0) {
+        iwFree(&window);
+        return -1;
+    }
+    if (pipelineInit(&pipeline, out, flags, threadCount) != 0) {
+        iwFree(&window);
+        return -1;
+    }
+    outputPatchable = isOutputPatchable(out);
 
     /*
      * Start with the header.
      */
-    if (ebReadString(pBuf, in) != 0)
+    avail = iwFill(&window, kSubRecordPeek);
+    if (avail < 0)
         goto bail;
+    buf = iwGetData(&window);
+    nul = memchr(buf, '\0', avail);
+    if (nul == NULL) {
+        if (avail < kSubRecordPeek) {
+            fprintf(stderr, "ERROR: failed reading input\n");
+        } else {
+            fprintf(stderr, "ERROR: expecting HPROF file format 1.0.3\n");
+        }
+        goto bail;
+    }
 
-    magicString = (const char*)ebGetBuffer(pBuf);
-    if (strcmp(magicString, "JAVA PROFILE 1.0.3") != 0) {
-        if (strcmp(magicString, "JAVA PROFILE 1.0.2") == 0) {
+    if (strcmp((const char*) buf, "JAVA PROFILE 1.0.3") != 0) {
+        if (strcmp((const char*) buf, "JAVA PROFILE 1.0.2") == 0) {
             fprintf(stderr, "ERROR: HPROF file already in 1.0.2 format.\n");
         } else {
             fprintf(stderr, "ERROR: expecting HPROF file format 1.0.3\n");
@@ -628,19 +1352,26 @@ static int filterData(FILE* in, FILE* out, int flags)
     }
 
     /* downgrade to 1.0.2 */
-    (ebGetBuffer(pBuf))[17] = '2';
-    if (ebWriteData(pBuf, out) != 0)
+    buf[17] = '2';
+    if (writeData(out, buf, nul + 1 - buf) != 0)
         goto bail;
+    iwConsume(&window, nul + 1 - buf);
 
     /*
      * Copy:
      * (4b) identifier size, always 4
      * (8b) file creation date
      */
-    if (ebReadData(pBuf, in, 12, FALSE) != 0)
+    avail = iwFill(&window, 12);
+    if (avail < 0)
         goto bail;
-    if (ebWriteData(pBuf, out) != 0)
+    if (avail < 12) {
+        fprintf(stderr, "ERROR: read %zd of %d bytes\n", avail, 12);
         goto bail;
+    }
+    if (writeData(out, iwGetData(&window), 12) != 0)
+        goto bail;
+    iwConsume(&window, 12);
 
     /*
      * Read records until we hit EOF.  Each record begins with:
@@ -649,53 +1380,54 @@ static int filterData(FILE* in, FILE* out, int flags)
      * (4b) length of data that follows
      */
     while (1) {
-        assert(ebGetLength(pBuf) == 0);
+        unsigned char hdr[kRecHdrLen];
+        uint32_t length;
 
-        /* read type char */
-        if (ebReadData(pBuf, in, 1, TRUE) != 0)
+        avail = iwFill(&window, kRecHdrLen);
+        if (avail < 0)
             goto bail;
-        if (feof(in))
+        if (avail == 0)
             break;
-
-        /* read the rest of the header */
-        if (ebReadData(pBuf, in, kRecHdrLen-1, FALSE) != 0)
+        if (avail < kRecHdrLen) {
+            fprintf(stderr, "ERROR: read %zd of %d bytes\n", avail, kRecHdrLen);
             goto bail;
+        }
 
-        unsigned char* buf = ebGetBuffer(pBuf);
-        unsigned char type;
-        unsigned int timestamp ATTRIBUTE_UNUSED;
-        unsigned int length;
-
-        type = buf[0];
-        timestamp = get4BE(buf + 1);
-        length = get4BE(buf + 5);
-        buf = NULL;     /* ptr invalid after next read op */
+        memcpy(hdr, iwGetData(&window), kRecHdrLen);
+        length = get4BE(hdr + 5);
 
-        /* read the record data */
-        if (length != 0) {
-            if (ebReadData(pBuf, in, length, FALSE) != 0)
+        if (kRecHdrLen + (uint64_t) length <= kJobSize) {
+            /* add it to the current job */
+            Job* job = pipelineGetJob(&pipeline);
+            if (job != NULL && job->len + kRecHdrLen + length > kJobSize) {
+                pipelineSubmit(&pipeline);
+                job = pipelineGetJob(&pipeline);
+            }
+            if (job == NULL)
                 goto bail;
-        }
 
-        if (type == HPROF_TAG_HEAP_DUMP
-                || type == HPROF_TAG_HEAP_DUMP_SEGMENT) {
-            DBUG("Processing heap dump 0x%02x (%d bytes)\n",
-                type, length);
-            if (processHeapDump(pBuf, out, flags) != 0)
+            if (iwRead(&window, job->storage + job->len, kRecHdrLen + length) != 0)
                 goto bail;
-            ebClear(pBuf);
+            job->len += kRecHdrLen + length;
         } else {
-            /* keep */
-            DBUG("Keeping 0x%02x (%d bytes)\n", type, length);
-            if (ebWriteData(pBuf, out) != 0)
+            /* everything before it has to be out first */
+            if (pipelineFlush(&pipeline) != 0)
+                goto bail;
+
+            iwConsume(&window, kRecHdrLen);
+            if (convertBigRecord(&window, hdr, out, flags, outputPatchable) != 0)
                 goto bail;
         }
     }
 
+    if (pipelineFlush(&pipeline) != 0)
+        goto bail;
+
     result = 0;
 
 bail:
-    ebFree(pBuf);
+    pipelineFree(&pipeline);
+    iwFree(&window);
     return result;
 }
 
@@ -707,19 +1439,40 @@ static FILE* fopen_or_default(const char* path, const char* mode, FILE* def) {
     }
 }
 
+/*
+ * Pick a thread count if none was given.
+ */
+static int defaultThreadCount(void)
+{
+#ifdef HAVE_THREADS
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    return cpus < kDefaultThreads ? cpus : kDefaultThreads;
+#else
+    return 1;
+#endif
+}
+
 int main(int argc, char** argv)
 {
     FILE* in = NULL;
     FILE* out = NULL;
     int flags = 0;
+    int threadCount = 0;
     int res = 1;
 
     int opt;
-    while ((opt = getopt(argc, argv, "z")) != -1) {
+    while ((opt = getopt(argc, argv, "zj:")) != -1) {
         switch (opt) {
             case 'z':
                 flags |= kFlagAppOnly;
                 break;
+            case 'j':
+                threadCount = atoi(optarg);
+                if (threadCount < 1 || threadCount > kMaxThreads)
+                    goto usage;
+                break;
             case '?':
             default:
                 goto usage;
@@ -742,13 +1495,23 @@ int main(int argc, char** argv)
         goto usage;
     }
 
-    res = filterData(in, out, flags);
+    if (threadCount == 0)
+        threadCount = defaultThreadCount();
+    setvbuf(out, NULL, _IOFBF, kOutputBufferSize);
+
+    res = filterData(in, out, flags, threadCount);
+    if (fflush(out) != 0) {
+        fprintf(stderr, "ERROR: failed writing output: %s\n", strerror(errno));
+        res = 1;
+    }
     goto finish;
 
 usage:
-    fprintf(stderr, "Usage: hprof-conf [-z] infile outfile\n");
+    fprintf(stderr, "Usage: hprof-conf [-z] [-j threads] infile outfile\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  -z: exclude non-app heaps, such as Zygote\n");
+    fprintf(stderr, "  -j: number of conversion threads (default: one per CPU, up to %d)\n",
+        kDefaultThreads);
     fprintf(stderr, "\n");
     fprintf(stderr, "Specify '-' for either or both files to use stdin/stdout.\n");
     fprintf(stderr, "\n");
@@ -767,7 +1530,9 @@ usage:
 finish:
     if (in != stdin && in != NULL)
         fclose(in);
-    if (out != stdout && out != NULL)
-        fclose(out);
+    if (out != stdout && out != NULL) {
+        if (fclose(out) != 0 && res == 0)
+            res = 1;
+    }
     return res;
 }
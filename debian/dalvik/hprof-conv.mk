@@ -2,7 +2,7 @@ NAME = hprof-conv
 
 # dalvik/tools/hprof-conv/Android.bp
 SOURCES = dalvik/tools/hprof-conv/HprofConv.c
-LDFLAGS += -pie
+LDFLAGS += -pie -pthread
 
 debian/out/dalvik/tools/$(NAME): $(SOURCES)
 	$(CC) -o $@ $^ $(CFLAGS) $(CPPFLAGS) $(LDFLAGS)
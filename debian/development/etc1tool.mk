@@ -8,7 +8,7 @@ CPPFLAGS += \
   -Idevelopment/include \
   -Iframeworks/native/opengl/include \
 
-LDFLAGS += -lpng -pie
+LDFLAGS += -lpng -pie -pthread
 STATIC_LIBS = debian/out/frameworks/native/libETC1.a
 
 debian/out/development/$(NAME): $(SOURCES)
@@ -20,6 +20,7 @@ SOURCES = \
   Timers.cpp \
   Tokenizer.cpp \
   Unicode.cpp \
+  UnicodeSimd.cpp \
   VectorImpl.cpp \
   misc.cpp \
   \
@@ -39,7 +39,7 @@ void usage(const char* message, ...) {
     }
     fprintf(
             stderr,
-            "%s infile [--help | --encode | --encodeNoHeader | --decode] [--showDifference difffile] [-o outfile]\n",
+            "%s infile [--help | --encode | --encodeNoHeader | --decode] [--showDifference difffile] [--preview] [--threads count] [-o outfile]\n",
             gpExeName);
     fprintf(stderr, "\tDefault is --encode\n");
     fprintf(stderr, "\t\t--help           print this usage information.\n");
@@ -54,6 +54,10 @@ void usage(const char* message, ...) {
             "\t\t--showDifference difffile    Write difference between original and encoded\n");
     fprintf(stderr,
             "\t\t                             image to difffile. (Only valid when encoding).\n");
+    fprintf(stderr,
+            "\t\t--preview        encode faster, at a lower quality. (Only valid when encoding).\n");
+    fprintf(stderr,
+            "\t\t--threads count  number of threads to encode with. Default is one per CPU.\n");
     fprintf(stderr,
             "\tIf outfile is not specified, an outfile path is constructed from infile,\n");
     fprintf(stderr, "\twith the appropriate suffix (.pkm or .png).\n");
@@ -310,7 +314,8 @@ int readPKMFile(const char* pInput, etc1_byte** ppImageData,
 // Encode the file.
 // Returns non-zero if an error occurred.
 
-int encode(const char* pInput, const char* pOutput, bool bEmitHeader, const char* pDiffFile) {
+int encode(const char* pInput, const char* pOutput, bool bEmitHeader, const char* pDiffFile,
+        int quality, etc1_uint32 threadCount) {
     FILE* pOut = NULL;
     etc1_uint32 width = 0;
     etc1_uint32 height = 0;
@@ -331,8 +336,8 @@ int encode(const char* pInput, const char* pOutput, bool bEmitHeader, const char
         goto exit;
     }
 
-    etc1_encode_image(pSourceImage,
-            width, height, 3, width * 3, pEncodedData);
+    etc1_encode_image_with_options(pSourceImage,
+            width, height, 3, width * 3, pEncodedData, quality, threadCount);
 
     if ((pOut = fopen(pOutput, "wb")) == NULL) {
         fprintf(stderr, "Could not open output file %s: %d\n", pOutput, errno);
@@ -490,6 +495,8 @@ int main(int argc, char** argv) {
     bool bEncode = false;
     bool bEncodeHeader = false;
     bool bShowDifference = false;
+    bool bPreview = false;
+    etc1_uint32 threadCount = 0;
 
     for (int i = 1; i < argc; i++) {
         const char* pArg = argv[i];
@@ -525,6 +532,18 @@ int main(int argc, char** argv) {
                         usage("Expected difffile after --showDifference");
                     }
                     pDiffFile = argv[++i];
+                } else if (strcmp(pArg, "--preview") == 0) {
+                    bPreview = true;
+                } else if (strcmp(pArg, "--threads") == 0) {
+                    if (i + 1 >= argc) {
+                        usage("Expected count after --threads");
+                    }
+                    char* pEnd;
+                    const char* pCount = argv[++i];
+                    threadCount = strtoul(pCount, &pEnd, 10);
+                    if (*pCount == '\0' || *pEnd != '\0' || threadCount == 0) {
+                        usage("Invalid thread count %s", pCount);
+                    }
                 } else if (strcmp(pArg, "--help") == 0) {
                     usage( NULL);
                 } else {
@@ -553,6 +572,9 @@ int main(int argc, char** argv) {
     if ((! bEncode) && bShowDifference) {
         usage("--showDifference is only valid when encoding.");
     }
+    if ((! bEncode) && bPreview) {
+        usage("--preview is only valid when encoding.");
+    }
 
     if (!pInput) {
         usage("Expected an input file.");
@@ -570,7 +592,8 @@ int main(int argc, char** argv) {
     }
 
     if (bEncode) {
-        encode(pInput, pOutput, bEncodeHeader, pDiffFile);
+        encode(pInput, pOutput, bEncodeHeader, pDiffFile,
+                bPreview ? ETC1_QUALITY_PREVIEW : ETC1_QUALITY_DEFAULT, threadCount);
     } else {
         decode(pInput, pOutput);
     }
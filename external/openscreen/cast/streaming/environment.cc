@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <utility>
+#include <vector>
 
 #include "cast/streaming/rtp_defines.h"
 #include "platform/api/task_runner.h"
@@ -78,6 +79,22 @@ void Environment::SendPacket(absl::Span<const uint8_t> packet) {
   }
 }
 
+void Environment::SendPackets(
+    absl::Span<const absl::Span<const uint8_t>> packets) {
+  OSP_DCHECK(remote_endpoint_.address);
+  OSP_DCHECK_NE(remote_endpoint_.port, 0);
+  if (!socket_ || packets.empty()) {
+    return;
+  }
+
+  std::vector<UdpSocket::OutgoingMessage> messages;
+  messages.reserve(packets.size());
+  for (const absl::Span<const uint8_t>& packet : packets) {
+    messages.push_back({packet.data(), packet.size()});
+  }
+  socket_->SendMessages(messages.data(), messages.size(), remote_endpoint_);
+}
+
 Environment::PacketConsumer::~PacketConsumer() = default;
 
 void Environment::OnBound(UdpSocket* socket) {
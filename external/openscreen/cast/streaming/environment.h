@@ -121,6 +121,11 @@ class Environment : public UdpSocket::Client {
   // before they actually head-out through the socket.
   virtual void SendPacket(absl::Span<const uint8_t> packet);
 
+  // Sends the given |packets|, in order, to the remote endpoint, best-effort.
+  // This has the same effect as calling SendPacket() for each of them, but
+  // lets the platform send them all with one system call (or a few).
+  virtual void SendPackets(absl::Span<const absl::Span<const uint8_t>> packets);
+
  protected:
   Environment() : now_function_(nullptr), task_runner_(nullptr) {}
 
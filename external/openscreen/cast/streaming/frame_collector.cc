@@ -6,7 +6,6 @@
 
 #include <algorithm>
 #include <limits>
-#include <numeric>
 
 #include "cast/streaming/frame_id.h"
 #include "cast/streaming/rtp_defines.h"
@@ -91,6 +90,7 @@ bool FrameCollector::CollectRtpPacket(const RtpPacketParser::ParseResult& part,
   PayloadChunk& chunk = chunks_[part.packet_id];
   chunk.buffer.swap(*buffer);
   chunk.payload = part.payload;
+  payload_size_ += chunk.payload.size();
   OSP_DCHECK_GE(chunk.payload.data(), chunk.buffer.data());
   OSP_DCHECK_LE(chunk.payload.data() + chunk.payload.size(),
                 chunk.buffer.data() + chunk.buffer.size());
@@ -122,17 +122,39 @@ void FrameCollector::GetMissingPackets(std::vector<PacketNack>* nacks) const {
   }
 }
 
+const EncryptedFrame& FrameCollector::PeekAtFrameMetadata() const {
+  OSP_DCHECK_EQ(num_missing_packets_, 0);
+  return frame_;
+}
+
+int FrameCollector::GetPayloadSize() const {
+  OSP_DCHECK_EQ(num_missing_packets_, 0);
+  return static_cast<int>(payload_size_);
+}
+
+void FrameCollector::DecryptFrame(const FrameCrypto& crypto,
+                                  EncodedFrame* encoded_frame) const {
+  OSP_DCHECK_EQ(num_missing_packets_, 0);
+  OSP_DCHECK_GE(encoded_frame->data.size(), payload_size_);
+
+  frame_.CopyMetadataTo(encoded_frame);
+  encoded_frame->data =
+      absl::Span<uint8_t>(encoded_frame->data.data(), payload_size_);
+  std::vector<absl::Span<const uint8_t>> payloads;
+  payloads.reserve(chunks_.size());
+  for (const PayloadChunk& chunk : chunks_) {
+    payloads.push_back(chunk.payload);
+  }
+  crypto.DecryptPayloadChunks(frame_.frame_id, payloads, encoded_frame->data);
+}
+
 const EncryptedFrame& FrameCollector::PeekAtAssembledFrame() {
   OSP_DCHECK_EQ(num_missing_packets_, 0);
 
   if (!frame_.data.data()) {
     // Allocate the frame's payload buffer once, right-sized to the sum of all
     // chunk sizes.
-    frame_.owned_data_.reserve(
-        std::accumulate(chunks_.cbegin(), chunks_.cend(), size_t{0},
-                        [](size_t num_bytes_so_far, const PayloadChunk& chunk) {
-                          return num_bytes_so_far + chunk.payload.size();
-                        }));
+    frame_.owned_data_.reserve(payload_size_);
     // Now, populate the frame's payload buffer with each chunk of data.
     for (const PayloadChunk& chunk : chunks_) {
       frame_.owned_data_.insert(frame_.owned_data_.end(), chunk.payload.begin(),
@@ -146,6 +168,7 @@ const EncryptedFrame& FrameCollector::PeekAtAssembledFrame() {
 
 void FrameCollector::Reset() {
   num_missing_packets_ = kUnknownNumberOfPackets;
+  payload_size_ = 0;
   frame_.frame_id = FrameId();
   frame_.owned_data_.clear();
   frame_.owned_data_.shrink_to_fit();
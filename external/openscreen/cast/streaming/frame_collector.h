@@ -46,6 +46,30 @@ class FrameCollector {
   // packet ID.
   void GetMissingPackets(std::vector<PacketNack>* nacks) const;
 
+  // Returns the metadata of the completely-collected frame. Its |data| is left
+  // empty until PeekAtAssembledFrame() is called.
+  //
+  // Precondition: is_complete() must return true before this method can be
+  // called.
+  const EncryptedFrame& PeekAtFrameMetadata() const;
+
+  // Returns the number of payload bytes in the completely-collected frame.
+  //
+  // Precondition: is_complete() must return true before this method can be
+  // called.
+  int GetPayloadSize() const;
+
+  // Decrypts the completely-collected frame into |encoded_frame|, straight out
+  // of the packet buffers it was collected in. Unlike passing the result of
+  // PeekAtAssembledFrame() to |crypto|, the payload is not copied into one
+  // contiguous buffer first. The caller must provide a data buffer of at least
+  // GetPayloadSize() bytes.
+  //
+  // Precondition: is_complete() must return true before this method can be
+  // called.
+  void DecryptFrame(const FrameCrypto& crypto,
+                    EncodedFrame* encoded_frame) const;
+
   // Returns a read-only reference to the completely-collected frame, assembling
   // it if necessary. The caller should reset the FrameCollector (see Reset()
   // below) to free-up memory once it has finished reading from the returned
@@ -78,6 +102,9 @@ class FrameCollector {
   // this is not yet known.
   int num_missing_packets_;
 
+  // The sum of the payload sizes of the chunks collected so far.
+  size_t payload_size_ = 0;
+
   // The chunks of payload data being collected, where element indices
   // correspond 1:1 with packet IDs. When the first part is collected, this is
   // resized to match the total number of packets being expected.
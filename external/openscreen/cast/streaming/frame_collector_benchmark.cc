@@ -0,0 +1,153 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares two ways for a Receiver to get a complete frame out of its
+// FrameCollector: assembling the payload with PeekAtAssembledFrame() and then
+// decrypting it, as the Receiver used to, or decrypting it straight out of the
+// packets with DecryptFrame(). For each frame size, prints the payload bytes
+// copied per frame in addition to the decryption, and the collection latency:
+// the time from collecting the last packet to having the decrypted frame.
+//
+// Usage: frame_collector_benchmark [frames_per_size]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "cast/streaming/frame_collector.h"
+#include "cast/streaming/frame_crypto.h"
+#include "util/crypto/random_bytes.h"
+#include "util/osp_logging.h"
+
+namespace openscreen {
+namespace cast {
+namespace {
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+constexpr size_t kFrameSizes[] = {1 << 10,   16 << 10,  64 << 10,
+                                  256 << 10, 512 << 10, 1 << 20};
+constexpr int kDefaultFramesPerSize = 200;
+
+// Roughly what fits in an Ethernet MTU after the IP, UDP and RTP headers.
+constexpr size_t kMaxPayloadSize = 1400;
+constexpr size_t kHeaderSize = 24;
+
+struct Result {
+  size_t bytes_copied = 0;
+  nanoseconds latency{0};
+};
+
+// Builds the RTP packets of an encrypted frame: each one a header's worth of
+// filler followed by its part of the payload.
+std::vector<std::vector<uint8_t>> Packetize(const EncryptedFrame& frame) {
+  std::vector<std::vector<uint8_t>> packets;
+  size_t offset = 0;
+  do {
+    const size_t length = std::min(kMaxPayloadSize, frame.data.size() - offset);
+    std::vector<uint8_t> packet(kHeaderSize);
+    packet.insert(packet.end(), frame.data.begin() + offset,
+                  frame.data.begin() + offset + length);
+    packets.push_back(std::move(packet));
+    offset += length;
+  } while (offset < frame.data.size());
+  return packets;
+}
+
+// Collects one frame from |packets|, and decrypts it into |buffer| either way.
+// Returns how many payload bytes were copied other than by decryption, and how
+// long it took from the last packet until the frame was decrypted.
+Result CollectAndDecrypt(const FrameCrypto& crypto,
+                         FrameId frame_id,
+                         std::vector<std::vector<uint8_t>> packets,
+                         bool assemble_first,
+                         std::vector<uint8_t>* buffer) {
+  FrameCollector collector;
+  collector.set_frame_id(frame_id);
+
+  RtpPacketParser::ParseResult part{};
+  part.is_key_frame = true;
+  part.frame_id = frame_id;
+  part.referenced_frame_id = frame_id;
+  part.max_packet_id = static_cast<FramePacketId>(packets.size() - 1);
+  std::chrono::steady_clock::time_point last_packet_time;
+  for (size_t i = 0; i < packets.size(); ++i) {
+    last_packet_time = std::chrono::steady_clock::now();
+    part.packet_id = static_cast<FramePacketId>(i);
+    part.payload = absl::Span<uint8_t>(packets[i]).subspan(kHeaderSize);
+    OSP_CHECK(collector.CollectRtpPacket(part, &packets[i]));
+  }
+  OSP_CHECK(collector.is_complete());
+
+  Result result;
+  EncodedFrame frame;
+  frame.data = absl::Span<uint8_t>(*buffer);
+  if (assemble_first) {
+    const EncryptedFrame& assembled = collector.PeekAtAssembledFrame();
+    result.bytes_copied = assembled.data.size();
+    crypto.Decrypt(assembled, &frame);
+  } else {
+    collector.DecryptFrame(crypto, &frame);
+  }
+  result.latency = duration_cast<nanoseconds>(
+      std::chrono::steady_clock::now() - last_packet_time);
+  OSP_CHECK_EQ(frame.data.size(),
+               static_cast<size_t>(collector.GetPayloadSize()));
+  return result;
+}
+
+void RunBenchmark(size_t frame_size, int num_frames) {
+  const FrameCrypto crypto(GenerateRandomBytes16(), GenerateRandomBytes16());
+  std::vector<uint8_t> plaintext(frame_size);
+  for (size_t i = 0; i < frame_size; ++i) {
+    plaintext[i] = static_cast<uint8_t>(i);
+  }
+  std::vector<uint8_t> buffer(frame_size);
+
+  printf("%8zu bytes:", frame_size);
+  for (bool assemble_first : {true, false}) {
+    Result total;
+    for (int i = 0; i < num_frames; ++i) {
+      EncodedFrame original;
+      original.frame_id = FrameId::first() + (i + 1);
+      original.data = absl::Span<uint8_t>(plaintext);
+      const EncryptedFrame encrypted = crypto.Encrypt(original);
+
+      const Result result =
+          CollectAndDecrypt(crypto, original.frame_id, Packetize(encrypted),
+                            assemble_first, &buffer);
+      OSP_CHECK(buffer == plaintext);
+      total.bytes_copied += result.bytes_copied;
+      total.latency += result.latency;
+    }
+    printf(" %s: %8zu bytes copied/frame, %8.1f us latency%s",
+           assemble_first ? "assemble+decrypt" : "DecryptFrame",
+           total.bytes_copied / num_frames,
+           total.latency.count() / 1e3 / num_frames,
+           assemble_first ? "," : "\n");
+  }
+}
+
+}  // namespace
+}  // namespace cast
+}  // namespace openscreen
+
+int main(int argc, char* argv[]) {
+  using namespace openscreen::cast;
+
+  const int frames_per_size = argc > 1 ? atoi(argv[1]) : kDefaultFramesPerSize;
+  if (frames_per_size <= 0) {
+    fprintf(stderr, "Usage: %s [frames_per_size]\n", argv[0]);
+    return 1;
+  }
+
+  for (size_t frame_size : kFrameSizes) {
+    RunBenchmark(frame_size, frames_per_size);
+  }
+  return 0;
+}
@@ -10,10 +10,12 @@
 #include <vector>
 
 #include "cast/streaming/encoded_frame.h"
+#include "cast/streaming/frame_crypto.h"
 #include "cast/streaming/frame_id.h"
 #include "cast/streaming/rtcp_common.h"
 #include "cast/streaming/rtp_time.h"
 #include "gtest/gtest.h"
+#include "util/crypto/random_bytes.h"
 
 namespace openscreen {
 namespace cast {
@@ -165,6 +167,59 @@ TEST(FrameCollectorTest, CollectsFrameWithMultiplePartsArrivingOutOfOrder) {
   ASSERT_TRUE(remaining_data.empty());
 }
 
+TEST(FrameCollectorTest, DecryptsFrameStraightFromItsPackets) {
+  const FrameCrypto crypto(GenerateRandomBytes16(), GenerateRandomBytes16(), 4);
+
+  // Large enough to be decrypted on several threads, with packet boundaries
+  // that do not line up with the AES blocks or with the ranges of the threads.
+  std::vector<uint8_t> plaintext(FrameCrypto::kMinBytesPerThread * 3 + 11);
+  for (size_t i = 0; i < plaintext.size(); ++i) {
+    plaintext[i] = static_cast<uint8_t>(i * 13);
+  }
+  EncodedFrame original;
+  original.frame_id = kSomeFrameId;
+  original.data = absl::Span<uint8_t>(plaintext);
+  const EncryptedFrame encrypted = crypto.Encrypt(original);
+
+  constexpr size_t kMaxPayloadSize = 1381;
+  const int num_packets =
+      (encrypted.data.size() + kMaxPayloadSize - 1) / kMaxPayloadSize;
+  FrameCollector collector;
+  collector.set_frame_id(kSomeFrameId);
+  for (int packet_id = num_packets - 1; packet_id >= 0; --packet_id) {
+    const auto payload = encrypted.data.subspan(packet_id * kMaxPayloadSize,
+                                                kMaxPayloadSize);
+    std::vector<uint8_t> buffer(24, uint8_t{0xab});
+    buffer.insert(buffer.end(), payload.begin(), payload.end());
+
+    RtpPacketParser::ParseResult part{};
+    part.rtp_timestamp = kSomeRtpTimestamp;
+    part.is_key_frame = true;
+    part.frame_id = kSomeFrameId;
+    part.packet_id = static_cast<FramePacketId>(packet_id);
+    part.max_packet_id = static_cast<FramePacketId>(num_packets - 1);
+    part.referenced_frame_id = kSomeFrameId;
+    part.payload = absl::Span<uint8_t>(buffer.data() + 24, buffer.size() - 24);
+    ASSERT_TRUE(collector.CollectRtpPacket(part, &buffer));
+  }
+  ASSERT_TRUE(collector.is_complete());
+  EXPECT_EQ(static_cast<int>(plaintext.size()), collector.GetPayloadSize());
+  EXPECT_EQ(EncodedFrame::KEY_FRAME,
+            collector.PeekAtFrameMetadata().dependency);
+
+  // The consumer's buffer may be larger than the frame.
+  std::vector<uint8_t> decrypted_buffer(collector.GetPayloadSize() + 100);
+  EncodedFrame decrypted;
+  decrypted.data = absl::Span<uint8_t>(decrypted_buffer);
+  collector.DecryptFrame(crypto, &decrypted);
+  EXPECT_EQ(kSomeFrameId, decrypted.frame_id);
+  EXPECT_EQ(EncodedFrame::KEY_FRAME, decrypted.dependency);
+  EXPECT_EQ(kSomeRtpTimestamp, decrypted.rtp_timestamp);
+  ASSERT_EQ(plaintext.size(), decrypted.data.size());
+  EXPECT_TRUE(std::equal(plaintext.begin(), plaintext.end(),
+                         decrypted.data.begin()));
+}
+
 TEST(FrameCollectorTest, RejectsInvalidParts) {
   FrameCollector collector;
 
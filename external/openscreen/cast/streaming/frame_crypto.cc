@@ -4,9 +4,16 @@
 
 #include "cast/streaming/frame_crypto.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <functional>
 #include <random>
+#include <thread>
 #include <utility>
 
+#include "openssl/aes.h"
 #include "openssl/crypto.h"
 #include "openssl/err.h"
 #include "openssl/rand.h"
@@ -17,6 +24,127 @@
 namespace openscreen {
 namespace cast {
 
+namespace {
+
+constexpr int kMaxDefaultThreads = 4;
+
+// Creates the AES-128-CTR context that every call starts from. The IV is set
+// separately for each range of blocks.
+bssl::UniquePtr<EVP_CIPHER_CTX> CreateKeyContext(
+    const std::array<uint8_t, 16>& aes_key) {
+  // Ensure that the library has been initialized. CRYPTO_library_init() may be
+  // safely called multiple times during the life of a process.
+  CRYPTO_library_init();
+
+  bssl::UniquePtr<EVP_CIPHER_CTX> context(EVP_CIPHER_CTX_new());
+  if (!context || EVP_EncryptInit_ex(context.get(), EVP_aes_128_ctr(), nullptr,
+                                     aes_key.data(), nullptr) != 1) {
+    ClearOpenSSLERRStack(CURRENT_LOCATION);
+    OSP_LOG_FATAL << "Failure when setting encryption key; unsafe to continue.";
+    OSP_NOTREACHED();
+  }
+  return context;
+}
+
+// Adds |num_blocks| to the big-endian 128-bit |counter|, as AES-CTR does after
+// each block.
+void AdvanceCounter(uint64_t num_blocks, std::array<uint8_t, 16>* counter) {
+  for (int i = counter->size() - 1; i >= 0 && num_blocks != 0; --i) {
+    const uint64_t sum = (*counter)[i] + (num_blocks & 0xff);
+    (*counter)[i] = static_cast<uint8_t>(sum);
+    num_blocks = (num_blocks >> 8) + (sum >> 8);
+  }
+}
+
+}  // namespace
+
+// Threads that help the calling one through the ranges of a frame.
+class FrameCrypto::Workers {
+ public:
+  explicit Workers(int num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this] { WorkerMain(); });
+    }
+  }
+
+  ~Workers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Calls |job| once with each index in [0, num_jobs), on the calling thread
+  // and the worker threads, and returns once all of the calls have.
+  void Run(int num_jobs, const std::function<void(int)>& job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      num_jobs_ = num_jobs;
+      next_job_ = 0;
+      num_pending_workers_ = threads_.size();
+      generation_++;
+    }
+    work_available_.notify_all();
+
+    TakeJobs(job, num_jobs);
+
+    // Each worker must be done with this generation before |job| goes away and
+    // |next_job_| is reset for the next one.
+    std::unique_lock<std::mutex> lock(mutex_);
+    workers_done_.wait(lock, [this] { return num_pending_workers_ == 0; });
+  }
+
+ private:
+  void WorkerMain() {
+    uint64_t last_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_available_.wait(lock, [this, last_generation] {
+        return stopping_ || generation_ != last_generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      last_generation = generation_;
+      const std::function<void(int)>& job = *job_;
+      const int num_jobs = num_jobs_;
+
+      lock.unlock();
+      TakeJobs(job, num_jobs);
+      lock.lock();
+
+      if (--num_pending_workers_ == 0) {
+        workers_done_.notify_one();
+      }
+    }
+  }
+
+  void TakeJobs(const std::function<void(int)>& job, int num_jobs) {
+    for (int i = next_job_++; i < num_jobs; i = next_job_++) {
+      job(i);
+    }
+  }
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable workers_done_;
+  bool stopping_ = false;
+  uint64_t generation_ = 0;
+  const std::function<void(int)>* job_ = nullptr;
+  int num_jobs_ = 0;
+  size_t num_pending_workers_ = 0;
+
+  // Only updated under |mutex_| between generations.
+  std::atomic<int> next_job_{0};
+};
+
 EncryptedFrame::EncryptedFrame() {
   data = absl::Span<uint8_t>(owned_data_);
 }
@@ -39,32 +167,27 @@ EncryptedFrame& EncryptedFrame::operator=(EncryptedFrame&& other) {
 }
 
 FrameCrypto::FrameCrypto(const std::array<uint8_t, 16>& aes_key,
-                         const std::array<uint8_t, 16>& cast_iv_mask)
-    : aes_key_{}, cast_iv_mask_(cast_iv_mask) {
-  // Ensure that the library has been initialized. CRYPTO_library_init() may be
-  // safely called multiple times during the life of a process.
-  CRYPTO_library_init();
-
-  // Initialize the 244-byte AES_KEY struct once, here at construction time. The
-  // const_cast<> is reasonable as this is a one-time-ctor-initialized value
-  // that will remain constant from here onward.
-  const int return_code = AES_set_encrypt_key(
-      aes_key.data(), aes_key.size() * 8, const_cast<AES_KEY*>(&aes_key_));
-  if (return_code != 0) {
-    ClearOpenSSLERRStack(CURRENT_LOCATION);
-    OSP_LOG_FATAL << "Failure when setting encryption key; unsafe to continue.";
-    OSP_NOTREACHED();
-  }
-}
+                         const std::array<uint8_t, 16>& cast_iv_mask,
+                         int max_threads)
+    : key_context_(CreateKeyContext(aes_key)),
+      max_threads_(std::max(max_threads, 1)),
+      cast_iv_mask_(cast_iv_mask) {}
 
 FrameCrypto::~FrameCrypto() = default;
 
+// static
+int FrameCrypto::GetDefaultMaxThreads() {
+  const int num_cores = static_cast<int>(std::thread::hardware_concurrency());
+  return std::min(std::max(num_cores, 1), kMaxDefaultThreads);
+}
+
 EncryptedFrame FrameCrypto::Encrypt(const EncodedFrame& encoded_frame) const {
   EncryptedFrame result;
   encoded_frame.CopyMetadataTo(&result);
   result.owned_data_.resize(encoded_frame.data.size());
   result.data = absl::Span<uint8_t>(result.owned_data_);
-  EncryptCommon(encoded_frame.frame_id, encoded_frame.data, result.data);
+  const absl::Span<const uint8_t> payload = encoded_frame.data;
+  EncryptCommon(encoded_frame.frame_id, {&payload, 1}, result.data);
   return result;
 }
 
@@ -77,15 +200,28 @@ void FrameCrypto::Decrypt(const EncryptedFrame& encrypted_frame,
     encoded_frame->data = absl::Span<uint8_t>(encoded_frame->data.data(),
                                               encrypted_frame.data.size());
   }
-  EncryptCommon(encrypted_frame.frame_id, encrypted_frame.data,
-                encoded_frame->data);
+  const absl::Span<const uint8_t> payload = encrypted_frame.data;
+  EncryptCommon(encrypted_frame.frame_id, {&payload, 1}, encoded_frame->data);
+}
+
+void FrameCrypto::DecryptPayloadChunks(
+    FrameId frame_id,
+    absl::Span<const absl::Span<const uint8_t>> payload_chunks,
+    absl::Span<uint8_t> out) const {
+  EncryptCommon(frame_id, payload_chunks, out);
 }
 
 void FrameCrypto::EncryptCommon(FrameId frame_id,
-                                absl::Span<const uint8_t> in,
+                                absl::Span<const absl::Span<const uint8_t>> in,
                                 absl::Span<uint8_t> out) const {
   OSP_DCHECK(!frame_id.is_null());
-  OSP_DCHECK_EQ(in.size(), out.size());
+#if OSP_DCHECK_IS_ON()
+  size_t in_size = 0;
+  for (absl::Span<const uint8_t> chunk : in) {
+    in_size += chunk.size();
+  }
+  OSP_DCHECK_EQ(in_size, out.size());
+#endif
 
   // Compute the AES nonce for Cast Streaming payload encryption, which is based
   // on the |frame_id|.
@@ -97,10 +233,75 @@ void FrameCrypto::EncryptCommon(FrameId frame_id,
     aes_nonce[i] ^= cast_iv_mask_[i];
   }
 
-  std::array<uint8_t, 16> ecount_buf{/* zero initialized */};
-  unsigned int block_offset = 0;
-  AES_ctr128_encrypt(in.data(), out.data(), in.size(), &aes_key_,
-                     aes_nonce.data(), ecount_buf.data(), &block_offset);
+  // Split the frame into ranges of whole blocks, one per thread, each starting
+  // with the counter that a single pass would have reached there.
+  const size_t max_ranges = out.size() / kMinBytesPerThread;
+  if (max_ranges < 2 || max_threads_ < 2) {
+    EncryptRange(aes_nonce, in, 0, out);
+    return;
+  }
+  const int num_ranges = static_cast<int>(
+      std::min(max_ranges, static_cast<size_t>(max_threads_)));
+  const size_t num_blocks = (out.size() + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+  const size_t blocks_per_range = (num_blocks + num_ranges - 1) / num_ranges;
+  const auto encrypt_range = [&](int index) {
+    const size_t first_block = index * blocks_per_range;
+    const size_t begin = std::min(first_block * AES_BLOCK_SIZE, out.size());
+    const size_t end =
+        std::min(begin + blocks_per_range * AES_BLOCK_SIZE, out.size());
+    std::array<uint8_t, 16> counter = aes_nonce;
+    AdvanceCounter(first_block, &counter);
+    EncryptRange(counter, in, begin, out.subspan(begin, end - begin));
+  };
+
+  std::lock_guard<std::mutex> lock(workers_mutex_);
+  if (!workers_) {
+    workers_ = std::make_unique<Workers>(max_threads_ - 1);
+  }
+  workers_->Run(num_ranges, encrypt_range);
+}
+
+void FrameCrypto::EncryptRange(const std::array<uint8_t, 16>& counter,
+                               absl::Span<const absl::Span<const uint8_t>> in,
+                               size_t offset,
+                               absl::Span<uint8_t> out) const {
+  OSP_DCHECK_LE(out.size(), static_cast<size_t>(INT_MAX));
+  if (out.empty()) {
+    return;
+  }
+
+  // Copying the context reuses the key schedule computed by the ctor, and
+  // leaves |key_context_| untouched for the other threads.
+  bssl::UniquePtr<EVP_CIPHER_CTX> context(EVP_CIPHER_CTX_new());
+  bool ok = context &&
+            EVP_CIPHER_CTX_copy(context.get(), key_context_.get()) == 1 &&
+            EVP_EncryptInit_ex(context.get(), nullptr, nullptr, nullptr,
+                               counter.data()) == 1;
+
+  // Skip the chunks before |offset|, then go through the rest until |out| is
+  // full. The context carries the position within the key stream from one
+  // chunk to the next.
+  for (auto chunk = in.begin(); ok && !out.empty() && chunk != in.end();
+       ++chunk) {
+    if (offset >= chunk->size()) {
+      offset -= chunk->size();
+      continue;
+    }
+    const size_t length = std::min(chunk->size() - offset, out.size());
+    int out_length = 0;
+    ok = EVP_EncryptUpdate(context.get(), out.data(), &out_length,
+                           chunk->data() + offset,
+                           static_cast<int>(length)) == 1;
+    OSP_DCHECK(!ok || static_cast<size_t>(out_length) == length);
+    out.remove_prefix(length);
+    offset = 0;
+  }
+  if (!ok) {
+    ClearOpenSSLERRStack(CURRENT_LOCATION);
+    OSP_LOG_FATAL << "Failure when encrypting frame; unsafe to continue.";
+    OSP_NOTREACHED();
+  }
+  OSP_DCHECK(out.empty());
 }
 
 }  // namespace cast
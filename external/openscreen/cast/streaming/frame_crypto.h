@@ -9,11 +9,14 @@
 #include <stdint.h>
 
 #include <array>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "absl/types/span.h"
 #include "cast/streaming/encoded_frame.h"
-#include "openssl/aes.h"
+#include "openssl/base.h"
+#include "openssl/evp.h"
 #include "platform/base/macros.h"
 
 namespace openscreen {
@@ -45,13 +48,22 @@ struct EncryptedFrame : public EncodedFrame {
 
 // Encrypts EncodedFrames before sending, or decrypts EncryptedFrames that have
 // been received.
+//
+// Since each block of AES-CTR only depends on its counter, large frames can be
+// split into ranges of blocks that are processed on several threads at once.
+// This is off by default: see docs/threading.md.
 class FrameCrypto {
  public:
   // Construct with the given 16-bytes AES key and IV mask. Both arguments
   // should be randomly-generated for each new streaming session.
   // GenerateRandomBytes() can be used to create them.
+  //
+  // Up to |max_threads| threads, including the calling one, work on each
+  // frame. The extra ones are only started once a frame large enough to be
+  // split comes along. With the default of 1, no threads are started.
   FrameCrypto(const std::array<uint8_t, 16>& aes_key,
-              const std::array<uint8_t, 16>& cast_iv_mask);
+              const std::array<uint8_t, 16>& cast_iv_mask,
+              int max_threads = 1);
 
   ~FrameCrypto();
 
@@ -63,6 +75,14 @@ class FrameCrypto {
   void Decrypt(const EncryptedFrame& encrypted_frame,
                EncodedFrame* encoded_frame) const;
 
+  // Decrypts the payload of frame |frame_id|, given as the |payload_chunks| it
+  // arrived in, into |out|. This saves concatenating the chunks first. |out|
+  // must be exactly the total size of the chunks.
+  void DecryptPayloadChunks(
+      FrameId frame_id,
+      absl::Span<const absl::Span<const uint8_t>> payload_chunks,
+      absl::Span<uint8_t> out) const;
+
   // AES crypto inputs and outputs (for either encrypting or decrypting) are
   // always the same size in bytes. The following are just "documentative code."
   static int GetEncryptedSize(const EncodedFrame& encoded_frame) {
@@ -72,20 +92,45 @@ class FrameCrypto {
     return encrypted_frame.data.size();
   }
 
+  // Returns a |max_threads| suited to this machine, for embedders which allow
+  // threads: one per core, up to four.
+  static int GetDefaultMaxThreads();
+
+  // The smallest number of bytes given to each thread. Frames smaller than
+  // twice this are always processed by the calling thread alone.
+  static constexpr size_t kMinBytesPerThread = 128 << 10;
+
  private:
-  // The 244-byte AES_KEY struct, derived from the |aes_key| passed to the ctor,
-  // and initialized by boringssl's AES_set_encrypt_key() function.
-  const AES_KEY aes_key_;
+  class Workers;
+
+  // AES-128-CTR cipher context, initialized with the |aes_key| passed to the
+  // ctor. Each call copies it and only sets the IV, so that the key schedule is
+  // only computed once.
+  const bssl::UniquePtr<EVP_CIPHER_CTX> key_context_;
+
+  const int max_threads_;
+
+  // Started by the first frame that is split across threads. Frames are split
+  // one at a time, so concurrent calls wait for |workers_mutex_|.
+  mutable std::mutex workers_mutex_;
+  mutable std::unique_ptr<Workers> workers_;
 
   // Random bytes used in the custom heuristic to generate a different
   // initialization vector for each frame.
   const std::array<uint8_t, 16> cast_iv_mask_;
 
   // AES-CTR is symmetric. Thus, the "meat" of both Encrypt() and Decrypt() is
-  // the same.
+  // the same. The input is the concatenation of the chunks in |in|.
   void EncryptCommon(FrameId frame_id,
-                     absl::Span<const uint8_t> in,
+                     absl::Span<const absl::Span<const uint8_t>> in,
                      absl::Span<uint8_t> out) const;
+
+  // Encrypts the input bytes starting at |offset| into |out|, starting with the
+  // counter block |counter|.
+  void EncryptRange(const std::array<uint8_t, 16>& counter,
+                    absl::Span<const absl::Span<const uint8_t>> in,
+                    size_t offset,
+                    absl::Span<uint8_t> out) const;
 };
 
 }  // namespace cast
@@ -0,0 +1,109 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures how fast FrameCrypto encrypts frames of 1 KB to 1 MB, with one
+// thread and with several, next to a single AES_ctr128_encrypt() call over the
+// same frame.
+//
+// Usage: frame_crypto_benchmark [bytes_per_size]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "cast/streaming/frame_crypto.h"
+#include "openssl/aes.h"
+#include "util/crypto/random_bytes.h"
+#include "util/osp_logging.h"
+
+namespace openscreen {
+namespace cast {
+namespace {
+
+constexpr size_t kFrameSizes[] = {1 << 10,  4 << 10,   16 << 10, 64 << 10,
+                                  256 << 10, 512 << 10, 1 << 20};
+constexpr int kThreadCounts[] = {1, 2, 4};
+
+// Enough frames of each size to take a noticeable amount of time.
+constexpr size_t kDefaultBytesPerSize = 256 << 20;
+
+// Runs |encrypt| enough times to go through |total_bytes| of frames of
+// |frame_size|, and returns the throughput in MB/s.
+template <typename Encrypt>
+double MeasureThroughput(size_t frame_size,
+                         size_t total_bytes,
+                         Encrypt encrypt) {
+  const size_t iterations = std::max<size_t>(total_bytes / frame_size, 1);
+  encrypt(FrameId::first());  // Warm up, and start any threads.
+
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    encrypt(FrameId::first() + (i + 1));
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return iterations * frame_size / std::max(elapsed.count(), 1e-9) / 1e6;
+}
+
+void RunBenchmark(size_t frame_size, size_t total_bytes) {
+  const std::array<uint8_t, 16> key = GenerateRandomBytes16();
+  const std::array<uint8_t, 16> iv = GenerateRandomBytes16();
+  std::vector<uint8_t> plaintext(frame_size);
+  for (size_t i = 0; i < frame_size; ++i) {
+    plaintext[i] = static_cast<uint8_t>(i);
+  }
+
+  printf("%8zu bytes:", frame_size);
+
+  // What FrameCrypto used to do: one pass over the frame with AES_KEY.
+  AES_KEY aes_key;
+  OSP_CHECK_EQ(AES_set_encrypt_key(key.data(), key.size() * 8, &aes_key), 0);
+  std::vector<uint8_t> ciphertext(frame_size);
+  printf(" AES_ctr128_encrypt %8.1f MB/s",
+         MeasureThroughput(frame_size, total_bytes, [&](FrameId frame_id) {
+           std::array<uint8_t, 16> nonce = iv;
+           nonce[11] ^= static_cast<uint8_t>(frame_id.lower_32_bits());
+           std::array<uint8_t, 16> ecount_buf{};
+           unsigned int block_offset = 0;
+           AES_ctr128_encrypt(plaintext.data(), ciphertext.data(), frame_size,
+                              &aes_key, nonce.data(), ecount_buf.data(),
+                              &block_offset);
+         }));
+
+  for (int num_threads : kThreadCounts) {
+    const FrameCrypto crypto(key, iv, num_threads);
+    EncodedFrame frame;
+    frame.data = absl::Span<uint8_t>(plaintext);
+    printf(", %d thread%s %8.1f MB/s", num_threads,
+           num_threads == 1 ? "" : "s",
+           MeasureThroughput(frame_size, total_bytes, [&](FrameId frame_id) {
+             frame.frame_id = frame_id;
+             crypto.Encrypt(frame);
+           }));
+  }
+  printf("\n");
+}
+
+}  // namespace
+}  // namespace cast
+}  // namespace openscreen
+
+int main(int argc, char* argv[]) {
+  using namespace openscreen::cast;
+
+  const long long bytes_per_size =
+      argc > 1 ? atoll(argv[1]) : kDefaultBytesPerSize;
+  if (bytes_per_size <= 0) {
+    fprintf(stderr, "Usage: %s [bytes_per_size]\n", argv[0]);
+    return 1;
+  }
+
+  for (size_t frame_size : kFrameSizes) {
+    RunBenchmark(frame_size, static_cast<size_t>(bytes_per_size));
+  }
+  return 0;
+}
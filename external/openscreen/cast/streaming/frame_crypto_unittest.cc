@@ -76,6 +76,76 @@ TEST(FrameCryptoTest, EncryptsAndDecryptsFrames) {
                       frame1.data.size()));
 }
 
+// The payload of frame 0 is encrypted with the IV mask itself as the initial
+// counter, so it matches the CTR-AES128 example of NIST SP 800-38A, F.5.1.
+TEST(FrameCryptoTest, EncryptsWithAesCtr) {
+  const std::array<uint8_t, 16> key = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae,
+                                       0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88,
+                                       0x09, 0xcf, 0x4f, 0x3c};
+  const std::array<uint8_t, 16> iv = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5,
+                                      0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb,
+                                      0xfc, 0xfd, 0xfe, 0xff};
+  std::vector<uint8_t> plaintext = {
+      0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e,
+      0x11, 0x73, 0x93, 0x17, 0x2a, 0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03,
+      0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51, 0x30,
+      0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19,
+      0x1a, 0x0a, 0x52, 0xef, 0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b,
+      0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+  const std::vector<uint8_t> expected_ciphertext = {
+      0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68,
+      0x64, 0x99, 0x0d, 0xb6, 0xce, 0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70,
+      0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff, 0x5a,
+      0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02,
+      0x0d, 0xb0, 0x3e, 0xab, 0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03,
+      0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee};
+
+  EncodedFrame frame;
+  frame.frame_id = FrameId::first();
+  frame.data = absl::Span<uint8_t>(plaintext);
+  const EncryptedFrame encrypted_frame = FrameCrypto(key, iv).Encrypt(frame);
+  EXPECT_EQ(expected_ciphertext,
+            std::vector<uint8_t>(encrypted_frame.data.begin(),
+                                 encrypted_frame.data.end()));
+}
+
+TEST(FrameCryptoTest, SplittingLargeFramesAcrossThreadsGivesTheSameResult) {
+  const std::array<uint8_t, 16> key = GenerateRandomBytes16();
+  std::array<uint8_t, 16> iv = GenerateRandomBytes16();
+  // Make the counter carry across bytes within the first frame's blocks.
+  iv[13] = iv[14] = iv[15] = 0xff;
+  const FrameCrypto single_threaded_crypto(key, iv, 1);
+  const FrameCrypto multi_threaded_crypto(key, iv, 4);
+
+  // Sizes around the thresholds for splitting, and ones that are not multiples
+  // of the AES block size.
+  constexpr size_t kMin = FrameCrypto::kMinBytesPerThread;
+  const size_t kSizes[] = {kMin * 2 - 1, kMin * 2,     kMin * 3 + 5,
+                           kMin * 4 + 1, kMin * 8 + 9, (1 << 20) + 7};
+  for (size_t size : kSizes) {
+    SCOPED_TRACE(size);
+    std::vector<uint8_t> buffer(size);
+    for (size_t i = 0; i < size; ++i) {
+      buffer[i] = static_cast<uint8_t>(i * 7);
+    }
+    EncodedFrame frame;
+    frame.frame_id = FrameId::first() + 1;
+    frame.data = absl::Span<uint8_t>(buffer);
+
+    const EncryptedFrame expected = single_threaded_crypto.Encrypt(frame);
+    const EncryptedFrame encrypted = multi_threaded_crypto.Encrypt(frame);
+    ASSERT_EQ(expected.data.size(), encrypted.data.size());
+    EXPECT_EQ(0, memcmp(expected.data.data(), encrypted.data.data(),
+                        expected.data.size()));
+
+    std::vector<uint8_t> decrypted_buffer(size);
+    EncodedFrame decrypted;
+    decrypted.data = absl::Span<uint8_t>(decrypted_buffer);
+    multi_threaded_crypto.Decrypt(encrypted, &decrypted);
+    EXPECT_EQ(buffer, decrypted_buffer);
+  }
+}
+
 }  // namespace
 }  // namespace cast
 }  // namespace openscreen
@@ -15,5 +15,12 @@ MockEnvironment::MockEnvironment(ClockNowFunctionPtr now_function,
 
 MockEnvironment::~MockEnvironment() = default;
 
+void MockEnvironment::SendPackets(
+    absl::Span<const absl::Span<const uint8_t>> packets) {
+  for (const absl::Span<const uint8_t>& packet : packets) {
+    SendPacket(packet);
+  }
+}
+
 }  // namespace cast
 }  // namespace openscreen
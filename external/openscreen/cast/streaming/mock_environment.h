@@ -22,6 +22,11 @@ class MockEnvironment : public Environment {
 
   // Used for intercepting packet sends from the implementation under test.
   MOCK_METHOD(void, SendPacket, (absl::Span<const uint8_t> packet), (override));
+
+  // Passes each of the |packets| to SendPacket(), so that tests only need to
+  // intercept that.
+  void SendPackets(
+      absl::Span<const absl::Span<const uint8_t>> packets) override;
 };
 
 }  // namespace cast
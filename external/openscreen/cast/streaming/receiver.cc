@@ -37,7 +37,9 @@ Receiver::Receiver(Environment* environment,
       stats_tracker_(config.rtp_timebase),
       rtp_parser_(config.sender_ssrc),
       rtp_timebase_(config.rtp_timebase),
-      crypto_(config.aes_secret_key, config.aes_iv_mask),
+      crypto_(config.aes_secret_key,
+              config.aes_iv_mask,
+              config.crypto_threads),
       is_pli_enabled_(config.is_pli_enabled),
       rtcp_buffer_capacity_(environment->GetMaxPacketSize()),
       rtcp_buffer_(new uint8_t[rtcp_buffer_capacity_]),
@@ -102,16 +104,17 @@ int Receiver::AdvanceToNextFrame() {
   for (FrameId f = immediate_next_frame; f <= latest_frame_expected_; ++f) {
     PendingFrame& entry = GetQueueEntry(f);
     if (entry.collector.is_complete()) {
-      const EncryptedFrame& encrypted_frame =
-          entry.collector.PeekAtAssembledFrame();
+      // AES-CTR leaves the payload size unchanged, so the plaintext is the
+      // same size as the collected payload.
       if (f == immediate_next_frame) {  // Typical case.
-        return FrameCrypto::GetPlaintextSize(encrypted_frame);
+        return entry.collector.GetPayloadSize();
       }
-      if (encrypted_frame.dependency != EncodedFrame::DEPENDS_ON_ANOTHER) {
+      if (entry.collector.PeekAtFrameMetadata().dependency !=
+          EncodedFrame::DEPENDS_ON_ANOTHER) {
         // Found a frame after skipping past some frames. Drop the ones being
         // skipped, advancing |last_frame_consumed_| before returning.
         DropAllFramesBefore(f);
-        return FrameCrypto::GetPlaintextSize(encrypted_frame);
+        return entry.collector.GetPayloadSize();
       }
       // Conclusion: The frame in the current queue entry is complete, but
       // depends on a prior incomplete frame. Continue scanning...
@@ -147,12 +150,14 @@ EncodedFrame Receiver::ConsumeNextFrame(absl::Span<uint8_t> buffer) {
   const FrameId frame_id = last_frame_consumed_ + 1;
   OSP_CHECK_LE(frame_id, checkpoint_frame());
 
-  // Decrypt the frame, populating the given output |frame|.
+  // Decrypt the frame, populating the given output |frame|. The payload is
+  // decrypted straight out of the packets it arrived in, without assembling it
+  // first.
   PendingFrame& entry = GetQueueEntry(frame_id);
   OSP_DCHECK(entry.collector.is_complete());
   EncodedFrame frame;
   frame.data = buffer;
-  crypto_.Decrypt(entry.collector.PeekAtAssembledFrame(), &frame);
+  entry.collector.DecryptFrame(crypto_, &frame);
   OSP_DCHECK(entry.estimated_capture_time);
   frame.reference_time =
       *entry.estimated_capture_time + ResolveTargetPlayoutDelay(frame_id);
@@ -265,11 +270,11 @@ void Receiver::OnReceivedRtpPacket(Clock::time_point arrival_time,
   if (!collector.is_complete()) {
     return;  // Wait for the rest of the packets to come in.
   }
-  const EncryptedFrame& encrypted_frame = collector.PeekAtAssembledFrame();
 
   // Whenever a key frame has been received, the decoder has what it needs to
   // recover. In this case, clear the PLI condition.
-  if (encrypted_frame.dependency == EncryptedFrame::KEY_FRAME) {
+  if (collector.PeekAtFrameMetadata().dependency ==
+      EncryptedFrame::KEY_FRAME) {
     rtcp_builder_.SetPictureLossIndicator(false);
     last_key_frame_received_ = part->frame_id;
   }
@@ -34,7 +34,9 @@ Sender::Sender(Environment* environment,
                       config.sender_ssrc,
                       packet_router_->max_packet_size()),
       rtp_timebase_(config.rtp_timebase),
-      crypto_(config.aes_secret_key, config.aes_iv_mask),
+      crypto_(config.aes_secret_key,
+              config.aes_iv_mask,
+              config.crypto_threads),
       target_playout_delay_(config.target_playout_delay) {
   OSP_DCHECK(packet_router_);
   OSP_DCHECK_NE(rtcp_session_.sender_ssrc(), rtcp_session_.receiver_ssrc());
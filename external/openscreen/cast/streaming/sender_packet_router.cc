@@ -34,7 +34,7 @@ SenderPacketRouter::SenderPacketRouter(Environment* environment,
                          environment->now()),
       environment_(environment),
       packet_buffer_size_(environment->GetMaxPacketSize()),
-      packet_buffer_(new uint8_t[packet_buffer_size_]),
+      packet_buffer_(new uint8_t[packet_buffer_size_ * kMaxPacketsPerBatch]),
       max_packets_per_burst_(max_packets_per_burst),
       burst_interval_(burst_interval),
       max_burst_bitrate_(ComputeMaxBurstBitrate(packet_buffer_size_,
@@ -43,6 +43,7 @@ SenderPacketRouter::SenderPacketRouter(Environment* environment,
       alarm_(environment_->now_function(), environment_->task_runner()) {
   OSP_DCHECK(environment_);
   OSP_DCHECK_GT(packet_buffer_size_, kRequiredNetworkPacketSize);
+  batch_.reserve(kMaxPacketsPerBatch);
 }
 
 SenderPacketRouter::~SenderPacketRouter() {
@@ -162,6 +163,7 @@ void SenderPacketRouter::SendBurstOfPackets() {
   // Higher priority Senders' RTP packets are sent first.
   const int num_rtp_packets_sent = SendJustTheRtpPackets(
       burst_time, max_packets_per_burst_ - num_rtcp_packets_sent);
+  FlushPackets();
   last_burst_time_ = burst_time;
 
   BandwidthEstimator::OnBurstComplete(
@@ -183,11 +185,10 @@ int SenderPacketRouter::SendJustTheRtcpPackets(Clock::time_point send_time) {
     // burst would mean that all but the last one are old/irrelevant snapshots
     // of Sender state, and this would just thrash/confuse the Receiver.
     const absl::Span<uint8_t> packet =
-        entry.sender->GetRtcpPacketForImmediateSend(
-            send_time,
-            absl::Span<uint8_t>(packet_buffer_.get(), packet_buffer_size_));
+        entry.sender->GetRtcpPacketForImmediateSend(send_time,
+                                                    GetBufferForNextPacket());
     if (!packet.empty()) {
-      environment_->SendPacket(packet);
+      EnqueuePacket(packet);
       entry.next_rtcp_send_time = send_time + kRtcpReportInterval;
       ++num_sent;
     }
@@ -209,13 +210,12 @@ int SenderPacketRouter::SendJustTheRtpPackets(Clock::time_point send_time,
 
     for (; num_sent < num_packets_to_send; ++num_sent) {
       const absl::Span<uint8_t> packet =
-          entry.sender->GetRtpPacketForImmediateSend(
-              send_time,
-              absl::Span<uint8_t>(packet_buffer_.get(), packet_buffer_size_));
+          entry.sender->GetRtpPacketForImmediateSend(send_time,
+                                                     GetBufferForNextPacket());
       if (packet.empty()) {
         break;
       }
-      environment_->SendPacket(packet);
+      EnqueuePacket(packet);
     }
     entry.next_rtp_send_time = entry.sender->GetRtpResumeTime();
   }
@@ -223,6 +223,27 @@ int SenderPacketRouter::SendJustTheRtpPackets(Clock::time_point send_time,
   return num_sent;
 }
 
+absl::Span<uint8_t> SenderPacketRouter::GetBufferForNextPacket() {
+  OSP_DCHECK_LT(batch_.size(), static_cast<size_t>(kMaxPacketsPerBatch));
+  return absl::Span<uint8_t>(
+      packet_buffer_.get() + batch_.size() * packet_buffer_size_,
+      packet_buffer_size_);
+}
+
+void SenderPacketRouter::EnqueuePacket(absl::Span<const uint8_t> packet) {
+  batch_.push_back(packet);
+  if (batch_.size() == static_cast<size_t>(kMaxPacketsPerBatch)) {
+    FlushPackets();
+  }
+}
+
+void SenderPacketRouter::FlushPackets() {
+  if (!batch_.empty()) {
+    environment_->SendPackets(batch_);
+    batch_.clear();
+  }
+}
+
 namespace {
 constexpr int kBitsPerByte = 8;
 constexpr auto kOneSecondInMilliseconds = to_milliseconds(seconds(1));
@@ -266,6 +287,8 @@ constexpr int SenderPacketRouter::kDefaultMaxBurstBitrate;
 constexpr milliseconds SenderPacketRouter::kDefaultBurstInterval;
 // static
 constexpr Clock::time_point SenderPacketRouter::kNever;
+// static
+constexpr int SenderPacketRouter::kMaxPacketsPerBatch;
 
 }  // namespace cast
 }  // namespace openscreen
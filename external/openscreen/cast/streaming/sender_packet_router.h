@@ -38,6 +38,10 @@ namespace cast {
 // packets can be sent together as one larger transmission unit, and this can be
 // critical for good performance over shared-medium networks (such as 802.11
 // WiFi). https://en.wikipedia.org/wiki/Frame-bursting
+//
+// The packets of a burst are also handed to the Environment in batches, rather
+// than one at a time, so that the platform can send each batch with a single
+// system call.
 class SenderPacketRouter : public BandwidthEstimator,
                            public Environment::PacketConsumer {
  public:
@@ -158,6 +162,17 @@ class SenderPacketRouter : public BandwidthEstimator,
   int SendJustTheRtpPackets(Clock::time_point send_time,
                             int num_packets_to_send);
 
+  // Returns the part of |packet_buffer_| that the next packet of the batch is
+  // to be written to.
+  absl::Span<uint8_t> GetBufferForNextPacket();
+
+  // Adds |packet|, which was written to GetBufferForNextPacket(), to the batch,
+  // and sends the batch if it is full.
+  void EnqueuePacket(absl::Span<const uint8_t> packet);
+
+  // Sends all the packets in the batch.
+  void FlushPackets();
+
   // Returns the maximum number of packets to send in one burst, based on the
   // given parameters.
   static int ComputeMaxPacketsPerBurst(
@@ -170,9 +185,17 @@ class SenderPacketRouter : public BandwidthEstimator,
                                     int max_packets_per_burst,
                                     std::chrono::milliseconds burst_interval);
 
+  // The most packets handed to the Environment at once.
+  static constexpr int kMaxPacketsPerBatch = 32;
+
   Environment* const environment_;
   const int packet_buffer_size_;
+
+  // Room for kMaxPacketsPerBatch packets of |packet_buffer_size_| bytes each.
   const std::unique_ptr<uint8_t[]> packet_buffer_;
+
+  // The packets written to |packet_buffer_| that are waiting to be sent.
+  std::vector<absl::Span<const uint8_t>> batch_;
   const int max_packets_per_burst_;
   const std::chrono::milliseconds burst_interval_;
   const int max_burst_bitrate_;
@@ -54,6 +54,12 @@ struct SessionConfig final {
 
   // Whether picture loss indication (PLI) should be used for this session.
   bool is_pli_enabled = false;
+
+  // The most threads the Sender or Receiver may use to encrypt or decrypt a
+  // frame, including the one it runs on. More than 1 lets large frames be
+  // split across threads the library starts itself (see docs/threading.md);
+  // FrameCrypto::GetDefaultMaxThreads() suggests a value.
+  int crypto_threads = 1;
 };
 
 }  // namespace cast
@@ -9,6 +9,14 @@ namespace openscreen {
 UdpSocket::UdpSocket() = default;
 UdpSocket::~UdpSocket() = default;
 
+void UdpSocket::SendMessages(const OutgoingMessage* messages,
+                             size_t count,
+                             const IPEndpoint& dest) {
+  for (size_t i = 0; i < count; ++i) {
+    SendMessage(messages[i].data, messages[i].length, dest);
+  }
+}
+
 UdpSocket::Client::~Client() = default;
 
 }  // namespace openscreen
@@ -114,6 +114,20 @@ class UdpSocket {
                            size_t length,
                            const IPEndpoint& dest) = 0;
 
+  // One of the messages passed to SendMessages().
+  struct OutgoingMessage {
+    const void* data;
+    size_t length;
+  };
+
+  // Sends |count| messages to the same destination, in order. Implementations
+  // may send them with fewer system calls than one SendMessage() call each
+  // would take; the default implementation just calls SendMessage(). If some
+  // are not sent, Client::OnSendError() is called as for SendMessage().
+  virtual void SendMessages(const OutgoingMessage* messages,
+                            size_t count,
+                            const IPEndpoint& dest);
+
   // Sets the DSCP value to use for all messages sent from this socket.
   virtual void SetDscp(DscpMode state) = 0;
 
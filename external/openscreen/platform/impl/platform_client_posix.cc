@@ -10,6 +10,10 @@
 
 #include "platform/impl/udp_socket_reader_posix.h"
 
+#if defined(OS_LINUX)
+#include "platform/impl/socket_handle_waiter_epoll.h"
+#endif
+
 namespace openscreen {
 
 // static
@@ -17,14 +21,17 @@ PlatformClientPosix* PlatformClientPosix::instance_ = nullptr;
 
 // static
 void PlatformClientPosix::Create(Clock::duration networking_operation_timeout,
-                                 std::unique_ptr<TaskRunnerImpl> task_runner) {
+                                 std::unique_ptr<TaskRunnerImpl> task_runner,
+                                 SocketWaiterType waiter_type) {
   SetInstance(new PlatformClientPosix(networking_operation_timeout,
-                                      std::move(task_runner)));
+                                      std::move(task_runner), waiter_type));
 }
 
 // static
-void PlatformClientPosix::Create(Clock::duration networking_operation_timeout) {
-  SetInstance(new PlatformClientPosix(networking_operation_timeout));
+void PlatformClientPosix::Create(Clock::duration networking_operation_timeout,
+                                 SocketWaiterType waiter_type) {
+  SetInstance(new PlatformClientPosix(networking_operation_timeout,
+                                      waiter_type));
 }
 
 // static
@@ -76,9 +83,11 @@ void PlatformClientPosix::SetInstance(PlatformClientPosix* instance) {
 }
 
 PlatformClientPosix::PlatformClientPosix(
-    Clock::duration networking_operation_timeout)
+    Clock::duration networking_operation_timeout,
+    SocketWaiterType waiter_type)
     : task_runner_(new TaskRunnerImpl(Clock::now)),
       networking_loop_timeout_(networking_operation_timeout),
+      waiter_type_(waiter_type),
       networking_loop_thread_(&PlatformClientPosix::RunNetworkLoopUntilStopped,
                               this),
       task_runner_thread_(
@@ -86,15 +95,24 @@ PlatformClientPosix::PlatformClientPosix(
 
 PlatformClientPosix::PlatformClientPosix(
     Clock::duration networking_operation_timeout,
-    std::unique_ptr<TaskRunnerImpl> task_runner)
+    std::unique_ptr<TaskRunnerImpl> task_runner,
+    SocketWaiterType waiter_type)
     : task_runner_(std::move(task_runner)),
       networking_loop_timeout_(networking_operation_timeout),
+      waiter_type_(waiter_type),
       networking_loop_thread_(&PlatformClientPosix::RunNetworkLoopUntilStopped,
                               this) {}
 
 SocketHandleWaiterPosix* PlatformClientPosix::socket_handle_waiter() {
   std::call_once(waiter_initialization_, [this]() {
-    waiter_ = std::make_unique<SocketHandleWaiterPosix>(&Clock::now);
+#if defined(OS_LINUX)
+    if (waiter_type_ == SocketWaiterType::kEpoll) {
+      waiter_ = SocketHandleWaiterEpoll::Create(&Clock::now);
+    }
+#endif
+    if (!waiter_) {
+      waiter_ = std::make_unique<SocketHandleWaiterPosix>(&Clock::now);
+    }
     waiter_created_.store(true);
   });
   return waiter_.get();
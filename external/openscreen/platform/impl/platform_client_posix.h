@@ -36,6 +36,15 @@ class UdpSocketReaderPosix;
 // FIXME: Remove Create and Shutdown and use the ctor/dtor directly.
 class PlatformClientPosix {
  public:
+  enum class SocketWaiterType {
+    // select(), on every platform.
+    kSelect,
+
+    // epoll, which scales to many sockets. Only available on Linux; elsewhere,
+    // or if it fails to initialize, select() is used instead.
+    kEpoll,
+  };
+
   // Initializes the platform implementation.
   //
   // |networking_loop_interval| sets the minimum amount of time that should pass
@@ -48,12 +57,16 @@ class PlatformClientPosix {
   // single networking operation type.
   //
   // |task_runner| is a client-provided TaskRunner implementation.
+  //
+  // |waiter_type| selects how sockets are watched for events.
   static void Create(Clock::duration networking_operation_timeout,
-                     std::unique_ptr<TaskRunnerImpl> task_runner);
+                     std::unique_ptr<TaskRunnerImpl> task_runner,
+                     SocketWaiterType waiter_type = SocketWaiterType::kSelect);
 
   // Initializes the platform implementation and creates a new TaskRunner (which
   // starts a new thread).
-  static void Create(Clock::duration networking_operation_timeout);
+  static void Create(Clock::duration networking_operation_timeout,
+                     SocketWaiterType waiter_type = SocketWaiterType::kSelect);
 
   // Shuts down and deletes the PlatformClient instance currently stored as a
   // singleton. This method is expected to be called before program exit. After
@@ -82,10 +95,12 @@ class PlatformClientPosix {
   static void SetInstance(PlatformClientPosix* client);
 
  private:
-  explicit PlatformClientPosix(Clock::duration networking_operation_timeout);
+  PlatformClientPosix(Clock::duration networking_operation_timeout,
+                      SocketWaiterType waiter_type);
 
   PlatformClientPosix(Clock::duration networking_operation_timeout,
-                      std::unique_ptr<TaskRunnerImpl> task_runner);
+                      std::unique_ptr<TaskRunnerImpl> task_runner,
+                      SocketWaiterType waiter_type);
 
   // This method is thread-safe.
   SocketHandleWaiterPosix* socket_handle_waiter();
@@ -102,6 +117,8 @@ class PlatformClientPosix {
   std::atomic_bool networking_loop_running_{true};
   Clock::duration networking_loop_timeout_;
 
+  const SocketWaiterType waiter_type_;
+
   // Flags used to ensure that initialization of below instance objects occurs
   // only once across all threads.
   std::once_flag waiter_initialization_;
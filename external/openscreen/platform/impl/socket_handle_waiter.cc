@@ -16,10 +16,12 @@ SocketHandleWaiter::SocketHandleWaiter(ClockNowFunctionPtr now_function)
     : now_function_(now_function) {}
 
 void SocketHandleWaiter::Subscribe(Subscriber* subscriber,
-                                   SocketHandleRef handle) {
+                                   SocketHandleRef handle,
+                                   uint32_t flags) {
   std::lock_guard<std::mutex> lock(mutex_);
   if (handle_mappings_.find(handle) == handle_mappings_.end()) {
     handle_mappings_.emplace(handle, SocketSubscription{subscriber});
+    OnHandleWatched(handle, flags);
   }
 }
 
@@ -29,6 +31,7 @@ void SocketHandleWaiter::Unsubscribe(Subscriber* subscriber,
   auto iterator = handle_mappings_.find(handle);
   if (handle_mappings_.find(handle) != handle_mappings_.end()) {
     handle_mappings_.erase(iterator);
+    OnHandleUnwatched(handle);
   }
 }
 
@@ -36,6 +39,7 @@ void SocketHandleWaiter::UnsubscribeAll(Subscriber* subscriber) {
   std::lock_guard<std::mutex> lock(mutex_);
   for (auto it = handle_mappings_.begin(); it != handle_mappings_.end();) {
     if (it->second.subscriber == subscriber) {
+      OnHandleUnwatched(it->first);
       it = handle_mappings_.erase(it);
     } else {
       it++;
@@ -50,6 +54,7 @@ void SocketHandleWaiter::OnHandleDeletion(Subscriber* subscriber,
   auto it = handle_mappings_.find(handle);
   if (it != handle_mappings_.end()) {
     handle_mappings_.erase(it);
+    OnHandleUnwatched(handle);
     if (!disable_locking_for_testing) {
       handles_being_deleted_.push_back(handle);
 
@@ -45,8 +45,11 @@ class SocketHandleWaiter {
 
   // Start notifying |subscriber| whenever |handle| has an event. May be called
   // multiple times, to be notified for multiple handles, but should not be
-  // called multiple times for the same handle.
-  void Subscribe(Subscriber* subscriber, SocketHandleRef handle);
+  // called multiple times for the same handle. |flags| are the events that
+  // |subscriber| acts on; implementations may report others as well.
+  void Subscribe(Subscriber* subscriber,
+                 SocketHandleRef handle,
+                 uint32_t flags = kReadable | kWriteable);
 
   // Stop receiving notifications for one of the handles currently subscribed
   // to.
@@ -81,6 +84,13 @@ class SocketHandleWaiter {
       const std::vector<SocketHandleRef>& socket_fds,
       const Clock::duration& timeout) = 0;
 
+  // Called when |handle| starts or stops being watched, for implementations
+  // that keep their own registrations rather than using the handles passed to
+  // AwaitSocketsReadable(). Called with the subscription lock held, possibly
+  // while AwaitSocketsReadable() is running on another thread.
+  virtual void OnHandleWatched(SocketHandleRef handle, uint32_t flags) {}
+  virtual void OnHandleUnwatched(SocketHandleRef handle) {}
+
  private:
   struct SocketSubscription {
     Subscriber* subscriber = nullptr;
@@ -0,0 +1,200 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures how long the socket handle waiters take to notice that one of many
+// watched UDP sockets has received a packet, that is, the time between
+// sending the packet and the subscriber being called for its socket.
+//
+// Usage: socket_handle_waiter_benchmark [iterations]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "platform/impl/socket_handle_posix.h"
+#include "platform/impl/socket_handle_waiter_epoll.h"
+#include "platform/impl/socket_handle_waiter_posix.h"
+#include "util/osp_logging.h"
+
+namespace openscreen {
+namespace {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+constexpr int kSocketCounts[] = {10, 100, 1000};
+constexpr int kDefaultIterations = 1000;
+constexpr Clock::duration kWaitTimeout = milliseconds(50);
+
+// Reads the packet of each ready socket, and hands the time it was noticed
+// at to the sending thread.
+class LatencySubscriber : public SocketHandleWaiter::Subscriber {
+ public:
+  void ProcessReadyHandle(SocketHandleWaiter::SocketHandleRef handle,
+                          uint32_t flags) override {
+    if (!(flags & SocketHandleWaiter::Flags::kReadable)) {
+      return;
+    }
+    char data;
+    if (recv(handle.get().fd, &data, sizeof(data), 0) != 1) {
+      return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    received_at_ = now;
+    received_ = true;
+    cv_.notify_one();
+  }
+
+  std::chrono::steady_clock::time_point WaitForPacket() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return received_; });
+    received_ = false;
+    return received_at_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool received_ = false;
+  std::chrono::steady_clock::time_point received_at_;
+};
+
+int OpenLoopbackSocket(sockaddr_in* address) {
+  const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  OSP_CHECK_GE(fd, 0);
+
+  sockaddr_in bind_address = {};
+  bind_address.sin_family = AF_INET;
+  bind_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  OSP_CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&bind_address),
+                    sizeof(bind_address)),
+               0);
+
+  socklen_t length = sizeof(*address);
+  OSP_CHECK_EQ(
+      getsockname(fd, reinterpret_cast<sockaddr*>(address), &length), 0);
+  return fd;
+}
+
+void RunBenchmark(const char* name,
+                  SocketHandleWaiterPosix* waiter,
+                  int socket_count,
+                  int iterations) {
+  std::vector<std::unique_ptr<SocketHandle>> handles;
+  std::vector<sockaddr_in> addresses(socket_count);
+  for (int i = 0; i < socket_count; i++) {
+    handles.push_back(
+        std::make_unique<SocketHandle>(OpenLoopbackSocket(&addresses[i])));
+  }
+  const int sender = socket(AF_INET, SOCK_DGRAM, 0);
+  OSP_CHECK_GE(sender, 0);
+
+  if (handles.back()->fd >= FD_SETSIZE &&
+      !dynamic_cast<SocketHandleWaiterEpoll*>(waiter)) {
+    printf("%-8s %6d sockets: skipped, fds exceed FD_SETSIZE\n", name,
+           socket_count);
+  } else {
+    LatencySubscriber subscriber;
+    for (const auto& handle : handles) {
+      waiter->Subscribe(&subscriber, std::cref(*handle),
+                        SocketHandleWaiter::Flags::kReadable);
+    }
+
+    std::atomic_bool running{true};
+    std::thread loop([waiter, &running] {
+      while (running) {
+        waiter->ProcessHandles(kWaitTimeout);
+      }
+    });
+
+    std::mt19937 random(socket_count);
+    std::uniform_int_distribution<int> pick(0, socket_count - 1);
+    std::vector<nanoseconds> latencies;
+    latencies.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+      const sockaddr_in& to = addresses[pick(random)];
+      const char data = 'x';
+      const auto sent_at = std::chrono::steady_clock::now();
+      OSP_CHECK_EQ(sendto(sender, &data, sizeof(data), 0,
+                          reinterpret_cast<const sockaddr*>(&to), sizeof(to)),
+                   1);
+      latencies.push_back(subscriber.WaitForPacket() - sent_at);
+    }
+
+    running = false;
+    loop.join();
+    waiter->UnsubscribeAll(&subscriber);
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](size_t p) {
+      return duration_cast<microseconds>(
+                 latencies[std::min(latencies.size() - 1,
+                                    latencies.size() * p / 100)])
+          .count();
+    };
+    printf("%-8s %6d sockets: p50 %6lld us, p90 %6lld us, p99 %6lld us\n",
+           name, socket_count, static_cast<long long>(percentile(50)),
+           static_cast<long long>(percentile(90)),
+           static_cast<long long>(percentile(99)));
+  }
+
+  close(sender);
+  for (const auto& handle : handles) {
+    close(handle->fd);
+  }
+}
+
+// The largest test needs more file descriptors than the usual soft limit.
+void RaiseFileLimit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+}  // namespace
+}  // namespace openscreen
+
+int main(int argc, char* argv[]) {
+  using namespace openscreen;
+
+  const int iterations = argc > 1 ? atoi(argv[1]) : kDefaultIterations;
+  if (iterations <= 0) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+  RaiseFileLimit();
+
+  for (int socket_count : kSocketCounts) {
+    SocketHandleWaiterPosix select_waiter(&Clock::now);
+    RunBenchmark("select", &select_waiter, socket_count, iterations);
+
+    std::unique_ptr<SocketHandleWaiterEpoll> epoll_waiter =
+        SocketHandleWaiterEpoll::Create(&Clock::now);
+    OSP_CHECK(epoll_waiter);
+    RunBenchmark("epoll", epoll_waiter.get(), socket_count, iterations);
+  }
+  return 0;
+}
@@ -0,0 +1,218 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "platform/impl/socket_handle_waiter_epoll.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <utility>
+
+#include "platform/impl/socket_handle_posix.h"
+#include "util/osp_logging.h"
+
+namespace openscreen {
+namespace {
+
+// Maximum number of events returned by one epoll_wait() call. Any others are
+// returned by the next call.
+constexpr int kMaxEvents = 256;
+
+// The same bits are used for both, which lets ToFlags() handle either.
+static_assert(EPOLLIN == POLLIN && EPOLLOUT == POLLOUT &&
+                  EPOLLERR == POLLERR && EPOLLHUP == POLLHUP,
+              "epoll and poll event bits differ");
+
+uint32_t ToPollEvents(uint32_t flags) {
+  uint32_t events = 0;
+  if (flags & SocketHandleWaiter::Flags::kReadable) {
+    events |= EPOLLIN;
+  }
+  if (flags & SocketHandleWaiter::Flags::kWriteable) {
+    events |= EPOLLOUT;
+  }
+  return events;
+}
+
+// Errors and hangups are reported for all of |subscribed_flags|, as select()
+// does, so that the subscriber's next read or write notices them.
+uint32_t ToFlags(uint32_t events, uint32_t subscribed_flags) {
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    return subscribed_flags;
+  }
+  uint32_t flags = 0;
+  if (events & EPOLLIN) {
+    flags |= SocketHandleWaiter::Flags::kReadable;
+  }
+  if (events & EPOLLOUT) {
+    flags |= SocketHandleWaiter::Flags::kWriteable;
+  }
+  return flags & subscribed_flags;
+}
+
+// Rounded up, so that a short timeout does not turn into a busy loop.
+int ToTimeoutMs(Clock::duration timeout) {
+  if (timeout <= Clock::duration::zero()) {
+    return 0;
+  }
+  const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      timeout + std::chrono::milliseconds(1) - Clock::duration(1));
+  return static_cast<int>(std::min<std::chrono::milliseconds::rep>(
+      ms.count(), std::numeric_limits<int>::max()));
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<SocketHandleWaiterEpoll> SocketHandleWaiterEpoll::Create(
+    ClockNowFunctionPtr now_function) {
+  ScopedFd epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+  if (!epoll_fd) {
+    OSP_LOG_ERROR << "Failed to create epoll instance: " << strerror(errno);
+    return nullptr;
+  }
+
+  ScopedFd wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!wake_fd) {
+    OSP_LOG_ERROR << "Failed to create eventfd: " << strerror(errno);
+    return nullptr;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_fd.get();
+  if (epoll_ctl(epoll_fd.get(), EPOLL_CTL_ADD, wake_fd.get(), &event) != 0) {
+    OSP_LOG_ERROR << "Failed to watch eventfd: " << strerror(errno);
+    return nullptr;
+  }
+
+  return std::unique_ptr<SocketHandleWaiterEpoll>(new SocketHandleWaiterEpoll(
+      now_function, std::move(epoll_fd), std::move(wake_fd)));
+}
+
+SocketHandleWaiterEpoll::SocketHandleWaiterEpoll(
+    ClockNowFunctionPtr now_function,
+    ScopedFd epoll_fd,
+    ScopedFd wake_fd)
+    : SocketHandleWaiterPosix(now_function),
+      epoll_fd_(std::move(epoll_fd)),
+      wake_fd_(std::move(wake_fd)) {}
+
+SocketHandleWaiterEpoll::~SocketHandleWaiterEpoll() = default;
+
+ErrorOr<std::vector<SocketHandleWaiterEpoll::ReadyHandle>>
+SocketHandleWaiterEpoll::AwaitSocketsReadable(
+    const std::vector<SocketHandleRef>& socket_handles,
+    const Clock::duration& timeout) {
+  // |socket_handles| is not needed, since the epoll instance already watches
+  // every subscribed handle.
+  std::vector<pollfd> previously_ready;
+  {
+    std::lock_guard<std::mutex> lock(registrations_mutex_);
+    previously_ready.reserve(ready_fds_.size());
+    for (int fd : ready_fds_) {
+      auto it = registrations_.find(fd);
+      if (it != registrations_.end()) {
+        previously_ready.push_back(
+            {fd, static_cast<short>(ToPollEvents(it->second.flags)), 0});
+      }
+    }
+    ready_fds_.clear();
+  }
+
+  // Edge-triggered events are not reported again for data that is still
+  // waiting, so handles that were ready last time are checked directly. If
+  // any still is, only collect new events without blocking.
+  int still_ready = 0;
+  if (!previously_ready.empty()) {
+    still_ready = poll(previously_ready.data(), previously_ready.size(), 0);
+    if (still_ready < 0) {
+      return Error::Code::kIOFailure;
+    }
+  }
+
+  epoll_event events[kMaxEvents];
+  const int count = epoll_wait(epoll_fd_.get(), events, kMaxEvents,
+                               still_ready > 0 ? 0 : ToTimeoutMs(timeout));
+  if (count < 0) {
+    return errno == EINTR ? Error::Code::kAgain : Error::Code::kIOFailure;
+  }
+
+  std::unordered_map<int, uint32_t> events_by_fd;
+  for (const pollfd& entry : previously_ready) {
+    if (entry.revents) {
+      events_by_fd[entry.fd] |= entry.revents;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (events[i].data.fd == wake_fd_.get()) {
+      uint64_t value;
+      const ssize_t rv = read(wake_fd_.get(), &value, sizeof(value));
+      OSP_DCHECK(rv == static_cast<ssize_t>(sizeof(value)) ||
+                 errno == EAGAIN);
+      continue;
+    }
+    events_by_fd[events[i].data.fd] |= events[i].events;
+  }
+
+  std::vector<ReadyHandle> ready_handles;
+  std::lock_guard<std::mutex> lock(registrations_mutex_);
+  for (const auto& entry : events_by_fd) {
+    // The handle may have stopped being watched while waiting.
+    auto it = registrations_.find(entry.first);
+    if (it == registrations_.end()) {
+      continue;
+    }
+    const uint32_t flags = ToFlags(entry.second, it->second.flags);
+    if (flags) {
+      ready_handles.push_back({it->second.handle, flags});
+      ready_fds_.push_back(entry.first);
+    }
+  }
+
+  if (ready_handles.empty()) {
+    return Error::Code::kAgain;
+  }
+  return ready_handles;
+}
+
+void SocketHandleWaiterEpoll::OnHandleWatched(SocketHandleRef handle,
+                                              uint32_t flags) {
+  std::lock_guard<std::mutex> lock(registrations_mutex_);
+  const int fd = handle.get().fd;
+  epoll_event event = {};
+  event.events = ToPollEvents(flags) | EPOLLET;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &event) != 0) {
+    OSP_LOG_ERROR << "Failed to watch socket " << fd << ": "
+                  << strerror(errno);
+    return;
+  }
+  registrations_.emplace(fd, Registration{handle, flags});
+}
+
+void SocketHandleWaiterEpoll::OnHandleUnwatched(SocketHandleRef handle) {
+  {
+    std::lock_guard<std::mutex> lock(registrations_mutex_);
+    const int fd = handle.get().fd;
+    if (!registrations_.erase(fd)) {
+      return;
+    }
+    // Fails if the socket was closed already, which also removed it.
+    epoll_ctl(epoll_fd_.get(), EPOLL_CTL_DEL, fd, nullptr);
+  }
+
+  const uint64_t value = 1;
+  const ssize_t rv = write(wake_fd_.get(), &value, sizeof(value));
+  OSP_DCHECK(rv == static_cast<ssize_t>(sizeof(value)) || errno == EAGAIN);
+}
+
+}  // namespace openscreen
@@ -0,0 +1,75 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef PLATFORM_IMPL_SOCKET_HANDLE_WAITER_EPOLL_H_
+#define PLATFORM_IMPL_SOCKET_HANDLE_WAITER_EPOLL_H_
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "platform/impl/scoped_pipe.h"
+#include "platform/impl/socket_handle_waiter_posix.h"
+
+namespace openscreen {
+
+// SocketHandleWaiterPosix implementation based on epoll, for Linux.
+//
+// Handles are added to the epoll instance once, when they are subscribed to,
+// so the cost of waiting depends on the number of ready handles rather than on
+// the number of watched ones, and file descriptors are not limited to
+// FD_SETSIZE.
+//
+// Handles are registered edge-triggered. Since subscribers may only handle one
+// message per call, handles that were reported ready are checked again with
+// poll() on the next wait, and reported again for as long as they stay ready.
+class SocketHandleWaiterEpoll : public SocketHandleWaiterPosix {
+ public:
+  // Returns nullptr if the epoll instance could not be created.
+  static std::unique_ptr<SocketHandleWaiterEpoll> Create(
+      ClockNowFunctionPtr now_function);
+
+  ~SocketHandleWaiterEpoll() override;
+
+ protected:
+  ErrorOr<std::vector<ReadyHandle>> AwaitSocketsReadable(
+      const std::vector<SocketHandleRef>& socket_fds,
+      const Clock::duration& timeout) override;
+
+  void OnHandleWatched(SocketHandleRef handle, uint32_t flags) override;
+  void OnHandleUnwatched(SocketHandleRef handle) override;
+
+ private:
+  struct Registration {
+    SocketHandleRef handle;
+    // The SocketHandleWaiter::Flags the subscriber asked for.
+    uint32_t flags;
+  };
+
+  SocketHandleWaiterEpoll(ClockNowFunctionPtr now_function,
+                          ScopedFd epoll_fd,
+                          ScopedFd wake_fd);
+
+  const ScopedFd epoll_fd_;
+
+  // eventfd that interrupts epoll_wait() when a handle stops being watched,
+  // so that OnHandleDeletion() does not have to wait for the timeout.
+  const ScopedFd wake_fd_;
+
+  // Guards the members below. AwaitSocketsReadable() does not hold it while
+  // waiting.
+  std::mutex registrations_mutex_;
+
+  // Watched handles, by file descriptor.
+  std::unordered_map<int, Registration> registrations_;
+
+  // File descriptors reported ready by the last call to
+  // AwaitSocketsReadable(), to be checked again by the next one.
+  std::vector<int> ready_fds_;
+};
+
+}  // namespace openscreen
+
+#endif  // PLATFORM_IMPL_SOCKET_HANDLE_WAITER_EPOLL_H_
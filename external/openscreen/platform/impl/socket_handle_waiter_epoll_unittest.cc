@@ -0,0 +1,123 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "platform/impl/socket_handle_waiter_epoll.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "platform/impl/socket_handle_posix.h"
+
+namespace openscreen {
+namespace {
+
+using ::testing::_;
+using ::testing::Invoke;
+
+using SocketHandleRef = SocketHandleWaiter::SocketHandleRef;
+
+constexpr Clock::duration kTimeout = std::chrono::milliseconds(10);
+
+class MockSubscriber : public SocketHandleWaiter::Subscriber {
+ public:
+  MOCK_METHOD2(ProcessReadyHandle, void(SocketHandleRef, uint32_t));
+};
+
+class SocketHandleWaiterEpollTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    waiter_ = SocketHandleWaiterEpoll::Create(&Clock::now);
+    ASSERT_TRUE(waiter_);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds), 0);
+    watched_ = std::make_unique<SocketHandle>(fds[0]);
+    peer_ = fds[1];
+  }
+
+  void TearDown() override {
+    waiter_->UnsubscribeAll(&subscriber_);
+    close(watched_->fd);
+    close(peer_);
+  }
+
+  void Send() { ASSERT_EQ(write(peer_, "x", 1), 1); }
+
+  void Receive() {
+    char data;
+    ASSERT_EQ(read(watched_->fd, &data, 1), 1);
+  }
+
+  std::unique_ptr<SocketHandleWaiterEpoll> waiter_;
+  MockSubscriber subscriber_;
+  std::unique_ptr<SocketHandle> watched_;
+  int peer_ = -1;
+};
+
+}  // namespace
+
+TEST_F(SocketHandleWaiterEpollTest, ReportsReadableHandle) {
+  waiter_->Subscribe(&subscriber_, std::cref(*watched_),
+                     SocketHandleWaiter::Flags::kReadable);
+
+  EXPECT_CALL(subscriber_, ProcessReadyHandle(_, _)).Times(0);
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::Code::kAgain);
+
+  Send();
+  EXPECT_CALL(subscriber_,
+              ProcessReadyHandle(_, SocketHandleWaiter::Flags::kReadable))
+      .WillOnce(Invoke([this](SocketHandleRef handle, uint32_t flags) {
+        EXPECT_EQ(handle.get(), *watched_);
+        Receive();
+      }));
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::None());
+}
+
+TEST_F(SocketHandleWaiterEpollTest, ReportsHandleUntilDrained) {
+  waiter_->Subscribe(&subscriber_, std::cref(*watched_),
+                     SocketHandleWaiter::Flags::kReadable);
+
+  // Both messages arrive before the first wait, so there is only one edge,
+  // but the subscriber only reads one message per call.
+  Send();
+  Send();
+  EXPECT_CALL(subscriber_, ProcessReadyHandle(_, _))
+      .Times(2)
+      .WillRepeatedly(Invoke(
+          [this](SocketHandleRef handle, uint32_t flags) { Receive(); }));
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::None());
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::None());
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::Code::kAgain);
+}
+
+TEST_F(SocketHandleWaiterEpollTest, ReportsOnlySubscribedFlags) {
+  // The socket is writable, but that was not asked for.
+  waiter_->Subscribe(&subscriber_, std::cref(*watched_),
+                     SocketHandleWaiter::Flags::kReadable);
+  EXPECT_CALL(subscriber_, ProcessReadyHandle(_, _)).Times(0);
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::Code::kAgain);
+
+  waiter_->Unsubscribe(&subscriber_, std::cref(*watched_));
+  waiter_->Subscribe(&subscriber_, std::cref(*watched_));
+  EXPECT_CALL(subscriber_,
+              ProcessReadyHandle(_, SocketHandleWaiter::Flags::kWriteable));
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::None());
+}
+
+TEST_F(SocketHandleWaiterEpollTest, IgnoresUnsubscribedHandle) {
+  waiter_->Subscribe(&subscriber_, std::cref(*watched_),
+                     SocketHandleWaiter::Flags::kReadable);
+  waiter_->Unsubscribe(&subscriber_, std::cref(*watched_));
+
+  Send();
+  EXPECT_CALL(subscriber_, ProcessReadyHandle(_, _)).Times(0);
+  EXPECT_EQ(waiter_->ProcessHandles(kTimeout), Error::Code::kAgain);
+}
+
+}  // namespace openscreen
@@ -28,6 +28,12 @@ void OnReceivedSignal(int signal) {
   g_signal_state = kSignaled;
 }
 
+// Returns the value of PostedTaskPool::free_head_ that makes |index| the first
+// free PostedTask, after |free_head|.
+uint64_t NextFreeHead(uint64_t free_head, uint32_t index) {
+  return (((free_head >> 32) + 1) << 32) | index;
+}
+
 }  // namespace
 
 TaskRunnerImpl::TaskRunnerImpl(ClockNowFunctionPtr now_function,
@@ -35,37 +41,29 @@ TaskRunnerImpl::TaskRunnerImpl(ClockNowFunctionPtr now_function,
                                Clock::duration waiter_timeout)
     : now_function_(now_function),
       is_running_(false),
+      delayed_tasks_(now_function_()),
       task_waiter_(event_waiter),
       waiter_timeout_(waiter_timeout) {}
 
 TaskRunnerImpl::~TaskRunnerImpl() {
   // Ensure no thread is currently executing inside RunUntilStopped().
   OSP_DCHECK_EQ(task_runner_thread_id_, std::thread::id());
+
+  while (PostedTask* posted_task = posted_tasks_.Pop()) {
+    posted_task_pool_.Return(posted_task);
+  }
 }
 
 void TaskRunnerImpl::PostPackagedTask(Task task) {
-  std::lock_guard<std::mutex> lock(task_mutex_);
-  tasks_.emplace_back(std::move(task));
-  if (task_waiter_) {
-    task_waiter_->OnTaskPosted();
-  } else {
-    run_loop_wakeup_.notify_one();
-  }
+  AddTask(std::move(task), Clock::time_point::min());
 }
 
 void TaskRunnerImpl::PostPackagedTaskWithDelay(Task task,
                                                Clock::duration delay) {
-  std::lock_guard<std::mutex> lock(task_mutex_);
   if (delay <= Clock::duration::zero()) {
-    tasks_.emplace_back(std::move(task));
+    AddTask(std::move(task), Clock::time_point::min());
   } else {
-    delayed_tasks_.emplace(
-        std::make_pair(now_function_() + delay, std::move(task)));
-  }
-  if (task_waiter_) {
-    task_waiter_->OnTaskPosted();
-  } else {
-    run_loop_wakeup_.notify_one();
+    AddTask(std::move(task), now_function_() + delay);
   }
 }
 
@@ -128,6 +126,29 @@ void TaskRunnerImpl::RequestStopSoon() {
   PostTask([this]() { is_running_ = false; });
 }
 
+void TaskRunnerImpl::AddTask(TaskWithMetadata task,
+                             Clock::time_point run_time) {
+  posted_tasks_.Push(posted_task_pool_.Take(std::move(task), run_time));
+
+  // Both this and the run loop go through sequentially-consistent operations
+  // on |posted_tasks_| and |is_waiting_|, in opposite orders, so either the
+  // run loop sees the task before it waits, or this sees that it is waiting.
+  if (is_waiting_.load()) {
+    WakeUpRunLoop();
+  }
+}
+
+void TaskRunnerImpl::WakeUpRunLoop() {
+  if (task_waiter_) {
+    task_waiter_->OnTaskPosted();
+  } else {
+    // Taking the lock ensures that the run loop is either not waiting yet,
+    // and will see the new task, or is waiting and gets notified.
+    std::lock_guard<std::mutex> lock(wakeup_mutex_);
+    run_loop_wakeup_.notify_one();
+  }
+}
+
 void TaskRunnerImpl::RunRunnableTasks() {
   for (TaskWithMetadata& running_task : running_tasks_) {
     // Move the task to the stack so that its bound state is freed immediately
@@ -138,22 +159,32 @@ void TaskRunnerImpl::RunRunnableTasks() {
   running_tasks_.clear();
 }
 
+void TaskRunnerImpl::TakePostedTasks() {
+  while (PostedTask* posted_task = posted_tasks_.Pop()) {
+    if (posted_task->run_time == Clock::time_point::min()) {
+      tasks_.push_back(std::move(posted_task->task));
+    } else {
+      delayed_tasks_.Insert(posted_task->run_time,
+                            std::move(posted_task->task));
+    }
+    posted_task_pool_.Return(posted_task);
+  }
+}
+
 void TaskRunnerImpl::ScheduleDelayedTasks() {
-  std::lock_guard<std::mutex> lock(task_mutex_);
+  TakePostedTasks();
 
   // Getting the time can be expensive on some platforms, so only get it once.
-  const auto current_time = now_function_();
-  const auto end_of_range = delayed_tasks_.upper_bound(current_time);
-  for (auto it = delayed_tasks_.begin(); it != end_of_range; ++it) {
-    tasks_.push_back(std::move(it->second));
+  // Tasks whose time has come run after the immediate ones posted before them.
+  if (!delayed_tasks_.empty()) {
+    delayed_tasks_.TakeExpired(now_function_(), &tasks_);
   }
-  delayed_tasks_.erase(delayed_tasks_.begin(), end_of_range);
 }
 
 bool TaskRunnerImpl::GrabMoreRunnableTasks() {
   OSP_DCHECK(running_tasks_.empty());
 
-  std::unique_lock<std::mutex> lock(task_mutex_);
+  TakePostedTasks();
   if (!tasks_.empty()) {
     running_tasks_.swap(tasks_);
     return true;
@@ -163,27 +194,187 @@ bool TaskRunnerImpl::GrabMoreRunnableTasks() {
     return false;  // Stop was requested. Don't wait for more tasks.
   }
 
+  // Since everything posted was taken above, a non-empty queue means that
+  // another thread is in the middle of posting a task. Let it finish.
   if (task_waiter_) {
-    Clock::duration timeout = waiter_timeout_;
-    if (!delayed_tasks_.empty()) {
-      Clock::duration next_task_delta =
-          delayed_tasks_.begin()->first - now_function_();
-      if (next_task_delta < timeout) {
-        timeout = next_task_delta;
-      }
+    is_waiting_.store(true);
+    if (posted_tasks_.empty()) {
+      task_waiter_->WaitForTaskToBePosted(GetWaitTimeout());
+    } else {
+      std::this_thread::yield();
     }
-    lock.unlock();
-    task_waiter_->WaitForTaskToBePosted(timeout);
+    is_waiting_.store(false);
     return false;
   }
 
-  if (delayed_tasks_.empty()) {
-    run_loop_wakeup_.wait(lock);
+  std::unique_lock<std::mutex> lock(wakeup_mutex_);
+  is_waiting_.store(true);
+  if (posted_tasks_.empty()) {
+    if (delayed_tasks_.empty()) {
+      run_loop_wakeup_.wait(lock);
+    } else {
+      run_loop_wakeup_.wait_for(lock, GetWaitTimeout());
+    }
   } else {
-    run_loop_wakeup_.wait_for(lock,
-                              delayed_tasks_.begin()->first - now_function_());
+    lock.unlock();
+    std::this_thread::yield();
   }
+  is_waiting_.store(false);
   return false;
 }
 
+Clock::duration TaskRunnerImpl::GetWaitTimeout() const {
+  Clock::duration timeout =
+      task_waiter_ ? waiter_timeout_ : Clock::duration::max();
+  if (!delayed_tasks_.empty()) {
+    const Clock::duration next_task_delta =
+        delayed_tasks_.GetNextDeadline() - now_function_();
+    if (next_task_delta < timeout) {
+      timeout = next_task_delta;
+    }
+  }
+  return timeout;
+}
+
+TaskRunnerImpl::PostedTaskPool::PostedTaskPool()
+    : free_head_(PostedTask::kNotPooled) {}
+
+TaskRunnerImpl::PostedTaskPool::~PostedTaskPool() {
+  for (std::atomic<PostedTask*>& block : blocks_) {
+    delete[] block.load(std::memory_order_relaxed);
+  }
+}
+
+TaskRunnerImpl::PostedTask* TaskRunnerImpl::PostedTaskPool::Take(
+    TaskWithMetadata task,
+    Clock::time_point run_time) {
+  PostedTask* posted_task = PopFree();
+  if (!posted_task) {
+    posted_task = Grow();
+  }
+  if (!posted_task) {
+    return new PostedTask(std::move(task), run_time);
+  }
+  posted_task->task = std::move(task);
+  posted_task->run_time = run_time;
+  return posted_task;
+}
+
+void TaskRunnerImpl::PostedTaskPool::Return(PostedTask* posted_task) {
+  if (posted_task->pool_index == PostedTask::kNotPooled) {
+    delete posted_task;
+    return;
+  }
+  // Don't hold on to the state bound to a task that never ran.
+  posted_task->task = Task();
+  PushFree(posted_task, posted_task);
+}
+
+TaskRunnerImpl::PostedTask* TaskRunnerImpl::PostedTaskPool::Get(
+    uint32_t pool_index) const {
+  // Block |b| starts at index (2^b - 1) << kFirstBlockBits.
+  const int block =
+      31 - __builtin_clz((pool_index >> kFirstBlockBits) + uint32_t{1});
+  const uint32_t block_start =
+      ((uint32_t{1} << block) - 1) << kFirstBlockBits;
+  // Any index read from |free_head_| was pushed after its block was stored.
+  return blocks_[block].load(std::memory_order_acquire) +
+         (pool_index - block_start);
+}
+
+TaskRunnerImpl::PostedTask* TaskRunnerImpl::PostedTaskPool::PopFree() {
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while (static_cast<uint32_t>(head) != PostedTask::kNotPooled) {
+    PostedTask* const posted_task = Get(static_cast<uint32_t>(head));
+    // If |posted_task| was taken since |head| was loaded, this may read
+    // anything, but then the exchange below fails.
+    const uint32_t next =
+        posted_task->next_free.load(std::memory_order_relaxed);
+    if (free_head_.compare_exchange_weak(head, NextFreeHead(head, next),
+                                         std::memory_order_acquire)) {
+      return posted_task;
+    }
+  }
+  return nullptr;
+}
+
+void TaskRunnerImpl::PostedTaskPool::PushFree(PostedTask* first,
+                                              PostedTask* last) {
+  uint64_t head = free_head_.load(std::memory_order_relaxed);
+  do {
+    last->next_free.store(static_cast<uint32_t>(head),
+                          std::memory_order_relaxed);
+  } while (!free_head_.compare_exchange_weak(
+      head, NextFreeHead(head, first->pool_index), std::memory_order_release,
+      std::memory_order_relaxed));
+}
+
+TaskRunnerImpl::PostedTask* TaskRunnerImpl::PostedTaskPool::Grow() {
+  std::lock_guard<std::mutex> lock(grow_mutex_);
+  // Another thread may have added a block while this one waited.
+  if (PostedTask* posted_task = PopFree()) {
+    return posted_task;
+  }
+  if (num_blocks_ == kMaxBlocks) {
+    return nullptr;
+  }
+
+  const uint32_t size = uint32_t{1} << (kFirstBlockBits + num_blocks_);
+  const uint32_t block_start = size - (uint32_t{1} << kFirstBlockBits);
+  PostedTask* const block = new PostedTask[size];
+  for (uint32_t i = 0; i < size; ++i) {
+    block[i].pool_index = block_start + i;
+    block[i].next_free.store(block_start + i + 1, std::memory_order_relaxed);
+  }
+  blocks_[num_blocks_++].store(block, std::memory_order_release);
+
+  // The first one goes to the caller.
+  PushFree(&block[1], &block[size - 1]);
+  return &block[0];
+}
+
+TaskRunnerImpl::PostedTaskQueue::PostedTaskQueue()
+    : head_(&stub_), tail_(&stub_), stub_(Task(), Clock::time_point::min()) {}
+
+void TaskRunnerImpl::PostedTaskQueue::Push(PostedTask* posted_task) {
+  posted_task->next.store(nullptr, std::memory_order_relaxed);
+  PostedTask* const previous = head_.exchange(posted_task);
+  // Until this store, the consumer sees the queue as ending at |previous|.
+  previous->next.store(posted_task, std::memory_order_release);
+}
+
+TaskRunnerImpl::PostedTask* TaskRunnerImpl::PostedTaskQueue::Pop() {
+  PostedTask* tail = tail_;
+  PostedTask* next = tail->next.load(std::memory_order_acquire);
+  if (tail == &stub_) {
+    if (!next) {
+      return nullptr;
+    }
+    tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+
+  // |tail| is the last task, unless another one is being pushed. It can only
+  // be taken once the stub is queued behind it.
+  if (tail != head_.load()) {
+    return nullptr;
+  }
+  Push(&stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+bool TaskRunnerImpl::PostedTaskQueue::empty() const {
+  return tail_ == &stub_ && head_.load() == &stub_;
+}
+
 }  // namespace openscreen
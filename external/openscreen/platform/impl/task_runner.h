@@ -5,23 +5,29 @@
 #ifndef PLATFORM_IMPL_TASK_RUNNER_H_
 #define PLATFORM_IMPL_TASK_RUNNER_H_
 
+#include <atomic>
 #include <condition_variable>  // NOLINT
-#include <map>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <utility>
 #include <vector>
 
-#include "absl/base/thread_annotations.h"
 #include "absl/types/optional.h"
 #include "platform/api/task_runner.h"
 #include "platform/api/time.h"
 #include "platform/base/error.h"
+#include "platform/impl/timer_wheel.h"
 #include "util/trace_logging.h"
 
 namespace openscreen {
 
+// Posting a task does not take a lock, except while the queue grows its pool of
+// nodes: tasks are pushed onto a lock-free queue, and the thread running the
+// tasks only needs to be woken when it is waiting. That thread moves the
+// delayed ones into a timer wheel.
 class TaskRunnerImpl final : public TaskRunner {
  public:
   using Task = TaskRunner::Task;
@@ -101,11 +107,110 @@ class TaskRunnerImpl final : public TaskRunner {
   using TaskWithMetadata = Task;
 #endif  // defined(ENABLE_TRACE_LOGGING)
 
+  // A posted task, waiting in |posted_tasks_| for the run loop to pick it up.
+  struct PostedTask {
+    static constexpr uint32_t kNotPooled = std::numeric_limits<uint32_t>::max();
+
+    PostedTask() : PostedTask(Task(), Clock::time_point::min()) {}
+    PostedTask(TaskWithMetadata posted_task, Clock::time_point time)
+        : task(std::move(posted_task)), run_time(time) {}
+
+    std::atomic<PostedTask*> next{nullptr};
+    TaskWithMetadata task;
+    // When the task may run, or Clock::time_point::min() to run it as soon as
+    // possible.
+    Clock::time_point run_time;
+
+    // Where this is in |posted_task_pool_|, or kNotPooled if it was allocated
+    // on the heap.
+    uint32_t pool_index = kNotPooled;
+    // The next free PostedTask in |posted_task_pool_|, while this one is free.
+    std::atomic<uint32_t> next_free{kNotPooled};
+  };
+
+  // Recycles PostedTasks, so that posting a task stops allocating once the
+  // pool has as many as were ever waiting to run at once. Take() may be called
+  // from any thread; Return() only from the thread running the tasks.
+  class PostedTaskPool {
+   public:
+    PostedTaskPool();
+    ~PostedTaskPool();
+
+    PostedTask* Take(TaskWithMetadata task, Clock::time_point run_time);
+    void Return(PostedTask* posted_task);
+
+   private:
+    // PostedTasks are allocated in blocks, each twice the size of the one
+    // before. Once all the blocks are in use, Take() allocates single ones
+    // that Return() deletes.
+    static constexpr int kFirstBlockBits = 8;
+    static constexpr int kMaxBlocks = 16;
+
+    PostedTask* Get(uint32_t pool_index) const;
+
+    // Returns the first free PostedTask, or nullptr if there are none.
+    PostedTask* PopFree();
+
+    // Adds the PostedTasks from |first| to |last|, linked by their
+    // |next_free|, to the free list.
+    void PushFree(PostedTask* first, PostedTask* last);
+
+    // Adds a block and returns one of its PostedTasks, or returns nullptr if
+    // there are kMaxBlocks already.
+    PostedTask* Grow();
+
+    // The index of the first free PostedTask in the low 32 bits, and a count
+    // of the changes made to the free list in the high 32 bits. The count
+    // keeps a PopFree() from succeeding if, between its load and its
+    // exchange, the PostedTask it read was taken and returned again (ABA
+    // problem).
+    std::atomic<uint64_t> free_head_;
+
+    // Only taken to add a block.
+    std::mutex grow_mutex_;
+    int num_blocks_ = 0;
+    std::atomic<PostedTask*> blocks_[kMaxBlocks] = {};
+  };
+
+  // Intrusive multi-producer single-consumer queue of PostedTasks, after
+  // Dmitry Vyukov's. Push() may be called from any thread; Pop() and empty()
+  // only from the thread running the tasks.
+  class PostedTaskQueue {
+   public:
+    PostedTaskQueue();
+
+    void Push(PostedTask* posted_task);
+
+    // Returns nullptr if the queue is empty, or if the task at its front is
+    // still being pushed.
+    PostedTask* Pop();
+
+    // Whether anything was pushed that has not been popped yet.
+    bool empty() const;
+
+   private:
+    // Where tasks are pushed. Exchanged by each Push().
+    std::atomic<PostedTask*> head_;
+    // Where tasks are popped from. Only used by the consumer.
+    PostedTask* tail_;
+    // Placeholder node that keeps the list from ever being empty.
+    PostedTask stub_;
+  };
+
+  // Queues |task| to run at |run_time|, from any thread.
+  void AddTask(TaskWithMetadata task, Clock::time_point run_time);
+
+  // Wakes up the run loop if it is waiting for tasks.
+  void WakeUpRunLoop();
+
   // Helper that runs all tasks in |running_tasks_| and then clears it.
   void RunRunnableTasks();
 
-  // Look at all tasks in the delayed task queue, then schedule them if the
-  // minimum delay time has elapsed.
+  // Moves the tasks posted since the last call into |tasks_| or, if delayed,
+  // into |delayed_tasks_|.
+  void TakePostedTasks();
+
+  // Moves the delayed tasks whose run time has been reached into |tasks_|.
   void ScheduleDelayedTasks();
 
   // Transfers all ready-to-run tasks from |tasks_| to |running_tasks_|. If
@@ -114,23 +219,34 @@ class TaskRunnerImpl final : public TaskRunner {
   // transferred.
   bool GrabMoreRunnableTasks();
 
+  // Returns how long the run loop may wait for tasks to be posted before the
+  // next delayed task is due.
+  Clock::duration GetWaitTimeout() const;
+
   const ClockNowFunctionPtr now_function_;
 
   // Flag that indicates whether the task runner loop should continue. This is
   // only meant to be read/written on the thread executing RunUntilStopped().
   bool is_running_;
 
-  // This mutex is used for |tasks_| and |delayed_tasks_|, and also for
-  // notifying the run loop to wake up when it is waiting for a task to be added
-  // to the queue in |run_loop_wakeup_|.
-  std::mutex task_mutex_;
-  std::vector<TaskWithMetadata> tasks_ GUARDED_BY(task_mutex_);
-  std::multimap<Clock::time_point, TaskWithMetadata> delayed_tasks_
-      GUARDED_BY(task_mutex_);
+  // Tasks posted from any thread, not yet seen by the run loop, in PostedTasks
+  // from |posted_task_pool_|.
+  PostedTaskPool posted_task_pool_;
+  PostedTaskQueue posted_tasks_;
+
+  // Set by the run loop while it waits for tasks to be posted, so that posting
+  // a task only has to wake it up then.
+  std::atomic_bool is_waiting_{false};
+
+  // The tasks below are only accessed by the thread running the tasks.
+  std::vector<TaskWithMetadata> tasks_;
+  TimerWheel<TaskWithMetadata> delayed_tasks_;
 
   // When |task_waiter_| is nullptr, |run_loop_wakeup_| is used for sleeping the
-  // task runner.  Otherwise, |run_loop_wakeup_| isn't used and |task_waiter_|
-  // is used instead (along with |waiter_timeout_|).
+  // task runner, along with |wakeup_mutex_|.  Otherwise, |run_loop_wakeup_|
+  // isn't used and |task_waiter_| is used instead (along with
+  // |waiter_timeout_|).
+  std::mutex wakeup_mutex_;
   std::condition_variable run_loop_wakeup_;
   TaskWaiter* const task_waiter_;
   Clock::duration waiter_timeout_;
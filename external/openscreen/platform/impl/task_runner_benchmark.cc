@@ -0,0 +1,133 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Measures how many tasks per second TaskRunnerImpl accepts from several
+// posting threads, and how late its delayed tasks run.
+//
+// Usage: task_runner_benchmark [posts_per_thread]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "platform/impl/task_runner.h"
+#include "util/osp_logging.h"
+
+namespace openscreen {
+namespace {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+constexpr int kThreadCounts[] = {1, 2, 4, 8};
+constexpr int kDefaultPostsPerThread = 200000;
+
+constexpr int kNumDelayedTasks = 2000;
+constexpr int kMaxDelayMs = 50;
+
+void RunPostBenchmark(int num_threads, int posts_per_thread) {
+  TaskRunnerImpl runner(&Clock::now);
+  std::thread run_loop([&runner] { runner.RunUntilStopped(); });
+
+  std::atomic<int> num_run{0};
+  const int num_posts = num_threads * posts_per_thread;
+  const auto start = Clock::now();
+  std::vector<std::thread> posters;
+  for (int i = 0; i < num_threads; ++i) {
+    posters.emplace_back([&runner, &num_run, posts_per_thread] {
+      for (int j = 0; j < posts_per_thread; ++j) {
+        runner.PostTask([&num_run] { num_run.fetch_add(1); });
+      }
+    });
+  }
+  for (std::thread& poster : posters) {
+    poster.join();
+  }
+  const auto posted = Clock::now();
+  while (num_run.load() < num_posts) {
+    std::this_thread::yield();
+  }
+  const auto ran = Clock::now();
+
+  runner.RequestStopSoon();
+  run_loop.join();
+
+  const auto posts_per_second = [num_posts](Clock::duration elapsed) {
+    return num_posts /
+           std::max(std::chrono::duration<double>(elapsed).count(), 1e-9);
+  };
+  printf("%d posting threads: %10.0f posts/sec, %10.0f tasks run/sec\n",
+         num_threads, posts_per_second(posted - start),
+         posts_per_second(ran - start));
+}
+
+void RunTimerBenchmark() {
+  TaskRunnerImpl runner(&Clock::now);
+  std::thread run_loop([&runner] { runner.RunUntilStopped(); });
+
+  // Each task records how long after its run time it ran. Only the run loop
+  // thread writes to |lateness|, and only after the task was posted.
+  std::vector<Clock::duration> lateness(kNumDelayedTasks);
+  std::atomic<int> num_run{0};
+  std::mt19937 random(kNumDelayedTasks);
+  std::uniform_int_distribution<int> pick_delay_us(0, kMaxDelayMs * 1000);
+  for (int i = 0; i < kNumDelayedTasks; ++i) {
+    const Clock::duration delay = microseconds(pick_delay_us(random));
+    const Clock::time_point run_time = Clock::now() + delay;
+    runner.PostTaskWithDelay(
+        [&lateness, &num_run, i, run_time] {
+          lateness[i] = Clock::now() - run_time;
+          num_run.fetch_add(1);
+        },
+        delay);
+  }
+  while (num_run.load() < kNumDelayedTasks) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  runner.RequestStopSoon();
+  run_loop.join();
+
+  std::sort(lateness.begin(), lateness.end());
+  const auto percentile = [&lateness](size_t p) {
+    return static_cast<long long>(
+        duration_cast<microseconds>(
+            lateness[std::min(lateness.size() - 1, lateness.size() * p / 100)])
+            .count());
+  };
+  // A task that ran early would show up as negative lateness.
+  printf("%d delayed tasks: lateness min %lld us, p50 %lld us, p99 %lld us, "
+         "max %lld us\n",
+         kNumDelayedTasks,
+         static_cast<long long>(
+             duration_cast<microseconds>(lateness.front()).count()),
+         percentile(50), percentile(99),
+         static_cast<long long>(
+             duration_cast<microseconds>(lateness.back()).count()));
+}
+
+}  // namespace
+}  // namespace openscreen
+
+int main(int argc, char* argv[]) {
+  using namespace openscreen;
+
+  const int posts_per_thread =
+      argc > 1 ? atoi(argv[1]) : kDefaultPostsPerThread;
+  if (posts_per_thread <= 0) {
+    fprintf(stderr, "Usage: %s [posts_per_thread]\n", argv[0]);
+    return 1;
+  }
+
+  for (int num_threads : kThreadCounts) {
+    RunPostBenchmark(num_threads, posts_per_thread);
+  }
+  RunTimerBenchmark();
+  return 0;
+}
@@ -8,8 +8,10 @@
 
 #include <atomic>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -126,6 +128,69 @@ TEST(TaskRunnerImplTest, TaskRunnerRunsDelayedTasksInOrder) {
   t.join();
 }
 
+TEST(TaskRunnerImplTest, TaskRunnerRunsDelayedTasksWithSameTimeInPostOrder) {
+  FakeClock fake_clock{Clock::time_point(milliseconds(1337))};
+  TaskRunnerImpl runner(&fake_clock.now);
+
+  std::thread t([&runner] { runner.RunUntilStopped(); });
+
+  std::string ran_tasks;
+  const auto kDelayTime = milliseconds(5);
+  runner.PostTaskWithDelay([&ran_tasks] { ran_tasks += "1"; }, kDelayTime);
+  runner.PostTaskWithDelay([&ran_tasks] { ran_tasks += "2"; }, kDelayTime);
+  runner.PostTaskWithDelay([&ran_tasks] { ran_tasks += "3"; },
+                           kDelayTime * 100);
+  runner.PostTaskWithDelay([&ran_tasks] { ran_tasks += "4"; }, kDelayTime);
+  runner.PostTaskWithDelay([&ran_tasks] { ran_tasks += "5"; },
+                           kDelayTime / 2);
+
+  fake_clock.Advance(kDelayTime);
+  WaitUntilCondition([&ran_tasks] { return ran_tasks.size() == 4; });
+  EXPECT_EQ(ran_tasks, "5124");
+
+  fake_clock.Advance(kDelayTime * 99);
+  WaitUntilCondition([&ran_tasks] { return ran_tasks.size() == 5; });
+  EXPECT_EQ(ran_tasks, "51243");
+
+  runner.RequestStopSoon();
+  t.join();
+}
+
+TEST(TaskRunnerImplTest, TaskRunnerRunsTasksFromManyThreadsInPostOrder) {
+  TaskRunnerImpl runner(Clock::now);
+  std::thread t([&runner] { runner.RunUntilStopped(); });
+
+  constexpr int kNumThreads = 4;
+  constexpr int kTasksPerThread = 1000;
+  // Only accessed by the tasks, on the task runner thread.
+  std::vector<int> next_task_of_thread(kNumThreads, 0);
+  int num_out_of_order = 0;
+  std::atomic<int> num_run{0};
+
+  std::vector<std::thread> posters;
+  for (int i = 0; i < kNumThreads; ++i) {
+    posters.emplace_back([&, i] {
+      for (int j = 0; j < kTasksPerThread; ++j) {
+        runner.PostTask([&, i, j] {
+          if (next_task_of_thread[i]++ != j) {
+            num_out_of_order++;
+          }
+          num_run++;
+        });
+      }
+    });
+  }
+  for (std::thread& poster : posters) {
+    poster.join();
+  }
+
+  WaitUntilCondition(
+      [&num_run] { return num_run == kNumThreads * kTasksPerThread; });
+  runner.RequestStopSoon();
+  t.join();
+  EXPECT_EQ(num_out_of_order, 0);
+}
+
 TEST(TaskRunnerImplTest, SingleThreadedTaskRunnerRunsSequentially) {
   FakeClock fake_clock{Clock::time_point(milliseconds(1337))};
   TaskRunnerImpl runner(&fake_clock.now);
@@ -200,6 +265,31 @@ TEST(TaskRunnerImplTest, TaskRunnerIsStableWithLotsOfTasks) {
   EXPECT_EQ(ran_tasks, expected_ran_tasks);
 }
 
+// Posts enough tasks at once that TaskRunnerImpl has to add queue nodes to its
+// pool several times, then recycles them.
+TEST(TaskRunnerImplTest, ReleasesTasksWhenRunOrDestroyed) {
+  constexpr int kNumberOfTasks = 3000;
+  const auto bound_state = std::make_shared<int>(0);
+  {
+    FakeClock fake_clock{Clock::time_point(milliseconds(1337))};
+    TaskRunnerImpl runner(&fake_clock.now);
+    for (int i = 0; i < kNumberOfTasks; ++i) {
+      runner.PostTask([bound_state] { ++*bound_state; });
+    }
+    runner.RequestStopSoon();
+    runner.RunUntilStopped();
+    EXPECT_EQ(*bound_state, kNumberOfTasks);
+    EXPECT_EQ(bound_state.use_count(), 1);
+
+    for (int i = 0; i < kNumberOfTasks; ++i) {
+      runner.PostTask([bound_state] { ++*bound_state; });
+    }
+    EXPECT_EQ(bound_state.use_count(), kNumberOfTasks + 1);
+  }
+  EXPECT_EQ(*bound_state, kNumberOfTasks);
+  EXPECT_EQ(bound_state.use_count(), 1);
+}
+
 TEST(TaskRunnerImplTest, TaskRunnerDelayedTasksDontBlockImmediateTasks) {
   TaskRunnerImpl runner(Clock::now);
 
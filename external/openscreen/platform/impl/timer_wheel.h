@@ -0,0 +1,273 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef PLATFORM_IMPL_TIMER_WHEEL_H_
+#define PLATFORM_IMPL_TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "platform/api/time.h"
+#include "util/osp_logging.h"
+
+namespace openscreen {
+
+// Hierarchical timer wheel holding values until their deadline has passed.
+//
+// Time is divided into ticks of kTickDuration. The first level has one slot per
+// tick, and each slot of a higher level covers all the slots of the level
+// below. A value is placed in the lowest level whose range still includes its
+// deadline, and is moved down a level each time the current tick reaches the
+// slot it is in. Values further out than the top level can reach are kept in
+// a separate list, and placed again whenever the top level wraps around.
+//
+// Inserting is a push onto the vector of a slot, which only allocates while
+// the wheel is warming up, and taking the expired values only visits slots
+// that have something in them. Deadlines are kept exactly, so values are never
+// taken before their deadline, however coarse the ticks.
+//
+// Not thread-safe.
+template <typename T>
+class TimerWheel {
+ public:
+  static constexpr Clock::duration kTickDuration = std::chrono::milliseconds(1);
+
+  // |origin| is the earliest time the wheel will be asked about.
+  explicit TimerWheel(Clock::time_point origin) : origin_(origin) {}
+  ~TimerWheel() = default;
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+  // Adds |value|, to be taken once |deadline| has been reached.
+  void Insert(Clock::time_point deadline, T value) {
+    Place(Entry{deadline, next_sequence_++, std::move(value)});
+    size_++;
+  }
+
+  // Appends the values whose deadline is at or before |now| to |expired|, in
+  // the order of their deadlines. Values with the same deadline are appended
+  // in the order they were inserted in.
+  void TakeExpired(Clock::time_point now, std::vector<T>* expired) {
+    if (empty()) {
+      // Nothing to move down the levels, so the wheel can just skip ahead.
+      current_tick_ = std::max(current_tick_, ToTick(now));
+      return;
+    }
+
+    const uint64_t now_tick = ToTick(now);
+    while (true) {
+      TakeFromSlot(&slots_[0][current_tick_ & kSlotMask], now, current_tick_,
+                   now_tick);
+      if (current_tick_ >= now_tick) {
+        break;
+      }
+
+      // Skip ahead to the start of the next occupied slot, which is where the
+      // next values are due, or moved down a level.
+      current_tick_ = std::min(GetNextOccupiedTick(), now_tick);
+      if ((current_tick_ & kSlotMask) == 0) {
+        Cascade();
+      }
+    }
+
+    if (!expired_.empty()) {
+      std::sort(expired_.begin(), expired_.end(),
+                [](const Entry& a, const Entry& b) {
+                  return a.deadline != b.deadline ? a.deadline < b.deadline
+                                                  : a.sequence < b.sequence;
+                });
+      for (Entry& entry : expired_) {
+        expired->push_back(std::move(entry.value));
+      }
+      size_ -= expired_.size();
+      expired_.clear();
+    }
+  }
+
+  // Returns the earliest deadline of all the values, or
+  // Clock::time_point::max() if there are none.
+  Clock::time_point GetNextDeadline() const {
+    // Every value in a level comes before all those in the levels above it,
+    // and the slots of a level are in time order from the current one.
+    for (int level = 0; level < kLevels; ++level) {
+      const int current_slot = SlotIndex(current_tick_, level);
+      const uint64_t later_slots =
+          occupied_[level] & (~uint64_t{0} << current_slot);
+      if (later_slots) {
+        return GetEarliestDeadline(
+            slots_[level][CountTrailingZeros(later_slots)]);
+      }
+    }
+    return GetEarliestDeadline(overflow_);
+  }
+
+ private:
+  struct Entry {
+    Clock::time_point deadline;
+    // Orders values with the same deadline.
+    uint64_t sequence;
+    T value;
+  };
+
+  using Slot = std::vector<Entry>;
+
+  static constexpr int kLevels = 4;
+  static constexpr int kBitsPerLevel = 6;
+  static constexpr int kSlotsPerLevel = 1 << kBitsPerLevel;
+  static constexpr uint64_t kSlotMask = kSlotsPerLevel - 1;
+  static_assert(kSlotsPerLevel == 64, "|occupied_| has one bit per slot");
+
+  static int CountTrailingZeros(uint64_t bits) {
+    OSP_DCHECK_NE(bits, 0u);
+    return __builtin_ctzll(bits);
+  }
+
+  static int SlotIndex(uint64_t tick, int level) {
+    return static_cast<int>((tick >> (level * kBitsPerLevel)) & kSlotMask);
+  }
+
+  static Clock::time_point GetEarliestDeadline(const Slot& slot) {
+    Clock::time_point earliest = Clock::time_point::max();
+    for (const Entry& entry : slot) {
+      earliest = std::min(earliest, entry.deadline);
+    }
+    return earliest;
+  }
+
+  // Returns the first tick after |current_tick_| that starts an occupied slot,
+  // at the lowest level that has one.
+  uint64_t GetNextOccupiedTick() const {
+    for (int level = 0; level < kLevels; ++level) {
+      const int current_slot = SlotIndex(current_tick_, level);
+      if (current_slot == kSlotsPerLevel - 1) {
+        continue;
+      }
+      const uint64_t later_slots =
+          occupied_[level] & (~uint64_t{0} << (current_slot + 1));
+      if (later_slots) {
+        const int shift = level * kBitsPerLevel;
+        const int range_shift = shift + kBitsPerLevel;
+        const uint64_t range_start =
+            (current_tick_ >> range_shift) << range_shift;
+        const uint64_t slot = CountTrailingZeros(later_slots);
+        return range_start + (slot << shift);
+      }
+    }
+    // Only the overflow is left, which is placed again when the top level
+    // wraps around.
+    const int shift = kLevels * kBitsPerLevel;
+    return ((current_tick_ >> shift) + 1) << shift;
+  }
+
+  uint64_t ToTick(Clock::time_point time) const {
+    if (time <= origin_) {
+      return 0;
+    }
+    return static_cast<uint64_t>((time - origin_) / kTickDuration);
+  }
+
+  // Puts |entry| in the lowest level that reaches its deadline. Deadlines that
+  // have passed already go in the current slot.
+  void Place(Entry entry) {
+    const uint64_t tick = std::max(ToTick(entry.deadline), current_tick_);
+    for (int level = 0; level < kLevels; ++level) {
+      const int shift = (level + 1) * kBitsPerLevel;
+      if ((tick >> shift) == (current_tick_ >> shift)) {
+        const int slot = SlotIndex(tick, level);
+        slots_[level][slot].push_back(std::move(entry));
+        occupied_[level] |= uint64_t{1} << slot;
+        return;
+      }
+    }
+    overflow_.push_back(std::move(entry));
+  }
+
+  // Moves the entries of |slot| that are due at |now| to |expired_|. Unless the
+  // slot is the one for |now_tick| itself, all of them are.
+  void TakeFromSlot(Slot* slot,
+                    Clock::time_point now,
+                    uint64_t slot_tick,
+                    uint64_t now_tick) {
+    if (slot->empty()) {
+      return;
+    }
+    if (slot_tick < now_tick) {
+      std::move(slot->begin(), slot->end(), std::back_inserter(expired_));
+      slot->clear();
+    } else {
+      auto kept = slot->begin();
+      for (auto it = slot->begin(); it != slot->end(); ++it) {
+        if (it->deadline <= now) {
+          expired_.push_back(std::move(*it));
+        } else {
+          if (kept != it) {
+            *kept = std::move(*it);
+          }
+          ++kept;
+        }
+      }
+      slot->erase(kept, slot->end());
+    }
+    if (slot->empty()) {
+      occupied_[0] &= ~(uint64_t{1} << SlotIndex(slot_tick, 0));
+    }
+  }
+
+  // Called when |current_tick_| reaches the start of a first-level range, to
+  // move the entries of each higher level whose slot now begins down a level.
+  // Ranges that were skipped over were empty.
+  void Cascade() {
+    for (int level = kLevels; level >= 1; --level) {
+      const uint64_t range_mask =
+          (uint64_t{1} << (level * kBitsPerLevel)) - 1;
+      if ((current_tick_ & range_mask) != 0) {
+        continue;
+      }
+      if (level == kLevels) {
+        cascading_.swap(overflow_);
+      } else {
+        const int slot = SlotIndex(current_tick_, level);
+        cascading_.swap(slots_[level][slot]);
+        occupied_[level] &= ~(uint64_t{1} << slot);
+      }
+      for (Entry& entry : cascading_) {
+        Place(std::move(entry));
+      }
+      cascading_.clear();
+    }
+  }
+
+  const Clock::time_point origin_;
+
+  // The tick that the first slot of each level is counted from. Every entry is
+  // in a slot for this tick or a later one.
+  uint64_t current_tick_ = 0;
+
+  Slot slots_[kLevels][kSlotsPerLevel];
+  uint64_t occupied_[kLevels] = {};
+  Slot overflow_;
+
+  size_t size_ = 0;
+  uint64_t next_sequence_ = 0;
+
+  // Reused by TakeExpired() to sort the entries it takes, and by Cascade() to
+  // hold the entries being moved down. Swapping the latter with a slot, rather
+  // than moving out of it, lets slots keep their capacity.
+  std::vector<Entry> expired_;
+  Slot cascading_;
+};
+
+// static
+template <typename T>
+constexpr Clock::duration TimerWheel<T>::kTickDuration;
+
+}  // namespace openscreen
+
+#endif  // PLATFORM_IMPL_TIMER_WHEEL_H_
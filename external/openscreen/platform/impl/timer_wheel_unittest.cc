@@ -0,0 +1,129 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "platform/impl/timer_wheel.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace openscreen {
+namespace {
+
+using std::chrono::hours;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+const Clock::time_point kOrigin = Clock::time_point(seconds(1000));
+
+std::vector<int> TakeExpired(TimerWheel<int>* wheel, Clock::time_point now) {
+  std::vector<int> expired;
+  wheel->TakeExpired(now, &expired);
+  return expired;
+}
+
+}  // namespace
+
+TEST(TimerWheelTest, TakesValuesOnlyOnceTheirDeadlineIsReached) {
+  TimerWheel<int> wheel(kOrigin);
+  EXPECT_TRUE(wheel.empty());
+  EXPECT_EQ(wheel.GetNextDeadline(), Clock::time_point::max());
+
+  wheel.Insert(kOrigin + microseconds(2500), 1);
+  EXPECT_EQ(wheel.size(), 1u);
+  EXPECT_EQ(wheel.GetNextDeadline(), kOrigin + microseconds(2500));
+
+  // Within the same tick as the deadline, but before it.
+  EXPECT_TRUE(TakeExpired(&wheel, kOrigin + microseconds(2499)).empty());
+  EXPECT_EQ(TakeExpired(&wheel, kOrigin + microseconds(2500)),
+            std::vector<int>{1});
+  EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, TakesValuesInDeadlineThenInsertionOrder) {
+  TimerWheel<int> wheel(kOrigin);
+  wheel.Insert(kOrigin + milliseconds(30), 1);
+  wheel.Insert(kOrigin + milliseconds(10), 2);
+  wheel.Insert(kOrigin + milliseconds(20), 3);
+  wheel.Insert(kOrigin + milliseconds(10), 4);
+  wheel.Insert(kOrigin + microseconds(10500), 5);
+
+  EXPECT_EQ(wheel.GetNextDeadline(), kOrigin + milliseconds(10));
+  EXPECT_EQ(TakeExpired(&wheel, kOrigin + milliseconds(25)),
+            (std::vector<int>{2, 4, 5, 3}));
+  EXPECT_EQ(TakeExpired(&wheel, kOrigin + milliseconds(30)),
+            std::vector<int>{1});
+}
+
+TEST(TimerWheelTest, TakesPastDeadlinesImmediately) {
+  TimerWheel<int> wheel(kOrigin);
+  EXPECT_TRUE(TakeExpired(&wheel, kOrigin + seconds(5)).empty());
+
+  wheel.Insert(kOrigin, 1);
+  wheel.Insert(kOrigin - seconds(1), 2);
+  EXPECT_EQ(TakeExpired(&wheel, kOrigin + seconds(5)),
+            (std::vector<int>{2, 1}));
+}
+
+TEST(TimerWheelTest, HandlesDeadlinesBeyondAllLevels) {
+  TimerWheel<int> wheel(kOrigin);
+  wheel.Insert(kOrigin + hours(10), 1);
+  wheel.Insert(kOrigin + seconds(90), 2);
+
+  EXPECT_EQ(wheel.GetNextDeadline(), kOrigin + seconds(90));
+  EXPECT_EQ(TakeExpired(&wheel, kOrigin + seconds(90)), std::vector<int>{2});
+  EXPECT_EQ(wheel.GetNextDeadline(), kOrigin + hours(10));
+  EXPECT_TRUE(TakeExpired(&wheel, kOrigin + hours(10) - milliseconds(1))
+                  .empty());
+  EXPECT_EQ(TakeExpired(&wheel, kOrigin + hours(10)), std::vector<int>{1});
+}
+
+// Compares the wheel against a std::multimap, with the clock moving forward
+// in steps of all sizes and values inserted along the way.
+TEST(TimerWheelTest, MatchesOrderedMap) {
+  TimerWheel<int> wheel(kOrigin);
+  std::multimap<Clock::time_point, int> expected_values;
+
+  std::mt19937 random(42);
+  std::uniform_int_distribution<int> pick_scale(0, 4);
+  std::uniform_int_distribution<int> pick_amount(0, 999);
+  const auto random_duration = [&]() -> Clock::duration {
+    // From microseconds to minutes, to exercise every level of the wheel.
+    static constexpr Clock::duration kScales[] = {
+        microseconds(1), microseconds(100), milliseconds(10), seconds(1),
+        seconds(60)};
+    return kScales[pick_scale(random)] * pick_amount(random);
+  };
+
+  Clock::time_point now = kOrigin;
+  int next_value = 0;
+  for (int step = 0; step < 2000; ++step) {
+    for (int i = pick_amount(random) % 8; i > 0; --i) {
+      const Clock::time_point deadline = now + random_duration();
+      wheel.Insert(deadline, next_value);
+      expected_values.emplace(deadline, next_value);
+      next_value++;
+    }
+    ASSERT_EQ(wheel.GetNextDeadline(), expected_values.empty()
+                                           ? Clock::time_point::max()
+                                           : expected_values.begin()->first);
+
+    now += random_duration() / 4;
+    std::vector<int> expected;
+    const auto end = expected_values.upper_bound(now);
+    for (auto it = expected_values.begin(); it != end; ++it) {
+      expected.push_back(it->second);
+    }
+    expected_values.erase(expected_values.begin(), end);
+    ASSERT_EQ(TakeExpired(&wheel, now), expected) << "at step " << step;
+    ASSERT_EQ(wheel.size(), expected_values.size());
+  }
+}
+
+}  // namespace openscreen
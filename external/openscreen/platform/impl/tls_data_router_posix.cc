@@ -60,7 +60,8 @@ void TlsDataRouterPosix::RegisterAcceptObserver(
     accept_socket_mappings_[socket_ptr] = observer;
   }
 
-  waiter_->Subscribe(this, socket_ptr->socket_handle());
+  waiter_->Subscribe(this, socket_ptr->socket_handle(),
+                     SocketHandleWaiter::Flags::kReadable);
 }
 
 void TlsDataRouterPosix::DeregisterAcceptObserver(SocketObserver* observer) {
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -20,6 +21,7 @@
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/types/optional.h"
 #include "platform/api/task_runner.h"
@@ -31,8 +33,24 @@ namespace openscreen {
 namespace {
 
 // 64 KB is the maximum possible UDP datagram size.
-#if !defined(OS_LINUX)
 constexpr int kMaxUdpBufferSize = 64 << 10;
+
+#if defined(OS_LINUX)
+// The most datagrams read by one recvmmsg() call.
+constexpr int kMaxReceiveBatchSize = 16;
+
+// The most datagrams sent by one sendmmsg() call.
+constexpr size_t kMaxSendBatchSize = 64;
+
+// Not defined by older C libraries; see linux/udp.h.
+#if !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103
+#endif
+
+// Limits on a UDP GSO send: the number of datagrams it is split into, and its
+// total payload, which has to fit in one IPv4 datagram.
+constexpr size_t kMaxGsoSegments = 64;
+constexpr size_t kMaxGsoPayloadSize = 65507;
 #endif
 
 constexpr bool IsPowerOf2(uint32_t x) {
@@ -378,6 +396,39 @@ bool IsPacketInfo<in6_pktinfo>(cmsghdr* cmh) {
   return cmh->cmsg_level == IPPROTO_IPV6 && cmh->cmsg_type == IPV6_PKTINFO;
 }
 
+// Sets the source and destination of |packet|, which was read with |msg|.
+// |local_sa| is the address the socket is bound to, or null if it could not be
+// retrieved.
+template <class SockAddrType, class PktInfoType>
+ErrorOr<UdpPacket> CompleteReceivedPacket(UdpPacket packet,
+                                          msghdr* msg,
+                                          const SockAddrType* local_sa) {
+  const SockAddrType& sa = *static_cast<const SockAddrType*>(msg->msg_name);
+  IPEndpoint source_endpoint = {.address = GetIPAddressFromSockAddr(sa),
+                                .port = GetPortFromFromSockAddr(sa)};
+  packet.set_source(std::move(source_endpoint));
+
+  // For multicast sockets, the packet's original destination address may be
+  // the host address (since we called bind()) but it may also be a
+  // multicast address.  This may be relevant for handling multicast data;
+  // specifically, mDNSResponder requires this information to work properly.
+
+  if (((msg->msg_flags & MSG_CTRUNC) != 0) || !local_sa) {
+    return Error::Code::kNone;
+  }
+  for (cmsghdr* cmh = CMSG_FIRSTHDR(msg); cmh; cmh = CMSG_NXTHDR(msg, cmh)) {
+    if (IsPacketInfo<PktInfoType>(cmh)) {
+      PktInfoType* pktinfo = reinterpret_cast<PktInfoType*>(CMSG_DATA(cmh));
+      IPEndpoint destination_endpoint = {
+          .address = GetIPAddressFromPktInfo(*pktinfo),
+          .port = GetPortFromFromSockAddr(*local_sa)};
+      packet.set_destination(std::move(destination_endpoint));
+      break;
+    }
+  }
+  return std::move(packet);
+}
+
 template <class SockAddrType, class PktInfoType>
 ErrorOr<UdpPacket> ReceiveMessageInternal(int fd) {
   int upper_bound_bytes;
@@ -423,32 +474,84 @@ ErrorOr<UdpPacket> ReceiveMessageInternal(int fd) {
   OSP_DCHECK_LE(static_cast<size_t>(bytes_received), packet.size());
   packet.resize(bytes_received);
 
-  IPEndpoint source_endpoint = {.address = GetIPAddressFromSockAddr(sa),
-                                .port = GetPortFromFromSockAddr(sa)};
-  packet.set_source(std::move(source_endpoint));
-
-  // For multicast sockets, the packet's original destination address may be
-  // the host address (since we called bind()) but it may also be a
-  // multicast address.  This may be relevant for handling multicast data;
-  // specifically, mDNSResponder requires this information to work properly.
+  SockAddrType local_sa;
+  socklen_t local_sa_len = sizeof(local_sa);
+  const bool has_local_sa =
+      getsockname(fd, reinterpret_cast<sockaddr*>(&local_sa), &local_sa_len) !=
+      -1;
+  return CompleteReceivedPacket<SockAddrType, PktInfoType>(
+      std::move(packet), &msg, has_local_sa ? &local_sa : nullptr);
+}
 
-  socklen_t sa_len = sizeof(sa);
-  if (((msg.msg_flags & MSG_CTRUNC) != 0) ||
-      (getsockname(fd, reinterpret_cast<sockaddr*>(&sa), &sa_len) == -1)) {
-    return Error::Code::kNone;
-  }
-  for (cmsghdr* cmh = CMSG_FIRSTHDR(&msg); cmh; cmh = CMSG_NXTHDR(&msg, cmh)) {
-    if (IsPacketInfo<PktInfoType>(cmh)) {
-      PktInfoType* pktinfo = reinterpret_cast<PktInfoType*>(CMSG_DATA(cmh));
-      IPEndpoint destination_endpoint = {
-          .address = GetIPAddressFromPktInfo(*pktinfo),
-          .port = GetPortFromFromSockAddr(sa)};
-      packet.set_destination(std::move(destination_endpoint));
-      break;
+#if defined(OS_LINUX)
+// Reads up to kMaxReceiveBatchSize datagrams with one recvmmsg() call.
+template <class SockAddrType, class PktInfoType>
+std::vector<ErrorOr<UdpPacket>> ReceiveMessages(int fd) {
+  // The size of each datagram is only known once it is read, so each one is
+  // read into a packet of the maximum size, kept from one read to the next on
+  // this thread. A datagram which fills most of its packet is handed out in
+  // it; a smaller one, such as a typical RTP packet, is copied into a packet
+  // of its own size rather than keep 64 KiB alive for as long as it's queued.
+  thread_local UdpPacket packets[kMaxReceiveBatchSize];
+  for (UdpPacket& packet : packets) {
+    packet.resize(kMaxUdpBufferSize);
+  }
+
+  SockAddrType addresses[kMaxReceiveBatchSize];
+  iovec iovs[kMaxReceiveBatchSize];
+  alignas(alignof(cmsghdr)) uint8_t control[kMaxReceiveBatchSize][1024];
+  mmsghdr msgs[kMaxReceiveBatchSize] = {};
+  for (int i = 0; i < kMaxReceiveBatchSize; ++i) {
+    iovs[i] = {packets[i].data(), packets[i].size()};
+    msghdr& msg = msgs[i].msg_hdr;
+    msg.msg_name = &addresses[i];
+    msg.msg_namelen = sizeof(addresses[i]);
+    msg.msg_iov = &iovs[i];
+    msg.msg_iovlen = 1;
+    msg.msg_control = control[i];
+    msg.msg_controllen = sizeof(control[i]);
+  }
+
+  std::vector<ErrorOr<UdpPacket>> results;
+  // Only what is already waiting is read: without MSG_DONTWAIT, recvmmsg()
+  // would wait for a full batch on a blocking socket.
+  const int count =
+      recvmmsg(fd, msgs, kMaxReceiveBatchSize, MSG_DONTWAIT, nullptr);
+  if (count == -1) {
+    OSP_DVLOG << "Failed to read from socket.";
+    results.emplace_back(ChooseError(errno, Error::Code::kSocketReadFailure));
+    return results;
+  }
+
+  SockAddrType local_sa;
+  socklen_t local_sa_len = sizeof(local_sa);
+  const bool has_local_sa =
+      getsockname(fd, reinterpret_cast<sockaddr*>(&local_sa), &local_sa_len) !=
+      -1;
+  results.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    const size_t length = msgs[i].msg_len;
+    UdpPacket packet;
+    if (length > static_cast<size_t>(kMaxUdpBufferSize) / 2) {
+      packet = std::move(packets[i]);
+      packet.resize(length);
+    } else {
+      packet = UdpPacket(packets[i].begin(), packets[i].begin() + length);
     }
+    results.emplace_back(CompleteReceivedPacket<SockAddrType, PktInfoType>(
+        std::move(packet), &msgs[i].msg_hdr,
+        has_local_sa ? &local_sa : nullptr));
   }
-  return std::move(packet);
+  return results;
+}
+#else
+template <class SockAddrType, class PktInfoType>
+std::vector<ErrorOr<UdpPacket>> ReceiveMessages(int fd) {
+  std::vector<ErrorOr<UdpPacket>> results;
+  results.emplace_back(ReceiveMessageInternal<SockAddrType, PktInfoType>(fd));
+  return results;
 }
+#endif  // defined(OS_LINUX)
 
 }  // namespace
 
@@ -467,15 +570,14 @@ void UdpSocketPosix::ReceiveMessage() {
     return;
   }
 
-  ErrorOr<UdpPacket> read_result = Error::Code::kUnknownError;
+  std::vector<ErrorOr<UdpPacket>> read_results;
   switch (local_endpoint_.address.version()) {
     case UdpSocket::Version::kV4: {
-      read_result = ReceiveMessageInternal<sockaddr_in, in_pktinfo>(handle_.fd);
+      read_results = ReceiveMessages<sockaddr_in, in_pktinfo>(handle_.fd);
       break;
     }
     case UdpSocket::Version::kV6: {
-      read_result =
-          ReceiveMessageInternal<sockaddr_in6, in6_pktinfo>(handle_.fd);
+      read_results = ReceiveMessages<sockaddr_in6, in6_pktinfo>(handle_.fd);
       break;
     }
     default: {
@@ -483,9 +585,15 @@ void UdpSocketPosix::ReceiveMessage() {
     }
   }
 
+  // All the packets read are delivered by a single task.
   task_runner_->PostTask([weak_this = weak_factory_.GetWeakPtr(),
-                          read_result = std::move(read_result)]() mutable {
-    if (auto* self = weak_this.get()) {
+                          read_results = std::move(read_results)]() mutable {
+    for (ErrorOr<UdpPacket>& read_result : read_results) {
+      // The client may destroy the socket while handling a packet.
+      auto* self = weak_this.get();
+      if (!self) {
+        return;
+      }
       if (auto* client = self->client_) {
         client->OnRead(self, std::move(read_result));
       }
@@ -548,6 +656,151 @@ void UdpSocketPosix::SendMessage(const void* data,
   OSP_DCHECK_EQ(static_cast<size_t>(num_bytes_sent), length);
 }
 
+void UdpSocketPosix::SendMessages(const OutgoingMessage* messages,
+                                  size_t count,
+                                  const IPEndpoint& dest) {
+#if defined(OS_LINUX)
+  if (is_closed()) {
+    if (client_) {
+      client_->OnSendError(this, Error::Code::kSocketClosedFailure);
+    }
+    return;
+  }
+
+  struct sockaddr_storage sa {};
+  socklen_t sa_length = 0;
+  switch (local_endpoint_.address.version()) {
+    case UdpSocket::Version::kV4: {
+      auto* sa_in = reinterpret_cast<sockaddr_in*>(&sa);
+      sa_in->sin_family = AF_INET;
+      sa_in->sin_port = htons(dest.port);
+      dest.address.CopyToV4(
+          reinterpret_cast<uint8_t*>(&sa_in->sin_addr.s_addr));
+      sa_length = sizeof(*sa_in);
+      break;
+    }
+
+    case UdpSocket::Version::kV6: {
+      auto* sa_in6 = reinterpret_cast<sockaddr_in6*>(&sa);
+      sa_in6->sin6_family = AF_INET6;
+      sa_in6->sin6_port = htons(dest.port);
+      dest.address.CopyToV6(
+          reinterpret_cast<uint8_t*>(&sa_in6->sin6_addr.s6_addr));
+      sa_length = sizeof(*sa_in6);
+      break;
+    }
+  }
+
+  while (count > 0) {
+    const ErrorOr<size_t> sent = SendMessageBatch(
+        messages, count, reinterpret_cast<const sockaddr*>(&sa), sa_length);
+    if (sent.is_error()) {
+      // Whatever was not sent yet is dropped, as a failed SendMessage() would
+      // drop its message.
+      if (client_) {
+        client_->OnSendError(this, sent.error());
+      }
+      return;
+    }
+    OSP_DCHECK_LE(sent.value(), count);
+    messages += sent.value();
+    count -= sent.value();
+  }
+#else
+  UdpSocket::SendMessages(messages, count, dest);
+#endif
+}
+
+#if defined(OS_LINUX)
+ErrorOr<size_t> UdpSocketPosix::SendMessageBatch(
+    const OutgoingMessage* messages,
+    size_t count,
+    const sockaddr* dest,
+    socklen_t dest_length) {
+  struct iovec iovs[kMaxSendBatchSize];
+  struct mmsghdr msgs[kMaxSendBatchSize] = {};
+  // The number of |messages| in each of |msgs|.
+  size_t msg_sizes[kMaxSendBatchSize];
+  // Room for one UDP_SEGMENT control message per entry of |msgs|.
+  alignas(struct cmsghdr) uint8_t
+      control[kMaxSendBatchSize][CMSG_SPACE(sizeof(uint16_t))] = {};
+
+  size_t num_msgs = 0;
+  size_t num_iovs = 0;
+  size_t next = 0;
+  while (next < count && num_iovs < kMaxSendBatchSize) {
+    // With GSO, a run of messages of the same size, optionally followed by a
+    // shorter one, goes out as a single send that the kernel (or the network
+    // device) splits back into one datagram per message.
+    const size_t segment_size = messages[next].length;
+    size_t run = 1;
+    size_t run_bytes = segment_size;
+    if (use_gso_ && segment_size > 0) {
+      while (next + run < count && num_iovs + run < kMaxSendBatchSize &&
+             run < kMaxGsoSegments) {
+        const size_t length = messages[next + run].length;
+        if (length == 0 || length > segment_size ||
+            run_bytes + length > kMaxGsoPayloadSize) {
+          break;
+        }
+        run_bytes += length;
+        run++;
+        if (length < segment_size) {
+          break;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < run; i++) {
+      iovs[num_iovs + i].iov_base = const_cast<void*>(messages[next + i].data);
+      iovs[num_iovs + i].iov_len = messages[next + i].length;
+    }
+
+    struct msghdr& msg = msgs[num_msgs].msg_hdr;
+    msg.msg_name = const_cast<sockaddr*>(dest);
+    msg.msg_namelen = dest_length;
+    msg.msg_iov = &iovs[num_iovs];
+    msg.msg_iovlen = run;
+    if (run > 1) {
+      msg.msg_control = control[num_msgs];
+      msg.msg_controllen = sizeof(control[num_msgs]);
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      const uint16_t gso_size = static_cast<uint16_t>(segment_size);
+      memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+
+    msg_sizes[num_msgs] = run;
+    num_msgs++;
+    num_iovs += run;
+    next += run;
+  }
+
+  const int num_sent = sendmmsg(handle_.fd, msgs, num_msgs, 0);
+  if (num_sent == -1) {
+    // EIO comes from devices that can not compute the checksums of segmented
+    // sends, the others from kernels without UDP GSO. In any case, send the
+    // same messages again, one datagram at a time.
+    if (msg_sizes[0] > 1 &&
+        (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+      OSP_LOG_INFO << "UDP GSO is not supported, disabling it: "
+                   << strerror(errno);
+      use_gso_ = false;
+      return size_t{0};
+    }
+    return ChooseError(errno, Error::Code::kSocketSendFailure);
+  }
+
+  size_t messages_sent = 0;
+  for (int i = 0; i < num_sent; i++) {
+    messages_sent += msg_sizes[i];
+  }
+  return messages_sent;
+}
+#endif  // defined(OS_LINUX)
+
 void UdpSocketPosix::SetDscp(UdpSocket::DscpMode state) {
   if (is_closed()) {
     OnError(Error::Code::kSocketClosedFailure);
@@ -5,6 +5,8 @@
 #ifndef PLATFORM_IMPL_UDP_SOCKET_POSIX_H_
 #define PLATFORM_IMPL_UDP_SOCKET_POSIX_H_
 
+#include <sys/socket.h>
+
 #include "absl/types/optional.h"
 #include "platform/api/udp_socket.h"
 #include "platform/base/macros.h"
@@ -43,6 +45,9 @@ class UdpSocketPosix : public UdpSocket {
   void SendMessage(const void* data,
                    size_t length,
                    const IPEndpoint& dest) override;
+  void SendMessages(const OutgoingMessage* messages,
+                    size_t count,
+                    const IPEndpoint& dest) override;
   void SetDscp(DscpMode state) override;
 
   const SocketHandle& GetHandle() const;
@@ -63,6 +68,19 @@ class UdpSocketPosix : public UdpSocket {
   bool is_closed() const { return handle_.fd < 0; }
   void Close();
 
+#if defined(OS_LINUX)
+  // Sends as many of |messages| to |dest| as one sendmmsg() call can take, and
+  // returns how many were sent.
+  ErrorOr<size_t> SendMessageBatch(const OutgoingMessage* messages,
+                                   size_t count,
+                                   const sockaddr* dest,
+                                   socklen_t dest_length);
+
+  // Whether SendMessages() may use UDP generic segmentation offload. Cleared
+  // when the kernel or the network device turns out not to support it.
+  bool use_gso_ = true;
+#endif
+
   // Task runner to use for queuing |client_| callbacks.
   TaskRunner* const task_runner_;
 
@@ -0,0 +1,182 @@
+// Copyright 2023 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "platform/impl/udp_socket_posix.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "platform/test/fake_clock.h"
+#include "platform/test/fake_task_runner.h"
+#include "platform/test/fake_udp_socket.h"
+
+namespace openscreen {
+namespace {
+
+using ::testing::_;
+using ::testing::Invoke;
+
+// Exposes ReceiveMessage(), which is normally only called by the
+// UdpSocketReaderPosix.
+class TestUdpSocketPosix : public UdpSocketPosix {
+ public:
+  TestUdpSocketPosix(TaskRunner* task_runner,
+                     Client* client,
+                     int fd,
+                     const IPEndpoint& local_endpoint)
+      : UdpSocketPosix(task_runner,
+                       client,
+                       SocketHandle(fd),
+                       local_endpoint,
+                       nullptr) {}
+
+  using UdpSocketPosix::ReceiveMessage;
+};
+
+// Opens a blocking UDP socket bound to an ephemeral loopback port.
+int OpenLoopbackSocket(IPEndpoint* endpoint) {
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  EXPECT_GE(fd, 0);
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  EXPECT_EQ(
+      bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+  socklen_t length = sizeof(address);
+  EXPECT_EQ(getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length),
+            0);
+
+  *endpoint = IPEndpoint{IPAddress::kV4LoopbackAddress(),
+                         ntohs(address.sin_port)};
+  return fd;
+}
+
+std::vector<uint8_t> MakeMessage(size_t length, uint8_t seed) {
+  std::vector<uint8_t> message(length);
+  for (size_t i = 0; i < length; ++i) {
+    message[i] = static_cast<uint8_t>(seed + i);
+  }
+  return message;
+}
+
+class UdpSocketPosixTest : public ::testing::Test {
+ protected:
+  UdpSocketPosixTest() : clock_(Clock::now()), task_runner_(&clock_) {}
+
+  void SetUp() override {
+    IPEndpoint socket_endpoint;
+    const int fd = OpenLoopbackSocket(&socket_endpoint);
+    socket_ = std::make_unique<TestUdpSocketPosix>(&task_runner_, &client_, fd,
+                                                   socket_endpoint);
+    peer_fd_ = OpenLoopbackSocket(&peer_endpoint_);
+  }
+
+  void TearDown() override { close(peer_fd_); }
+
+  FakeClock clock_;
+  FakeTaskRunner task_runner_;
+  FakeUdpSocket::MockClient client_;
+  std::unique_ptr<TestUdpSocketPosix> socket_;
+  int peer_fd_ = -1;
+  IPEndpoint peer_endpoint_;
+};
+
+}  // namespace
+
+TEST_F(UdpSocketPosixTest, SendMessagesDeliversEachMessageInOrder) {
+  // Runs of equally-sized messages, each ending with a shorter one, may be
+  // segmented by the kernel; each must still arrive as its own datagram.
+  const size_t kLengths[] = {1200, 1200, 1200, 700, 50, 1200, 1200, 1};
+  std::vector<std::vector<uint8_t>> messages;
+  std::vector<UdpSocket::OutgoingMessage> outgoing;
+  for (size_t length : kLengths) {
+    messages.push_back(MakeMessage(length, messages.size()));
+  }
+  for (const std::vector<uint8_t>& message : messages) {
+    outgoing.push_back({message.data(), message.size()});
+  }
+
+  EXPECT_CALL(client_, OnSendError(_, _)).Times(0);
+  socket_->SendMessages(outgoing.data(), outgoing.size(), peer_endpoint_);
+
+  for (const std::vector<uint8_t>& message : messages) {
+    std::vector<uint8_t> received(2048);
+    const ssize_t length =
+        recv(peer_fd_, received.data(), received.size(), MSG_DONTWAIT);
+    ASSERT_EQ(length, static_cast<ssize_t>(message.size()));
+    received.resize(length);
+    EXPECT_EQ(received, message);
+  }
+}
+
+TEST_F(UdpSocketPosixTest, ReceiveMessageDeliversAllWaitingPackets) {
+  const IPEndpoint local_endpoint = socket_->GetLocalEndpoint();
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(local_endpoint.port);
+
+  constexpr int kNumPackets = 3;
+  std::vector<std::vector<uint8_t>> received;
+  std::vector<size_t> capacities;
+  EXPECT_CALL(client_, OnReadInternal(socket_.get(), _))
+      .Times(2 * kNumPackets)
+      .WillRepeatedly(Invoke(
+          [&](UdpSocket* socket, const ErrorOr<UdpPacket>& packet_or_error) {
+            ASSERT_TRUE(packet_or_error.is_value());
+            EXPECT_EQ(packet_or_error.value().source(), peer_endpoint_);
+            received.emplace_back(packet_or_error.value().begin(),
+                                  packet_or_error.value().end());
+            capacities.push_back(packet_or_error.value().capacity());
+          }));
+
+  // The second round checks that the packets are ready again for another read.
+  for (int round = 0; round < 2; ++round) {
+    std::vector<std::vector<uint8_t>> sent;
+    for (int i = 0; i < kNumPackets; ++i) {
+      // The last one is near the largest UDP payload.
+      const size_t length =
+          i == kNumPackets - 1 ? 50000 + round : 100 * (round + 1) + i;
+      sent.push_back(MakeMessage(length, round + i));
+      ASSERT_EQ(sendto(peer_fd_, sent.back().data(), sent.back().size(), 0,
+                       reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+                static_cast<ssize_t>(sent.back().size()));
+    }
+
+    // On Linux, a single call reads all of them.
+#if defined(OS_LINUX)
+    constexpr int kNumReceiveCalls = 1;
+#else
+    constexpr int kNumReceiveCalls = kNumPackets;
+#endif
+    received.clear();
+    capacities.clear();
+    for (int i = 0; i < kNumReceiveCalls; ++i) {
+      socket_->ReceiveMessage();
+    }
+    task_runner_.RunTasksUntilIdle();
+
+    EXPECT_EQ(received, sent);
+    // Packets don't keep much more memory than their datagram needs, since
+    // they may be queued for a while.
+    ASSERT_EQ(capacities.size(), sent.size());
+    for (size_t i = 0; i < sent.size(); ++i) {
+      if (sent[i].size() < 1000) {
+        EXPECT_EQ(capacities[i], sent[i].size());
+      } else {
+        EXPECT_LE(capacities[i], 2 * sent[i].size());
+      }
+    }
+  }
+}
+
+}  // namespace openscreen
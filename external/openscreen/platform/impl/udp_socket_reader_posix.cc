@@ -41,7 +41,8 @@ void UdpSocketReaderPosix::OnCreate(UdpSocket* socket) {
     std::lock_guard<std::mutex> lock(mutex_);
     sockets_.push_back(read_socket);
   }
-  waiter_->Subscribe(this, std::cref(read_socket->GetHandle()));
+  waiter_->Subscribe(this, std::cref(read_socket->GetHandle()),
+                     SocketHandleWaiter::Flags::kReadable);
 }
 
 void UdpSocketReaderPosix::OnDestroy(UdpSocket* socket) {
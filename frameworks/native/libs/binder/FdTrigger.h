@@ -58,6 +58,14 @@ public:
     [[nodiscard]] status_t triggerablePoll(const android::RpcTransportFd& transportFd,
                                            int16_t event);
 
+#ifndef BINDER_RPC_SINGLE_THREADED
+    /**
+     * The read end of the pipe, which hangs up once this is triggered, for
+     * callers which wait on it with epoll themselves.
+     */
+    [[nodiscard]] int pollFd() const { return mRead.get(); }
+#endif
+
 private:
 #ifdef BINDER_RPC_SINGLE_THREADED
     bool mTriggered = false;
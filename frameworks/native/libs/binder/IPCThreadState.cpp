@@ -39,6 +39,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include "ParcelBufferPool.h"
 #include "binder_module.h"
 
 #if LOG_NDEBUG
@@ -1414,6 +1415,18 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
                 std::string message = logStream.str();
                 ALOGI("%s", message.c_str());
             }
+            const void* replyKey =
+                    tr.target.ptr ? reinterpret_cast<const void*>(tr.cookie)
+                                  : static_cast<const void*>(the_context_object.get());
+            if ((tr.flags & TF_ONE_WAY) == 0) {
+                // Reserve what the last reply to this call needed, rather than
+                // growing the buffer a few times while it is written.
+                if (size_t hint = ParcelBufferPool::replyCapacityHint(replyKey, tr.code);
+                    hint > 0) {
+                    (void)reply.setDataCapacity(hint);
+                }
+            }
+
             if (tr.target.ptr) {
                 // We only have a weak reference on the target object, so we must first try to
                 // safely acquire a strong reference before doing anything else with it.
@@ -1435,6 +1448,7 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
 
             if ((tr.flags & TF_ONE_WAY) == 0) {
                 LOG_ONEWAY("Sending reply to %d!", mCallingPid);
+                ParcelBufferPool::recordReplySize(replyKey, tr.code, reply.dataSize());
                 if (error < NO_ERROR) reply.setError(error);
 
                 // b/238777741: clear buffer before we send the reply.
@@ -49,6 +49,7 @@
 #include <utils/misc.h>
 
 #include "OS.h"
+#include "ParcelBufferPool.h"
 #include "RpcState.h"
 #include "Static.h"
 #include "Utils.h"
@@ -537,13 +538,9 @@ status_t Parcel::appendFrom(const Parcel* parcel, size_t offset, size_t len) {
                     return NO_MEMORY; // overflow
                 size_t newSize = ((kernelFields->mObjectsSize + numObjects) * 3) / 2;
                 if (newSize > SIZE_MAX / sizeof(binder_size_t)) return NO_MEMORY; // overflow
-                binder_size_t* objects = (binder_size_t*)realloc(kernelFields->mObjects,
-                                                                 newSize * sizeof(binder_size_t));
-                if (objects == (binder_size_t*)nullptr) {
-                    return NO_MEMORY;
+                if (status_t status = resizeObjects(newSize); status != OK) {
+                    return status;
                 }
-                kernelFields->mObjects = objects;
-                kernelFields->mObjectsCapacity = newSize;
             }
 
             // append and acquire objects
@@ -1697,11 +1694,7 @@ restart_write:
         if ((kernelFields->mObjectsSize + 2) > SIZE_MAX / 3) return NO_MEMORY; // overflow
         size_t newSize = ((kernelFields->mObjectsSize + 2) * 3) / 2;
         if (newSize > SIZE_MAX / sizeof(binder_size_t)) return NO_MEMORY; // overflow
-        binder_size_t* objects =
-                (binder_size_t*)realloc(kernelFields->mObjects, newSize * sizeof(binder_size_t));
-        if (objects == nullptr) return NO_MEMORY;
-        kernelFields->mObjects = objects;
-        kernelFields->mObjectsCapacity = newSize;
+        if (status_t status = resizeObjects(newSize); status != OK) return status;
     }
 
     goto restart_write;
@@ -2791,10 +2784,13 @@ void Parcel::freeDataNoInit()
             if (mDeallocZero) {
                 zeroMemory(mData, mDataSize);
             }
-            free(mData);
+            ParcelBufferPool::release(mData, mDataCapacity);
         }
         auto* kernelFields = maybeKernelFields();
-        if (kernelFields && kernelFields->mObjects) free(kernelFields->mObjects);
+        if (kernelFields && kernelFields->mObjects) {
+            ParcelBufferPool::release(kernelFields->mObjects,
+                                      kernelFields->mObjectsCapacity * sizeof(binder_size_t));
+        }
     }
 }
 
@@ -2814,19 +2810,17 @@ status_t Parcel::growData(size_t len)
             : continueWrite(std::max(newSize, (size_t) 128));
 }
 
-static uint8_t* reallocZeroFree(uint8_t* data, size_t oldCapacity, size_t newCapacity, bool zero) {
-    if (!zero) {
-        return (uint8_t*)realloc(data, newCapacity);
-    }
-    uint8_t* newData = (uint8_t*)malloc(newCapacity);
-    if (!newData) {
-        return nullptr;
-    }
-
-    memcpy(newData, data, std::min(oldCapacity, newCapacity));
-    zeroMemory(data, oldCapacity);
-    free(data);
-    return newData;
+status_t Parcel::resizeObjects(size_t newCapacity) {
+    auto* kernelFields = maybeKernelFields();
+    size_t capacity;
+    binder_size_t* objects = static_cast<binder_size_t*>(
+            ParcelBufferPool::reallocate(kernelFields->mObjects,
+                                         kernelFields->mObjectsCapacity * sizeof(binder_size_t),
+                                         newCapacity * sizeof(binder_size_t), &capacity, false));
+    if (objects == nullptr) return NO_MEMORY;
+    kernelFields->mObjects = objects;
+    kernelFields->mObjectsCapacity = capacity / sizeof(binder_size_t);
+    return OK;
 }
 
 status_t Parcel::restartWrite(size_t desired)
@@ -2842,7 +2836,9 @@ status_t Parcel::restartWrite(size_t desired)
         return continueWrite(desired);
     }
 
-    uint8_t* data = reallocZeroFree(mData, mDataCapacity, desired, mDeallocZero);
+    size_t capacity = 0;
+    uint8_t* data = static_cast<uint8_t*>(
+            ParcelBufferPool::reallocate(mData, mDataCapacity, desired, &capacity, mDeallocZero));
     if (!data && desired > mDataCapacity) {
         mError = NO_MEMORY;
         return NO_MEMORY;
@@ -2851,18 +2847,20 @@ status_t Parcel::restartWrite(size_t desired)
     releaseObjects();
 
     if (data || desired == 0) {
-        LOG_ALLOC("Parcel %p: restart from %zu to %zu capacity", this, mDataCapacity, desired);
-        if (mDataCapacity > desired) {
-            gParcelGlobalAllocSize -= (mDataCapacity - desired);
+        LOG_ALLOC("Parcel %p: restart from %zu to %zu capacity", this, mDataCapacity, capacity);
+        if (mDataCapacity > capacity) {
+            gParcelGlobalAllocSize -= (mDataCapacity - capacity);
         } else {
-            gParcelGlobalAllocSize += (desired - mDataCapacity);
+            gParcelGlobalAllocSize += (capacity - mDataCapacity);
         }
 
-        if (!mData) {
+        if (!mData && data) {
             gParcelGlobalAllocCount++;
+        } else if (mData && !data) {
+            gParcelGlobalAllocCount--;
         }
         mData = data;
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     mDataSize = mDataPos = 0;
@@ -2870,7 +2868,8 @@ status_t Parcel::restartWrite(size_t desired)
     ALOGV("restartWrite Setting data pos of %p to %zu", this, mDataPos);
 
     if (auto* kernelFields = maybeKernelFields()) {
-        free(kernelFields->mObjects);
+        ParcelBufferPool::release(kernelFields->mObjects,
+                                  kernelFields->mObjectsCapacity * sizeof(binder_size_t));
         kernelFields->mObjects = nullptr;
         kernelFields->mObjectsSize = kernelFields->mObjectsCapacity = 0;
         kernelFields->mNextObjectHint = 0;
@@ -2928,21 +2927,26 @@ status_t Parcel::continueWrite(size_t desired)
 
         // If there is a different owner, we need to take
         // posession.
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity;
+        uint8_t* data = static_cast<uint8_t*>(ParcelBufferPool::allocate(desired, &capacity));
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
         }
         binder_size_t* objects = nullptr;
+        size_t objectsCapacity = 0;
 
         if (kernelFields && objectsSize) {
-            objects = (binder_size_t*)calloc(objectsSize, sizeof(binder_size_t));
+            objects = static_cast<binder_size_t*>(
+                    ParcelBufferPool::allocate(objectsSize * sizeof(binder_size_t),
+                                               &objectsCapacity));
             if (!objects) {
-                free(data);
+                ParcelBufferPool::release(data, capacity);
 
                 mError = NO_MEMORY;
                 return NO_MEMORY;
             }
+            memset(objects, 0, objectsCapacity);
 
             // Little hack to only acquire references on objects
             // we will be keeping.
@@ -2953,7 +2957,7 @@ status_t Parcel::continueWrite(size_t desired)
         }
         if (rpcFields) {
             if (status_t status = truncateRpcObjects(objectsSize); status != OK) {
-                free(data);
+                ParcelBufferPool::release(data, capacity);
                 return status;
             }
         }
@@ -2974,17 +2978,18 @@ status_t Parcel::continueWrite(size_t desired)
                kernelFields ? kernelFields->mObjectsSize : 0);
         mOwner = nullptr;
 
-        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, desired);
-        gParcelGlobalAllocSize += desired;
+        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, capacity);
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocCount++;
 
         mData = data;
         mDataSize = (mDataSize < desired) ? mDataSize : desired;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
         if (kernelFields) {
             kernelFields->mObjects = objects;
-            kernelFields->mObjectsSize = kernelFields->mObjectsCapacity = objectsSize;
+            kernelFields->mObjectsSize = objectsSize;
+            kernelFields->mObjectsCapacity = objectsCapacity / sizeof(binder_size_t);
             kernelFields->mNextObjectHint = 0;
             kernelFields->mObjectsSorted = false;
         }
@@ -3005,17 +3010,13 @@ status_t Parcel::continueWrite(size_t desired)
             }
 
             if (objectsSize == 0) {
-                free(kernelFields->mObjects);
+                ParcelBufferPool::release(kernelFields->mObjects,
+                                          kernelFields->mObjectsCapacity * sizeof(binder_size_t));
                 kernelFields->mObjects = nullptr;
                 kernelFields->mObjectsCapacity = 0;
             } else {
-                binder_size_t* objects =
-                        (binder_size_t*)realloc(kernelFields->mObjects,
-                                                objectsSize * sizeof(binder_size_t));
-                if (objects) {
-                    kernelFields->mObjects = objects;
-                    kernelFields->mObjectsCapacity = objectsSize;
-                }
+                // On failure, keep the larger array.
+                (void)resizeObjects(objectsSize);
             }
             kernelFields->mObjectsSize = objectsSize;
             kernelFields->mNextObjectHint = 0;
@@ -3032,14 +3033,17 @@ status_t Parcel::continueWrite(size_t desired)
 
         // We own the data, so we can just do a realloc().
         if (desired > mDataCapacity) {
-            uint8_t* data = reallocZeroFree(mData, mDataCapacity, desired, mDeallocZero);
+            size_t capacity;
+            uint8_t* data = static_cast<uint8_t*>(
+                    ParcelBufferPool::reallocate(mData, mDataCapacity, desired, &capacity,
+                                                 mDeallocZero));
             if (data) {
                 LOG_ALLOC("Parcel %p: continue from %zu to %zu capacity", this, mDataCapacity,
-                        desired);
-                gParcelGlobalAllocSize += desired;
+                        capacity);
+                gParcelGlobalAllocSize += capacity;
                 gParcelGlobalAllocSize -= mDataCapacity;
                 mData = data;
-                mDataCapacity = desired;
+                mDataCapacity = capacity;
             } else {
                 mError = NO_MEMORY;
                 return NO_MEMORY;
@@ -3057,7 +3061,8 @@ status_t Parcel::continueWrite(size_t desired)
 
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity;
+        uint8_t* data = static_cast<uint8_t*>(ParcelBufferPool::allocate(desired, &capacity));
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -3071,15 +3076,15 @@ status_t Parcel::continueWrite(size_t desired)
                   kernelFields ? kernelFields->mObjectsCapacity : 0, desired);
         }
 
-        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, desired);
-        gParcelGlobalAllocSize += desired;
+        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, capacity);
+        gParcelGlobalAllocSize += capacity;
         gParcelGlobalAllocCount++;
 
         mData = data;
         mDataSize = mDataPos = 0;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
         ALOGV("continueWrite Setting data pos of %p to %zu", this, mDataPos);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     return NO_ERROR;
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ParcelBufferPool"
+
+#include "ParcelBufferPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BINDER_RPC_SINGLE_THREADED
+#include <pthread.h>
+#endif
+
+#include <algorithm>
+
+#include <log/log.h>
+
+#include "Utils.h"
+
+namespace android {
+
+namespace {
+
+// 128, 256, ..., kMaxCachedSize
+constexpr size_t kNumSizeClasses = 7;
+static_assert((ParcelBufferPool::kMinCachedSize << (kNumSizeClasses - 1)) ==
+              ParcelBufferPool::kMaxCachedSize);
+
+// At most 4 * (128 + 256 + ... + 8192) bytes, just under 64KiB, per thread.
+constexpr size_t kBuffersPerClass = 4;
+
+constexpr size_t kNumReplySizes = 64;
+
+struct ReplySize {
+    const void* binder;
+    uint32_t code;
+    uint32_t size;
+};
+
+// Trivial, so that thread_local instances don't need any allocation or
+// registration to be set up.
+struct ThreadCache {
+    void* buffers[kNumSizeClasses][kBuffersPerClass];
+    size_t counts[kNumSizeClasses];
+    bool registered;
+
+    ReplySize replySizes[kNumReplySizes];
+};
+
+#ifdef BINDER_RPC_SINGLE_THREADED
+// Never written to, since kCacheEnabled is false in these builds.
+ThreadCache gCache;
+
+ThreadCache& threadCache() {
+    return gCache;
+}
+
+bool registerThreadCache(ThreadCache&) {
+    return true;
+}
+#else
+thread_local ThreadCache tCache;
+pthread_key_t gCacheKey;
+pthread_once_t gCacheKeyOnce = PTHREAD_ONCE_INIT;
+bool gCacheKeyCreated = false;
+
+ThreadCache& threadCache() {
+    return tCache;
+}
+
+void freeThreadCache(void* arg) {
+    ThreadCache* cache = static_cast<ThreadCache*>(arg);
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+        while (cache->counts[i] > 0) {
+            free(cache->buffers[i][--cache->counts[i]]);
+        }
+    }
+    cache->registered = false;
+}
+
+// Makes sure the buffers in |cache| are freed when this thread exits.
+bool registerThreadCache(ThreadCache& cache) {
+    if (cache.registered) return true;
+    pthread_once(&gCacheKeyOnce,
+                 [] { gCacheKeyCreated = pthread_key_create(&gCacheKey, freeThreadCache) == 0; });
+    if (!gCacheKeyCreated || pthread_setspecific(gCacheKey, &cache) != 0) {
+        return false;
+    }
+    cache.registered = true;
+    return true;
+}
+#endif // BINDER_RPC_SINGLE_THREADED
+
+size_t sizeClass(size_t size) {
+    size_t index = 0;
+    while ((ParcelBufferPool::kMinCachedSize << index) < size) index++;
+    return index;
+}
+
+size_t replySizeIndex(const void* binder, uint32_t code) {
+    return ((reinterpret_cast<uintptr_t>(binder) >> 4) ^ code) % kNumReplySizes;
+}
+
+} // namespace
+
+void* ParcelBufferPool::allocate(size_t size, size_t* capacity) {
+    if (size > kMaxCachedSize) {
+        void* data = malloc(size);
+        if (data) *capacity = size;
+        return data;
+    }
+
+    size_t index = sizeClass(size);
+    ThreadCache& cache = threadCache();
+    void* data;
+    if (cache.counts[index] > 0) {
+        data = cache.buffers[index][--cache.counts[index]];
+    } else {
+        data = malloc(kMinCachedSize << index);
+    }
+    if (data) *capacity = kMinCachedSize << index;
+    return data;
+}
+
+void* ParcelBufferPool::reallocate(void* data, size_t oldCapacity, size_t size, size_t* capacity,
+                                   bool zero) {
+    if (size == 0) {
+        if (data && zero) zeroMemory(static_cast<uint8_t*>(data), oldCapacity);
+        release(data, oldCapacity);
+        *capacity = 0;
+        return nullptr;
+    }
+
+    if (data) {
+        if (size <= kMaxCachedSize && oldCapacity == (kMinCachedSize << sizeClass(size))) {
+            // already the right size
+            *capacity = oldCapacity;
+            return data;
+        }
+        if (!zero && oldCapacity > kMaxCachedSize && size > kMaxCachedSize) {
+            void* newData = realloc(data, size);
+            if (newData) *capacity = size;
+            return newData;
+        }
+    }
+
+    size_t newCapacity;
+    void* newData = allocate(size, &newCapacity);
+    if (!newData) return nullptr;
+    if (data) {
+        memcpy(newData, data, std::min(oldCapacity, newCapacity));
+        if (zero) zeroMemory(static_cast<uint8_t*>(data), oldCapacity);
+        release(data, oldCapacity);
+    }
+    *capacity = newCapacity;
+    return newData;
+}
+
+void ParcelBufferPool::release(void* data, size_t capacity) {
+    if (data == nullptr) return;
+
+    if (kCacheEnabled && capacity <= kMaxCachedSize) {
+        size_t index = sizeClass(capacity);
+        LOG_ALWAYS_FATAL_IF((kMinCachedSize << index) != capacity,
+                            "Buffer of capacity %zu was not allocated by ParcelBufferPool",
+                            capacity);
+        ThreadCache& cache = threadCache();
+        if (cache.counts[index] < kBuffersPerClass && registerThreadCache(cache)) {
+            cache.buffers[index][cache.counts[index]++] = data;
+            return;
+        }
+    }
+    free(data);
+}
+
+size_t ParcelBufferPool::replyCapacityHint(const void* binder, uint32_t code) {
+    if (!kCacheEnabled) return 0;
+    const ReplySize& entry = threadCache().replySizes[replySizeIndex(binder, code)];
+    if (entry.binder != binder || entry.code != code) return 0;
+    return entry.size;
+}
+
+void ParcelBufferPool::recordReplySize(const void* binder, uint32_t code, size_t size) {
+    if (!kCacheEnabled) return;
+    // Don't let one large reply make every later one allocate that much.
+    threadCache().replySizes[replySizeIndex(binder, code)] = {
+            .binder = binder,
+            .code = code,
+            .size = static_cast<uint32_t>(std::min(size, kMaxCachedSize)),
+    };
+}
+
+} // namespace android
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Allocator for the data and object arrays Parcel owns.
+//
+// Small buffers are rounded up to a power of two and, when released, are kept
+// in a cache owned by the releasing thread instead of being freed, so that a
+// thread serving or making transactions reuses the same few buffers rather than
+// going to malloc several times per transaction. Larger buffers go straight to
+// malloc. The cache is bounded and freed when the thread exits.
+//
+// The capacity reported by allocate() must be passed back as is: it is how the
+// pool tells its buffers apart from the ones it did not cache.
+class ParcelBufferPool {
+public:
+    // Buffers of up to this size are rounded up and cached.
+    static constexpr size_t kMinCachedSize = 128;
+    static constexpr size_t kMaxCachedSize = 8 * 1024;
+
+    // Whether released buffers and reply sizes are kept at all. Not under
+    // sanitizers, since buffers sitting in a cache would hide use-after-free
+    // bugs from them, nor in single-threaded builds, where the cache would be
+    // one unsynchronized global rather than one per thread.
+#if defined(BINDER_RPC_SINGLE_THREADED) || defined(__SANITIZE_ADDRESS__) || \
+        defined(__SANITIZE_HWADDRESS__)
+    static constexpr bool kCacheEnabled = false;
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(hwaddress_sanitizer)
+    static constexpr bool kCacheEnabled = false;
+#else
+    static constexpr bool kCacheEnabled = true;
+#endif
+#else
+    static constexpr bool kCacheEnabled = true;
+#endif
+
+    // Returns a buffer of at least |size| bytes (non-zero) and sets |*capacity|
+    // to its usable size, or returns nullptr if out of memory.
+    static void* allocate(size_t size, size_t* capacity);
+
+    // Like realloc: returns a buffer of at least |size| bytes holding the
+    // first min(|oldCapacity|, |size|) bytes of |data|, and releases |data|.
+    // If |zero|, the old contents are cleared before the buffer is reused or
+    // freed. If |size| is 0, releases |data| and returns nullptr. On failure,
+    // returns nullptr and leaves |data| alone.
+    static void* reallocate(void* data, size_t oldCapacity, size_t size, size_t* capacity,
+                            bool zero);
+
+    // Releases a buffer returned by allocate() or reallocate(). |data| may be
+    // nullptr.
+    static void release(void* data, size_t capacity);
+
+    // Capacity to reserve for the reply to |code| on |binder|, based on the
+    // size of the last such reply this thread wrote. 0 if unknown.
+    static size_t replyCapacityHint(const void* binder, uint32_t code);
+    static void recordReplySize(const void* binder, uint32_t code, size_t size);
+};
+
+} // namespace android
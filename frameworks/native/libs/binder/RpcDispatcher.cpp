@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RpcDispatcher"
+
+#include "RpcDispatcher.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include <log/log.h>
+
+namespace android {
+
+// How long a worker waits for more work before exiting.
+constexpr std::chrono::seconds kWorkerIdleTimeout{10};
+
+constexpr int kMaxEvents = 32;
+
+std::shared_ptr<RpcDispatcher> RpcDispatcher::make(size_t maxWorkers) {
+    if (maxWorkers == 0) {
+        ALOGE("RpcDispatcher needs at least one worker");
+        return nullptr;
+    }
+    std::shared_ptr<RpcDispatcher> dispatcher(new RpcDispatcher());
+    dispatcher->mMaxWorkers = maxWorkers;
+
+    dispatcher->mEpoll.reset(epoll_create1(EPOLL_CLOEXEC));
+    if (!dispatcher->mEpoll.ok()) {
+        ALOGE("Could not create epoll: %s", strerror(errno));
+        return nullptr;
+    }
+    dispatcher->mWake.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    if (!dispatcher->mWake.ok()) {
+        ALOGE("Could not create eventfd: %s", strerror(errno));
+        return nullptr;
+    }
+    epoll_event event{.events = EPOLLIN, .data = {.fd = dispatcher->mWake.get()}};
+    if (epoll_ctl(dispatcher->mEpoll.get(), EPOLL_CTL_ADD, dispatcher->mWake.get(), &event) != 0) {
+        ALOGE("Could not add eventfd to epoll: %s", strerror(errno));
+        return nullptr;
+    }
+
+    // the threads keep the dispatcher alive until stop()
+    std::thread([self = dispatcher] { self->pollLoop(); }).detach();
+    return dispatcher;
+}
+
+bool RpcDispatcher::add(int fd, int triggerFd, std::function<bool()> onReadable,
+                        std::function<void()> onRemoved) {
+    std::lock_guard<std::mutex> _l(mMutex);
+    if (mStopping) return false;
+    if (mSources.count(fd) != 0) {
+        ALOGE("fd %d is already dispatched", fd);
+        return false;
+    }
+
+    // Added disarmed, and run once below: data may have been read into a
+    // transport's buffer before it got here, and epoll would not report it.
+    epoll_event event{.events = EPOLLONESHOT, .data = {.fd = fd}};
+    if (epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, fd, &event) != 0) {
+        ALOGE("Could not add fd %d to epoll: %s", fd, strerror(errno));
+        return false;
+    }
+
+    auto source = std::make_unique<Source>();
+    source->fd = fd;
+    source->triggerFd = triggerFd;
+    source->onReadable = std::move(onReadable);
+    source->onRemoved = std::move(onRemoved);
+    Source* raw = source.get();
+    mSources[fd] = std::move(source);
+    mTriggers[triggerFd].sources.insert(raw);
+
+    scheduleLocked(raw);
+    return true;
+}
+
+void RpcDispatcher::stop() {
+    std::lock_guard<std::mutex> _l(mMutex);
+    mStopping = true;
+    uint64_t one = 1;
+    (void)TEMP_FAILURE_RETRY(write(mWake.get(), &one, sizeof(one)));
+    mWorkCv.notify_all();
+}
+
+void RpcDispatcher::pollLoop() {
+    epoll_event events[kMaxEvents];
+    while (true) {
+        int count = TEMP_FAILURE_RETRY(epoll_wait(mEpoll.get(), events, kMaxEvents, -1));
+        LOG_ALWAYS_FATAL_IF(count < 0, "epoll_wait failed: %s", strerror(errno));
+
+        std::lock_guard<std::mutex> _l(mMutex);
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == mWake.get()) {
+                uint64_t value;
+                (void)TEMP_FAILURE_RETRY(read(mWake.get(), &value, sizeof(value)));
+                continue;
+            }
+
+            if (auto it = mTriggers.find(fd); it != mTriggers.end()) {
+                Trigger& trigger = it->second;
+                if (epoll_ctl(mEpoll.get(), EPOLL_CTL_DEL, fd, nullptr) != 0) {
+                    ALOGE("Could not remove trigger fd %d from epoll: %s", fd, strerror(errno));
+                }
+                trigger.registered = false;
+                for (Source* source : trigger.sources) {
+                    if (!source->armed) continue;
+                    epoll_event disarm{.events = EPOLLONESHOT, .data = {.fd = source->fd}};
+                    (void)epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, source->fd, &disarm);
+                    scheduleLocked(source);
+                }
+                continue;
+            }
+
+            // Events from before an fd was removed may still be in this batch.
+            if (auto it = mSources.find(fd); it != mSources.end() && it->second->armed) {
+                scheduleLocked(it->second.get());
+            }
+        }
+
+        if (doneLocked()) break;
+    }
+}
+
+void RpcDispatcher::workLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        if (mReady.empty()) {
+            if (doneLocked()) break;
+
+            mIdleWorkers++;
+            bool woken = mWorkCv.wait_for(lock, kWorkerIdleTimeout,
+                                          [&] { return !mReady.empty() || doneLocked(); });
+            mIdleWorkers--;
+            if (!woken) break;
+            continue;
+        }
+
+        Source* source = mReady.front();
+        mReady.pop_front();
+
+        lock.unlock();
+        bool keep = source->onReadable();
+        lock.lock();
+
+        if (keep) {
+            rearmLocked(source);
+            continue;
+        }
+
+        std::unique_ptr<Source> removed = removeLocked(source);
+        if (doneLocked()) {
+            uint64_t one = 1;
+            (void)TEMP_FAILURE_RETRY(write(mWake.get(), &one, sizeof(one)));
+            mWorkCv.notify_all();
+        }
+        lock.unlock();
+        removed->onRemoved();
+        removed.reset();
+        lock.lock();
+    }
+    mWorkers--;
+}
+
+void RpcDispatcher::scheduleLocked(Source* source) {
+    source->armed = false;
+    mReady.push_back(source);
+    if (mReady.size() <= mIdleWorkers) {
+        mWorkCv.notify_one();
+        return;
+    }
+    // otherwise, the next worker to finish picks it up
+    if (mWorkers == mMaxWorkers) return;
+    mWorkers++;
+    std::thread([self = shared_from_this()] { self->workLoop(); }).detach();
+}
+
+void RpcDispatcher::rearmLocked(Source* source) {
+    Trigger& trigger = mTriggers[source->triggerFd];
+    if (!trigger.registered) {
+        // fires right away if it was triggered meanwhile
+        epoll_event event{.events = EPOLLIN, .data = {.fd = source->triggerFd}};
+        if (epoll_ctl(mEpoll.get(), EPOLL_CTL_ADD, source->triggerFd, &event) != 0) {
+            ALOGE("Could not add trigger fd %d to epoll: %s", source->triggerFd, strerror(errno));
+        } else {
+            trigger.registered = true;
+        }
+    }
+
+    source->armed = true;
+    epoll_event event{.events = EPOLLIN | EPOLLONESHOT, .data = {.fd = source->fd}};
+    LOG_ALWAYS_FATAL_IF(epoll_ctl(mEpoll.get(), EPOLL_CTL_MOD, source->fd, &event) != 0,
+                        "Could not rearm fd %d: %s", source->fd, strerror(errno));
+}
+
+std::unique_ptr<RpcDispatcher::Source> RpcDispatcher::removeLocked(Source* source) {
+    if (epoll_ctl(mEpoll.get(), EPOLL_CTL_DEL, source->fd, nullptr) != 0) {
+        ALOGE("Could not remove fd %d from epoll: %s", source->fd, strerror(errno));
+    }
+
+    auto trigger = mTriggers.find(source->triggerFd);
+    LOG_ALWAYS_FATAL_IF(trigger == mTriggers.end(), "Bad state: unknown trigger fd %d",
+                        source->triggerFd);
+    trigger->second.sources.erase(source);
+    if (trigger->second.sources.empty()) {
+        if (trigger->second.registered) {
+            (void)epoll_ctl(mEpoll.get(), EPOLL_CTL_DEL, source->triggerFd, nullptr);
+        }
+        mTriggers.erase(trigger);
+    }
+
+    auto it = mSources.find(source->fd);
+    LOG_ALWAYS_FATAL_IF(it == mSources.end(), "Bad state: unknown fd %d", source->fd);
+    std::unique_ptr<Source> removed = std::move(it->second);
+    mSources.erase(it);
+    return removed;
+}
+
+} // namespace android
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include <android-base/unique_fd.h>
+
+namespace android {
+
+// Runs callbacks for many file descriptors on a pool of threads, rather than
+// blocking a thread on each of them.
+//
+// One thread waits on every registered fd with epoll. When one has data to
+// read, its callback is queued for a worker thread. Workers are started when
+// callbacks are queued and all of them are busy, up to a maximum, and exit once
+// they have been idle for a while, so the number of threads follows the number
+// of callbacks running at once. Past the maximum, callbacks wait for a worker.
+// The callback for an fd is never run by two threads at once.
+//
+// Every fd is registered along with a trigger fd (see FdTrigger), which is
+// watched too: once it hangs up, the callbacks of all of its idle fds run so
+// that they can notice the shutdown.
+class RpcDispatcher : public std::enable_shared_from_this<RpcDispatcher> {
+public:
+    // Runs at most |maxWorkers| callbacks at once. Returns nullptr on error.
+    static std::shared_ptr<RpcDispatcher> make(size_t maxWorkers);
+
+    // Calls |onReadable| on a worker thread once right away, then each time
+    // |fd| is readable or |triggerFd| has been triggered, until it returns
+    // false. Then stops watching |fd| and calls |onRemoved|. |fd| must stay
+    // open until then.
+    [[nodiscard]] bool add(int fd, int triggerFd, std::function<bool()> onReadable,
+                           std::function<void()> onRemoved);
+
+    // Lets all threads exit once every fd has been removed. No more fds can be
+    // added.
+    void stop();
+
+private:
+    struct Source {
+        int fd;
+        int triggerFd;
+        std::function<bool()> onReadable;
+        std::function<void()> onRemoved;
+        // Waiting in epoll, as opposed to queued or running.
+        bool armed = false;
+    };
+    struct Trigger {
+        std::set<Source*> sources;
+        // Triggers stay readable once triggered, so they are taken out of
+        // epoll when they fire, and put back when one of their fds is.
+        bool registered = false;
+    };
+
+    RpcDispatcher() = default;
+
+    void pollLoop();
+    void workLoop();
+    // All of these need mMutex.
+    void scheduleLocked(Source* source);
+    void rearmLocked(Source* source);
+    std::unique_ptr<Source> removeLocked(Source* source);
+    bool doneLocked() const { return mStopping && mSources.empty(); }
+
+    base::unique_fd mEpoll;
+    // eventfd to wake up pollLoop
+    base::unique_fd mWake;
+
+    std::mutex mMutex;
+    std::condition_variable mWorkCv;
+    std::map<int, std::unique_ptr<Source>> mSources;
+    std::map<int, Trigger> mTriggers;
+    std::deque<Source*> mReady;
+    size_t mMaxWorkers = 0;
+    size_t mWorkers = 0;
+    size_t mIdleWorkers = 0;
+    bool mStopping = false;
+};
+
+} // namespace android
@@ -35,6 +35,9 @@
 #include "BuildFlags.h"
 #include "FdTrigger.h"
 #include "OS.h"
+#ifndef BINDER_RPC_SINGLE_THREADED
+#include "RpcDispatcher.h"
+#endif
 #include "RpcSocketAddress.h"
 #include "RpcState.h"
 #include "RpcTransportUtils.h"
@@ -52,6 +55,9 @@ RpcServer::RpcServer(std::unique_ptr<RpcTransportCtx> ctx) : mCtx(std::move(ctx)
 RpcServer::~RpcServer() {
     RpcMutexUniqueLock _l(mLock);
     LOG_ALWAYS_FATAL_IF(mShutdownTrigger != nullptr, "Must call shutdown() before destructor");
+#ifndef BINDER_RPC_SINGLE_THREADED
+    if (mDispatcher != nullptr) mDispatcher->stop();
+#endif
 }
 
 sp<RpcServer> RpcServer::make(std::unique_ptr<RpcTransportCtxFactory> rpcTransportCtxFactory) {
@@ -141,6 +147,38 @@ void RpcServer::setSupportedFileDescriptorTransportModes(
     }
 }
 
+bool RpcServer::setWriteBatching(size_t maxBytes, std::chrono::microseconds maxDelay) {
+#ifdef BINDER_RPC_SINGLE_THREADED
+    (void)maxBytes;
+    (void)maxDelay;
+    ALOGE("Write batching is not supported in single-threaded builds");
+    return false;
+#else
+    mWriteBatchMaxBytes = maxBytes;
+    mWriteBatchMaxDelay = maxDelay;
+    return true;
+#endif
+}
+
+bool RpcServer::setEventDrivenDispatch(bool enabled, size_t maxThreads) {
+#ifdef BINDER_RPC_SINGLE_THREADED
+    (void)enabled;
+    (void)maxThreads;
+    ALOGE("Event-driven dispatch is not supported in single-threaded builds");
+    return false;
+#else
+    RpcMutexLockGuard _l(mLock);
+    if (!enabled) {
+        // connections already handed over stay with it until they end
+        if (mDispatcher != nullptr) mDispatcher->stop();
+        mDispatcher = nullptr;
+        return true;
+    }
+    if (mDispatcher == nullptr) mDispatcher = RpcDispatcher::make(maxThreads);
+    return mDispatcher != nullptr;
+#endif
+}
+
 void RpcServer::setRootObject(const sp<IBinder>& binder) {
     RpcMutexLockGuard _l(mLock);
     mRootObjectFactory = nullptr;
@@ -451,6 +489,7 @@ void RpcServer::establishConnection(
 
     RpcMaybeThread thisThread;
     sp<RpcSession> session;
+    std::shared_ptr<RpcDispatcher> dispatcher;
     {
         RpcMutexUniqueLock _l(server->mLock);
 
@@ -512,6 +551,12 @@ void RpcServer::establishConnection(
                 return;
             }
 
+            if (server->mWriteBatchMaxBytes > 0 &&
+                !session->setWriteBatching(server->mWriteBatchMaxBytes,
+                                           server->mWriteBatchMaxDelay)) {
+                return;
+            }
+
             // if null, falls back to server root
             sp<IBinder> sessionSpecificRoot;
             if (server->mRootObjectFactory != nullptr) {
@@ -550,6 +595,7 @@ void RpcServer::establishConnection(
 
         detachGuard.Disable();
         session->preJoinThreadOwnership(std::move(thisThread));
+        dispatcher = server->mDispatcher;
     }
 
     auto setupResult = session->preJoinSetup(std::move(client));
@@ -557,6 +603,12 @@ void RpcServer::establishConnection(
     // avoid strong cycle
     server = nullptr;
 
+#ifndef BINDER_RPC_SINGLE_THREADED
+    if (dispatcher != nullptr && RpcSession::joinDispatcher(dispatcher, session, setupResult)) {
+        return;
+    }
+#endif
+
     joinFn(std::move(session), std::move(setupResult));
 }
 
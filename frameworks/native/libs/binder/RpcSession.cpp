@@ -24,6 +24,8 @@
 #include <poll.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <mutex>
 #include <string_view>
 
 #include <android-base/hex.h>
@@ -40,6 +42,9 @@
 #include "BuildFlags.h"
 #include "FdTrigger.h"
 #include "OS.h"
+#ifndef BINDER_RPC_SINGLE_THREADED
+#include "RpcDispatcher.h"
+#endif
 #include "RpcSocketAddress.h"
 #include "RpcState.h"
 #include "RpcTransportUtils.h"
@@ -55,6 +60,17 @@ namespace android {
 
 using base::unique_fd;
 
+#ifndef BINDER_RPC_SINGLE_THREADED
+struct RpcSession::WriteFlusher {
+    std::mutex mutex;
+    std::condition_variable cv;
+    // earliest deadline of a batch left on an idle connection, if any
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    bool stop = false;
+    std::thread thread;
+};
+#endif
+
 RpcSession::RpcSession(std::unique_ptr<RpcTransportCtx> ctx) : mCtx(std::move(ctx)) {
     LOG_RPC_DETAIL("RpcSession created %p", this);
 
@@ -63,6 +79,37 @@ RpcSession::RpcSession(std::unique_ptr<RpcTransportCtx> ctx) : mCtx(std::move(ct
 RpcSession::~RpcSession() {
     LOG_RPC_DETAIL("RpcSession destroyed %p", this);
 
+#ifndef BINDER_RPC_SINGLE_THREADED
+    if (mWriteFlusher != nullptr) {
+        {
+            std::lock_guard<std::mutex> _l(mWriteFlusher->mutex);
+            mWriteFlusher->stop = true;
+        }
+        mWriteFlusher->cv.notify_one();
+        // the flusher drops the last reference if the session goes away while
+        // it is flushing
+        if (mWriteFlusher->thread.get_id() == std::this_thread::get_id()) {
+            mWriteFlusher->thread.detach();
+        } else {
+            mWriteFlusher->thread.join();
+        }
+    }
+
+    // Oneway calls and refcounts queued right before the last reference went
+    // away still need to go out. Nothing else can use the connections now.
+    for (const auto& connection : mConnections.mOutgoing) {
+        if (connection->pendingWrites.empty()) continue;
+        iovec iov{connection->pendingWrites.data(), connection->pendingWrites.size()};
+        if (status_t status =
+                    connection->rpcTransport->interruptableWriteFully(mShutdownTrigger.get(), &iov,
+                                                                      1, std::nullopt, nullptr);
+            status != OK) {
+            ALOGW("Dropping %zu bytes of batched commands: %s", connection->pendingWrites.size(),
+                  statusToString(status).c_str());
+        }
+    }
+#endif
+
     RpcMutexLockGuard _l(mMutex);
     LOG_ALWAYS_FATAL_IF(mConnections.mIncoming.size() != 0,
                         "Should not be able to destroy a session with servers in use.");
@@ -141,6 +188,21 @@ RpcSession::FileDescriptorTransportMode RpcSession::getFileDescriptorTransportMo
     return mFileDescriptorTransportMode;
 }
 
+bool RpcSession::setWriteBatching(size_t maxBytes, std::chrono::microseconds maxDelay) {
+#ifdef BINDER_RPC_SINGLE_THREADED
+    (void)maxBytes;
+    (void)maxDelay;
+    ALOGE("Write batching is not supported in single-threaded builds");
+    return false;
+#else
+    RpcMutexLockGuard _l(mMutex);
+    LOG_ALWAYS_FATAL_IF(mStartedSetup, "Must set write batching before setting up connections");
+    mWriteBatchMaxBytes = maxBytes;
+    mWriteBatchMaxDelay = maxDelay;
+    return true;
+#endif
+}
+
 status_t RpcSession::setupUnixDomainClient(const char* path) {
     return setupSocketClient(UnixSocketAddress(path));
 }
@@ -447,16 +509,7 @@ void RpcSession::join(sp<RpcSession>&& session, PreJoinSetupResult&& setupResult
               statusToString(setupResult.status).c_str());
     }
 
-    sp<RpcSession::EventListener> listener;
-    {
-        RpcMutexLockGuard _l(session->mMutex);
-        auto it = session->mConnections.mThreads.find(rpc_this_thread::get_id());
-        LOG_ALWAYS_FATAL_IF(it == session->mConnections.mThreads.end());
-        it->second.detach();
-        session->mConnections.mThreads.erase(it);
-
-        listener = session->mEventListener.promote();
-    }
+    sp<RpcSession::EventListener> listener = session->detachJoinThread();
 
     // done after all cleanup, since session shutdown progresses via callbacks here
     if (connection != nullptr) {
@@ -471,6 +524,102 @@ void RpcSession::join(sp<RpcSession>&& session, PreJoinSetupResult&& setupResult
     }
 }
 
+sp<RpcSession::EventListener> RpcSession::detachJoinThread() {
+    RpcMutexLockGuard _l(mMutex);
+    auto it = mConnections.mThreads.find(rpc_this_thread::get_id());
+    LOG_ALWAYS_FATAL_IF(it == mConnections.mThreads.end());
+    it->second.detach();
+    mConnections.mThreads.erase(it);
+
+    return mEventListener.promote();
+}
+
+#ifndef BINDER_RPC_SINGLE_THREADED
+bool RpcSession::joinDispatcher(const std::shared_ptr<RpcDispatcher>& dispatcher,
+                                sp<RpcSession>& session, PreJoinSetupResult& setupResult) {
+    if (setupResult.status != OK) return false;
+    sp<RpcConnection> connection = setupResult.connection;
+    LOG_ALWAYS_FATAL_IF(!connection, "must have connection if setup succeeded");
+
+    int fd = connection->rpcTransport->pollableFd();
+    if (fd < 0) return false;
+
+    // from here on, the connection is only owned by whichever thread the
+    // dispatcher runs it on
+    {
+        RpcMutexLockGuard _l(session->mMutex);
+        connection->exclusiveTid = std::nullopt;
+    }
+    if (!dispatcher->add(
+                fd, session->mShutdownTrigger->pollFd(),
+                [session, connection] { return session->serveDispatchedCommands(connection); },
+                [session, connection] { session->endDispatchedConnection(connection); })) {
+        RpcMutexLockGuard _l(session->mMutex);
+        connection->exclusiveTid = rpcGetThreadId();
+        return false;
+    }
+
+    sp<RpcSession::EventListener> listener = session->detachJoinThread();
+    session = nullptr;
+
+    if (listener != nullptr) {
+        listener->onSessionIncomingThreadEnded();
+    }
+    return true;
+}
+
+bool RpcSession::serveDispatchedCommands(const sp<RpcConnection>& connection) {
+    if (mShutdownTrigger->isTriggered()) return false;
+
+    // worker threads are reused across connections, so stay attached
+    [[maybe_unused]] static thread_local JavaThreadAttacher javaThreadAttacher;
+
+    {
+        RpcMutexLockGuard _l(mMutex);
+        connection->exclusiveTid = rpcGetThreadId();
+    }
+
+    // Only wait for data when there is some, and go back to the dispatcher
+    // once it is all handled.
+    sp<RpcSession> session = sp<RpcSession>::fromExisting(this);
+    status_t status;
+    while (true) {
+        if (status = connection->rpcTransport->pollRead(); status == WOULD_BLOCK) break;
+        // errors, including hangups, are handled (and the session shut down)
+        // by the read itself
+        status = state()->getAndExecuteCommand(connection, session, RpcState::CommandType::ANY);
+        if (status != OK) break;
+    }
+
+    {
+        RpcMutexLockGuard _l(mMutex);
+        connection->exclusiveTid = std::nullopt;
+    }
+
+    if (status != WOULD_BLOCK) {
+        LOG_RPC_DETAIL("Binder dispatched connection closing w/ status %s",
+                       statusToString(status).c_str());
+        return false;
+    }
+    return true;
+}
+
+void RpcSession::endDispatchedConnection(const sp<RpcConnection>& connection) {
+    sp<RpcSession::EventListener> listener;
+    {
+        RpcMutexLockGuard _l(mMutex);
+        listener = mEventListener.promote();
+    }
+
+    LOG_ALWAYS_FATAL_IF(!removeIncomingConnection(connection),
+                        "bad state: connection object guaranteed to be in list");
+
+    if (listener != nullptr) {
+        listener->onSessionIncomingThreadEnded();
+    }
+}
+#endif // BINDER_RPC_SINGLE_THREADED
+
 sp<RpcServer> RpcSession::server() {
     RpcServer* unsafeServer = mForServer.unsafe_get();
     sp<RpcServer> server = mForServer.promote();
@@ -771,6 +920,7 @@ status_t RpcSession::addOutgoingConnection(std::unique_ptr<RpcTransport> rpcTran
         RpcMutexLockGuard _l(mMutex);
         connection->rpcTransport = std::move(rpcTransport);
         connection->exclusiveTid = rpcGetThreadId();
+        connection->batchWrites = mWriteBatchMaxBytes > 0;
         mConnections.mOutgoing.push_back(connection);
     }
 
@@ -854,12 +1004,81 @@ bool RpcSession::removeIncomingConnection(const sp<RpcConnection>& connection) {
 void RpcSession::clearConnectionTid(const sp<RpcConnection>& connection) {
     RpcMutexUniqueLock _l(mMutex);
     connection->exclusiveTid = std::nullopt;
+    if (!connection->pendingWrites.empty()) {
+        scheduleFlushLocked(connection->pendingDeadline);
+    }
     if (mConnections.mWaitingThreads > 0) {
         _l.unlock();
         mAvailableConnectionCv.notify_one();
     }
 }
 
+void RpcSession::scheduleFlushLocked(std::chrono::steady_clock::time_point deadline) {
+#ifdef BINDER_RPC_SINGLE_THREADED
+    (void)deadline;
+    LOG_ALWAYS_FATAL("Write batching is not supported in single-threaded builds");
+#else
+    if (mWriteFlusher == nullptr) {
+        mWriteFlusher = std::make_shared<WriteFlusher>();
+        mWriteFlusher->thread = std::thread([weakSession = wp<RpcSession>::fromExisting(this),
+                                             flusher = mWriteFlusher] {
+            std::unique_lock<std::mutex> lock(flusher->mutex);
+            while (!flusher->stop) {
+                if (!flusher->deadline.has_value()) {
+                    flusher->cv.wait(lock);
+                    continue;
+                }
+                if (auto deadline = *flusher->deadline; std::chrono::steady_clock::now() < deadline) {
+                    flusher->cv.wait_until(lock, deadline);
+                    continue;
+                }
+                flusher->deadline.reset();
+                lock.unlock();
+                if (sp<RpcSession> session = weakSession.promote(); session != nullptr) {
+                    session->flushExpiredWrites();
+                }
+                lock.lock();
+            }
+        });
+    }
+
+    {
+        std::lock_guard<std::mutex> _l(mWriteFlusher->mutex);
+        if (mWriteFlusher->deadline.has_value() && *mWriteFlusher->deadline <= deadline) return;
+        mWriteFlusher->deadline = deadline;
+    }
+    mWriteFlusher->cv.notify_one();
+#endif
+}
+
+void RpcSession::flushExpiredWrites() {
+    std::vector<sp<RpcConnection>> expired;
+    {
+        RpcMutexUniqueLock _l(mMutex);
+        auto now = std::chrono::steady_clock::now();
+        uint64_t tid = rpcGetThreadId();
+        for (const auto& connection : mConnections.mOutgoing) {
+            // connections in use are flushed by their thread, or rescheduled
+            // when it lets go of them
+            if (connection->exclusiveTid != std::nullopt || connection->pendingWrites.empty()) {
+                continue;
+            }
+            if (connection->pendingDeadline > now) {
+                scheduleFlushLocked(connection->pendingDeadline);
+                continue;
+            }
+            connection->exclusiveTid = tid;
+            expired.push_back(connection);
+        }
+    }
+
+    for (const auto& connection : expired) {
+        // on failure, the session is shut down by RpcState
+        (void)state()->flushPendingWrites(connection, sp<RpcSession>::fromExisting(this));
+        clearConnectionTid(connection);
+    }
+}
+
 std::vector<uint8_t> RpcSession::getCertificate(RpcCertificateFormat format) {
     return mCtx->getCertificate(format);
 }
@@ -27,6 +27,7 @@
 #include <binder/RpcServer.h>
 
 #include "Debug.h"
+#include "ParcelBufferPool.h"
 #include "RpcWireFormat.h"
 #include "Utils.h"
 
@@ -366,6 +367,96 @@ status_t RpcState::rpcSend(
                        android::base::HexString(iovs[i].iov_base, iovs[i].iov_len).c_str());
     }
 
+    if (connection->pendingWrites.empty()) {
+        return writeToTransport(connection, session, what, iovs, niovs, altPoll, ancillaryFds);
+    }
+
+    // Batched commands have to go out first. File descriptors are delivered
+    // with the first bytes of a write, so they can't share one.
+    if (ancillaryFds != nullptr && !ancillaryFds->empty()) {
+        if (status_t status = flushPendingWrites(connection, session); status != OK) return status;
+        return writeToTransport(connection, session, what, iovs, niovs, altPoll, ancillaryFds);
+    }
+
+    // altPoll may read from this connection, which flushes pending writes, so
+    // take them off the connection while they are being written.
+    std::vector<uint8_t> pending;
+    pending.swap(connection->pendingWrites);
+    std::vector<iovec> batch;
+    batch.reserve(niovs + 1);
+    batch.push_back({pending.data(), pending.size()});
+    batch.insert(batch.end(), iovs, iovs + niovs);
+    status_t status = writeToTransport(connection, session, what, batch.data(), batch.size(),
+                                       altPoll, nullptr);
+    reusePendingWritesBuffer(connection, &pending);
+    return status;
+}
+
+status_t RpcState::rpcSendBatched(
+        const sp<RpcSession::RpcConnection>& connection, const sp<RpcSession>& session,
+        const char* what, iovec* iovs, int niovs,
+        const std::optional<android::base::function_ref<status_t()>>& altPoll) {
+    if (!connection->batchWrites) {
+        return rpcSend(connection, session, what, iovs, niovs, altPoll);
+    }
+
+    size_t size = 0;
+    for (int i = 0; i < niovs; i++) {
+        size += iovs[i].iov_len;
+    }
+    std::vector<uint8_t>& pending = connection->pendingWrites;
+    if (pending.size() + size > session->mWriteBatchMaxBytes) {
+        return rpcSend(connection, session, what, iovs, niovs, altPoll);
+    }
+
+    for (int i = 0; i < niovs; i++) {
+        LOG_RPC_DETAIL("Queueing %s (part %d of %d) on RpcTransport %p: %s",
+                       what, i + 1, niovs, connection->rpcTransport.get(),
+                       android::base::HexString(iovs[i].iov_base, iovs[i].iov_len).c_str());
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (pending.empty()) {
+        connection->pendingDeadline = now + session->mWriteBatchMaxDelay;
+    }
+    for (int i = 0; i < niovs; i++) {
+        const uint8_t* data = static_cast<const uint8_t*>(iovs[i].iov_base);
+        pending.insert(pending.end(), data, data + iovs[i].iov_len);
+    }
+
+    if (pending.size() >= session->mWriteBatchMaxBytes || now >= connection->pendingDeadline) {
+        return flushPendingWrites(connection, session);
+    }
+    // otherwise, RpcSession flushes it when the deadline passes
+    return OK;
+}
+
+status_t RpcState::flushPendingWrites(const sp<RpcSession::RpcConnection>& connection,
+                                      const sp<RpcSession>& session) {
+    if (connection->pendingWrites.empty()) return OK;
+
+    std::vector<uint8_t> pending;
+    pending.swap(connection->pendingWrites);
+    iovec iov{pending.data(), pending.size()};
+    status_t status =
+            writeToTransport(connection, session, "batched commands", &iov, 1, std::nullopt,
+                             nullptr);
+    reusePendingWritesBuffer(connection, &pending);
+    return status;
+}
+
+void RpcState::reusePendingWritesBuffer(const sp<RpcSession::RpcConnection>& connection,
+                                        std::vector<uint8_t>* buffer) {
+    if (!connection->pendingWrites.empty()) return;
+    buffer->clear();
+    connection->pendingWrites.swap(*buffer);
+}
+
+status_t RpcState::writeToTransport(
+        const sp<RpcSession::RpcConnection>& connection, const sp<RpcSession>& session,
+        const char* what, iovec* iovs, int niovs,
+        const std::optional<android::base::function_ref<status_t()>>& altPoll,
+        const std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds) {
     if (status_t status =
                 connection->rpcTransport->interruptableWriteFully(session->mShutdownTrigger.get(),
                                                                   iovs, niovs, altPoll,
@@ -384,6 +475,9 @@ status_t RpcState::rpcRec(
         const sp<RpcSession::RpcConnection>& connection, const sp<RpcSession>& session,
         const char* what, iovec* iovs, int niovs,
         std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds) {
+    // the peer may be waiting on batched commands before it sends anything
+    if (status_t status = flushPendingWrites(connection, session); status != OK) return status;
+
     if (status_t status =
                 connection->rpcTransport->interruptableReadFully(session->mShutdownTrigger.get(),
                                                                  iovs, niovs, std::nullopt,
@@ -596,31 +690,38 @@ status_t RpcState::transactAddress(const sp<RpcSession::RpcConnection>& connecti
     constexpr size_t kWaitLogUs = 10000;
     size_t waitUs = 0;
 
+    auto altPoll = [&] {
+        if (waitUs > kWaitLogUs) {
+            ALOGE("Cannot send command, trying to process pending refcounts. Waiting "
+                  "%zuus. Too many oneway calls?",
+                  waitUs);
+        }
+
+        if (waitUs > 0) {
+            usleep(waitUs);
+            waitUs = std::min(kWaitMaxUs, waitUs * 2);
+        } else {
+            waitUs = 1;
+        }
+
+        return drainCommands(connection, session, CommandType::CONTROL_ONLY);
+    };
+
     iovec iovs[]{
             {&command, sizeof(RpcWireHeader)},
             {&transaction, sizeof(RpcWireTransaction)},
             {const_cast<uint8_t*>(data.data()), data.dataSize()},
             objectTableSpan.toIovec(),
     };
-    if (status_t status = rpcSend(
-                connection, session, "transaction", iovs, arraysize(iovs),
-                [&] {
-                    if (waitUs > kWaitLogUs) {
-                        ALOGE("Cannot send command, trying to process pending refcounts. Waiting "
-                              "%zuus. Too many oneway calls?",
-                              waitUs);
-                    }
-
-                    if (waitUs > 0) {
-                        usleep(waitUs);
-                        waitUs = std::min(kWaitMaxUs, waitUs * 2);
-                    } else {
-                        waitUs = 1;
-                    }
-
-                    return drainCommands(connection, session, CommandType::CONTROL_ONLY);
-                },
-                rpcFields->mFds.get());
+    // Oneway transactions may be batched with other commands, unless they carry
+    // file descriptors.
+    bool batch = (flags & IBinder::FLAG_ONEWAY) &&
+            (rpcFields->mFds == nullptr || rpcFields->mFds->empty());
+    if (status_t status = batch
+                ? rpcSendBatched(connection, session, "transaction", iovs, arraysize(iovs),
+                                 altPoll)
+                : rpcSend(connection, session, "transaction", iovs, arraysize(iovs), altPoll,
+                          rpcFields->mFds.get());
         status != OK) {
         // rpcSend calls shutdownAndWait, so all refcounts should be reset. If we ever tolerate
         // errors here, then we may need to undo the binder-sent counts for the transaction as
@@ -762,7 +863,7 @@ status_t RpcState::sendDecStrongToTarget(const sp<RpcSession::RpcConnection>& co
             .bodySize = sizeof(RpcDecStrong),
     };
     iovec iovs[]{{&cmd, sizeof(cmd)}, {&body, sizeof(body)}};
-    return rpcSend(connection, session, "dec ref", iovs, arraysize(iovs), std::nullopt);
+    return rpcSendBatched(connection, session, "dec ref", iovs, arraysize(iovs), std::nullopt);
 }
 
 status_t RpcState::getAndExecuteCommand(const sp<RpcSession::RpcConnection>& connection,
@@ -952,6 +1053,14 @@ processTransactInternalTailCall:
 
     Parcel reply;
     reply.markForRpc(session);
+    if (target && !oneway) {
+        // Reserve what the last reply to this call needed, rather than growing
+        // the buffer a few times while it is written.
+        if (size_t hint = ParcelBufferPool::replyCapacityHint(target.get(), transaction->code);
+            hint > 0) {
+            (void)reply.setDataCapacity(hint);
+        }
+    }
 
     if (replyStatus == OK) {
         Span<const uint8_t> parcelSpan = {transaction->data,
@@ -1105,6 +1214,10 @@ processTransactInternalTailCall:
         replyStatus = flushExcessBinderRefs(session, addr, target);
     }
 
+    if (target) {
+        ParcelBufferPool::recordReplySize(target.get(), transaction->code, reply.dataSize());
+    }
+
     std::string errorMsg;
     if (status_t status = validateParcel(session, reply, &errorMsg); status != OK) {
         ALOGE("Reply Parcel failed validation: %s", errorMsg.c_str());
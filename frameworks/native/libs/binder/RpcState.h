@@ -112,6 +112,14 @@ public:
                                                  const sp<RpcSession>& session, uint64_t address,
                                                  size_t target);
 
+    /**
+     * Writes out commands queued on this connection by write batching (see
+     * RpcSession::setWriteBatching). The caller must have exclusive use of the
+     * connection.
+     */
+    [[nodiscard]] status_t flushPendingWrites(const sp<RpcSession::RpcConnection>& connection,
+                                              const sp<RpcSession>& session);
+
     enum class CommandType {
         ANY,
         CONTROL_ONLY,
@@ -193,6 +201,21 @@ private:
             const std::optional<android::base::function_ref<status_t()>>& altPoll,
             const std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds =
                     nullptr);
+    // Like rpcSend, but queues the command on the connection if it batches
+    // writes. Commands with file descriptors must use rpcSend.
+    [[nodiscard]] status_t rpcSendBatched(
+            const sp<RpcSession::RpcConnection>& connection, const sp<RpcSession>& session,
+            const char* what, iovec* iovs, int niovs,
+            const std::optional<android::base::function_ref<status_t()>>& altPoll);
+    // Gives the buffer of flushed batched commands back to the connection, to
+    // avoid an allocation for the next batch.
+    static void reusePendingWritesBuffer(const sp<RpcSession::RpcConnection>& connection,
+                                         std::vector<uint8_t>* buffer);
+    [[nodiscard]] status_t writeToTransport(
+            const sp<RpcSession::RpcConnection>& connection, const sp<RpcSession>& session,
+            const char* what, iovec* iovs, int niovs,
+            const std::optional<android::base::function_ref<status_t()>>& altPoll,
+            const std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds);
     [[nodiscard]] status_t rpcRec(
             const sp<RpcSession::RpcConnection>& connection, const sp<RpcSession>& session,
             const char* what, iovec* iovs, int niovs,
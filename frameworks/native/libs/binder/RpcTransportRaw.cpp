@@ -81,6 +81,8 @@ public:
 
     virtual bool isWaiting() { return mSocket.isInPollingState(); }
 
+    int pollableFd() override { return mSocket.fd.get(); }
+
 private:
     android::RpcTransportFd mSocket;
 };
@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RpcShmTransport"
+#include <log/log.h>
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include <android-base/macros.h>
+#include <binder/RpcTransportShm.h>
+
+#include "FdTrigger.h"
+#include "OS.h"
+#include "RpcState.h"
+#include "RpcTransportUtils.h"
+
+namespace android {
+
+namespace {
+
+constexpr uint32_t kShmMagic = 0x314d4853; // "SHM1"
+constexpr size_t kMinRingSize = 4 * 1024;
+constexpr size_t kMaxRingSize = 16 * 1024 * 1024;
+// Same limit as sendMessageOnSocket (SCM_MAX_FD).
+constexpr uint32_t kMaxFdsPerChunk = 253;
+
+bool isValidRingSize(size_t ringSize) {
+    return ringSize >= kMinRingSize && ringSize <= kMaxRingSize &&
+            (ringSize & (ringSize - 1)) == 0;
+}
+
+// Sent by the client right after connecting, with the memfd attached if |ringSize| is not 0.
+// The server answers with |ringSize| if it mapped the rings, or 0 to stay on the socket.
+struct ShmHello {
+    uint32_t magic;
+    uint32_t ringSize;
+};
+
+// Indices of one direction. Only the producer writes |head| and only the consumer writes
+// |tail|. The peer can write anything to the mapping, so each side keeps its own copy of the
+// index it owns and checks the other one before using it.
+struct RingControl {
+    alignas(64) std::atomic<uint64_t> head;
+    // Set by the consumer before it sleeps on the socket until |head| moves.
+    std::atomic<uint32_t> consumerWaiting;
+    alignas(64) std::atomic<uint64_t> tail;
+    // Set by the producer before it sleeps on the socket until |tail| moves.
+    std::atomic<uint32_t> producerWaiting;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+// The memfd holds both control blocks, then the client-to-server ring, then the
+// server-to-client ring.
+constexpr size_t kRingsOffset = 2 * sizeof(RingControl);
+
+size_t mappingSize(size_t ringSize) {
+    return kRingsOffset + 2 * ringSize;
+}
+
+// Precedes the data of each interruptableWriteFully() call in the ring. File descriptors for
+// the chunk are sent on the socket before the header is published.
+struct ChunkHeader {
+    uint32_t size;
+    uint32_t fdCount;
+};
+
+void copyToRing(uint8_t* ring, size_t ringSize, uint64_t index, const uint8_t* data,
+                size_t size) {
+    size_t offset = index & (ringSize - 1);
+    size_t first = std::min(size, ringSize - offset);
+    memcpy(ring + offset, data, first);
+    memcpy(ring, data + first, size - first);
+}
+
+void copyFromRing(const uint8_t* ring, size_t ringSize, uint64_t index, uint8_t* data,
+                  size_t size) {
+    size_t offset = index & (ringSize - 1);
+    size_t first = std::min(size, ringSize - offset);
+    memcpy(data, ring + offset, first);
+    memcpy(data + first, ring, size - first);
+}
+
+bool isUnixSocket(const RpcTransportFd& socket) {
+    sockaddr_storage addr;
+    socklen_t addrLen = sizeof(addr);
+    if (getsockname(socket.fd.get(), reinterpret_cast<sockaddr*>(&addr), &addrLen) != 0) {
+        return false;
+    }
+    return addr.ss_family == AF_UNIX;
+}
+
+class ShmMapping {
+public:
+    static std::unique_ptr<ShmMapping> map(base::borrowed_fd fd, size_t ringSize) {
+        void* addr = mmap(nullptr, mappingSize(ringSize), PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd.get(), 0);
+        if (addr == MAP_FAILED) {
+            ALOGE("Could not map %zu byte rings: %s", ringSize, strerror(errno));
+            return nullptr;
+        }
+        return std::unique_ptr<ShmMapping>(new ShmMapping(addr, ringSize));
+    }
+    ~ShmMapping() { munmap(mAddr, mappingSize(mRingSize)); }
+
+    size_t ringSize() const { return mRingSize; }
+    RingControl* control(size_t ring) const { return static_cast<RingControl*>(mAddr) + ring; }
+    uint8_t* data(size_t ring) const {
+        return static_cast<uint8_t*>(mAddr) + kRingsOffset + ring * mRingSize;
+    }
+
+private:
+    ShmMapping(void* addr, size_t ringSize) : mAddr(addr), mRingSize(ringSize) {}
+    DISALLOW_COPY_AND_ASSIGN(ShmMapping);
+
+    void* mAddr;
+    size_t mRingSize;
+};
+
+// Creates and seals a memfd for the client side. Returns an invalid fd if shared memory isn't
+// usable here, in which case the connection stays on the socket.
+base::unique_fd createRingsFd(size_t ringSize) {
+    base::unique_fd fd(memfd_create("binder_rpc_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    if (!fd.ok()) {
+        ALOGW("memfd_create: %s", strerror(errno));
+        return {};
+    }
+    if (TEMP_FAILURE_RETRY(ftruncate(fd.get(), mappingSize(ringSize))) != 0) {
+        ALOGW("Could not size rings: %s", strerror(errno));
+        return {};
+    }
+    // The server checks for these, since a peer shrinking the file would turn our accesses to
+    // the mapping into SIGBUS.
+    if (fcntl(fd.get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        ALOGW("Could not seal rings: %s", strerror(errno));
+        return {};
+    }
+    return fd;
+}
+
+// Validates a memfd received from a client and maps it.
+std::unique_ptr<ShmMapping> mapRingsFd(base::borrowed_fd fd, size_t ringSize) {
+    if (!isValidRingSize(ringSize)) {
+        ALOGE("Client asked for invalid ring size %zu", ringSize);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd.get(), &st) != 0 || static_cast<size_t>(st.st_size) != mappingSize(ringSize)) {
+        ALOGE("Client rings have the wrong size for %zu byte rings", ringSize);
+        return nullptr;
+    }
+    int seals = fcntl(fd.get(), F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+        ALOGE("Client rings are not sealed against shrinking");
+        return nullptr;
+    }
+    return ShmMapping::map(fd, ringSize);
+}
+
+status_t writeHello(const RpcTransportFd& socket, FdTrigger* fdTrigger, ShmHello hello,
+                    const std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* fds) {
+    iovec iov{&hello, sizeof(hello)};
+    bool sentFds = false;
+    auto send = [&](iovec* iovs, int niovs) -> ssize_t {
+        ssize_t ret = sendMessageOnSocket(socket, iovs, niovs, sentFds ? nullptr : fds);
+        sentFds |= ret > 0;
+        return ret;
+    };
+    return interruptableReadOrWrite(socket, fdTrigger, &iov, 1, send, "sendmsg", POLLOUT,
+                                    std::nullopt);
+}
+
+status_t readHello(const RpcTransportFd& socket, FdTrigger* fdTrigger, ShmHello* hello,
+                   std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* fds) {
+    iovec iov{hello, sizeof(*hello)};
+    auto recv = [&](iovec* iovs, int niovs) -> ssize_t {
+        return receiveMessageFromSocket(socket, iovs, niovs, fds);
+    };
+    if (status_t status = interruptableReadOrWrite(socket, fdTrigger, &iov, 1, recv, "recvmsg",
+                                                   POLLIN, std::nullopt);
+        status != OK) {
+        return status;
+    }
+    if (hello->magic != kShmMagic) {
+        ALOGE("Peer is not using shared memory transport (magic %#x)", hello->magic);
+        return BAD_VALUE;
+    }
+    return OK;
+}
+
+} // namespace
+
+// RpcTransport over shared memory rings, or over the socket alone if no rings were
+// negotiated.
+class RpcTransportShm : public RpcTransport {
+public:
+    RpcTransportShm(android::RpcTransportFd socket, std::unique_ptr<ShmMapping> mapping,
+                    bool isClient)
+          : mSocket(std::move(socket)), mMapping(std::move(mapping)) {
+        if (mMapping != nullptr) {
+            size_t tx = isClient ? 0 : 1;
+            mTx = mMapping->control(tx);
+            mTxData = mMapping->data(tx);
+            mRx = mMapping->control(1 - tx);
+            mRxData = mMapping->data(1 - tx);
+        }
+    }
+
+    status_t pollRead(void) override {
+        if (mMapping == nullptr) {
+            return pollReadSocket();
+        }
+        if (mRx->head.load(std::memory_order_acquire) != mRxTail) {
+            return OK;
+        }
+        if (status_t status = drainSocket(); status != OK) {
+            return status;
+        }
+        if (mRx->head.load(std::memory_order_acquire) != mRxTail) {
+            return OK;
+        }
+        return mPeerClosed ? DEAD_OBJECT : WOULD_BLOCK;
+    }
+
+    status_t interruptableWriteFully(
+            FdTrigger* fdTrigger, iovec* iovs, int niovs,
+            const std::optional<android::base::function_ref<status_t()>>& altPoll,
+            const std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds)
+            override {
+        if (mMapping == nullptr) {
+            bool sentFds = false;
+            auto send = [&](iovec* iovs, int niovs) -> ssize_t {
+                ssize_t ret = sendMessageOnSocket(mSocket, iovs, niovs,
+                                                  sentFds ? nullptr : ancillaryFds);
+                sentFds |= ret > 0;
+                return ret;
+            };
+            return interruptableReadOrWrite(mSocket, fdTrigger, iovs, niovs, send, "sendmsg",
+                                            POLLOUT, altPoll);
+        }
+
+        MAYBE_WAIT_IN_FLAKE_MODE;
+
+        if (niovs < 0) {
+            return BAD_VALUE;
+        }
+        if (fdTrigger->isTriggered()) {
+            return DEAD_OBJECT;
+        }
+
+        size_t size = 0;
+        for (int i = 0; i < niovs; i++) {
+            size += iovs[i].iov_len;
+        }
+        if (size == 0) {
+            return OK;
+        }
+        if (size > UINT32_MAX) {
+            ALOGE("Cannot send %zu bytes in one chunk", size);
+            return BAD_VALUE;
+        }
+
+        ChunkHeader header{.size = static_cast<uint32_t>(size), .fdCount = 0};
+        if (ancillaryFds != nullptr && !ancillaryFds->empty()) {
+            if (ancillaryFds->size() > kMaxFdsPerChunk) {
+                return BAD_VALUE;
+            }
+            header.fdCount = ancillaryFds->size();
+
+            // The reader picks these up when it gets to the header below.
+            uint8_t marker = 0;
+            iovec markerIov{&marker, sizeof(marker)};
+            auto send = [&](iovec* iovs, int niovs) -> ssize_t {
+                return sendMessageOnSocket(mSocket, iovs, niovs, ancillaryFds);
+            };
+            if (status_t status = interruptableReadOrWrite(mSocket, fdTrigger, &markerIov, 1, send,
+                                                           "sendmsg", POLLOUT, altPoll);
+                status != OK) {
+                return status;
+            }
+        }
+
+        if (status_t status = push(fdTrigger, &header, sizeof(header), altPoll); status != OK) {
+            return status;
+        }
+        for (int i = 0; i < niovs; i++) {
+            if (status_t status = push(fdTrigger, iovs[i].iov_base, iovs[i].iov_len, altPoll);
+                status != OK) {
+                return status;
+            }
+        }
+        publishHead();
+        return OK;
+    }
+
+    status_t interruptableReadFully(
+            FdTrigger* fdTrigger, iovec* iovs, int niovs,
+            const std::optional<android::base::function_ref<status_t()>>& altPoll,
+            std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds) override {
+        if (mMapping == nullptr) {
+            auto recv = [&](iovec* iovs, int niovs) -> ssize_t {
+                return receiveMessageFromSocket(mSocket, iovs, niovs, ancillaryFds);
+            };
+            return interruptableReadOrWrite(mSocket, fdTrigger, iovs, niovs, recv, "recvmsg",
+                                            POLLIN, altPoll);
+        }
+
+        MAYBE_WAIT_IN_FLAKE_MODE;
+
+        if (niovs < 0) {
+            return BAD_VALUE;
+        }
+        if (fdTrigger->isTriggered()) {
+            return DEAD_OBJECT;
+        }
+
+        for (int i = 0; i < niovs; i++) {
+            uint8_t* data = static_cast<uint8_t*>(iovs[i].iov_base);
+            size_t size = iovs[i].iov_len;
+            while (size > 0) {
+                if (mRxChunkRemaining == 0) {
+                    ChunkHeader header;
+                    if (status_t status = pop(fdTrigger, &header, sizeof(header), altPoll);
+                        status != OK) {
+                        return status;
+                    }
+                    if (status_t status = takeFds(header.fdCount, ancillaryFds); status != OK) {
+                        return status;
+                    }
+                    mRxChunkRemaining = header.size;
+                    continue;
+                }
+                size_t n = std::min<size_t>(size, mRxChunkRemaining);
+                if (status_t status = pop(fdTrigger, data, n, altPoll); status != OK) {
+                    return status;
+                }
+                data += n;
+                size -= n;
+                mRxChunkRemaining -= n;
+            }
+        }
+        return OK;
+    }
+
+    bool isWaiting() override { return mSocket.isInPollingState(); }
+
+private:
+    status_t pollReadSocket() {
+        uint8_t buf;
+        ssize_t ret = TEMP_FAILURE_RETRY(
+                ::recv(mSocket.fd.get(), &buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT));
+        if (ret < 0) {
+            int savedErrno = errno;
+            if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK) {
+                return WOULD_BLOCK;
+            }
+
+            LOG_RPC_DETAIL("RpcTransport poll(): %s", strerror(savedErrno));
+            return -savedErrno;
+        } else if (ret == 0) {
+            return DEAD_OBJECT;
+        }
+
+        return OK;
+    }
+
+    // Copies |size| bytes into the transmit ring, waiting for the peer to make room as needed.
+    // Data only becomes visible to the peer on publishHead().
+    status_t push(FdTrigger* fdTrigger, const void* data, size_t size,
+                  const std::optional<android::base::function_ref<status_t()>>& altPoll) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        const size_t ringSize = mMapping->ringSize();
+        while (size > 0) {
+            uint64_t used = mTxHead - mTx->tail.load(std::memory_order_acquire);
+            if (used > ringSize) {
+                ALOGE("Peer corrupted the ring tail");
+                return DEAD_OBJECT;
+            }
+            if (used == ringSize) {
+                publishHead();
+                auto hasRoom = [&] {
+                    return mTxHead - mTx->tail.load(std::memory_order_seq_cst) != ringSize;
+                };
+                if (status_t status =
+                            waitForPeer(fdTrigger, mTx->producerWaiting, hasRoom, altPoll);
+                    status != OK) {
+                    return status;
+                }
+                continue;
+            }
+            size_t n = std::min(size, ringSize - used);
+            copyToRing(mTxData, ringSize, mTxHead, bytes, n);
+            mTxHead += n;
+            bytes += n;
+            size -= n;
+        }
+        return OK;
+    }
+
+    void publishHead() {
+        if (mTxPublished == mTxHead) return;
+        mTxPublished = mTxHead;
+        mTx->head.store(mTxHead, std::memory_order_seq_cst);
+        wakePeer(mTx->consumerWaiting);
+    }
+
+    // Copies |size| bytes out of the receive ring, waiting for the peer to write them as needed.
+    status_t pop(FdTrigger* fdTrigger, void* data, size_t size,
+                 const std::optional<android::base::function_ref<status_t()>>& altPoll) {
+        uint8_t* bytes = static_cast<uint8_t*>(data);
+        const size_t ringSize = mMapping->ringSize();
+        while (size > 0) {
+            uint64_t available = mRx->head.load(std::memory_order_acquire) - mRxTail;
+            if (available > ringSize) {
+                ALOGE("Peer corrupted the ring head");
+                return DEAD_OBJECT;
+            }
+            if (available == 0) {
+                auto hasData = [&] {
+                    return mRx->head.load(std::memory_order_seq_cst) != mRxTail;
+                };
+                if (status_t status =
+                            waitForPeer(fdTrigger, mRx->consumerWaiting, hasData, altPoll);
+                    status != OK) {
+                    return status;
+                }
+                continue;
+            }
+            size_t n = std::min<size_t>(size, available);
+            copyFromRing(mRxData, ringSize, mRxTail, bytes, n);
+            mRxTail += n;
+            bytes += n;
+            size -= n;
+            mRx->tail.store(mRxTail, std::memory_order_seq_cst);
+            wakePeer(mRx->producerWaiting);
+        }
+        return OK;
+    }
+
+    // Sleeps until the peer moves an index. |waiting| is set before |ready| is checked one last
+    // time, and the peer clears it after moving the index, so either we see the new index or
+    // the peer sees the flag and rings the doorbell on the socket.
+    template <typename Ready>
+    status_t waitForPeer(FdTrigger* fdTrigger, std::atomic<uint32_t>& waiting, Ready ready,
+                         const std::optional<android::base::function_ref<status_t()>>& altPoll) {
+        waiting.store(1, std::memory_order_seq_cst);
+        if (ready()) {
+            waiting.store(0, std::memory_order_relaxed);
+            return OK;
+        }
+        if (mPeerClosed) {
+            return DEAD_OBJECT;
+        }
+        if (altPoll) {
+            if (status_t status = (*altPoll)(); status != OK) return status;
+            if (fdTrigger->isTriggered()) {
+                return DEAD_OBJECT;
+            }
+            return OK;
+        }
+        if (status_t status = fdTrigger->triggerablePoll(mSocket, POLLIN); status != OK) {
+            return status;
+        }
+        return drainSocket();
+    }
+
+    void wakePeer(std::atomic<uint32_t>& waiting) {
+        if (waiting.load(std::memory_order_seq_cst) == 0 || waiting.exchange(0) == 0) return;
+        // If the socket is full, the peer has something to wake up for already.
+        uint8_t doorbell = 0;
+        TEMP_FAILURE_RETRY(::send(mSocket.fd.get(), &doorbell, sizeof(doorbell),
+                                  MSG_DONTWAIT | MSG_NOSIGNAL));
+    }
+
+    // Reads doorbells and file descriptors off the socket until it would block.
+    status_t drainSocket() {
+        while (!mPeerClosed) {
+            uint8_t buf[64];
+            iovec iov{buf, sizeof(buf)};
+            ssize_t ret = receiveMessageFromSocket(mSocket, &iov, 1, &mPendingFds);
+            if (ret < 0) {
+                int savedErrno = errno;
+                if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK) {
+                    return OK;
+                }
+                LOG_RPC_DETAIL("RpcTransport recvmsg(): %s", strerror(savedErrno));
+                return -savedErrno;
+            }
+            if (ret == 0) {
+                mPeerClosed = true;
+            }
+        }
+        return OK;
+    }
+
+    // Moves the file descriptors of the chunk that just started to |ancillaryFds|, or closes
+    // them if the caller doesn't expect any, like recvmsg() without a control buffer.
+    status_t takeFds(uint32_t count,
+                     std::vector<std::variant<base::unique_fd, base::borrowed_fd>>* ancillaryFds) {
+        if (count == 0) {
+            return OK;
+        }
+        if (count > kMaxFdsPerChunk) {
+            ALOGE("Peer sent a chunk with %" PRIu32 " fds", count);
+            return BAD_VALUE;
+        }
+        // The fds were sent before the chunk header was published, so they are already queued
+        // on the socket.
+        if (mPendingFds.size() < count) {
+            if (status_t status = drainSocket(); status != OK) {
+                return status;
+            }
+        }
+        if (mPendingFds.size() < count) {
+            ALOGE("Peer sent a chunk with %" PRIu32 " fds but only %zu arrived", count,
+                  mPendingFds.size());
+            return BAD_VALUE;
+        }
+        auto first = mPendingFds.begin();
+        auto last = first + count;
+        if (ancillaryFds != nullptr) {
+            ancillaryFds->insert(ancillaryFds->end(), std::make_move_iterator(first),
+                                 std::make_move_iterator(last));
+        }
+        mPendingFds.erase(first, last);
+        return OK;
+    }
+
+    android::RpcTransportFd mSocket;
+    std::unique_ptr<ShmMapping> mMapping;
+
+    RingControl* mTx = nullptr;
+    uint8_t* mTxData = nullptr;
+    uint64_t mTxHead = 0;
+    uint64_t mTxPublished = 0;
+
+    RingControl* mRx = nullptr;
+    uint8_t* mRxData = nullptr;
+    uint64_t mRxTail = 0;
+    uint32_t mRxChunkRemaining = 0;
+
+    std::vector<std::variant<base::unique_fd, base::borrowed_fd>> mPendingFds;
+    bool mPeerClosed = false;
+};
+
+// RpcTransportCtx with shared memory rings.
+class RpcTransportCtxShm : public RpcTransportCtx {
+public:
+    RpcTransportCtxShm(bool isClient, size_t ringSize)
+          : mIsClient(isClient), mRingSize(ringSize) {}
+
+    std::unique_ptr<RpcTransport> newTransport(android::RpcTransportFd socket,
+                                               FdTrigger* fdTrigger) const override {
+        std::unique_ptr<ShmMapping> mapping;
+        status_t status = mIsClient ? connectRings(socket, fdTrigger, &mapping)
+                                    : acceptRings(socket, fdTrigger, &mapping);
+        if (status != OK) {
+            ALOGE("Shared memory handshake failed: %s", statusToString(status).c_str());
+            return nullptr;
+        }
+        return std::make_unique<RpcTransportShm>(std::move(socket), std::move(mapping),
+                                                 mIsClient);
+    }
+    std::vector<uint8_t> getCertificate(RpcCertificateFormat) const override { return {}; }
+
+private:
+    status_t connectRings(const RpcTransportFd& socket, FdTrigger* fdTrigger,
+                          std::unique_ptr<ShmMapping>* outMapping) const {
+        ShmHello hello{.magic = kShmMagic, .ringSize = 0};
+        std::vector<std::variant<base::unique_fd, base::borrowed_fd>> fds;
+        base::unique_fd memfd;
+        std::unique_ptr<ShmMapping> mapping;
+        if (isUnixSocket(socket) && isValidRingSize(mRingSize)) {
+            memfd = createRingsFd(mRingSize);
+            if (memfd.ok()) mapping = ShmMapping::map(memfd, mRingSize);
+            if (mapping != nullptr) {
+                hello.ringSize = mRingSize;
+                fds.emplace_back(base::borrowed_fd(memfd));
+            }
+        }
+        if (status_t status = writeHello(socket, fdTrigger, hello, &fds); status != OK) {
+            return status;
+        }
+
+        ShmHello reply;
+        if (status_t status = readHello(socket, fdTrigger, &reply, nullptr); status != OK) {
+            return status;
+        }
+        if (reply.ringSize == 0) {
+            mapping.reset();
+        } else if (reply.ringSize != hello.ringSize) {
+            ALOGE("Server accepted %" PRIu32 " byte rings, expected %" PRIu32, reply.ringSize,
+                  hello.ringSize);
+            return BAD_VALUE;
+        }
+        *outMapping = std::move(mapping);
+        return OK;
+    }
+
+    status_t acceptRings(const RpcTransportFd& socket, FdTrigger* fdTrigger,
+                         std::unique_ptr<ShmMapping>* outMapping) const {
+        ShmHello hello;
+        std::vector<std::variant<base::unique_fd, base::borrowed_fd>> fds;
+        if (status_t status =
+                    readHello(socket, fdTrigger, &hello, isUnixSocket(socket) ? &fds : nullptr);
+            status != OK) {
+            return status;
+        }
+
+        std::unique_ptr<ShmMapping> mapping;
+        if (hello.ringSize != 0 && fds.size() == 1) {
+            mapping = mapRingsFd(std::get<base::unique_fd>(fds[0]), hello.ringSize);
+        }
+        ShmHello reply{.magic = kShmMagic,
+                       .ringSize = mapping != nullptr ? hello.ringSize : 0};
+        if (status_t status = writeHello(socket, fdTrigger, reply, nullptr); status != OK) {
+            return status;
+        }
+        *outMapping = std::move(mapping);
+        return OK;
+    }
+
+    bool mIsClient;
+    size_t mRingSize;
+};
+
+std::unique_ptr<RpcTransportCtx> RpcTransportCtxFactoryShm::newServerCtx() const {
+    return std::make_unique<RpcTransportCtxShm>(false /* isClient */, mRingSize);
+}
+
+std::unique_ptr<RpcTransportCtx> RpcTransportCtxFactoryShm::newClientCtx() const {
+    return std::make_unique<RpcTransportCtxShm>(true /* isClient */, mRingSize);
+}
+
+const char* RpcTransportCtxFactoryShm::toCString() const {
+    return "shm";
+}
+
+std::unique_ptr<RpcTransportCtxFactory> RpcTransportCtxFactoryShm::make(size_t ringSize) {
+    return std::unique_ptr<RpcTransportCtxFactoryShm>(new RpcTransportCtxFactoryShm(ringSize));
+}
+
+} // namespace android
@@ -294,6 +294,8 @@ public:
 
     bool isWaiting() { return mSocket.isInPollingState(); };
 
+    int pollableFd() override { return mSocket.fd.get(); }
+
 private:
     android::RpcTransportFd mSocket;
     Ssl mSsl;
@@ -636,6 +636,8 @@ private:
     // Set the capacity to `desired`, truncating the Parcel if necessary.
     status_t            continueWrite(size_t desired);
     status_t truncateRpcObjects(size_t newObjectsSize);
+    // Reallocate the kernel object offsets to hold at least `newCapacity` entries.
+    status_t resizeObjects(size_t newCapacity);
     status_t            writePointer(uintptr_t val);
     status_t            readPointer(uintptr_t *pArg) const;
     uintptr_t           readPointer() const;
@@ -23,12 +23,14 @@
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
 
+#include <chrono>
 #include <mutex>
 #include <thread>
 
 namespace android {
 
 class FdTrigger;
+class RpcDispatcher;
 class RpcServerTrusty;
 class RpcSocketAddress;
 
@@ -148,6 +150,31 @@ public:
     void setSupportedFileDescriptorTransportModes(
             const std::vector<RpcSession::FileDescriptorTransportMode>& modes);
 
+    /**
+     * Batch writes on the outgoing connections of sessions set up after this
+     * call, which carry callbacks to clients. See RpcSession::setWriteBatching.
+     *
+     * Returns false in single-threaded builds.
+     */
+    [[nodiscard]] bool setWriteBatching(size_t maxBytes, std::chrono::microseconds maxDelay);
+
+    /**
+     * Serve connections set up after this call from a shared pool of threads,
+     * which grows and shrinks with the number of transactions running at once,
+     * instead of from a thread per connection. This saves threads on servers
+     * with many mostly idle clients. Clients still open as many connections as
+     * setMaxThreads allows. Connections using transports which can't be
+     * watched with epoll keep their own thread.
+     *
+     * The pool has at most |maxThreads| threads; any more transactions wait
+     * for one to be free. A transaction which waits on another one to the
+     * same server, such as a nested call, needs a thread for each. The limit
+     * is set when dispatch is turned on, and kept until it is turned off.
+     *
+     * Returns false in single-threaded builds, or on failure.
+     */
+    [[nodiscard]] bool setEventDrivenDispatch(bool enabled, size_t maxThreads = 32);
+
     /**
      * The root object can be retrieved by any client, without any
      * authentication. TODO(b/183988761)
@@ -267,6 +294,9 @@ private:
     // A mode is supported if the N'th bit is on, where N is the mode enum's value.
     std::bitset<8> mSupportedFileDescriptorTransportModes = std::bitset<8>().set(
             static_cast<size_t>(RpcSession::FileDescriptorTransportMode::NONE));
+    size_t mWriteBatchMaxBytes = 0;
+    std::chrono::microseconds mWriteBatchMaxDelay{0};
+    std::shared_ptr<RpcDispatcher> mDispatcher;
     RpcTransportFd mServer; // socket we are accepting sessions on
 
     RpcMutex mLock; // for below
@@ -23,13 +23,16 @@
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
 
+#include <chrono>
 #include <map>
+#include <memory>
 #include <optional>
 #include <vector>
 
 namespace android {
 
 class Parcel;
+class RpcDispatcher;
 class RpcServer;
 class RpcServerTrusty;
 class RpcSocketAddress;
@@ -115,6 +118,21 @@ public:
     void setFileDescriptorTransportMode(FileDescriptorTransportMode mode);
     FileDescriptorTransportMode getFileDescriptorTransportMode();
 
+    /**
+     * Batch writes on outgoing connections. By default, this is off (maxBytes is 0).
+     *
+     * When on, oneway transactions without file descriptors and refcount commands
+     * are queued on their connection instead of being written right away. They
+     * are written together in a single write once |maxBytes| are queued,
+     * |maxDelay| after the first of them was queued, or as soon as anything else
+     * is sent or received on that connection. This trades oneway latency for
+     * fewer syscalls. This must be called before setting up this session.
+     *
+     * Returns false in single-threaded builds, which have no thread to flush
+     * expired batches.
+     */
+    [[nodiscard]] bool setWriteBatching(size_t maxBytes, std::chrono::microseconds maxDelay);
+
     /**
      * This should be called once per thread, matching 'join' in the remote
      * process.
@@ -259,6 +277,12 @@ private:
         std::optional<uint64_t> exclusiveTid;
 
         bool allowNested = false;
+
+        // Commands queued by RpcState when write batching is on, and when they
+        // have to be written by. Only touched by the thread in exclusiveTid.
+        bool batchWrites = false;
+        std::vector<uint8_t> pendingWrites;
+        std::chrono::steady_clock::time_point pendingDeadline;
     };
 
     [[nodiscard]] status_t readId();
@@ -281,6 +305,18 @@ private:
     PreJoinSetupResult preJoinSetup(std::unique_ptr<RpcTransport> rpcTransport);
     // join on thread passed to preJoinThreadOwnership
     static void join(sp<RpcSession>&& session, PreJoinSetupResult&& result);
+    // Instead of join, hands the connection to |dispatcher| and lets this
+    // thread go. Returns false, leaving everything alone, if setup failed or
+    // the transport can't be dispatched, in which case join must be called.
+    static bool joinDispatcher(const std::shared_ptr<RpcDispatcher>& dispatcher,
+                               sp<RpcSession>& session, PreJoinSetupResult& result);
+    // Runs the commands which are already available on |connection|. Returns
+    // false once the connection is done.
+    bool serveDispatchedCommands(const sp<RpcConnection>& connection);
+    // The end of join, for dispatched connections.
+    void endDispatchedConnection(const sp<RpcConnection>& connection);
+    // Releases the thread passed to preJoinThreadOwnership.
+    sp<EventListener> detachJoinThread();
 
     [[nodiscard]] status_t setupClient(
             const std::function<status_t(const std::vector<uint8_t>& sessionId, bool incoming)>&
@@ -304,6 +340,13 @@ private:
     [[nodiscard]] bool removeIncomingConnection(const sp<RpcConnection>& connection);
     void clearConnectionTid(const sp<RpcConnection>& connection);
 
+    // Wakes up the write flusher thread (starting it if needed) so that pending
+    // writes are flushed by |deadline|. mMutex must be held.
+    void scheduleFlushLocked(std::chrono::steady_clock::time_point deadline);
+    // Called by the write flusher thread. Flushes idle outgoing connections whose
+    // batch deadline has passed.
+    void flushExpiredWrites();
+
     [[nodiscard]] status_t initShutdownTrigger();
 
     /**
@@ -378,6 +421,13 @@ private:
     size_t mMaxOutgoingConnections = kDefaultMaxOutgoingConnections;
     std::optional<uint32_t> mProtocolVersion;
     FileDescriptorTransportMode mFileDescriptorTransportMode = FileDescriptorTransportMode::NONE;
+    size_t mWriteBatchMaxBytes = 0;
+    std::chrono::microseconds mWriteBatchMaxDelay{0};
+
+    // Shared with the thread flushing batched writes, which may outlive this
+    // session by a little if it drops the last reference.
+    struct WriteFlusher;
+    std::shared_ptr<WriteFlusher> mWriteFlusher;
 
     RpcConditionVariable mAvailableConnectionCv; // for mWaitingThreads
 
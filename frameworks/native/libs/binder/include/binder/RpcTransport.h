@@ -41,10 +41,12 @@ struct RpcTransportFd;
 
 // for 'friend'
 class RpcTransportRaw;
+class RpcTransportShm;
 class RpcTransportTls;
 class RpcTransportTipcAndroid;
 class RpcTransportTipcTrusty;
 class RpcTransportCtxRaw;
+class RpcTransportCtxShm;
 class RpcTransportCtxTls;
 class RpcTransportCtxTipcAndroid;
 class RpcTransportCtxTipcTrusty;
@@ -102,6 +104,16 @@ public:
      */
     [[nodiscard]] virtual bool isWaiting() = 0;
 
+    /**
+     *  File descriptor which becomes readable when data arrives on this
+     *  transport, so that it can be watched with poll or epoll instead of
+     *  blocking a thread in interruptableReadFully. Data already buffered by
+     *  the transport is not reported, so check pollRead first.
+     *  Return:
+     *    The fd, or -1 if the transport can't be watched this way.
+     */
+    [[nodiscard]] virtual int pollableFd() { return -1; }
+
 private:
     // limit the classes which can implement RpcTransport. Being able to change this
     // interface is important to allow development of RPC binder. In the past, we
@@ -113,6 +125,7 @@ private:
     // to add more transports.
 
     friend class ::android::RpcTransportRaw;
+    friend class ::android::RpcTransportShm;
     friend class ::android::RpcTransportTls;
     friend class ::android::RpcTransportTipcAndroid;
     friend class ::android::RpcTransportTipcTrusty;
@@ -144,6 +157,7 @@ public:
 private:
     // see comment on RpcTransport
     friend class ::android::RpcTransportCtxRaw;
+    friend class ::android::RpcTransportCtxShm;
     friend class ::android::RpcTransportCtxTls;
     friend class ::android::RpcTransportCtxTipcAndroid;
     friend class ::android::RpcTransportCtxTipcTrusty;
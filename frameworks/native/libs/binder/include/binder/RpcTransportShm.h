@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Wraps the transport layer of RPC. Implementation moves data through a pair of
+// shared memory ring buffers negotiated over a unix domain socket, and uses the
+// socket itself for wakeups and file descriptors. Connections over other socket
+// types fall back to plain sockets.
+// Note: don't use directly. You probably want newServerRpcTransportCtx / newClientRpcTransportCtx.
+
+#pragma once
+
+#include <memory>
+
+#include <binder/RpcTransport.h>
+
+namespace android {
+
+// RpcTransportCtxFactory with shared memory rings.
+class RpcTransportCtxFactoryShm : public RpcTransportCtxFactory {
+public:
+    // Size of each of the two rings a client asks for. Must be a power of two
+    // between 4KiB and 16MiB; the server rejects anything else and the
+    // connection falls back to the socket.
+    static constexpr size_t kDefaultRingSize = 256 * 1024;
+
+    static std::unique_ptr<RpcTransportCtxFactory> make(size_t ringSize = kDefaultRingSize);
+
+    std::unique_ptr<RpcTransportCtx> newServerCtx() const override;
+    std::unique_ptr<RpcTransportCtx> newClientCtx() const override;
+    const char* toCString() const override;
+
+private:
+    explicit RpcTransportCtxFactoryShm(size_t ringSize) : mRingSize(ringSize) {}
+
+    size_t mRingSize;
+};
+
+} // namespace android
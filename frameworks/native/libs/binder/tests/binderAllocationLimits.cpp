@@ -28,6 +28,8 @@
 #include <functional>
 #include <vector>
 
+#include "../ParcelBufferPool.h"
+
 static android::String8 gEmpty(""); // make sure first allocation from optimization runs
 
 struct DestructionAction {
@@ -195,8 +197,12 @@ TEST(BinderAllocation, InterfaceDescriptorTransaction) {
 }
 
 TEST(BinderAllocation, SmallTransaction) {
+    if (!android::ParcelBufferPool::kCacheEnabled) {
+        GTEST_SKIP() << "Parcel buffers are not cached in this build";
+    }
     String16 empty_descriptor = String16("");
     sp<IServiceManager> manager = defaultServiceManager();
+    manager->checkService(empty_descriptor); // fills the buffer cache
 
     size_t mallocs = 0;
     const auto on_malloc = OnMalloc([&](size_t bytes) {
@@ -206,7 +212,26 @@ TEST(BinderAllocation, SmallTransaction) {
     });
     manager->checkService(empty_descriptor);
 
-    EXPECT_EQ(mallocs, 1);
+    // The buffers used by the first checkService are reused.
+    EXPECT_EQ(mallocs, 0);
+}
+
+static void writeParcelTo8KiB() {
+    Parcel p;
+    for (int32_t i = 0; i < 2048; i++) {
+        p.writeInt32(i);
+    }
+    imaginary_use = p.data();
+}
+
+TEST(BinderAllocation, ParcelBuffersReused) {
+    if (!android::ParcelBufferPool::kCacheEnabled) {
+        GTEST_SKIP() << "Parcel buffers are not cached in this build";
+    }
+    writeParcelTo8KiB(); // first time through fills the buffer cache
+    const auto m = ScopeDisallowMalloc();
+    writeParcelTo8KiB();
+    writeParcelTo8KiB();
 }
 
 TEST(RpcBinderAllocation, SetupRpcServer) {
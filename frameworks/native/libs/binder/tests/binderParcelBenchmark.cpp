@@ -163,10 +163,35 @@ static void BM_Int64Vector(benchmark::State& state) {
     BM_ParcelVector<int64_t>(state);
 }
 
+/*
+  A Parcel written from scratch, read and destroyed, like the data of a
+  transaction. Buffers are reused across Parcels on the same thread.
+*/
+static void BM_ParcelRoundTrip(benchmark::State& state) {
+    const size_t bytes = state.range(0);
+
+    std::vector<uint8_t> v1(bytes);
+    std::vector<uint8_t> v2;
+    while (state.KeepRunning()) {
+        android::Parcel p;
+        p.writeInt32(0);
+        p.writeByteVector(v1);
+
+        p.setDataPosition(0);
+        (void)p.readInt32();
+        p.readByteVector(&v2);
+
+        benchmark::DoNotOptimize(v2.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
 BENCHMARK(BM_BoolVector)->Apply(VectorArgs);
 BENCHMARK(BM_ByteVector)->Apply(VectorArgs);
 BENCHMARK(BM_CharVector)->Apply(VectorArgs);
 BENCHMARK(BM_Int32Vector)->Apply(VectorArgs);
 BENCHMARK(BM_Int64Vector)->Apply(VectorArgs);
+BENCHMARK(BM_ParcelRoundTrip)->RangeMultiplier(4)->Range(16, 64 * 1024);
 
 BENCHMARK_MAIN();
@@ -20,6 +20,7 @@
 #include <binder/Binder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
+#include <binder/Parcel.h>
 #include <binder/ProcessState.h>
 #include <binder/RpcCertificateFormat.h>
 #include <binder/RpcCertificateVerifier.h>
@@ -28,10 +29,13 @@
 #include <binder/RpcTlsTestUtils.h>
 #include <binder/RpcTlsUtils.h>
 #include <binder/RpcTransportRaw.h>
+#include <binder/RpcTransportShm.h>
 #include <binder/RpcTransportTls.h>
 #include <openssl/ssl.h>
 
+#include <chrono>
 #include <thread>
+#include <vector>
 
 #include <signal.h>
 #include <sys/prctl.h>
@@ -45,6 +49,7 @@ using android::interface_cast;
 using android::IPCThreadState;
 using android::IServiceManager;
 using android::OK;
+using android::Parcel;
 using android::ProcessState;
 using android::RpcAuthPreSigned;
 using android::RpcCertificateFormat;
@@ -54,6 +59,7 @@ using android::RpcServer;
 using android::RpcSession;
 using android::RpcTransportCtxFactory;
 using android::RpcTransportCtxFactoryRaw;
+using android::RpcTransportCtxFactoryShm;
 using android::RpcTransportCtxFactoryTls;
 using android::sp;
 using android::status_t;
@@ -118,6 +124,8 @@ enum Transport {
     KERNEL,
     RPC,
     RPC_TLS,
+    RPC_SHM,
+    RPC_BATCHED,
 };
 
 static const std::initializer_list<int64_t> kTransportList = {
@@ -126,6 +134,8 @@ static const std::initializer_list<int64_t> kTransportList = {
 #endif
         Transport::RPC,
         Transport::RPC_TLS,
+        Transport::RPC_SHM,
+        Transport::RPC_BATCHED,
 };
 
 std::unique_ptr<RpcTransportCtxFactory> makeFactoryTls() {
@@ -145,6 +155,16 @@ static sp<IBinder> gRpcBinder;
 // Skip certificate validation to simplify the setup process.
 static sp<RpcSession> gSessionTls = RpcSession::make(makeFactoryTls());
 static sp<IBinder> gRpcTlsBinder;
+static sp<RpcSession> gSessionShm = RpcSession::make(RpcTransportCtxFactoryShm::make());
+static sp<IBinder> gRpcShmBinder;
+// Same server as gSession, but the client batches oneway calls and refcount updates.
+static sp<RpcSession> gSessionBatched = RpcSession::make();
+static sp<IBinder> gRpcBatchedBinder;
+// One session per benchmark thread, against a server with a thread per
+// connection, or one serving all connections from a shared pool.
+constexpr size_t kMaxConcurrentClients = 64;
+static std::vector<sp<IBinder>> gThreadedServerBinders;
+static std::vector<sp<IBinder>> gDispatchServerBinders;
 #ifdef __BIONIC__
 static const String16 kKernelBinderInstance = String16(u"binderRpcBenchmark-control");
 static sp<IBinder> gKernelBinder;
@@ -161,6 +181,10 @@ static sp<IBinder> getBinderForOptions(benchmark::State& state) {
             return gRpcBinder;
         case RPC_TLS:
             return gRpcTlsBinder;
+        case RPC_SHM:
+            return gRpcShmBinder;
+        case RPC_BATCHED:
+            return gRpcBatchedBinder;
         default:
             LOG(FATAL) << "Unknown transport value: " << transport;
             return nullptr;
@@ -181,6 +205,12 @@ static void SetLabel(benchmark::State& state) {
         case RPC_TLS:
             state.SetLabel("rpc_tls");
             break;
+        case RPC_SHM:
+            state.SetLabel("rpc_shm");
+            break;
+        case RPC_BATCHED:
+            state.SetLabel("rpc_batched");
+            break;
         default:
             LOG(FATAL) << "Unknown transport value: " << transport;
     }
@@ -301,9 +331,54 @@ void BM_repeatBinder(benchmark::State& state) {
 }
 BENCHMARK(BM_repeatBinder)->ArgsProduct({kTransportList});
 
-void forkRpcServer(const char* addr, const sp<RpcServer>& server) {
+void BM_onewayThroughput(benchmark::State& state) {
+    sp<IBinder> binder = getBinderForOptions(state);
+    CHECK(binder != nullptr);
+
+    // oneway calls return as soon as they are written, so send a burst and
+    // then a synchronous call to wait for the other side to catch up
+    constexpr size_t kCallsPerIteration = 32;
+
+    Parcel data;
+    data.markForBinder(binder);
+    std::vector<uint8_t> bytes(state.range(1));
+    CHECK_EQ(OK, data.write(bytes.data(), bytes.size()));
+
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < kCallsPerIteration; i++) {
+            CHECK_EQ(OK,
+                     binder->transact(IBinder::PING_TRANSACTION, data, nullptr,
+                                      IBinder::FLAG_ONEWAY));
+        }
+        CHECK_EQ(OK, binder->pingBinder());
+    }
+
+    state.SetItemsProcessed(state.iterations() * kCallsPerIteration);
+    state.SetBytesProcessed(state.iterations() * kCallsPerIteration * bytes.size());
+    SetLabel(state);
+}
+BENCHMARK(BM_onewayThroughput)->ArgsProduct({kTransportList, {0, 256, 4096}});
+
+void BM_concurrentClients(benchmark::State& state) {
+    bool eventDriven = state.range(0);
+    const auto& binders = eventDriven ? gDispatchServerBinders : gThreadedServerBinders;
+    sp<IBinder> binder = binders.at(state.thread_index());
+    CHECK(binder != nullptr);
+
+    while (state.KeepRunning()) {
+        CHECK_EQ(OK, binder->pingBinder());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(eventDriven ? "event_driven" : "thread_per_connection");
+}
+BENCHMARK(BM_concurrentClients)->Arg(0)->Arg(1)->ThreadRange(1, kMaxConcurrentClients)->UseRealTime();
+
+void forkRpcServer(const char* addr, const sp<RpcServer>& server, bool eventDriven = false) {
     if (0 == fork()) {
         prctl(PR_SET_PDEATHSIG, SIGHUP); // racey, okay
+        // after fork, since the dispatcher starts threads
+        if (eventDriven) CHECK(server->setEventDrivenDispatch(true, kMaxConcurrentClients));
         server->setRootObject(sp<MyBinderRpcBenchmark>::make());
         CHECK_EQ(OK, server->setupUnixDomainServer(addr));
         server->join();
@@ -350,12 +425,36 @@ int main(int argc, char** argv) {
     setupClient(gSession, addr.c_str());
     gRpcBinder = gSession->getRootObject();
 
+    CHECK(gSessionBatched->setWriteBatching(64 * 1024, std::chrono::milliseconds(1)));
+    setupClient(gSessionBatched, addr.c_str());
+    gRpcBatchedBinder = gSessionBatched->getRootObject();
+
     std::string tlsAddr = tmp + "/binderRpcTlsBenchmark";
     (void)unlink(tlsAddr.c_str());
     forkRpcServer(tlsAddr.c_str(), RpcServer::make(makeFactoryTls()));
     setupClient(gSessionTls, tlsAddr.c_str());
     gRpcTlsBinder = gSessionTls->getRootObject();
 
+    std::string shmAddr = tmp + "/binderRpcShmBenchmark";
+    (void)unlink(shmAddr.c_str());
+    forkRpcServer(shmAddr.c_str(), RpcServer::make(RpcTransportCtxFactoryShm::make()));
+    setupClient(gSessionShm, shmAddr.c_str());
+    gRpcShmBinder = gSessionShm->getRootObject();
+
+    for (bool eventDriven : {false, true}) {
+        std::string concurrentAddr =
+                tmp + (eventDriven ? "/binderRpcDispatchBenchmark" : "/binderRpcThreadedBenchmark");
+        (void)unlink(concurrentAddr.c_str());
+        forkRpcServer(concurrentAddr.c_str(), RpcServer::make(RpcTransportCtxFactoryRaw::make()),
+                      eventDriven);
+        auto& binders = eventDriven ? gDispatchServerBinders : gThreadedServerBinders;
+        for (size_t i = 0; i < kMaxConcurrentClients; i++) {
+            sp<RpcSession> session = RpcSession::make();
+            setupClient(session, concurrentAddr.c_str());
+            binders.push_back(session->getRootObject());
+        }
+    }
+
     ::benchmark::RunSpecifiedBenchmarks();
     return 0;
 }
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays transactions recorded with RecordedTransaction (see record_binder)
+// over RPC binder, from several clients at once and at a chosen pace, and
+// reports the latency distribution and throughput.
+//
+// Without -u, the transactions are sent to a server in this process whose
+// root object accepts everything, which measures libbinder itself.
+
+#include <android-base/logging.h>
+#include <android-base/parsedouble.h>
+#include <android-base/parseint.h>
+#include <android-base/unique_fd.h>
+#include <binder/Binder.h>
+#include <binder/Parcel.h>
+#include <binder/RecordedTransaction.h>
+#include <binder/RpcServer.h>
+#include <binder/RpcSession.h>
+#include <binder/RpcTransportRaw.h>
+#include <binder/RpcTransportShm.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+using android::BBinder;
+using android::IBinder;
+using android::OK;
+using android::Parcel;
+using android::RpcServer;
+using android::RpcSession;
+using android::RpcTransportCtxFactory;
+using android::RpcTransportCtxFactoryRaw;
+using android::RpcTransportCtxFactoryShm;
+using android::sp;
+using android::status_t;
+using android::String16;
+using android::base::unique_fd;
+using android::binder::debug::RecordedTransaction;
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string recordingPath;
+    std::string serverPath;
+    bool shm = false;
+    bool eventDriven = false;
+    size_t clients = 1;
+    size_t passes = 100;
+    size_t warmupPasses = 1;
+    // total transactions per second, 0 for as fast as possible
+    double rate = 0;
+    // if not 0, replay with the recorded gaps divided by this
+    double speed = 0;
+};
+
+// What one recorded transaction is replayed as.
+struct Call {
+    uint32_t code;
+    uint32_t flags;
+    status_t expectedStatus;
+    std::vector<uint8_t> data;
+    // from the start of the recording
+    Clock::duration offset;
+};
+
+// Accepts every transaction, for replaying without the recorded service.
+class AcceptAllBinder : public BBinder {
+public:
+    status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                        uint32_t flags) override {
+        if (code < IBinder::FIRST_CALL_TRANSACTION || code > IBinder::LAST_CALL_TRANSACTION) {
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+        return OK;
+    }
+};
+
+// Transactions recorded from kernel binder start with a header RPC binder
+// doesn't use (strict mode policy, work source and a marker) before the
+// interface token. Returns how many bytes to skip so that |transaction| can be
+// sent over RPC.
+size_t kernelHeaderSize(const RecordedTransaction& transaction) {
+    constexpr size_t kKernelHeaderSize = 3 * sizeof(int32_t);
+    const Parcel& recorded = transaction.getDataParcel();
+    if (transaction.getVersion() != 0 || transaction.getInterfaceName().empty() ||
+        recorded.dataSize() < kKernelHeaderSize) {
+        return 0;
+    }
+
+    Parcel token;
+    if (token.setData(recorded.data() + kKernelHeaderSize,
+                      recorded.dataSize() - kKernelHeaderSize) != OK) {
+        return 0;
+    }
+    size_t length;
+    const char16_t* name = token.readString16Inplace(&length);
+    if (name == nullptr ||
+        String16(name, length) != String16(transaction.getInterfaceName().c_str())) {
+        return 0;
+    }
+    return kKernelHeaderSize;
+}
+
+bool loadRecording(const std::string& path, std::vector<Call>* calls) {
+    unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd.ok()) {
+        std::cerr << "Failed to open recording " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::optional<timespec> first;
+    while (auto transaction = RecordedTransaction::fromFile(fd)) {
+        timespec timestamp = transaction->getTimestamp();
+        if (!first) first = timestamp;
+
+        const Parcel& recorded = transaction->getDataParcel();
+        size_t skip = kernelHeaderSize(*transaction);
+        calls->push_back(Call{
+                .code = transaction->getCode(),
+                .flags = transaction->getFlags(),
+                .expectedStatus = transaction->getReturnedStatus(),
+                .data = std::vector<uint8_t>(recorded.data() + skip,
+                                             recorded.data() + recorded.dataSize()),
+                .offset = std::chrono::seconds(timestamp.tv_sec - first->tv_sec) +
+                        std::chrono::nanoseconds(timestamp.tv_nsec - first->tv_nsec),
+        });
+    }
+
+    if (calls->empty()) {
+        std::cerr << "No valid transaction found in recording " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct ClientResults {
+    std::vector<Clock::duration> latencies;
+    size_t mismatches = 0;
+};
+
+// Replays |calls| on |binder| |passes| times. When paced, latencies are
+// measured from when each call was due rather than from when it was sent, so
+// that a slow call also counts against the calls it delayed.
+void runClient(const sp<IBinder>& binder, const std::vector<Call>& calls, const Options& options,
+               size_t clientIndex, size_t passes, Clock::time_point start,
+               ClientResults* results) {
+    // per client, when paced by rate
+    Clock::duration interval{0};
+    if (options.rate > 0) {
+        interval = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(options.clients / options.rate));
+        start += interval * static_cast<Clock::rep>(clientIndex) /
+                static_cast<Clock::rep>(options.clients);
+    }
+    Clock::duration recordingLength{0};
+    if (options.speed > 0) {
+        Clock::duration span = calls.back().offset;
+        // leave the average gap between the end of a pass and the next one
+        recordingLength =
+                span + (calls.size() > 1 ? span / static_cast<Clock::rep>(calls.size() - 1) : span);
+    }
+
+    results->latencies.reserve(results->latencies.size() + passes * calls.size());
+    size_t sent = 0;
+    for (size_t pass = 0; pass < passes; pass++) {
+        for (const Call& call : calls) {
+            Clock::time_point due = Clock::now();
+            if (options.speed > 0) {
+                due = start +
+                        std::chrono::duration_cast<Clock::duration>(
+                                (recordingLength * static_cast<Clock::rep>(pass) + call.offset) /
+                                options.speed);
+            } else if (options.rate > 0) {
+                due = start + interval * static_cast<Clock::rep>(sent);
+            }
+            std::this_thread::sleep_until(due);
+            sent++;
+
+            Parcel data, reply;
+            data.markForBinder(binder);
+            CHECK_EQ(OK, data.setData(call.data.data(), call.data.size()));
+            bool oneway = call.flags & IBinder::FLAG_ONEWAY;
+            status_t status = binder->transact(call.code, data, oneway ? nullptr : &reply,
+                                               call.flags);
+
+            results->latencies.push_back(Clock::now() - due);
+            if (status != call.expectedStatus) results->mismatches++;
+        }
+    }
+}
+
+// Runs every client over the same calls, starting them together.
+ClientResults runClients(const std::vector<sp<IBinder>>& binders, const std::vector<Call>& calls,
+                         const Options& options, size_t passes) {
+    std::vector<ClientResults> results(binders.size());
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::optional<Clock::time_point> start;
+    for (size_t i = 0; i < binders.size(); i++) {
+        threads.emplace_back([&, i] {
+            Clock::time_point clientStart;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return start.has_value(); });
+                clientStart = *start;
+            }
+            runClient(binders[i], calls, options, i, passes, clientStart, &results[i]);
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        start = Clock::now();
+    }
+    cv.notify_all();
+    for (auto& thread : threads) thread.join();
+
+    ClientResults total;
+    for (auto& result : results) {
+        total.latencies.insert(total.latencies.end(), result.latencies.begin(),
+                               result.latencies.end());
+        total.mismatches += result.mismatches;
+    }
+    return total;
+}
+
+double toMicros(Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void report(ClientResults& results, Clock::duration elapsed) {
+    auto& latencies = results.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        size_t index = static_cast<size_t>(p * (latencies.size() - 1) + 0.5);
+        return toMicros(latencies[index]);
+    };
+
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "transactions: " << latencies.size() << " (" << results.mismatches
+              << " returned a different status than recorded)" << std::endl;
+    std::cout << "throughput: " << latencies.size() / seconds << " transactions/s" << std::endl;
+    std::cout << "latency (us): p50 " << percentile(0.5) << " p99 " << percentile(0.99)
+              << " p999 " << percentile(0.999) << " max " << toMicros(latencies.back())
+              << std::endl;
+}
+
+std::unique_ptr<RpcTransportCtxFactory> makeFactory(const Options& options) {
+    if (options.shm) return RpcTransportCtxFactoryShm::make();
+    return RpcTransportCtxFactoryRaw::make();
+}
+
+void printHelp(const char* toolName) {
+    std::cout << "Usage: \n\n"
+              << toolName << " -r <recording_path> [options]\n\n"
+              << "  -u <path>    unix domain socket of the RpcServer to replay against. By\n"
+                 "               default, a server in this process accepts everything.\n"
+                 "  -t raw|shm   transport (default raw)\n"
+                 "  -e           serve the local server with setEventDrivenDispatch\n"
+                 "  -c <n>       concurrent clients, with a session each (default 1)\n"
+                 "  -n <n>       passes over the recording per client (default 100)\n"
+                 "  -w <n>       untimed passes to run first (default 1)\n"
+                 "  -q <rate>    total transactions per second (default: as fast as possible)\n"
+                 "  -x <speed>   replay at the recorded pace, sped up by <speed>\n\n"
+                 "Transactions are replayed as flat data: binders and file descriptors in\n"
+                 "them are not sent.\n\n*Use record_binder tool for recording binder "
+                 "transactions."
+              << std::endl;
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:u:t:ec:n:w:q:x:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                options->recordingPath = optarg;
+                break;
+            case 'u':
+                options->serverPath = optarg;
+                break;
+            case 't':
+                if (optarg == std::string("shm")) {
+                    options->shm = true;
+                } else if (optarg != std::string("raw")) {
+                    return false;
+                }
+                break;
+            case 'e':
+                options->eventDriven = true;
+                break;
+            case 'c':
+                if (!android::base::ParseUint(optarg, &options->clients, size_t{1024}) ||
+                    options->clients == 0) {
+                    return false;
+                }
+                break;
+            case 'n':
+                if (!android::base::ParseUint(optarg, &options->passes) || options->passes == 0) {
+                    return false;
+                }
+                break;
+            case 'w':
+                if (!android::base::ParseUint(optarg, &options->warmupPasses)) return false;
+                break;
+            case 'q':
+                if (!android::base::ParseDouble(optarg, &options->rate, 0.0)) return false;
+                break;
+            case 'x':
+                if (!android::base::ParseDouble(optarg, &options->speed, 0.0)) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc && !options->recordingPath.empty();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    std::vector<Call> calls;
+    if (!loadRecording(options.recordingPath, &calls)) return 1;
+
+    sp<RpcServer> server;
+    std::thread serverThread;
+    std::string serverPath = options.serverPath;
+    if (serverPath.empty()) {
+        serverPath = std::string(getenv("TMPDIR") ?: "/tmp") + "/binderRpcReplayBenchmark";
+        (void)unlink(serverPath.c_str());
+
+        server = RpcServer::make(makeFactory(options));
+        server->setRootObject(sp<AcceptAllBinder>::make());
+        if (options.eventDriven) CHECK(server->setEventDrivenDispatch(true));
+        CHECK_EQ(OK, server->setupUnixDomainServer(serverPath.c_str()));
+        serverThread = std::thread([server] { server->join(); });
+    }
+
+    std::vector<sp<RpcSession>> sessions;
+    std::vector<sp<IBinder>> binders;
+    for (size_t i = 0; i < options.clients; i++) {
+        sp<RpcSession> session = RpcSession::make(makeFactory(options));
+        status_t status = session->setupUnixDomainClient(serverPath.c_str());
+        if (status != OK) {
+            std::cerr << "Could not connect to " << serverPath << ": "
+                      << android::statusToString(status) << std::endl;
+            return 1;
+        }
+        binders.push_back(session->getRootObject());
+        CHECK(binders.back() != nullptr);
+        sessions.push_back(session);
+    }
+
+    if (options.warmupPasses > 0) {
+        Options warmup = options;
+        warmup.rate = warmup.speed = 0;
+        (void)runClients(binders, calls, warmup, options.warmupPasses);
+    }
+
+    Clock::time_point start = Clock::now();
+    ClientResults results = runClients(binders, calls, options, options.passes);
+    report(results, Clock::now() - start);
+
+    binders.clear();
+    for (const auto& session : sessions) (void)session->shutdownAndWait(true);
+    if (server != nullptr) {
+        while (!server->shutdown()) usleep(10 * 1000);
+        serverThread.join();
+        (void)unlink(serverPath.c_str());
+    }
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include <aidl/IBinderRpcTest.h>
 #include <android-base/stringprintf.h>
 
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
 #include <iostream>
@@ -357,6 +358,10 @@ std::unique_ptr<ProcessSession> BinderRpc::createRpcTestSocketServerProcessEtc(
         session->setMaxIncomingThreads(numIncoming);
         session->setMaxOutgoingConnections(options.numOutgoingConnections);
         session->setFileDescriptorTransportMode(options.clientFileDescriptorTransportMode);
+        if (options.clientWriteBatchBytes > 0) {
+            CHECK(session->setWriteBatching(options.clientWriteBatchBytes,
+                                            std::chrono::milliseconds(1)));
+        }
 
         switch (socketType) {
             case SocketType::PRECONNECTED:
@@ -622,6 +627,39 @@ TEST_P(BinderRpc, OnewayCallQueueing) {
     saturateThreadPool(1 + kNumExtraServerThreads, proc.rootIface);
 }
 
+TEST_P(BinderRpc, OnewayCallBatching) {
+    if (clientOrServerSingleThreaded()) {
+        GTEST_SKIP() << "This test requires multiple threads";
+    }
+
+    constexpr size_t kNumQueued = 10;
+    constexpr size_t kNumStrings = 100;
+    constexpr size_t kNumExtraServerThreads = 4;
+
+    auto proc = createRpcTestSocketServerProcess({
+            .numThreads = 1 + kNumExtraServerThreads,
+            .clientWriteBatchBytes = 4096,
+    });
+
+    // batched oneway calls must still arrive in order, and must be flushed
+    // ahead of any synchronous call on the same connection
+    for (size_t i = 0; i + 1 < kNumQueued; i++) {
+        EXPECT_OK(proc.rootIface->blockingSendIntOneway(i));
+    }
+    for (size_t i = 0; i + 1 < kNumQueued; i++) {
+        int n;
+        EXPECT_OK(proc.rootIface->blockingRecvInt(&n));
+        EXPECT_EQ(n, i);
+    }
+
+    // bursts larger than the batch are split across several writes
+    for (size_t i = 0; i < kNumStrings; i++) {
+        EXPECT_OK(proc.rootIface->sendString(std::string(100, 'a' + i % 26)));
+    }
+
+    saturateThreadPool(1 + kNumExtraServerThreads, proc.rootIface);
+}
+
 TEST_P(BinderRpc, OnewayCallExhaustion) {
     if (clientOrServerSingleThreaded()) {
         GTEST_SKIP() << "This test requires multiple threads";
@@ -1458,6 +1496,176 @@ TEST_P(BinderRpcServerOnly, Shutdown) {
             << "After server->shutdown() returns true, join() did not stop after 2s";
 }
 
+TEST_P(BinderRpcServerOnly, EventDrivenDispatch) {
+    if constexpr (!kEnableRpcThreads) {
+        GTEST_SKIP() << "Test skipped because threads were disabled at build time";
+    }
+    if (std::get<0>(GetParam()) != RpcSecurity::RAW) {
+        GTEST_SKIP() << "Dispatch doesn't depend on the security of the transport";
+    }
+
+    constexpr size_t kNumClients = 4;
+
+    // Every call waits for all of them to arrive, so they can only succeed if
+    // the connections are served on as many threads at once.
+    class BarrierBinder : public BBinder {
+    public:
+        status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                            uint32_t flags) override {
+            if (code != IBinder::FIRST_CALL_TRANSACTION) {
+                return BBinder::onTransact(code, data, reply, flags);
+            }
+            std::unique_lock<std::mutex> lock(mMutex);
+            mArrived++;
+            mCv.notify_all();
+            return mCv.wait_for(lock, 5s, [&] { return mArrived >= kNumClients; }) ? OK
+                                                                                  : TIMED_OUT;
+        }
+
+    private:
+        std::mutex mMutex;
+        std::condition_variable mCv;
+        size_t mArrived = 0;
+    };
+
+    auto addr = allocateSocketAddress();
+    auto server = RpcServer::make(RpcTransportCtxFactoryRaw::make());
+    ASSERT_TRUE(server->setProtocolVersion(std::get<1>(GetParam())));
+    ASSERT_TRUE(server->setEventDrivenDispatch(true));
+    server->setRootObject(sp<BarrierBinder>::make());
+    ASSERT_EQ(OK, server->setupUnixDomainServer(addr.c_str()));
+    auto joinEnds = std::make_shared<OneOffSignal>();
+    std::thread([server, joinEnds] {
+        server->join();
+        joinEnds->notify();
+    }).detach();
+
+    std::vector<sp<RpcSession>> sessions;
+    std::vector<sp<IBinder>> roots;
+    for (size_t i = 0; i < kNumClients; i++) {
+        auto session = RpcSession::make(RpcTransportCtxFactoryRaw::make());
+        ASSERT_EQ(OK, session->setupUnixDomainClient(addr.c_str()));
+        sp<IBinder> root = session->getRootObject();
+        ASSERT_NE(nullptr, root);
+        sessions.push_back(session);
+        roots.push_back(root);
+    }
+
+    std::vector<status_t> statuses(kNumClients, UNKNOWN_ERROR);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kNumClients; i++) {
+        threads.emplace_back([&, i] {
+            Parcel data, reply;
+            data.markForBinder(roots[i]);
+            statuses[i] = roots[i]->transact(IBinder::FIRST_CALL_TRANSACTION, data, &reply);
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (size_t i = 0; i < kNumClients; i++) {
+        EXPECT_EQ(OK, statuses[i]) << "client " << i;
+    }
+
+    // idle connections are still served
+    for (const auto& root : roots) EXPECT_EQ(OK, root->pingBinder());
+
+    roots.clear();
+    for (const auto& session : sessions) EXPECT_TRUE(session->shutdownAndWait(true));
+
+    bool shutdown = false;
+    for (int i = 0; i < 10 && !shutdown; i++) {
+        usleep(30 * 1000); // 30ms; total 300ms
+        if (server->shutdown()) shutdown = true;
+    }
+    ASSERT_TRUE(shutdown) << "server->shutdown() never returns true";
+    ASSERT_TRUE(joinEnds->wait(2s))
+            << "After server->shutdown() returns true, join() did not stop after 2s";
+}
+
+TEST_P(BinderRpcServerOnly, EventDrivenDispatchMaxThreads) {
+    if constexpr (!kEnableRpcThreads) {
+        GTEST_SKIP() << "Test skipped because threads were disabled at build time";
+    }
+    if (std::get<0>(GetParam()) != RpcSecurity::RAW) {
+        GTEST_SKIP() << "Dispatch doesn't depend on the security of the transport";
+    }
+
+    constexpr size_t kNumClients = 6;
+    constexpr size_t kMaxThreads = 2;
+
+    // Records how many calls run at once.
+    class CountingBinder : public BBinder {
+    public:
+        status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                            uint32_t flags) override {
+            if (code != IBinder::FIRST_CALL_TRANSACTION) {
+                return BBinder::onTransact(code, data, reply, flags);
+            }
+            size_t running = ++mRunning;
+            size_t max = mMaxRunning.load();
+            while (running > max && !mMaxRunning.compare_exchange_weak(max, running)) {
+            }
+            usleep(50 * 1000); // 50ms
+            mRunning--;
+            return OK;
+        }
+
+        std::atomic<size_t> mRunning = 0;
+        std::atomic<size_t> mMaxRunning = 0;
+    };
+
+    auto addr = allocateSocketAddress();
+    auto server = RpcServer::make(RpcTransportCtxFactoryRaw::make());
+    ASSERT_TRUE(server->setProtocolVersion(std::get<1>(GetParam())));
+    ASSERT_TRUE(server->setEventDrivenDispatch(true, kMaxThreads));
+    auto binder = sp<CountingBinder>::make();
+    server->setRootObject(binder);
+    ASSERT_EQ(OK, server->setupUnixDomainServer(addr.c_str()));
+    auto joinEnds = std::make_shared<OneOffSignal>();
+    std::thread([server, joinEnds] {
+        server->join();
+        joinEnds->notify();
+    }).detach();
+
+    std::vector<sp<RpcSession>> sessions;
+    std::vector<sp<IBinder>> roots;
+    for (size_t i = 0; i < kNumClients; i++) {
+        auto session = RpcSession::make(RpcTransportCtxFactoryRaw::make());
+        ASSERT_EQ(OK, session->setupUnixDomainClient(addr.c_str()));
+        sp<IBinder> root = session->getRootObject();
+        ASSERT_NE(nullptr, root);
+        sessions.push_back(session);
+        roots.push_back(root);
+    }
+
+    // Calls beyond the limit wait for a thread rather than fail.
+    std::vector<status_t> statuses(kNumClients, UNKNOWN_ERROR);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kNumClients; i++) {
+        threads.emplace_back([&, i] {
+            Parcel data, reply;
+            data.markForBinder(roots[i]);
+            statuses[i] = roots[i]->transact(IBinder::FIRST_CALL_TRANSACTION, data, &reply);
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (size_t i = 0; i < kNumClients; i++) {
+        EXPECT_EQ(OK, statuses[i]) << "client " << i;
+    }
+    EXPECT_EQ(kMaxThreads, binder->mMaxRunning.load());
+
+    roots.clear();
+    for (const auto& session : sessions) EXPECT_TRUE(session->shutdownAndWait(true));
+
+    bool shutdown = false;
+    for (int i = 0; i < 10 && !shutdown; i++) {
+        usleep(30 * 1000); // 30ms; total 300ms
+        if (server->shutdown()) shutdown = true;
+    }
+    ASSERT_TRUE(shutdown) << "server->shutdown() never returns true";
+    ASSERT_TRUE(joinEnds->wait(2s))
+            << "After server->shutdown() returns true, join() did not stop after 2s";
+}
+
 INSTANTIATE_TEST_CASE_P(BinderRpc, BinderRpcServerOnly,
                         ::testing::Combine(::testing::ValuesIn(RpcSecurityValues()),
                                            ::testing::ValuesIn(testVersions())),
@@ -1752,7 +1960,8 @@ public:
             for (auto socketType : testSocketTypes(false /* hasPreconnected */)) {
                 for (auto rpcSecurity : RpcSecurityValues()) {
                     switch (rpcSecurity) {
-                        case RpcSecurity::RAW: {
+                        case RpcSecurity::RAW:
+                        case RpcSecurity::SHM: {
                             ret.emplace_back(socketType, rpcSecurity, std::nullopt, serverVersion);
                         } break;
                         case RpcSecurity::TLS: {
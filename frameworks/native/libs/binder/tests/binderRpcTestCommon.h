@@ -46,6 +46,7 @@
 #include <binder/ProcessState.h>
 #include <binder/RpcTlsTestUtils.h>
 #include <binder/RpcTlsUtils.h>
+#include <binder/RpcTransportShm.h>
 #include <binder/RpcTransportTls.h>
 
 #include <signal.h>
@@ -64,10 +65,10 @@ namespace android {
 
 constexpr char kLocalInetAddress[] = "127.0.0.1";
 
-enum class RpcSecurity { RAW, TLS };
+enum class RpcSecurity { RAW, TLS, SHM };
 
 static inline std::vector<RpcSecurity> RpcSecurityValues() {
-    return {RpcSecurity::RAW, RpcSecurity::TLS};
+    return {RpcSecurity::RAW, RpcSecurity::TLS, RpcSecurity::SHM};
 }
 
 static inline std::vector<uint32_t> testVersions() {
@@ -137,6 +138,8 @@ struct BinderRpcOptions {
     std::vector<RpcSession::FileDescriptorTransportMode>
             serverSupportedFileDescriptorTransportModes = {
                     RpcSession::FileDescriptorTransportMode::NONE};
+    // If non-zero, client sessions batch oneway calls up to this many bytes.
+    size_t clientWriteBatchBytes = 0;
 
     // If true, connection failures will result in `ProcessSession::sessions` being empty
     // instead of a fatal error.
@@ -189,6 +192,8 @@ static inline std::unique_ptr<RpcTransportCtxFactory> newTlsFactory(
             }
             return RpcTransportCtxFactoryTls::make(std::move(verifier), std::move(auth));
         }
+        case RpcSecurity::SHM:
+            return RpcTransportCtxFactoryShm::make();
         default:
             LOG_ALWAYS_FATAL("Unknown RpcSecurity %d", rpcSecurity);
     }
@@ -67,6 +67,22 @@ etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height);
 int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut);
 
+// Quality settings for etc1_encode_image_with_options.
+// ETC1_QUALITY_DEFAULT gives the same output as etc1_encode_image.
+// ETC1_QUALITY_PREVIEW only tries the block orientation that looks most promising, which takes
+// about a third less time at a small loss of quality.
+
+#define ETC1_QUALITY_DEFAULT 0
+#define ETC1_QUALITY_PREVIEW 1
+
+// Encode an entire image, as etc1_encode_image, splitting the work across threadCount threads.
+// threadCount 0 means one thread per CPU. The output doesn't depend on threadCount.
+// returns non-zero if there is an error.
+
+int etc1_encode_image_with_options(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut, int quality,
+        etc1_uint32 threadCount);
+
 // Decode an entire image.
 // pIn - pointer to encoded data.
 // pOut - pointer to the image data. Will be written such that
@@ -16,6 +16,15 @@
 
 #include <string.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ETC1_SIMD_SSE2 1
+#endif
+
 /* From http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
 
  The number of bits that represent a 4x4 texel block is 64 bits if
@@ -117,6 +126,13 @@ static const int kModifierTable[] = {
 /* 6 */33, 106, -33, -106,
 /* 7 */47, 183, -47, -183 };
 
+// kModifierTable transposed, for scoring all the tables at once.
+alignas(16) static const short kModifiers[4][8] = {
+    { 2, 5, 9, 13, 18, 24, 33, 47 },
+    { 8, 17, 29, 42, 60, 80, 106, 183 },
+    { -2, -5, -9, -13, -18, -24, -33, -47 },
+    { -8, -17, -29, -42, -60, -80, -106, -183 } };
+
 static const int kLookup[8] = { 0, 1, 2, 3, -4, -3, -2, -1 };
 
 static inline etc1_byte clamp(int x) {
@@ -295,47 +311,28 @@ inline int square(int x) {
     return x * x;
 }
 
-static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
-        const etc1_byte* pIn, etc1_uint32 *pLow, int bitIndex,
-        const int* pModifierTable) {
-    etc1_uint32 bestScore = ~0;
-    int bestIndex = 0;
-    int pixelR = pIn[0];
-    int pixelG = pIn[1];
-    int pixelB = pIn[2];
-    int r = pBaseColors[0];
-    int g = pBaseColors[1];
-    int b = pBaseColors[2];
-    for (int i = 0; i < 4; i++) {
-        int modifier = pModifierTable[i];
-        int decodedG = clamp(g + modifier);
-        etc1_uint32 score = (etc1_uint32) (6 * square(decodedG - pixelG));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedR = clamp(r + modifier);
-        score += (etc1_uint32) (3 * square(decodedR - pixelR));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedB = clamp(b + modifier);
-        score += (etc1_uint32) square(decodedB - pixelB);
-        if (score < bestScore) {
-            bestScore = score;
-            bestIndex = i;
-        }
-    }
-    etc1_uint32 lowMask = (((bestIndex >> 1) << 16) | (bestIndex & 1))
-            << bitIndex;
-    *pLow |= lowMask;
-    return bestScore;
-}
+// The valid pixels of a sub-block, as offsets into the 4 x 4 block, along with the bit in the
+// low word that holds the index of their modifier.
+typedef struct {
+    int count;
+    etc1_byte pixel[8];
+    etc1_byte bitIndex[8];
+} etc_subblock;
+
+static const etc_subblock kFullSubblocks[2][2] = {
+    { { 8, { 0, 1, 4, 5, 8, 9, 12, 13 }, { 0, 4, 1, 5, 2, 6, 3, 7 } },
+      { 8, { 2, 3, 6, 7, 10, 11, 14, 15 }, { 8, 12, 9, 13, 10, 14, 11, 15 } } },
+    { { 8, { 0, 1, 2, 3, 4, 5, 6, 7 }, { 0, 4, 8, 12, 1, 5, 9, 13 } },
+      { 8, { 8, 9, 10, 11, 12, 13, 14, 15 }, { 2, 6, 10, 14, 3, 7, 11, 15 } } } };
 
 static
-void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc_compressed* pCompressed, bool flipped, bool second,
-        const etc1_byte* pBaseColors, const int* pModifierTable) {
-    int score = pCompressed->score;
+void etc_get_subblock(etc1_uint32 inMask, bool flipped, bool second,
+        etc_subblock* pSubblock) {
+    if (inMask == 0xffff) {
+        *pSubblock = kFullSubblocks[flipped][second];
+        return;
+    }
+    pSubblock->count = 0;
     if (flipped) {
         int by = 0;
         if (second) {
@@ -346,8 +343,9 @@ void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
             for (int x = 0; x < 4; x++) {
                 int i = x + 4 * yy;
                 if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, yy + x * 4, pModifierTable);
+                    pSubblock->pixel[pSubblock->count] = i;
+                    pSubblock->bitIndex[pSubblock->count] = yy + x * 4;
+                    pSubblock->count++;
                 }
             }
         }
@@ -361,13 +359,131 @@ void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
                 int xx = bx + x;
                 int i = xx + 4 * y;
                 if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, y + xx * 4, pModifierTable);
+                    pSubblock->pixel[pSubblock->count] = i;
+                    pSubblock->bitIndex[pSubblock->count] = y + xx * 4;
+                    pSubblock->count++;
                 }
             }
         }
     }
-    pCompressed->score = score;
+}
+
+// Scores a sub-block against all eight modifier tables at once. For each table, pScores gets
+// the sum of the errors of each pixel's best modifier, and pIndices[8 * pixel + table] that
+// modifier's index. The error is 3 * dR^2 + 6 * dG^2 + dB^2, and ties go to the lowest index.
+
+static
+void etc_score_subblock(const etc1_byte* pIn, const etc_subblock* pSubblock,
+        const etc1_byte* pBaseColors, etc1_uint32* pScores, etc1_byte* pIndices) {
+#if defined(ETC1_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i decoded[3][4];
+    for (int c = 0; c < 3; c++) {
+        __m128i base = _mm_set1_epi16(pBaseColors[c]);
+        for (int m = 0; m < 4; m++) {
+            __m128i color = _mm_add_epi16(base, _mm_load_si128((const __m128i*) kModifiers[m]));
+            decoded[c][m] = _mm_min_epi16(_mm_max_epi16(color, zero), _mm_set1_epi16(255));
+        }
+    }
+    __m128i scoresLo = zero;
+    __m128i scoresHi = zero;
+    for (int p = 0; p < pSubblock->count; p++) {
+        const etc1_byte* pPixel = pIn + pSubblock->pixel[p] * 3;
+        __m128i pixelR = _mm_set1_epi16(pPixel[0]);
+        __m128i pixelG = _mm_set1_epi16(pPixel[1]);
+        __m128i pixelB = _mm_set1_epi16(pPixel[2]);
+        __m128i bestLo = zero, bestHi = zero, indexLo = zero, indexHi = zero;
+        for (int m = 0; m < 4; m++) {
+            __m128i dR = _mm_sub_epi16(decoded[0][m], pixelR);
+            __m128i dG = _mm_sub_epi16(decoded[1][m], pixelG);
+            __m128i dB = _mm_sub_epi16(decoded[2][m], pixelB);
+            __m128i wR = _mm_mullo_epi16(dR, _mm_set1_epi16(3));
+            __m128i wG = _mm_mullo_epi16(dG, _mm_set1_epi16(6));
+            // Interleaving R and G lets one multiply-add do both.
+            __m128i errorLo = _mm_add_epi32(
+                    _mm_madd_epi16(_mm_unpacklo_epi16(dR, dG), _mm_unpacklo_epi16(wR, wG)),
+                    _mm_madd_epi16(_mm_unpacklo_epi16(dB, zero), _mm_unpacklo_epi16(dB, zero)));
+            __m128i errorHi = _mm_add_epi32(
+                    _mm_madd_epi16(_mm_unpackhi_epi16(dR, dG), _mm_unpackhi_epi16(wR, wG)),
+                    _mm_madd_epi16(_mm_unpackhi_epi16(dB, zero), _mm_unpackhi_epi16(dB, zero)));
+            if (m == 0) {
+                bestLo = errorLo;
+                bestHi = errorHi;
+                continue;
+            }
+            __m128i index = _mm_set1_epi32(m);
+            __m128i lessLo = _mm_cmplt_epi32(errorLo, bestLo);
+            __m128i lessHi = _mm_cmplt_epi32(errorHi, bestHi);
+            bestLo = _mm_or_si128(_mm_and_si128(lessLo, errorLo), _mm_andnot_si128(lessLo, bestLo));
+            bestHi = _mm_or_si128(_mm_and_si128(lessHi, errorHi), _mm_andnot_si128(lessHi, bestHi));
+            indexLo = _mm_or_si128(_mm_and_si128(lessLo, index), _mm_andnot_si128(lessLo, indexLo));
+            indexHi = _mm_or_si128(_mm_and_si128(lessHi, index), _mm_andnot_si128(lessHi, indexHi));
+        }
+        scoresLo = _mm_add_epi32(scoresLo, bestLo);
+        scoresHi = _mm_add_epi32(scoresHi, bestHi);
+        __m128i index16 = _mm_packs_epi32(indexLo, indexHi);
+        _mm_storel_epi64((__m128i*) (pIndices + 8 * p), _mm_packus_epi16(index16, index16));
+    }
+    _mm_storeu_si128((__m128i*) pScores, scoresLo);
+    _mm_storeu_si128((__m128i*) (pScores + 4), scoresHi);
+#else
+    // The decoded colors, by channel, then modifier index, then table. Laid out like the
+    // vector code, with the tables innermost, so that compilers can vectorize it.
+    short decoded[3][4][8];
+    for (int c = 0; c < 3; c++) {
+        for (int m = 0; m < 4; m++) {
+            for (int t = 0; t < 8; t++) {
+                decoded[c][m][t] = clamp(pBaseColors[c] + kModifiers[m][t]);
+            }
+        }
+    }
+    for (int t = 0; t < 8; t++) {
+        pScores[t] = 0;
+    }
+    for (int p = 0; p < pSubblock->count; p++) {
+        const etc1_byte* pPixel = pIn + pSubblock->pixel[p] * 3;
+        int best[8];
+        etc1_byte index[8];
+        for (int m = 0; m < 4; m++) {
+            for (int t = 0; t < 8; t++) {
+                int error = 3 * square(decoded[0][m][t] - pPixel[0])
+                        + 6 * square(decoded[1][m][t] - pPixel[1])
+                        + square(decoded[2][m][t] - pPixel[2]);
+                bool less = m == 0 || error < best[t];
+                best[t] = less ? error : best[t];
+                index[t] = less ? m : index[t];
+            }
+        }
+        for (int t = 0; t < 8; t++) {
+            pScores[t] += best[t];
+            pIndices[8 * p + t] = index[t];
+        }
+    }
+#endif
+}
+
+// Picks the modifier table for a sub-block, the first one with the lowest error, and adds it
+// and the modifier indices of the pixels to pCompressed.
+
+static
+void etc_encode_subblock_helper(const etc1_byte* pIn, const etc_subblock* pSubblock,
+        etc_compressed* pCompressed, const etc1_byte* pBaseColors, int tableShift) {
+    etc1_uint32 scores[8];
+    etc1_byte indices[8 * 8];
+    etc_score_subblock(pIn, pSubblock, pBaseColors, scores, indices);
+
+    int bestTable = 0;
+    for (int t = 1; t < 8; t++) {
+        if (scores[t] < scores[bestTable]) {
+            bestTable = t;
+        }
+    }
+    pCompressed->high |= bestTable << tableShift;
+    pCompressed->score += scores[bestTable];
+    for (int p = 0; p < pSubblock->count; p++) {
+        int index = indices[8 * p + bestTable];
+        pCompressed->low |= (((index >> 1) << 16) | (index & 1)) << pSubblock->bitIndex[p];
+    }
 }
 
 static bool inRange4bitSigned(int color) {
@@ -428,7 +544,7 @@ static void etc_encodeBaseColors(etc1_byte* pBaseColors,
 static
 void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
         const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped) {
-    pCompressed->score = ~0;
+    pCompressed->score = 0;
     pCompressed->high = (flipped ? 1 : 0);
     pCompressed->low = 0;
 
@@ -436,33 +552,31 @@ void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
 
     etc_encodeBaseColors(pBaseColors, pColors, pCompressed);
 
-    int originalHigh = pCompressed->high;
-
-    const int* pModifierTable = kModifierTable;
-    for (int i = 0; i < 8; i++, pModifierTable += 4) {
-        etc_compressed temp;
-        temp.score = 0;
-        temp.high = originalHigh | (i << 5);
-        temp.low = 0;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, false,
-                pBaseColors, pModifierTable);
-        take_best(pCompressed, &temp);
-    }
-    pModifierTable = kModifierTable;
-    etc_compressed firstHalf = *pCompressed;
-    for (int i = 0; i < 8; i++, pModifierTable += 4) {
-        etc_compressed temp;
-        temp.score = firstHalf.score;
-        temp.high = firstHalf.high | (i << 2);
-        temp.low = firstHalf.low;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, true,
-                pBaseColors + 3, pModifierTable);
-        if (i == 0) {
-            *pCompressed = temp;
-        } else {
-            take_best(pCompressed, &temp);
+    etc_subblock first, second;
+    etc_get_subblock(inMask, flipped, false, &first);
+    etc_get_subblock(inMask, flipped, true, &second);
+    etc_encode_subblock_helper(pIn, &first, pCompressed, pBaseColors, 5);
+    etc_encode_subblock_helper(pIn, &second, pCompressed, pBaseColors + 3, 2);
+}
+
+// Estimates how well an orientation suits a block from the error of the sub-block averages
+// alone, weighted as in etc_score_subblock.
+
+static
+etc1_uint32 etc_average_error(const etc1_byte* pIn, etc1_uint32 inMask,
+        const etc1_byte* pColors, bool flipped) {
+    etc1_uint32 error = 0;
+    for (int half = 0; half < 2; half++) {
+        etc_subblock subblock;
+        etc_get_subblock(inMask, flipped, half == 1, &subblock);
+        const etc1_byte* pAverage = pColors + 3 * half;
+        for (int p = 0; p < subblock.count; p++) {
+            const etc1_byte* pPixel = pIn + subblock.pixel[p] * 3;
+            error += 3 * square(pPixel[0] - pAverage[0]) + 6 * square(pPixel[1] - pAverage[1])
+                    + square(pPixel[2] - pAverage[2]);
         }
     }
+    return error;
 }
 
 static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
@@ -477,8 +591,9 @@ static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
 // pixel is valid or not. Invalid pixel color values are ignored when compressing.
 // Output is an ETC1 compressed version of the data.
 
-void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc1_byte* pOut) {
+static
+void etc_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut, bool preview) {
     etc1_byte colors[6];
     etc1_byte flippedColors[6];
     etc_average_colors_subblock(pIn, inMask, colors, false, false);
@@ -487,29 +602,39 @@ void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
     etc_average_colors_subblock(pIn, inMask, flippedColors + 3, true, true);
 
     etc_compressed a, b;
-    etc_encode_block_helper(pIn, inMask, colors, &a, false);
-    etc_encode_block_helper(pIn, inMask, flippedColors, &b, true);
-    take_best(&a, &b);
+    if (preview) {
+        if (etc_average_error(pIn, inMask, flippedColors, true)
+                < etc_average_error(pIn, inMask, colors, false)) {
+            etc_encode_block_helper(pIn, inMask, flippedColors, &a, true);
+        } else {
+            etc_encode_block_helper(pIn, inMask, colors, &a, false);
+        }
+    } else {
+        etc_encode_block_helper(pIn, inMask, colors, &a, false);
+        etc_encode_block_helper(pIn, inMask, flippedColors, &b, true);
+        take_best(&a, &b);
+    }
     writeBigEndian(pOut, a.high);
     writeBigEndian(pOut + 4, a.low);
 }
 
+void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut) {
+    etc_encode_block(pIn, inMask, pOut, false);
+}
+
 // Return the size of the encoded image data (does not include size of PKM header).
 
 etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height) {
     return (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
 }
 
-// Encode an entire image.
-// pIn - pointer to the image data. Formatted such that the Red component of
-//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
-// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+// Encode the rows of blocks from pixel row yBegin up to yEnd, both multiples of 4.
 
-int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
-        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
-    if (pixelSize < 2 || pixelSize > 3) {
-        return -1;
-    }
+static
+void etc_encode_rows(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut,
+        etc1_uint32 yBegin, etc1_uint32 yEnd, bool preview) {
     static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
     static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
             0xffff };
@@ -517,9 +642,9 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
     etc1_byte encoded[ETC1_ENCODED_BLOCK_SIZE];
 
     etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
+    pOut += (size_t) yBegin * encodedWidth / 2;
 
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
+    for (etc1_uint32 y = yBegin; y < yEnd; y += 4) {
         etc1_uint32 yEnd = height - y;
         if (yEnd > 4) {
             yEnd = 4;
@@ -546,11 +671,75 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
                     }
                 }
             }
-            etc1_encode_block(block, mask, encoded);
+            etc_encode_block(block, mask, encoded, preview);
             memcpy(pOut, encoded, sizeof(encoded));
             pOut += sizeof(encoded);
         }
     }
+}
+
+// Encode an entire image.
+// pIn - pointer to the image data. Formatted such that the Red component of
+//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
+// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+
+int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
+    return etc1_encode_image_with_options(pIn, width, height, pixelSize, stride, pOut,
+            ETC1_QUALITY_DEFAULT, 1);
+}
+
+// Encode an entire image on several threads. Blocks are encoded independently, so the image
+// is cut into bands of a few rows of blocks, which the threads take in turn until none are
+// left.
+
+int etc1_encode_image_with_options(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut, int quality,
+        etc1_uint32 threadCount) {
+    if (pixelSize < 2 || pixelSize > 3) {
+        return -1;
+    }
+    if (quality != ETC1_QUALITY_DEFAULT && quality != ETC1_QUALITY_PREVIEW) {
+        return -1;
+    }
+    bool preview = quality == ETC1_QUALITY_PREVIEW;
+
+    static const etc1_uint32 kBandHeight = 16;
+    etc1_uint32 encodedHeight = (height + 3) & ~3;
+    etc1_uint32 bandCount = (encodedHeight + kBandHeight - 1) / kBandHeight;
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount > bandCount) {
+        threadCount = bandCount;
+    }
+    if (threadCount <= 1) {
+        etc_encode_rows(pIn, width, height, pixelSize, stride, pOut, 0, encodedHeight,
+                preview);
+        return 0;
+    }
+
+    std::atomic<etc1_uint32> nextBand(0);
+    auto encodeBands = [&]() {
+        etc1_uint32 band;
+        while ((band = nextBand.fetch_add(1, std::memory_order_relaxed)) < bandCount) {
+            etc1_uint32 yBegin = band * kBandHeight;
+            etc1_uint32 yEnd = yBegin + kBandHeight;
+            if (yEnd > encodedHeight) {
+                yEnd = encodedHeight;
+            }
+            etc_encode_rows(pIn, width, height, pixelSize, stride, pOut, yBegin, yEnd,
+                    preview);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (etc1_uint32 i = 1; i < threadCount; i++) {
+        threads.emplace_back(encodeBands);
+    }
+    encodeBands();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
     return 0;
 }
 
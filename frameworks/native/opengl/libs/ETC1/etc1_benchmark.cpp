@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ETC1/etc1.h>
+
+#include <math.h>
+
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+constexpr etc1_uint32 kSize = 2048;
+
+enum ImageKind {
+    // Smooth gradients with some grain, like photos and rendered art.
+    kPhoto,
+    // Flat areas with hard edges, like UI atlases.
+    kFlat,
+    // Random pixels, the worst case for the modifier search.
+    kNoise,
+};
+
+const std::vector<etc1_byte>& GetImage(ImageKind kind) {
+    static std::vector<etc1_byte> images[3];
+    std::vector<etc1_byte>& image = images[kind];
+    if (!image.empty()) {
+        return image;
+    }
+
+    std::mt19937 random(kind);
+    image.resize(kSize * kSize * 3);
+    for (etc1_uint32 y = 0; y < kSize; y++) {
+        for (etc1_uint32 x = 0; x < kSize; x++) {
+            etc1_byte* pixel = &image[(y * kSize + x) * 3];
+            switch (kind) {
+                case kPhoto: {
+                    int grain = static_cast<int>(random() % 9) - 4;
+                    pixel[0] = 128 + 100 * sin(x / 97.0) + grain;
+                    pixel[1] = 128 + 100 * cos(y / 61.0) + grain;
+                    pixel[2] = 128 + 100 * sin((x + y) / 143.0) + grain;
+                    break;
+                }
+                case kFlat: {
+                    // Tiles of a single color, with a few one-pixel borders.
+                    etc1_uint32 tile = (x / 37) * 31 + (y / 23) * 17;
+                    bool border = x % 37 == 0 || y % 23 == 0;
+                    pixel[0] = border ? 0 : tile * 71;
+                    pixel[1] = border ? 0 : tile * 113;
+                    pixel[2] = border ? 0 : tile * 29;
+                    break;
+                }
+                case kNoise:
+                    pixel[0] = random();
+                    pixel[1] = random();
+                    pixel[2] = random();
+                    break;
+            }
+        }
+    }
+    return image;
+}
+
+// Args: image kind, quality, thread count (0 for one per CPU).
+void BM_etc1_encode_image(benchmark::State& state) {
+    const std::vector<etc1_byte>& image = GetImage(static_cast<ImageKind>(state.range(0)));
+    std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(kSize, kSize));
+    for (auto _ : state) {
+        etc1_encode_image_with_options(image.data(), kSize, kSize, 3, kSize * 3, encoded.data(),
+                                       state.range(1), state.range(2));
+    }
+    state.counters["megapixels/s"] = benchmark::Counter(
+            state.iterations() * (kSize * kSize / 1e6), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_etc1_encode_image)
+        ->ArgsProduct({{kPhoto, kFlat, kNoise},
+                       {ETC1_QUALITY_DEFAULT, ETC1_QUALITY_PREVIEW},
+                       {1, 0}})
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+void BM_etc1_decode_image(benchmark::State& state) {
+    const std::vector<etc1_byte>& image = GetImage(kPhoto);
+    std::vector<etc1_byte> encoded(etc1_get_encoded_data_size(kSize, kSize));
+    etc1_encode_image(image.data(), kSize, kSize, 3, kSize * 3, encoded.data());
+    std::vector<etc1_byte> decoded(image.size());
+    for (auto _ : state) {
+        etc1_decode_image(encoded.data(), decoded.data(), kSize, kSize, 3, kSize * 3);
+    }
+    state.counters["megapixels/s"] = benchmark::Counter(
+            state.iterations() * (kSize * kSize / 1e6), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_etc1_decode_image)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
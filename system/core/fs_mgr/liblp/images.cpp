@@ -17,7 +17,16 @@
 #include "images.h"
 
 #include <limits.h>
+#include <string.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <android-base/file.h>
 
@@ -35,6 +44,11 @@ using android::base::unique_fd;
 static const int O_NOFOLLOW = 0;
 #endif
 
+// Partition images are read this much at a time.
+static constexpr size_t kScanChunkSize = 1024 * 1024;
+// Buffer size when copying or filling raw images by hand.
+static constexpr size_t kCopyBufferSize = 1024 * 1024;
+
 static bool IsEmptySuperImage(borrowed_fd fd) {
     struct stat s;
     if (fstat(fd.get(), &s) < 0) {
@@ -133,11 +147,13 @@ bool WriteToImageFile(const std::string& file, const LpMetadata& input) {
 }
 
 ImageBuilder::ImageBuilder(const LpMetadata& metadata, uint32_t block_size,
-                           const std::map<std::string, std::string>& images, bool sparsify)
+                           const std::map<std::string, std::string>& images, bool sparsify,
+                           uint32_t max_jobs)
     : metadata_(metadata),
       geometry_(metadata.geometry),
       block_size_(block_size),
       sparsify_(sparsify),
+      max_jobs_(std::max(max_jobs, 1u)),
       images_(images) {
     uint64_t total_size = GetTotalSuperPartitionSize(metadata);
     if (block_size % LP_SECTOR_SIZE != 0) {
@@ -177,6 +193,7 @@ ImageBuilder::ImageBuilder(const LpMetadata& metadata, uint32_t block_size,
         }
         device_images_.emplace_back(std::move(file));
     }
+    device_chunks_.resize(device_images_.size());
 }
 
 bool ImageBuilder::IsValid() const {
@@ -193,13 +210,7 @@ bool ImageBuilder::Export(const std::string& file) {
         LERROR << "Cannot export to a single image on retrofit builds.";
         return false;
     }
-    // No gzip compression; no checksum.
-    int ret = sparse_file_write(device_images_[0].get(), fd, false, sparsify_, false);
-    if (ret != 0) {
-        LERROR << "sparse_file_write failed (error code " << ret << ")";
-        return false;
-    }
-    return true;
+    return WriteDeviceImage(0, fd);
 }
 
 bool ImageBuilder::ExportFiles(const std::string& output_dir) {
@@ -214,27 +225,162 @@ bool ImageBuilder::ExportFiles(const std::string& output_dir) {
             PERROR << "open failed: " << file_path;
             return false;
         }
-        // No gzip compression; no checksum.
-        int ret = sparse_file_write(device_images_[i].get(), fd, false, sparsify_, false);
-        if (ret != 0) {
-            LERROR << "sparse_file_write failed (error code " << ret << ")";
+        if (!WriteDeviceImage(i, fd)) {
             return false;
         }
     }
     return true;
 }
 
-bool ImageBuilder::AddData(sparse_file* file, const std::string& blob, uint64_t sector) {
+bool ImageBuilder::WriteDeviceImage(size_t device, borrowed_fd fd) {
+#if defined(__linux__)
+    struct stat s;
+    if (!sparsify_ && fstat(fd.get(), &s) == 0 && S_ISREG(s.st_mode)) {
+        return WriteRawDeviceImage(device, fd);
+    }
+#endif
+    // No gzip compression; no checksum.
+    int ret = sparse_file_write(device_images_[device].get(), fd.get(), false, sparsify_, false);
+    if (ret != 0) {
+        LERROR << "sparse_file_write failed (error code " << ret << ")";
+        return false;
+    }
+    return true;
+}
+
+#if defined(__linux__)
+// Copies |length| bytes between two files. The kernel is asked first, which
+// lets file systems such as btrfs or XFS share the blocks instead of copying
+// them; if it can't, the data is read and written here.
+static bool CopyFileRange(int in_fd, uint64_t in_offset, int out_fd, uint64_t out_offset,
+                          uint64_t length, std::vector<uint8_t>* buffer) {
+#if defined(__NR_copy_file_range)
+    while (length) {
+        loff_t in = in_offset;
+        loff_t out = out_offset;
+        size_t size = std::min<uint64_t>(length, 1u << 30);
+        ssize_t rv = syscall(__NR_copy_file_range, in_fd, &in, out_fd, &out, size, 0);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            // e.g. EXDEV or ENOSYS.
+            break;
+        }
+        in_offset += rv;
+        out_offset += rv;
+        length -= rv;
+    }
+#endif
+    buffer->resize(kCopyBufferSize);
+    while (length) {
+        size_t size = std::min<uint64_t>(length, buffer->size());
+        if (!android::base::ReadFullyAtOffset(in_fd, buffer->data(), size, in_offset)) {
+            PERROR << "read failed";
+            return false;
+        }
+        if (!android::base::WriteFullyAtOffset(out_fd, buffer->data(), size, out_offset)) {
+            PERROR << "write failed";
+            return false;
+        }
+        in_offset += size;
+        out_offset += size;
+        length -= size;
+    }
+    return true;
+}
+
+// Writes the chunks recorded for |device| directly. Zero fills are left as
+// holes in the file.
+bool ImageBuilder::WriteRawDeviceImage(size_t device, borrowed_fd fd) {
+    if (ftruncate(fd.get(), metadata_.block_devices[device].size) < 0) {
+        PERROR << "ftruncate failed";
+        return false;
+    }
+
+    std::vector<uint8_t> buffer;
+    for (const auto& chunk : device_chunks_[device]) {
+        uint64_t offset = chunk.block * block_size_;
+        if (chunk.data) {
+            if (!android::base::WriteFullyAtOffset(fd, chunk.data, chunk.length, offset)) {
+                PERROR << "write failed";
+                return false;
+            }
+        } else if (chunk.fd >= 0) {
+            if (!CopyFileRange(chunk.fd, chunk.fd_offset, fd.get(), offset, chunk.length,
+                               &buffer)) {
+                return false;
+            }
+        } else if (chunk.fill_value != 0) {
+            buffer.resize(kCopyBufferSize);
+            for (size_t i = 0; i < buffer.size(); i += sizeof(chunk.fill_value)) {
+                memcpy(&buffer[i], &chunk.fill_value, sizeof(chunk.fill_value));
+            }
+            for (uint64_t done = 0; done < chunk.length;) {
+                size_t size = std::min<uint64_t>(chunk.length - done, buffer.size());
+                if (!android::base::WriteFullyAtOffset(fd, buffer.data(), size, offset + done)) {
+                    PERROR << "write failed";
+                    return false;
+                }
+                done += size;
+            }
+        }
+    }
+    return true;
+}
+#endif
+
+bool ImageBuilder::AddData(size_t device, const std::string& blob, uint64_t sector) {
     uint32_t block;
     if (!SectorToBlock(sector, &block)) {
         return false;
     }
     void* data = const_cast<char*>(blob.data());
-    int ret = sparse_file_add_data(file, data, blob.size(), block);
+    int ret = sparse_file_add_data(device_images_[device].get(), data, blob.size(), block);
     if (ret != 0) {
         LERROR << "sparse_file_add_data failed (error code " << ret << ")";
         return false;
     }
+    device_chunks_[device].push_back({.block = block,
+                                      .length = blob.size(),
+                                      .data = data,
+                                      .fd = -1,
+                                      .fd_offset = 0,
+                                      .fill = false,
+                                      .fill_value = 0});
+    return true;
+}
+
+bool ImageBuilder::AddFd(size_t device, int fd, uint64_t offset, uint64_t length,
+                         uint32_t block) {
+    int rv = sparse_file_add_fd(device_images_[device].get(), fd, offset, length, block);
+    if (rv) {
+        LERROR << "sparse_file_add_fd failed with code: " << rv;
+        return false;
+    }
+    device_chunks_[device].push_back({.block = block,
+                                      .length = length,
+                                      .data = nullptr,
+                                      .fd = fd,
+                                      .fd_offset = offset,
+                                      .fill = false,
+                                      .fill_value = 0});
+    return true;
+}
+
+bool ImageBuilder::AddFill(size_t device, uint32_t value, uint64_t length, uint32_t block) {
+    int rv = sparse_file_add_fill(device_images_[device].get(), value, length, block);
+    if (rv) {
+        LERROR << "sparse_file_add_fill failed with code: " << rv;
+        return false;
+    }
+    device_chunks_[device].push_back({.block = block,
+                                      .length = length,
+                                      .data = nullptr,
+                                      .fd = -1,
+                                      .fd_offset = 0,
+                                      .fill = true,
+                                      .fill_value = value});
     return true;
 }
 
@@ -258,7 +404,7 @@ uint64_t ImageBuilder::BlockToSector(uint64_t block) const {
 }
 
 bool ImageBuilder::Build() {
-    if (sparse_file_add_fill(device_images_[0].get(), 0, LP_PARTITION_RESERVED_BYTES, 0) < 0) {
+    if (!AddFill(0, 0, LP_PARTITION_RESERVED_BYTES, 0)) {
         LERROR << "Could not add initial sparse block for reserved zeroes";
         return false;
     }
@@ -274,7 +420,7 @@ bool ImageBuilder::Build() {
     }
 
     uint64_t first_sector = LP_PARTITION_RESERVED_BYTES / LP_SECTOR_SIZE;
-    if (!AddData(device_images_[0].get(), all_metadata_, first_sector)) {
+    if (!AddData(0, all_metadata_, first_sector)) {
         return false;
     }
 
@@ -282,14 +428,22 @@ bool ImageBuilder::Build() {
         return false;
     }
 
+    struct PartitionImage {
+        const LpMetadataPartition* partition = nullptr;
+        std::string file;
+        int fd = -1;
+        std::vector<ImageRun> runs;
+        bool ok = false;
+    };
+    std::vector<PartitionImage> partition_images;
     for (const auto& partition : metadata_.partitions) {
         auto iter = images_.find(GetPartitionName(partition));
         if (iter == images_.end()) {
             continue;
         }
-        if (!AddPartitionImage(partition, iter->second)) {
-            return false;
-        }
+        auto& image = partition_images.emplace_back();
+        image.partition = &partition;
+        image.file = iter->second;
         images_.erase(iter);
     }
 
@@ -297,30 +451,65 @@ bool ImageBuilder::Build() {
         LERROR << "Partition image was specified but no partition was found.";
         return false;
     }
-    return true;
-}
 
-static inline bool HasFillValue(uint32_t* buffer, size_t count) {
-    uint32_t fill_value = buffer[0];
-    for (size_t i = 1; i < count; i++) {
-        if (fill_value != buffer[i]) {
+    // Reading the images is what takes time, so do it in parallel, then add
+    // them in order so that the output doesn't depend on scheduling.
+    std::atomic<size_t> next_image = 0;
+    auto scan_images = [&]() -> void {
+        for (size_t i; (i = next_image++) < partition_images.size();) {
+            auto& image = partition_images[i];
+            image.ok = ScanPartitionImage(*image.partition, image.file, &image.fd, &image.runs);
+        }
+    };
+    std::vector<std::thread> threads;
+    size_t num_jobs = std::min<size_t>(max_jobs_, partition_images.size());
+    for (size_t i = 1; i < num_jobs; i++) {
+        threads.emplace_back(scan_images);
+    }
+    scan_images();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& image : partition_images) {
+        if (!image.ok || !AddPartitionImage(*image.partition, image.fd, image.runs)) {
             return false;
         }
     }
     return true;
 }
 
-bool ImageBuilder::AddPartitionImage(const LpMetadataPartition& partition,
-                                     const std::string& file) {
+// A block is filled with a single 32-bit value if it is equal to itself
+// shifted by 4 bytes, which lets memcmp do the work with wide loads.
+static inline bool IsFillBlock(const uint8_t* block, size_t size, uint32_t* fill_value) {
+    memcpy(fill_value, block, sizeof(*fill_value));
+    return memcmp(block, block + sizeof(*fill_value), size - sizeof(*fill_value)) == 0;
+}
+
+void ImageBuilder::AppendImageRun(std::vector<ImageRun>* runs, uint64_t offset, uint64_t length,
+                                  bool fill, uint32_t fill_value) {
+    if (!runs->empty()) {
+        auto& last = runs->back();
+        if (last.offset + last.length == offset && last.fill == fill &&
+            (!fill || last.fill_value == fill_value)) {
+            last.length += length;
+            return;
+        }
+    }
+    runs->push_back({.offset = offset, .length = length, .fill = fill, .fill_value = fill_value});
+}
+
+// Splits the image in |file| into runs of data and fill blocks. May be called
+// from several threads at once.
+bool ImageBuilder::ScanPartitionImage(const LpMetadataPartition& partition,
+                                      const std::string& file, int* out_fd,
+                                      std::vector<ImageRun>* runs) {
     if (partition.num_extents == 0) {
         LERROR << "Partition size is zero: " << GetPartitionName(partition);
         return false;
     }
 
-    // Track which extent we're processing.
-    uint32_t extent_index = partition.first_extent_index;
-
-    const LpMetadataExtent& extent = metadata_.extents[extent_index];
+    const LpMetadataExtent& extent = metadata_.extents[partition.first_extent_index];
     if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
         LERROR << "Partition should only have linear extents: " << GetPartitionName(partition);
         return false;
@@ -345,69 +534,71 @@ bool ImageBuilder::AddPartitionImage(const LpMetadataPartition& partition,
                << ")";
         return false;
     }
-    if (SeekFile64(fd, 0, SEEK_SET)) {
-        PERROR << "lseek failed";
-        return false;
-    }
-
-    // We track the current logical sector and the position the current extent
-    // ends at.
-    uint64_t output_sector = 0;
-    uint64_t extent_last_sector = extent.num_sectors;
-
-    // We also track the output device and the current output block within that
-    // device.
-    uint32_t output_block;
-    if (!SectorToBlock(extent.target_data, &output_block)) {
-        return false;
-    }
-    sparse_file* output_device = device_images_[extent.target_source].get();
-
-    // Proceed to read the file and build sparse images.
-    uint64_t pos = 0;
-    uint64_t remaining = file_length;
-    while (remaining) {
-        // Check if we need to advance to the next extent.
-        if (output_sector == extent_last_sector) {
-            extent_index++;
-            if (extent_index >= partition.first_extent_index + partition.num_extents) {
-                LERROR << "image is larger than extent table";
-                return false;
-            }
-
-            const LpMetadataExtent& extent = metadata_.extents[extent_index];
-            extent_last_sector += extent.num_sectors;
-            output_device = device_images_[extent.target_source].get();
-            if (!SectorToBlock(extent.target_data, &output_block)) {
-                return false;
-            }
-        }
 
-        uint32_t buffer[block_size_ / sizeof(uint32_t)];
-        size_t read_size = remaining >= sizeof(buffer) ? sizeof(buffer) : size_t(remaining);
-        if (!android::base::ReadFully(fd, buffer, sizeof(buffer))) {
+    size_t buffer_size = std::max<size_t>(kScanChunkSize / block_size_, 1) * block_size_;
+    std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(buffer_size);
+    for (uint64_t pos = 0; pos < file_length;) {
+        size_t read_size = std::min<uint64_t>(buffer_size, file_length - pos);
+        if (!android::base::ReadFullyAtOffset(fd, buffer.get(), read_size, pos)) {
             PERROR << "read failed";
             return false;
         }
-        if (read_size != sizeof(buffer) || !HasFillValue(buffer, read_size / sizeof(uint32_t))) {
-            int rv = sparse_file_add_fd(output_device, fd, pos, read_size, output_block);
-            if (rv) {
-                LERROR << "sparse_file_add_fd failed with code: " << rv;
-                return false;
+        for (size_t i = 0; i < read_size; i += block_size_) {
+            // A partial block at the end of the image is always data.
+            size_t size = std::min<size_t>(block_size_, read_size - i);
+            uint32_t fill_value = 0;
+            bool fill = size == block_size_ && IsFillBlock(&buffer[i], size, &fill_value);
+            AppendImageRun(runs, pos + i, size, fill, fill_value);
+        }
+        pos += read_size;
+    }
+
+    *out_fd = fd;
+    return true;
+}
+
+bool ImageBuilder::AddPartitionImage(const LpMetadataPartition& partition, int fd,
+                                     const std::vector<ImageRun>& runs) {
+    // Track which extent we're processing, where in its device we are, and
+    // how much of it is left.
+    uint32_t extent_index = partition.first_extent_index;
+    uint32_t extent_end = partition.first_extent_index + partition.num_extents;
+    uint64_t extent_remaining = 0;
+    size_t output_device = 0;
+    uint32_t output_block = 0;
+
+    for (const auto& run : runs) {
+        uint64_t offset = run.offset;
+        uint64_t remaining = run.length;
+        while (remaining) {
+            // Check if we need to advance to the next extent.
+            if (extent_remaining == 0) {
+                if (extent_index >= extent_end) {
+                    LERROR << "image is larger than extent table";
+                    return false;
+                }
+                const LpMetadataExtent& extent = metadata_.extents[extent_index++];
+                extent_remaining = extent.num_sectors * LP_SECTOR_SIZE;
+                output_device = extent.target_source;
+                if (!SectorToBlock(extent.target_data, &output_block)) {
+                    return false;
+                }
+                continue;
             }
-        } else {
-            int rv = sparse_file_add_fill(output_device, buffer[0], read_size, output_block);
-            if (rv) {
-                LERROR << "sparse_file_add_fill failed with code: " << rv;
+
+            uint64_t length = std::min(remaining, extent_remaining);
+            bool ok = run.fill ? AddFill(output_device, run.fill_value, length, output_block)
+                               : AddFd(output_device, fd, offset, length, output_block);
+            if (!ok) {
                 return false;
             }
+            offset += length;
+            remaining -= length;
+            extent_remaining -= length;
+            // Only the last run can end in a partial block.
+            output_block += length / block_size_;
         }
-        pos += read_size;
-        remaining -= read_size;
-        output_sector += block_size_ / LP_SECTOR_SIZE;
-        output_block++;
     }
-
     return true;
 }
 
@@ -457,6 +648,7 @@ int ImageBuilder::OpenImageFile(const std::string& file) {
     SparsePtr source(sparse_file_import(source_fd, true, true), sparse_file_destroy);
     if (!source) {
         int fd = source_fd.get();
+        std::lock_guard<std::mutex> lock(temp_fds_lock_);
         temp_fds_.push_back(std::move(source_fd));
         return fd;
     }
@@ -473,20 +665,22 @@ int ImageBuilder::OpenImageFile(const std::string& file) {
         LERROR << "sparse_file_write failed with code: " << rv;
         return -1;
     }
+    std::lock_guard<std::mutex> lock(temp_fds_lock_);
     temp_fds_.push_back(android::base::unique_fd(tf.release()));
     return temp_fds_.back().get();
 }
 
 bool WriteToImageFile(const std::string& file, const LpMetadata& metadata, uint32_t block_size,
-                      const std::map<std::string, std::string>& images, bool sparsify) {
-    ImageBuilder builder(metadata, block_size, images, sparsify);
+                      const std::map<std::string, std::string>& images, bool sparsify,
+                      uint32_t max_jobs) {
+    ImageBuilder builder(metadata, block_size, images, sparsify, max_jobs);
     return builder.IsValid() && builder.Build() && builder.Export(file);
 }
 
 bool WriteSplitImageFiles(const std::string& output_dir, const LpMetadata& metadata,
                           uint32_t block_size, const std::map<std::string, std::string>& images,
-                          bool sparsify) {
-    ImageBuilder builder(metadata, block_size, images, sparsify);
+                          bool sparsify, uint32_t max_jobs) {
+    ImageBuilder builder(metadata, block_size, images, sparsify, max_jobs);
     return builder.IsValid() && builder.Build() && builder.ExportFiles(output_dir);
 }
 
@@ -17,7 +17,9 @@
 #include <stdint.h>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <liblp/liblp.h>
@@ -33,10 +35,15 @@ std::unique_ptr<LpMetadata> ReadFromImageFile(int fd);
 // We use an object to build the image file since it requires that data
 // pointers be held alive until the sparse file is destroyed. It's easier
 // to do this when the data pointers are all in one place.
+//
+// Partition images are scanned on up to |max_jobs| threads at once. Raw (not
+// sparsified) images are written without reading partition images back where
+// the kernel can copy or share their blocks directly.
 class ImageBuilder {
   public:
     ImageBuilder(const LpMetadata& metadata, uint32_t block_size,
-                 const std::map<std::string, std::string>& images, bool sparsify);
+                 const std::map<std::string, std::string>& images, bool sparsify,
+                 uint32_t max_jobs = 1);
 
     bool Build();
     bool Export(const std::string& file);
@@ -47,8 +54,39 @@ class ImageBuilder {
     const std::vector<SparsePtr>& device_images() const { return device_images_; }
 
   private:
-    bool AddData(sparse_file* file, const std::string& blob, uint64_t sector);
-    bool AddPartitionImage(const LpMetadataPartition& partition, const std::string& file);
+    // A range of a partition image which is either all data, or all blocks
+    // filled with the same 32-bit value.
+    struct ImageRun {
+        uint64_t offset;
+        uint64_t length;
+        bool fill;
+        uint32_t fill_value;
+    };
+
+    // What was added to a device image, so that raw images can be written
+    // without going through libsparse. Exactly one of |data|, |fd| (if not
+    // -1) or |fill| describes the contents.
+    struct DeviceChunk {
+        uint64_t block;
+        uint64_t length;
+        const void* data;
+        int fd;
+        uint64_t fd_offset;
+        bool fill;
+        uint32_t fill_value;
+    };
+
+    bool AddData(size_t device, const std::string& blob, uint64_t sector);
+    bool AddFd(size_t device, int fd, uint64_t offset, uint64_t length, uint32_t block);
+    bool AddFill(size_t device, uint32_t value, uint64_t length, uint32_t block);
+    static void AppendImageRun(std::vector<ImageRun>* runs, uint64_t offset, uint64_t length,
+                               bool fill, uint32_t fill_value);
+    bool ScanPartitionImage(const LpMetadataPartition& partition, const std::string& file,
+                            int* fd, std::vector<ImageRun>* runs);
+    bool AddPartitionImage(const LpMetadataPartition& partition, int fd,
+                           const std::vector<ImageRun>& runs);
+    bool WriteDeviceImage(size_t device, android::base::borrowed_fd fd);
+    bool WriteRawDeviceImage(size_t device, android::base::borrowed_fd fd);
     int OpenImageFile(const std::string& file);
     bool SectorToBlock(uint64_t sector, uint32_t* block);
     uint64_t BlockToSector(uint64_t block) const;
@@ -59,10 +97,13 @@ class ImageBuilder {
     const LpMetadataGeometry& geometry_;
     uint32_t block_size_;
     bool sparsify_;
+    uint32_t max_jobs_;
 
     std::vector<SparsePtr> device_images_;
+    std::vector<std::vector<DeviceChunk>> device_chunks_;
     std::string all_metadata_;
     std::map<std::string, std::string> images_;
+    std::mutex temp_fds_lock_;
     std::vector<android::base::unique_fd> temp_fds_;
 };
 
@@ -77,9 +77,10 @@ std::unique_ptr<LpMetadata> ReadMetadata(const std::string& super_partition, uin
 bool IsEmptySuperImage(const std::string& file);
 
 // Read/Write logical partition metadata and contents to an image file, for
-// flashing.
+// flashing. Up to |max_jobs| partition images are read at once.
 bool WriteToImageFile(const std::string& file, const LpMetadata& metadata, uint32_t block_size,
-                      const std::map<std::string, std::string>& images, bool sparsify);
+                      const std::map<std::string, std::string>& images, bool sparsify,
+                      uint32_t max_jobs = 1);
 
 // Read/Write logical partition metadata to an image file, for producing a
 // super_empty.img (for fastboot wipe-super/update-super) or for diagnostics.
@@ -95,7 +96,7 @@ std::unique_ptr<LpMetadata> ReadFromImageBlob(const void* data, size_t bytes);
 // output folder.
 bool WriteSplitImageFiles(const std::string& output_dir, const LpMetadata& metadata,
                           uint32_t block_size, const std::map<std::string, std::string>& images,
-                          bool sparsify);
+                          bool sparsify, uint32_t max_jobs = 1);
 
 // Helper to extract safe C++ strings from partition info.
 std::string GetPartitionName(const LpMetadataPartition& partition);
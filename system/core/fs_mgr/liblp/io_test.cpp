@@ -627,6 +627,86 @@ TEST_F(LiblpTest, FlashSparseImage) {
     ASSERT_NE(ReadBackupMetadata(fd.get(), geometry, 0), nullptr);
 }
 
+// Writes an image of |size| bytes cycling through blocks of random data, of a
+// repeated value and of zeroes.
+static bool WriteTestImage(const std::string& path, size_t size, unsigned int seed) {
+    std::string data(size, '\0');
+    for (size_t block = 0; block * 4096 < size; block++) {
+        char* start = &data[block * 4096];
+        size_t length = std::min<size_t>(4096, size - block * 4096);
+        switch ((block + seed) % 3) {
+            case 0:
+                for (size_t i = 0; i < length; i++) {
+                    start[i] = static_cast<char>(rand_r(&seed));
+                }
+                break;
+            case 1:
+                memset(start, 0xa5, length);
+                break;
+        }
+    }
+    return android::base::WriteStringToFile(data, path);
+}
+
+static std::string ReadRawImage(const ImageBuilder& builder) {
+    TemporaryFile tf;
+    if (sparse_file_write(builder.device_images()[0].get(), tf.fd, false, false, false) != 0) {
+        return {};
+    }
+    std::string contents;
+    android::base::ReadFileToString(tf.path, &contents);
+    return contents;
+}
+
+// Test that scanning images in parallel, and writing raw images without
+// libsparse, produce the same images.
+TEST_F(LiblpTest, ParallelImageBuild) {
+    BlockDeviceInfo device_info("super", 8 * 1024 * 1024, 0, 0, 4096);
+    unique_ptr<MetadataBuilder> builder = MetadataBuilder::New(device_info, 4096, 2);
+    ASSERT_NE(builder, nullptr);
+
+    TemporaryDir dir;
+    std::map<std::string, std::string> images;
+    unsigned int seed = 0;
+    for (const char* name : {"system", "vendor", "product"}) {
+        Partition* partition = builder->AddPartition(name, LP_PARTITION_ATTR_NONE);
+        ASSERT_NE(partition, nullptr);
+        ASSERT_TRUE(builder->ResizePartition(partition, 512 * 1024));
+
+        std::string path = std::string(dir.path) + "/" + name + ".img";
+        ASSERT_TRUE(WriteTestImage(path, (100 + seed * 10) * 4096, seed));
+        images[name] = path;
+        seed++;
+    }
+    unique_ptr<LpMetadata> exported = builder->Export();
+    ASSERT_NE(exported, nullptr);
+
+    ImageBuilder serial(*exported.get(), 4096, images, false, 1);
+    ASSERT_TRUE(serial.IsValid());
+    ASSERT_TRUE(serial.Build());
+    std::string expected = ReadRawImage(serial);
+    ASSERT_EQ(expected.size(), device_info.size);
+
+    ImageBuilder parallel(*exported.get(), 4096, images, true, 4);
+    ASSERT_TRUE(parallel.IsValid());
+    ASSERT_TRUE(parallel.Build());
+    EXPECT_EQ(ReadRawImage(parallel), expected);
+
+    std::string raw_path = std::string(dir.path) + "/super.img";
+    ASSERT_TRUE(WriteToImageFile(raw_path, *exported.get(), 4096, images, false, 4));
+    std::string raw;
+    ASSERT_TRUE(android::base::ReadFileToString(raw_path, &raw));
+    EXPECT_EQ(raw, expected);
+
+    // And the images are where the metadata says.
+    const LpMetadataPartition* system = FindPartition(*exported.get(), "system");
+    ASSERT_NE(system, nullptr);
+    const LpMetadataExtent& extent = exported->extents[system->first_extent_index];
+    std::string system_image;
+    ASSERT_TRUE(android::base::ReadFileToString(images["system"], &system_image));
+    EXPECT_EQ(raw.substr(extent.target_data * LP_SECTOR_SIZE, system_image.size()), system_image);
+}
+
 TEST_F(LiblpTest, AutoSlotSuffixing) {
     unique_ptr<MetadataBuilder> builder = CreateDefaultBuilder();
     ASSERT_NE(builder, nullptr);
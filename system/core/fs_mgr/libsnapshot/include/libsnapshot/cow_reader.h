@@ -20,6 +20,7 @@
 #include <memory>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <libsnapshot/cow_format.h>
@@ -32,6 +33,7 @@ namespace android {
 namespace snapshot {
 
 class ICowOpIter;
+class IDecompressor;
 
 // Interface for reading from a snapuserd COW.
 class ICowReader {
@@ -144,6 +146,28 @@ class CowReader final : public ICowReader {
     ssize_t ReadData(const CowOperation* op, void* buffer, size_t buffer_size,
                      size_t ignore_bytes = 0) override;
 
+    // Decode the data of each of |ops|, which must be replace or xor
+    // operations, into consecutive blocks of |buffer|, like ReadData(). The
+    // operations are split between up to |num_threads| threads; the data of
+    // ops[i] always lands at block i. Returns false if any operation could
+    // not be read.
+    //
+    // If |failed| is null, reading stops at the first failure. Otherwise the
+    // indices of all the operations that could not be read are appended to
+    // it, in order.
+    bool ReadDataParallel(const std::vector<const CowOperation*>& ops, void* buffer,
+                          size_t num_threads, std::vector<size_t>* failed = nullptr);
+
+    // Decode the data of a run of replace operations into consecutive blocks
+    // of |buffer|, reading it from the COW with a single read. The data of
+    // each operation must immediately follow the data of the one before it;
+    // see IsDataContiguous().
+    bool ReadReplaceData(const std::vector<const CowOperation*>& ops, void* buffer);
+
+    // True if |next| is a replace operation whose data immediately follows
+    // the data of replace operation |prev| in the COW.
+    static bool IsDataContiguous(const CowOperation* prev, const CowOperation* next);
+
     CowHeader& GetHeader() override { return header_; }
 
     bool GetRawBytes(const CowOperation* op, void* buffer, size_t len, size_t* read);
@@ -168,6 +192,7 @@ class CowReader final : public ICowReader {
     bool PrepMergeOps();
     uint64_t FindNumCopyops();
     uint8_t GetCompressionType(const CowOperation* op);
+    bool GetDecompressor(const CowOperation* op, std::unique_ptr<IDecompressor>* decompressor);
 
     android::base::unique_fd owned_fd_;
     android::base::borrowed_fd fd_;
@@ -184,6 +209,8 @@ class CowReader final : public ICowReader {
     std::shared_ptr<std::unordered_map<uint64_t, uint64_t>> data_loc_;
     ReaderFlags reader_flag_;
     bool is_merge_{};
+    // Compressed data for ReadReplaceData().
+    std::vector<uint8_t> replace_data_;
 };
 
 }  // namespace snapshot
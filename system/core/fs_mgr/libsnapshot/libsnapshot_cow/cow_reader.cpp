@@ -14,10 +14,15 @@
 // limitations under the License.
 //
 
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -554,11 +559,8 @@ bool CowReader::GetRawBytes(uint64_t offset, void* buffer, size_t len, size_t* r
         LOG(ERROR) << "invalid data offset: " << offset << ", " << len << " bytes";
         return false;
     }
-    if (lseek(fd_.get(), offset, SEEK_SET) < 0) {
-        PLOG(ERROR) << "lseek to read raw bytes failed";
-        return false;
-    }
-    ssize_t rv = TEMP_FAILURE_RETRY(::read(fd_.get(), buffer, len));
+    // pread, so that ReadDataParallel() threads can share the fd.
+    ssize_t rv = TEMP_FAILURE_RETRY(::pread(fd_.get(), buffer, len, offset));
     if (rv < 0) {
         PLOG(ERROR) << "read failed";
         return false;
@@ -597,35 +599,65 @@ class CowDataStream final : public IByteStream {
     size_t remaining_;
 };
 
+class BufferDataStream final : public IByteStream {
+  public:
+    BufferDataStream(const uint8_t* data, size_t data_length)
+        : data_(data), data_length_(data_length), remaining_(data_length) {}
+
+    ssize_t Read(void* buffer, size_t length) override {
+        size_t to_read = std::min(length, remaining_);
+        memcpy(buffer, data_ + data_length_ - remaining_, to_read);
+        remaining_ -= to_read;
+        return to_read;
+    }
+
+    size_t Size() const override { return data_length_; }
+
+  private:
+    const uint8_t* data_;
+    size_t data_length_;
+    size_t remaining_;
+};
+
 uint8_t CowReader::GetCompressionType(const CowOperation* op) {
     return op->compression;
 }
 
-ssize_t CowReader::ReadData(const CowOperation* op, void* buffer, size_t buffer_size,
-                            size_t ignore_bytes) {
-    std::unique_ptr<IDecompressor> decompressor;
+// Sets |decompressor| to null if the data of |op| is not compressed.
+bool CowReader::GetDecompressor(const CowOperation* op,
+                                std::unique_ptr<IDecompressor>* decompressor) {
+    decompressor->reset();
     switch (GetCompressionType(op)) {
         case kCowCompressNone:
             break;
         case kCowCompressGz:
-            decompressor = IDecompressor::Gz();
+            *decompressor = IDecompressor::Gz();
             break;
         case kCowCompressBrotli:
-            decompressor = IDecompressor::Brotli();
+            *decompressor = IDecompressor::Brotli();
             break;
         case kCowCompressZstd:
             if (header_.block_size != op->data_length) {
-                decompressor = IDecompressor::Zstd();
+                *decompressor = IDecompressor::Zstd();
             }
             break;
         case kCowCompressLz4:
             if (header_.block_size != op->data_length) {
-                decompressor = IDecompressor::Lz4();
+                *decompressor = IDecompressor::Lz4();
             }
             break;
         default:
             LOG(ERROR) << "Unknown compression type: " << GetCompressionType(op);
-            return -1;
+            return false;
+    }
+    return true;
+}
+
+ssize_t CowReader::ReadData(const CowOperation* op, void* buffer, size_t buffer_size,
+                            size_t ignore_bytes) {
+    std::unique_ptr<IDecompressor> decompressor;
+    if (!GetDecompressor(op, &decompressor)) {
+        return -1;
     }
 
     uint64_t offset;
@@ -645,6 +677,114 @@ ssize_t CowReader::ReadData(const CowOperation* op, void* buffer, size_t buffer_
     return decompressor->Decompress(buffer, buffer_size, header_.block_size, ignore_bytes);
 }
 
+bool CowReader::ReadDataParallel(const std::vector<const CowOperation*>& ops, void* buffer,
+                                 size_t num_threads, std::vector<size_t>* failed) {
+    // Ops are handed out to the threads in chunks of this many.
+    static constexpr size_t kOpsPerChunk = 64;
+
+    std::atomic<size_t> next_chunk = 0;
+    std::atomic<bool> ok = true;
+    std::mutex failed_lock;
+    auto worker = [&]() {
+        std::vector<size_t> worker_failed;
+        while (ok || failed) {
+            size_t start = next_chunk++ * kOpsPerChunk;
+            if (start >= ops.size()) {
+                break;
+            }
+            size_t end = std::min(start + kOpsPerChunk, ops.size());
+            for (size_t i = start; i < end; i++) {
+                uint8_t* out = reinterpret_cast<uint8_t*>(buffer) + i * header_.block_size;
+                ssize_t rv = ReadData(ops[i], out, header_.block_size);
+                if (rv != static_cast<ssize_t>(header_.block_size)) {
+                    LOG(ERROR) << "Failed to read data for " << *ops[i] << ", return value: " << rv;
+                    ok = false;
+                    worker_failed.emplace_back(i);
+                }
+            }
+        }
+        if (failed && !worker_failed.empty()) {
+            std::lock_guard<std::mutex> lock(failed_lock);
+            failed->insert(failed->end(), worker_failed.begin(), worker_failed.end());
+        }
+    };
+
+    size_t num_chunks = (ops.size() + kOpsPerChunk - 1) / kOpsPerChunk;
+    num_threads = std::min(std::max<size_t>(num_threads, 1), num_chunks);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (failed) {
+        std::sort(failed->begin(), failed->end());
+    }
+    return ok;
+}
+
+bool CowReader::IsDataContiguous(const CowOperation* prev, const CowOperation* next) {
+    return prev->type == kCowReplaceOp && next->type == kCowReplaceOp &&
+           GetCowOpSourceInfoData(prev) + prev->data_length == GetCowOpSourceInfoData(next);
+}
+
+bool CowReader::ReadReplaceData(const std::vector<const CowOperation*>& ops, void* buffer) {
+    if (ops.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (ops[i]->type != kCowReplaceOp || (i > 0 && !IsDataContiguous(ops[i - 1], ops[i]))) {
+            LOG(ERROR) << "Not a contiguous run of replace ops: " << *ops[i];
+            return false;
+        }
+    }
+
+    uint64_t offset = GetCowOpSourceInfoData(ops.front());
+    size_t length = GetCowOpSourceInfoData(ops.back()) + ops.back()->data_length - offset;
+    replace_data_.resize(length);
+    for (size_t pos = 0; pos < length;) {
+        size_t read;
+        if (!GetRawBytes(offset + pos, replace_data_.data() + pos, length - pos, &read)) {
+            return false;
+        }
+        if (!read) {
+            LOG(ERROR) << "Unexpected end of COW data at offset " << offset + pos;
+            return false;
+        }
+        pos += read;
+    }
+
+    const uint8_t* data = replace_data_.data();
+    uint8_t* out = reinterpret_cast<uint8_t*>(buffer);
+    for (const auto& op : ops) {
+        std::unique_ptr<IDecompressor> decompressor;
+        if (!GetDecompressor(op, &decompressor)) {
+            return false;
+        }
+        if (!decompressor) {
+            if (op->data_length != header_.block_size) {
+                LOG(ERROR) << "Invalid uncompressed data length: " << *op;
+                return false;
+            }
+            memcpy(out, data, op->data_length);
+        } else {
+            BufferDataStream stream(data, op->data_length);
+            decompressor->set_stream(&stream);
+            ssize_t rv = decompressor->Decompress(out, header_.block_size, header_.block_size, 0);
+            if (rv != static_cast<ssize_t>(header_.block_size)) {
+                LOG(ERROR) << "Failed to decompress " << *op << ", return value: " << rv;
+                return false;
+            }
+        }
+        data += op->data_length;
+        out += header_.block_size;
+    }
+    return true;
+}
+
 bool CowReader::GetSourceOffset(const CowOperation* op, uint64_t* source_offset) {
     switch (op->type) {
         case kCowCopyOp:
@@ -6,6 +6,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <cstring>
 #include <future>
@@ -37,12 +39,16 @@ DEFINE_string(source, "", "Source partition image");
 DEFINE_string(target, "", "Target partition image");
 DEFINE_string(compression, "lz4",
               "Compression algorithm. Default is set to lz4. Available options: lz4, zstd, gz");
+DEFINE_bool(xor_similar, true,
+            "Encode target blocks that are similar, but not identical, to a source block as "
+            "XOR ops against it");
 
 namespace android {
 namespace snapshot {
 
 using namespace android::storage_literals;
 using namespace android;
+using android::base::borrowed_fd;
 using android::base::unique_fd;
 
 using android::snapshot::CreateCowWriter;
@@ -51,7 +57,8 @@ using android::snapshot::ICowWriter;
 class CreateSnapshot {
   public:
     CreateSnapshot(const std::string& src_file, const std::string& target_file,
-                   const std::string& patch_file, const std::string& compression);
+                   const std::string& patch_file, const std::string& compression,
+                   bool xor_similar);
     bool CreateSnapshotPatch();
 
   private:
@@ -75,6 +82,24 @@ class CreateSnapshot {
     std::unordered_map<std::string, int> source_block_hash_;
     std::mutex source_block_hash_lock_;
 
+    /*
+     * Similarity index of the source blocks, used to find a block to XOR
+     * against when there is no exact match. Each feature hashes a few words
+     * sampled at fixed positions in the block; blocks which share a feature
+     * are likely to differ in only a few places. Since XOR ops only work on
+     * aligned data, the positions don't need to be content-defined.
+     */
+    static constexpr int kNumFeatures = 4;
+    static constexpr int kSamplesPerFeature = 4;
+    std::unordered_map<uint64_t, uint32_t> source_features_[kNumFeatures];
+    bool xor_similar_ = true;
+
+    /* Op counts, for the summary. */
+    std::atomic<uint64_t> num_copy_ops_ = 0;
+    std::atomic<uint64_t> num_xor_ops_ = 0;
+    std::atomic<uint64_t> num_replace_ops_ = 0;
+    std::atomic<uint64_t> num_zero_ops_ = 0;
+
     std::unique_ptr<ICowWriter> writer_;
     std::mutex write_lock_;
 
@@ -88,12 +113,16 @@ class CreateSnapshot {
     bool IsBlockAligned(uint64_t read_size) { return ((read_size & (BLOCK_SZ - 1)) == 0); }
     bool ReadBlocks(off_t offset, const int skip_blocks, const uint64_t dev_sz);
     std::string ToHexString(const uint8_t* buf, size_t len);
+    void BlockFeatures(const void* data, uint64_t features[kNumFeatures]);
+    bool FindSimilarBlock(borrowed_fd src_fd, const void* buffer, uint8_t* xor_buffer,
+                          uint32_t* source_block);
 
     bool CreateSnapshotFile();
     bool FindSourceBlockHash();
     bool PrepareParse(std::string& parsing_file, const bool createSnapshot);
     bool ParsePartition();
-    bool WriteSnapshot(const void* buffer, uint64_t block, std::string& block_hash);
+    bool WriteSnapshot(const void* buffer, uint64_t block, std::string& block_hash,
+                       borrowed_fd src_fd, uint8_t* xor_buffer);
 };
 
 void CreateSnapshotLogger(android::base::LogId, android::base::LogSeverity severity, const char*,
@@ -106,8 +135,12 @@ void CreateSnapshotLogger(android::base::LogId, android::base::LogSeverity sever
 }
 
 CreateSnapshot::CreateSnapshot(const std::string& src_file, const std::string& target_file,
-                               const std::string& patch_file, const std::string& compression)
-    : src_file_(src_file), target_file_(target_file), patch_file_(patch_file) {
+                               const std::string& patch_file, const std::string& compression,
+                               bool xor_similar)
+    : src_file_(src_file),
+      target_file_(target_file),
+      patch_file_(patch_file),
+      xor_similar_(xor_similar) {
     if (!compression.empty()) {
         compression_ = compression;
     }
@@ -117,6 +150,9 @@ bool CreateSnapshot::PrepareParse(std::string& parsing_file, const bool createSn
     parsing_file_ = parsing_file;
     create_snapshot_patch_ = createSnapshot;
 
+    zblock_ = std::make_unique<uint8_t[]>(BLOCK_SZ);
+    std::memset(zblock_.get(), 0, BLOCK_SZ);
+
     if (createSnapshot) {
         fd_.reset(open(patch_file_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666));
         if (fd_ < 0) {
@@ -124,9 +160,6 @@ bool CreateSnapshot::PrepareParse(std::string& parsing_file, const bool createSn
             return false;
         }
 
-        zblock_ = std::make_unique<uint8_t[]>(BLOCK_SZ);
-        std::memset(zblock_.get(), 0, BLOCK_SZ);
-
         CowOptions options;
         options.compression = compression_;
         options.num_compress_threads = 2;
@@ -163,10 +196,17 @@ bool CreateSnapshot::CreateSnapshotFile() {
  * Creates snapshot patch file by comparing source.img and target.img
  */
 bool CreateSnapshot::CreateSnapshotPatch() {
+    android::base::Timer timer;
     if (!FindSourceBlockHash()) {
         return false;
     }
-    return CreateSnapshotFile();
+    if (!CreateSnapshotFile()) {
+        return false;
+    }
+    LOG(INFO) << "Ops: " << num_copy_ops_ << " copy, " << num_xor_ops_ << " xor, "
+              << num_replace_ops_ << " replace, " << num_zero_ops_ << " zero";
+    LOG(INFO) << "COW size: " << writer_->GetCowSize() << " bytes, created in " << timer;
+    return true;
 }
 
 void CreateSnapshot::SHA256(const void* data, size_t length, uint8_t out[32]) {
@@ -187,17 +227,97 @@ std::string CreateSnapshot::ToHexString(const uint8_t* buf, size_t len) {
     return out;
 }
 
-bool CreateSnapshot::WriteSnapshot(const void* buffer, uint64_t block, std::string& block_hash) {
+void CreateSnapshot::BlockFeatures(const void* data, uint64_t features[kNumFeatures]) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const size_t num_words = BLOCK_SZ / sizeof(uint64_t);
+    const size_t stride = num_words / (kNumFeatures * kSamplesPerFeature);
+
+    for (int i = 0; i < kNumFeatures; i++) {
+        uint64_t hash = i + 1;
+        for (int j = 0; j < kSamplesPerFeature; j++) {
+            // Interleave the features so that a change in one part of the
+            // block only spoils some of them.
+            size_t word = (j * kNumFeatures + i) * stride + i;
+            uint64_t value;
+            std::memcpy(&value, bytes + word * sizeof(uint64_t), sizeof(value));
+            hash = (hash ^ value) * 0x9e3779b97f4a7c15ULL;
+            hash ^= hash >> 29;
+        }
+        features[i] = hash;
+    }
+}
+
+/*
+ * Look for a source block sharing a feature with |buffer| that differs from
+ * it in at most half of its bytes. On success, |xor_buffer| holds the XOR of
+ * the two blocks.
+ */
+bool CreateSnapshot::FindSimilarBlock(borrowed_fd src_fd, const void* buffer, uint8_t* xor_buffer,
+                                      uint32_t* source_block) {
+    uint64_t features[kNumFeatures];
+    BlockFeatures(buffer, features);
+
+    const uint8_t* target = static_cast<const uint8_t*>(buffer);
+    std::vector<uint8_t> source(BLOCK_SZ);
+    const size_t max_diff = BLOCK_SZ / 2;
+    size_t best_diff = max_diff + 1;
+    uint32_t tried[kNumFeatures];
+    int num_tried = 0;
+
+    for (int i = 0; i < kNumFeatures; i++) {
+        auto iter = source_features_[i].find(features[i]);
+        if (iter == source_features_[i].end()) {
+            continue;
+        }
+        uint32_t candidate = iter->second;
+        if (std::find(tried, tried + num_tried, candidate) != tried + num_tried) {
+            continue;
+        }
+        tried[num_tried++] = candidate;
+
+        if (!android::base::ReadFullyAtOffset(src_fd, source.data(), BLOCK_SZ,
+                                              static_cast<off_t>(candidate) * BLOCK_SZ)) {
+            PLOG(ERROR) << "Failed to read source block: " << candidate;
+            return false;
+        }
+        size_t diff = 0;
+        for (int j = 0; j < BLOCK_SZ; j++) {
+            diff += (source[j] != target[j]);
+        }
+        if (diff < best_diff) {
+            best_diff = diff;
+            *source_block = candidate;
+            for (int j = 0; j < BLOCK_SZ; j++) {
+                xor_buffer[j] = source[j] ^ target[j];
+            }
+        }
+    }
+    return best_diff <= max_diff;
+}
+
+bool CreateSnapshot::WriteSnapshot(const void* buffer, uint64_t block, std::string& block_hash,
+                                   borrowed_fd src_fd, uint8_t* xor_buffer) {
     if (std::memcmp(zblock_.get(), buffer, BLOCK_SZ) == 0) {
+        num_zero_ops_++;
         std::lock_guard<std::mutex> lock(write_lock_);
         return writer_->AddZeroBlocks(block, 1);
     }
 
     auto iter = source_block_hash_.find(block_hash);
     if (iter != source_block_hash_.end()) {
+        num_copy_ops_++;
         std::lock_guard<std::mutex> lock(write_lock_);
         return writer_->AddCopy(block, iter->second, 1);
     }
+
+    uint32_t source_block;
+    if (xor_similar_ && FindSimilarBlock(src_fd, buffer, xor_buffer, &source_block)) {
+        num_xor_ops_++;
+        std::lock_guard<std::mutex> lock(write_lock_);
+        return writer_->AddXorBlocks(block, xor_buffer, BLOCK_SZ, source_block, 0);
+    }
+
+    num_replace_ops_++;
     std::lock_guard<std::mutex> lock(write_lock_);
     return writer_->AddRawBlocks(block, buffer, BLOCK_SZ);
 }
@@ -209,6 +329,18 @@ bool CreateSnapshot::ReadBlocks(off_t offset, const int skip_blocks, const uint6
         return false;
     }
 
+    // Source blocks are read back to compute XOR ops.
+    unique_fd src_fd;
+    std::unique_ptr<uint8_t[]> xor_buffer;
+    if (create_snapshot_patch_ && xor_similar_) {
+        src_fd.reset(TEMP_FAILURE_RETRY(open(src_file_.c_str(), O_RDONLY)));
+        if (src_fd < 0) {
+            LOG(ERROR) << "open failed: " << src_file_;
+            return false;
+        }
+        xor_buffer = std::make_unique<uint8_t[]>(BLOCK_SZ);
+    }
+
     loff_t file_offset = offset;
     const uint64_t read_sz = kBlockSizeToRead;
     std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(read_sz);
@@ -241,16 +373,25 @@ bool CreateSnapshot::ReadBlocks(off_t offset, const int skip_blocks, const uint6
             std::string hash = ToHexString(checksum, sizeof(checksum));
 
             if (create_snapshot_patch_) {
-                if (!WriteSnapshot(bufptr, blkindex, hash)) {
+                if (!WriteSnapshot(bufptr, blkindex, hash, src_fd, xor_buffer.get())) {
                     LOG(ERROR) << "WriteSnapshot failed for block: " << blkindex;
                     return false;
                 }
             } else {
+                uint64_t features[kNumFeatures];
+                bool index_features = xor_similar_ && std::memcmp(zblock_.get(), bufptr, BLOCK_SZ);
+                if (index_features) {
+                    BlockFeatures(bufptr, features);
+                }
+
                 std::lock_guard<std::mutex> lock(source_block_hash_lock_);
                 {
                     if (source_block_hash_.count(hash) == 0) {
                         source_block_hash_[hash] = blkindex;
                     }
+                    for (int i = 0; index_features && i < kNumFeatures; i++) {
+                        source_features_[i].emplace(features[i], blkindex);
+                    }
                 }
             }
             buffer_offset += BLOCK_SZ;
@@ -327,6 +468,8 @@ SYNOPSIS
     source.img -> Source partition image
     target.img -> Target partition image
     compressoin -> compression algorithm. Default set to lz4. Supported types are gz, lz4, zstd.
+    xor_similar -> encode blocks similar to a source block as XOR ops. Default true; pass
+                   --noxor_similar to only use exact matches.
 
 EXAMPLES
 
@@ -349,7 +492,7 @@ int main(int argc, char* argv[]) {
     auto parts = android::base::Split(fname, ".");
     std::string snapshotfile = parts[0] + ".patch";
     android::snapshot::CreateSnapshot snapshot(FLAGS_source, FLAGS_target, snapshotfile,
-                                               FLAGS_compression);
+                                               FLAGS_compression, FLAGS_xor_similar);
 
     if (!snapshot.CreateSnapshotPatch()) {
         LOG(ERROR) << "Snapshot creation failed";
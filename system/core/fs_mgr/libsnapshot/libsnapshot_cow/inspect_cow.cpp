@@ -16,10 +16,13 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -30,6 +33,8 @@
 
 DEFINE_bool(silent, false, "Run silently");
 DEFINE_bool(decompress, false, "Attempt to decompress data ops");
+DEFINE_uint32(decompress_threads, 0,
+              "Number of threads to decompress data ops with; 0 uses one per CPU");
 DEFINE_bool(show_bad_data, false, "If an op fails to decompress, show its daw data");
 DEFINE_bool(show_ops, false, "Print all opcode information");
 DEFINE_string(order, "", "If show_ops is true, change the order (either merge or reverse-merge)");
@@ -71,6 +76,40 @@ static void ShowBad(CowReader& reader, const struct CowOperation* op) {
     }
 }
 
+// Decompresses data ops in batches on several threads.
+class DecompressChecker {
+  public:
+    DecompressChecker(CowReader& reader, size_t num_threads)
+        : reader_(reader),
+          num_threads_(num_threads),
+          buffer_(kBatchSize * reader.GetHeader().block_size, '\0') {}
+
+    bool Add(const CowOperation* op) {
+        ops_.emplace_back(op);
+        return ops_.size() < kBatchSize || Flush();
+    }
+
+    // Returns false if any op since the last call failed to decompress.
+    bool Flush() {
+        std::vector<size_t> failed;
+        reader_.ReadDataParallel(ops_, buffer_.data(), num_threads_, &failed);
+        for (const auto& index : failed) {
+            std::cerr << "Failed to decompress for :" << *ops_[index] << "\n";
+            if (FLAGS_show_bad_data) ShowBad(reader_, ops_[index]);
+        }
+        ops_.clear();
+        return failed.empty();
+    }
+
+  private:
+    static constexpr size_t kBatchSize = 4096;
+
+    CowReader& reader_;
+    size_t num_threads_;
+    std::vector<const CowOperation*> ops_;
+    std::string buffer_;
+};
+
 static bool ShowRawOpStreamV2(borrowed_fd fd, const CowHeader& header) {
     CowParserV2 parser;
     if (!parser.Parse(fd, header)) {
@@ -162,7 +201,13 @@ static bool Inspect(const std::string& path) {
         iter = reader.GetMergeOpIter(FLAGS_show_merged);
     }
 
-    std::string buffer(header.block_size, '\0');
+    size_t num_threads = FLAGS_decompress_threads;
+    if (!num_threads) {
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    // Only allocate the batch buffer if there's anything to decompress.
+    std::optional<DecompressChecker> checker;
+    if (FLAGS_decompress) checker.emplace(reader, num_threads);
 
     if (!FLAGS_silent && FLAGS_show_raw_ops) {
         std::cout << "\n";
@@ -187,10 +232,8 @@ static bool Inspect(const std::string& path) {
         if (!FLAGS_silent && FLAGS_show_ops) std::cout << *op << "\n";
 
         if (FLAGS_decompress && op->type == kCowReplaceOp && op->compression != kCowCompressNone) {
-            if (reader.ReadData(op, buffer.data(), buffer.size()) < 0) {
-                std::cerr << "Failed to decompress for :" << *op << "\n";
+            if (!checker->Add(op)) {
                 success = false;
-                if (FLAGS_show_bad_data) ShowBad(reader, op);
             }
         }
 
@@ -224,6 +267,9 @@ static bool Inspect(const std::string& path) {
 
         iter->Next();
     }
+    if (checker && !checker->Flush()) {
+        success = false;
+    }
 
     if (!FLAGS_silent) {
         auto total_ops = replace_ops + zero_ops + copy_ops + xor_ops;
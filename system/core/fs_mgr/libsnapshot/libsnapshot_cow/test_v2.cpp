@@ -598,6 +598,46 @@ TEST_F(CowTest, CompressTwoBlocks) {
     ASSERT_TRUE(ReadData(reader, op, sink.data(), sink.size()));
 }
 
+TEST_F(CowTest, ReadDataParallel) {
+    CowOptions options;
+    options.compression = "lz4";
+    options.cluster_ops = 0;
+    CowWriterV2 writer(options, GetCowFd());
+
+    ASSERT_TRUE(writer.Initialize());
+
+    constexpr size_t kNumBlocks = 300;
+    std::string data;
+    for (size_t i = 0; i < kNumBlocks; i++) {
+        std::string block = "Block " + std::to_string(i);
+        block.resize(options.block_size, static_cast<char>(i));
+        data += block;
+    }
+
+    ASSERT_TRUE(writer.AddRawBlocks(50, data.data(), data.size()));
+    ASSERT_TRUE(writer.Finalize());
+
+    ASSERT_EQ(lseek(cow_->fd, 0, SEEK_SET), 0);
+
+    CowReader reader;
+    ASSERT_TRUE(reader.Parse(cow_->fd));
+
+    std::vector<const CowOperation*> ops;
+    for (auto iter = reader.GetOpIter(); !iter->AtEnd(); iter->Next()) {
+        ASSERT_EQ(iter->Get()->type, kCowReplaceOp);
+        ops.emplace_back(iter->Get());
+    }
+    ASSERT_EQ(ops.size(), kNumBlocks);
+
+    for (size_t num_threads : {1, 4}) {
+        std::string sink(data.size(), '\0');
+        std::vector<size_t> failed;
+        ASSERT_TRUE(reader.ReadDataParallel(ops, sink.data(), num_threads, &failed));
+        ASSERT_TRUE(failed.empty());
+        ASSERT_EQ(sink, data);
+    }
+}
+
 TEST_F(CowTest, GetSize) {
     CowOptions options;
     options.cluster_ops = 0;
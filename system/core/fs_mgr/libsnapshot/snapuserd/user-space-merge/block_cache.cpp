@@ -0,0 +1,77 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "block_cache.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace android {
+namespace snapshot {
+
+BlockCache::BlockCache(size_t capacity_blocks, size_t block_size, size_t num_shards)
+    : block_size_(block_size),
+      shard_capacity_(capacity_blocks / std::max<size_t>(num_shards, 1)),
+      shards_(std::max<size_t>(num_shards, 1)) {}
+
+bool BlockCache::Get(uint64_t block, void* buffer) {
+    Shard& shard = GetShard(block);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    auto iter = shard.index.find(block);
+    if (iter == shard.index.end()) {
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+    memcpy(buffer, iter->second->second.get(), block_size_);
+    return true;
+}
+
+bool BlockCache::Contains(uint64_t block) {
+    Shard& shard = GetShard(block);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.index.count(block) != 0;
+}
+
+void BlockCache::Put(uint64_t block, const void* data) {
+    if (!shard_capacity_) {
+        return;
+    }
+
+    Shard& shard = GetShard(block);
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    auto iter = shard.index.find(block);
+    if (iter != shard.index.end()) {
+        // COW data never changes, so the cached copy is already right.
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+        return;
+    }
+
+    if (shard.lru.size() < shard_capacity_) {
+        shard.lru.emplace_front(block, std::make_unique<uint8_t[]>(block_size_));
+    } else {
+        // Reuse the oldest entry and its buffer.
+        shard.index.erase(shard.lru.back().first);
+        shard.lru.splice(shard.lru.begin(), shard.lru, std::prev(shard.lru.end()));
+        shard.lru.front().first = block;
+    }
+    memcpy(shard.lru.front().second.get(), data, block_size_);
+    shard.index.emplace(block, shard.lru.begin());
+}
+
+}  // namespace snapshot
+}  // namespace android
@@ -0,0 +1,67 @@
+// Copyright (C) 2023 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace snapshot {
+
+// LRU cache of decompressed COW data, keyed by the block of the new image a
+// COW op writes. It is shared by the read workers of a snapshot, so it is
+// split into shards, each with its own lock and an equal share of the
+// capacity.
+class BlockCache {
+  public:
+    BlockCache(size_t capacity_blocks, size_t block_size, size_t num_shards);
+
+    // Copies the cached data for |block| to |buffer| and returns true, or
+    // returns false if it is not cached.
+    bool Get(uint64_t block, void* buffer);
+
+    // Returns true if |block| is cached, without marking it as used.
+    bool Contains(uint64_t block);
+
+    // Caches a copy of |data| for |block|, evicting the least recently used
+    // block of its shard if it is full.
+    void Put(uint64_t block, const void* data);
+
+  private:
+    using Entry = std::pair<uint64_t, std::unique_ptr<uint8_t[]>>;
+
+    struct Shard {
+        std::mutex lock;
+        // Most recently used first.
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    };
+
+    Shard& GetShard(uint64_t block) { return shards_[block % shards_.size()]; }
+
+    size_t block_size_;
+    size_t shard_capacity_;
+    std::vector<Shard> shards_;
+};
+
+}  // namespace snapshot
+}  // namespace android
@@ -42,14 +42,78 @@ ReadWorker::ReadWorker(const std::string& cow_device, const std::string& backing
       backing_store_device_(backing_device),
       block_server_opener_(opener) {}
 
+// Only compressed data is worth keeping in the block cache.
+static bool IsCacheable(const CowOperation* cow_op) {
+    return GetCowOpSourceInfoCompression(cow_op) && cow_op->data_length != BLOCK_SZ;
+}
+
 // Start the replace operation. This will read the
 // internal COW format and if the block is compressed,
 // it will be de-compressed.
 bool ReadWorker::ProcessReplaceOp(const CowOperation* cow_op, void* buffer) {
-    if (!reader_->ReadData(cow_op, buffer, BLOCK_SZ)) {
-        SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block;
+    BlockCache* cache = snapuserd_->GetBlockCache();
+    if (IsCacheable(cow_op) && cache->Get(cow_op->new_block, buffer)) {
+        return true;
+    }
+
+    ssize_t size = reader_->ReadData(cow_op, buffer, BLOCK_SZ);
+    if (size != BLOCK_SZ) {
+        SNAP_LOG(ERROR) << "ProcessReplaceOp failed for block " << cow_op->new_block
+                        << ", return value: " << size;
+        return false;
+    }
+    if (IsCacheable(cow_op)) {
+        cache->Put(cow_op->new_block, buffer);
+    }
+    return true;
+}
+
+// Returns how many of the ops starting at |it|, up to |max_ops|, map
+// consecutive blocks to replace ops whose data is contiguous in the COW, and
+// can thus be read and decompressed in one go. Blocks already in the cache
+// end the run, so that they are served from it.
+size_t ReadWorker::GetReplaceRun(std::vector<std::pair<sector_t, const CowOperation*>>::iterator it,
+                                 std::vector<std::pair<sector_t, const CowOperation*>>::iterator end,
+                                 size_t max_ops) {
+    BlockCache* cache = snapuserd_->GetBlockCache();
+    const CowOperation* first = it->second;
+    if (first->type != kCowReplaceOp || (IsCacheable(first) && cache->Contains(first->new_block))) {
+        return 1;
+    }
+
+    size_t num_ops = 1;
+    for (auto next = std::next(it); num_ops < max_ops && next != end; it = next++, num_ops++) {
+        if (next->first != it->first + (BLOCK_SZ >> SECTOR_SHIFT) ||
+            !CowReader::IsDataContiguous(it->second, next->second) ||
+            (IsCacheable(next->second) && cache->Contains(next->second->new_block))) {
+            break;
+        }
+    }
+    return num_ops;
+}
+
+// Decompress the data of a run of |num_ops| replace ops found by
+// GetReplaceRun() into |buffer|.
+bool ReadWorker::ProcessReplaceOps(std::vector<std::pair<sector_t, const CowOperation*>>::iterator it,
+                                   size_t num_ops, void* buffer) {
+    replace_ops_.clear();
+    for (size_t i = 0; i < num_ops; i++, it++) {
+        replace_ops_.emplace_back(it->second);
+    }
+    if (!reader_->ReadReplaceData(replace_ops_, buffer)) {
+        SNAP_LOG(ERROR) << "ProcessReplaceOps failed for " << num_ops << " blocks from block "
+                        << replace_ops_.front()->new_block;
         return false;
     }
+
+    BlockCache* cache = snapuserd_->GetBlockCache();
+    auto data = reinterpret_cast<uint8_t*>(buffer);
+    for (const auto& cow_op : replace_ops_) {
+        if (IsCacheable(cow_op)) {
+            cache->Put(cow_op->new_block, data);
+        }
+        data += BLOCK_SZ;
+    }
     return true;
 }
 
@@ -95,11 +159,17 @@ bool ReadWorker::ProcessXorOp(const CowOperation* cow_op, void* buffer) {
     }
     CHECK(xor_buffer_.size() == BLOCK_SZ);
 
-    ssize_t size = reader_->ReadData(cow_op, xor_buffer_.data(), xor_buffer_.size());
-    if (size != BLOCK_SZ) {
-        SNAP_LOG(ERROR) << "ProcessXorOp failed for block " << cow_op->new_block
-                        << ", return value: " << size;
-        return false;
+    BlockCache* cache = snapuserd_->GetBlockCache();
+    if (!IsCacheable(cow_op) || !cache->Get(cow_op->new_block, xor_buffer_.data())) {
+        ssize_t size = reader_->ReadData(cow_op, xor_buffer_.data(), xor_buffer_.size());
+        if (size != BLOCK_SZ) {
+            SNAP_LOG(ERROR) << "ProcessXorOp failed for block " << cow_op->new_block
+                            << ", return value: " << size;
+            return false;
+        }
+        if (IsCacheable(cow_op)) {
+            cache->Put(cow_op->new_block, xor_buffer_.data());
+        }
     }
 
     auto xor_out = reinterpret_cast<uint8_t*>(buffer);
@@ -263,6 +333,28 @@ bool ReadWorker::ReadAlignedSector(sector_t sector, size_t sz) {
                                        std::make_pair(sector, nullptr), SnapshotHandler::compare);
             bool not_found = (it == chunk_vec.end() || it->first != sector);
 
+            // Read a run of replace ops at once.
+            size_t num_ops = not_found ? 0 : GetReplaceRun(it, chunk_vec.end(), read_size / BLOCK_SZ);
+            if (num_ops > 1) {
+                void* buffer = block_server_->GetResponseBuffer(num_ops * BLOCK_SZ,
+                                                                num_ops * BLOCK_SZ);
+                if (!buffer) {
+                    SNAP_LOG(ERROR) << "AcquireBuffer failed in ReadAlignedSector";
+                    return false;
+                }
+                if (!ProcessReplaceOps(it, num_ops, buffer)) {
+                    SNAP_LOG(ERROR) << "ProcessReplaceOps failed, sector = " << sector
+                                    << ", size = " << sz;
+                    return false;
+                }
+
+                ret = num_ops * BLOCK_SZ;
+                read_size -= ret;
+                total_bytes_read += ret;
+                sector += (ret >> SECTOR_SHIFT);
+                continue;
+            }
+
             void* buffer = block_server_->GetResponseBuffer(BLOCK_SZ, size);
             if (!buffer) {
                 SNAP_LOG(ERROR) << "AcquireBuffer failed in ReadAlignedSector";
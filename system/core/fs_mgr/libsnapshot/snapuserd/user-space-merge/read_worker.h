@@ -45,6 +45,11 @@ class ReadWorker : public Worker, public IBlockServer::Delegate {
     bool ProcessOrderedOp(const CowOperation* cow_op, void* buffer);
     bool ProcessCopyOp(const CowOperation* cow_op, void* buffer);
     bool ProcessReplaceOp(const CowOperation* cow_op, void* buffer);
+    bool ProcessReplaceOps(std::vector<std::pair<sector_t, const CowOperation*>>::iterator it,
+                           size_t num_ops, void* buffer);
+    size_t GetReplaceRun(std::vector<std::pair<sector_t, const CowOperation*>>::iterator it,
+                         std::vector<std::pair<sector_t, const CowOperation*>>::iterator end,
+                         size_t max_ops);
     bool ProcessZeroOp(void* buffer);
 
     bool ReadAlignedSector(sector_t sector, size_t sz);
@@ -64,6 +69,7 @@ class ReadWorker : public Worker, public IBlockServer::Delegate {
     std::unique_ptr<IBlockServer> block_server_;
 
     std::basic_string<uint8_t> xor_buffer_;
+    std::vector<const CowOperation*> replace_ops_;
 };
 
 }  // namespace snapshot
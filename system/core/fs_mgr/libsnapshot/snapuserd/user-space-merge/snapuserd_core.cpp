@@ -49,6 +49,9 @@ SnapshotHandler::SnapshotHandler(std::string misc_name, std::string cow_device,
 }
 
 bool SnapshotHandler::InitializeWorkers() {
+    block_cache_ = std::make_unique<BlockCache>(kDecompressedCacheBlocks, BLOCK_SZ,
+                                                kDecompressedCacheShards);
+
     for (int i = 0; i < num_worker_threads_; i++) {
         auto wt = std::make_unique<ReadWorker>(cow_device_, backing_store_device_, misc_name_,
                                                base_path_merge_, GetSharedPtr(),
@@ -442,6 +445,7 @@ bool SnapshotHandler::CheckPartitionVerification() {
 
 void SnapshotHandler::FreeResources() {
     worker_threads_.clear();
+    block_cache_ = nullptr;
     read_ahead_thread_ = nullptr;
     merge_thread_ = nullptr;
 }
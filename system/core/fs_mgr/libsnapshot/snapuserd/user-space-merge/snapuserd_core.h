@@ -48,6 +48,7 @@
 #include <snapuserd/snapuserd_buffer.h>
 #include <snapuserd/snapuserd_kernel.h>
 #include <storage_literals/storage_literals.h>
+#include "block_cache.h"
 #include "snapuserd_readahead.h"
 #include "snapuserd_verify.h"
 
@@ -63,6 +64,10 @@ static_assert(PAYLOAD_BUFFER_SZ >= BLOCK_SZ);
 
 static constexpr int kNumWorkerThreads = 4;
 
+// Decompressed COW blocks kept for the read workers of each snapshot: 2MiB.
+static constexpr size_t kDecompressedCacheBlocks = 512;
+static constexpr size_t kDecompressedCacheShards = 8;
+
 static constexpr int kNiceValueForMergeThreads = -5;
 
 #define SNAP_LOG(level) LOG(level) << misc_name_ << ": "
@@ -127,6 +132,7 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     std::shared_ptr<SnapshotHandler> GetSharedPtr() { return shared_from_this(); }
 
     std::vector<std::pair<sector_t, const CowOperation*>>& GetChunkVec() { return chunk_vec_; }
+    BlockCache* GetBlockCache() { return block_cache_.get(); }
 
     static bool compare(std::pair<sector_t, const CowOperation*> p1,
                         std::pair<sector_t, const CowOperation*> p2) {
@@ -218,6 +224,8 @@ class SnapshotHandler : public std::enable_shared_from_this<SnapshotHandler> {
     size_t total_mapped_addr_length_;
 
     std::vector<std::unique_ptr<ReadWorker>> worker_threads_;
+    // Decompressed data of the COW ops, shared by the read workers
+    std::unique_ptr<BlockCache> block_cache_;
     // Read-ahead related
     bool populate_data_from_cow_ = false;
     bool ra_thread_ = false;
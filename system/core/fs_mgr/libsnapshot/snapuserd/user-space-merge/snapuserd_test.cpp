@@ -38,6 +38,7 @@
 #include <libsnapshot/cow_writer.h>
 #include <snapuserd/dm_user_block_server.h>
 #include <storage_literals/storage_literals.h>
+#include "block_cache.h"
 #include "handler_manager.h"
 #include "merge_worker.h"
 #include "read_worker.h"
@@ -889,6 +890,52 @@ TEST_F(HandlerTest, ReadUnalignedSize) {
     ASSERT_EQ(memcmp(snapuserd_buffer.get(), orig_buffer_.get(), SECTOR_SIZE), 0);
 }
 
+// Data read again may come from the block cache rather than the COW.
+TEST_F(HandlerTest, ReadTwice) {
+    std::unique_ptr<uint8_t[]> snapuserd_buffer = std::make_unique<uint8_t[]>(size_);
+
+    // REPLACE, REPLACE and XOR
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t region : {1, 3, 4}) {
+            loff_t offset = size_ * region;
+            ASSERT_TRUE(ReadSectors(offset / SECTOR_SIZE, size_, snapuserd_buffer.get()));
+            ASSERT_EQ(memcmp(snapuserd_buffer.get(), (char*)orig_buffer_.get() + offset, size_),
+                      0);
+        }
+    }
+
+    // One block at a time, backwards, so that replace ops are not batched.
+    for (loff_t offset = size_ * 2 - BLOCK_SZ; offset >= (loff_t)size_; offset -= BLOCK_SZ) {
+        ASSERT_TRUE(ReadSectors(offset / SECTOR_SIZE, BLOCK_SZ, snapuserd_buffer.get()));
+        ASSERT_EQ(memcmp(snapuserd_buffer.get(), (char*)orig_buffer_.get() + offset, BLOCK_SZ), 0);
+    }
+}
+
+TEST(BlockCacheTest, EvictLeastRecentlyUsed) {
+    // A single shard holding two blocks.
+    BlockCache cache(2, BLOCK_SZ, 1);
+    std::string block(BLOCK_SZ, 'a');
+    std::string out(BLOCK_SZ, '\0');
+
+    cache.Put(1, block.data());
+    block.assign(BLOCK_SZ, 'b');
+    cache.Put(2, block.data());
+
+    ASSERT_TRUE(cache.Get(1, out.data()));
+    ASSERT_EQ(out, std::string(BLOCK_SZ, 'a'));
+
+    // Block 2 is now the least recently used.
+    block.assign(BLOCK_SZ, 'c');
+    cache.Put(3, block.data());
+    ASSERT_FALSE(cache.Contains(2));
+    ASSERT_FALSE(cache.Get(2, out.data()));
+
+    ASSERT_TRUE(cache.Get(1, out.data()));
+    ASSERT_EQ(out, std::string(BLOCK_SZ, 'a'));
+    ASSERT_TRUE(cache.Get(3, out.data()));
+    ASSERT_EQ(out, std::string(BLOCK_SZ, 'c'));
+}
+
 }  // namespace snapshot
 }  // namespace android
 
@@ -29,12 +29,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/fs.h>
 #include <log/log.h>
 #include <private/android_filesystem_config.h>
@@ -43,6 +51,7 @@
 
 using android::base::EndsWith;
 using android::base::StartsWith;
+using android::base::unique_fd;
 
 #define ALIGN(x, alignment) (((x) + ((alignment)-1)) & ~((alignment)-1))
 #define CAP_MASK_LONG(cap_name) (1ULL << (cap_name))
@@ -241,26 +250,24 @@ static size_t strip(const char* path, size_t len, const char suffix[]) {
     return len - strlen(suffix);
 }
 
-static int fs_config_open(int dir, int which, const char* target_out_path) {
-    int fd = -1;
-
+// Opens the override file for conf[which][dir]: the one under target_out_path
+// if it can be opened, the one on the running system otherwise. Sets name to
+// the file opened, and returns -1 if neither can be opened.
+static int fs_config_open(int dir, int which, const char* target_out_path, std::string* name) {
     if (target_out_path && *target_out_path) {
         // target_out_path is the path to the directory holding content of
         // system partition but as we cannot guarantee it ends with '/system'
         // or with or without a trailing slash, need to strip them carefully.
-        char* name = NULL;
         size_t len = strlen(target_out_path);
         len = strip(target_out_path, len, "/");
         len = strip(target_out_path, len, "/system");
-        if (asprintf(&name, "%.*s%s", (int)len, target_out_path, conf[which][dir]) != -1) {
-            fd = TEMP_FAILURE_RETRY(open(name, O_RDONLY));
-            free(name);
-        }
-    }
-    if (fd < 0) {
-        fd = TEMP_FAILURE_RETRY(open(conf[which][dir], O_RDONLY));
+        name->assign(target_out_path, len);
+        *name += conf[which][dir];
+        int fd = TEMP_FAILURE_RETRY(open(name->c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd >= 0) return fd;
     }
-    return fd;
+    *name = conf[which][dir];
+    return TEMP_FAILURE_RETRY(open(name->c_str(), O_RDONLY | O_CLOEXEC));
 }
 
 // if path is "odm/<stuff>", "oem/<stuff>", "product/<stuff>",
@@ -273,113 +280,321 @@ static bool is_partition(const std::string& path) {
     return false;
 }
 
-// alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
-// "system/<partition>/<stuff>" to "<partition>/<stuff>"
-static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
+// Massage pattern and input so that they can be used by fnmatch where
+// directories have to end with /.
+static std::string fs_config_pattern(bool dir, const char* prefix, size_t len) {
     std::string pattern(prefix, len);
-    std::string input(path, plen);
-
-    // Massage pattern and input so that they can be used by fnmatch where
-    // directories have to end with /.
-    if (dir) {
-        if (!EndsWith(input, "/")) {
-            input.append("/");
-        }
-
-        if (!EndsWith(pattern, "/*")) {
-            if (EndsWith(pattern, "/")) {
-                pattern.append("*");
-            } else {
-                pattern.append("/*");
-            }
+    if (dir && !EndsWith(pattern, "/*")) {
+        if (EndsWith(pattern, "/")) {
+            pattern.append("*");
+        } else {
+            pattern.append("/*");
         }
     }
+    return pattern;
+}
 
-    // no FNM_PATHNAME is set in order to match a/b/c/d with a/*
-    // FNM_ESCAPE is set in order to prevent using \\? and \\* and maintenance issues.
-    const int fnm_flags = FNM_NOESCAPE;
-    if (fnmatch(pattern.c_str(), input.c_str(), fnm_flags) == 0) return true;
+static std::string fs_config_input(bool dir, const char* path, size_t plen) {
+    std::string input(path, plen);
+    if (dir && !EndsWith(input, "/")) {
+        input.append("/");
+    }
+    return input;
+}
 
-    // Check match between logical partition's files and patterns.
+// Returns input with its logical partition's "system/" or "vendor/" stripped
+// if it is a file in a logical partition, or an empty string.
+static std::string fs_config_alias(const std::string& input) {
     static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
                                                          "system/vendor/", "vendor/odm/"};
     for (auto& logical_partition : kLogicalPartitions) {
         if (StartsWith(input, logical_partition)) {
             std::string input_in_partition = input.substr(input.find('/') + 1);
-            if (!is_partition(input_in_partition)) continue;
-            if (fnmatch(pattern.c_str(), input_in_partition.c_str(), fnm_flags) == 0) {
-                return true;
-            }
+            if (is_partition(input_in_partition)) return input_in_partition;
         }
     }
-    return false;
+    return "";
+}
+
+// no FNM_PATHNAME is set in order to match a/b/c/d with a/*
+// FNM_ESCAPE is set in order to prevent using \\? and \\* and maintenance issues.
+static constexpr int fnm_flags = FNM_NOESCAPE;
+
+// alias prefixes of "<partition>/<stuff>" to "system/<partition>/<stuff>" or
+// "system/<partition>/<stuff>" to "<partition>/<stuff>"
+static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char* path, size_t plen) {
+    std::string pattern = fs_config_pattern(dir, prefix, len);
+    std::string input = fs_config_input(dir, path, plen);
+
+    if (fnmatch(pattern.c_str(), input.c_str(), fnm_flags) == 0) return true;
+
+    // Check match between logical partition's files and patterns.
+    std::string input_in_partition = fs_config_alias(input);
+    return !input_in_partition.empty() &&
+           fnmatch(pattern.c_str(), input_in_partition.c_str(), fnm_flags) == 0;
 }
 #ifndef __ANDROID_VNDK__
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
-void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
-               unsigned* mode, uint64_t* capabilities) {
-    const struct fs_path_config* pc;
-    size_t which, plen;
+namespace {
 
-    if (path[0] == '/') {
-        path++;
+// All the rules for either files or directories, in "first match" order: the
+// override files in conf[] order followed by android_files or android_dirs.
+//
+// Rules are indexed by a trie of their literal prefix, the part in front of
+// the first wildcard. A lookup walks the input (and its logical partition
+// alias) down the trie, which yields exactly the rules that can possibly
+// match, and only those are handed to fnmatch() in rule order. Rules without
+// wildcards are compared with a plain string comparison instead.
+class FsConfigTable {
+  public:
+    struct Rule {
+        std::string pattern;
+        bool literal;
+        unsigned mode;
+        unsigned uid;
+        unsigned gid;
+        uint64_t capabilities;
+    };
+
+    explicit FsConfigTable(bool dir) : dir_(dir), nodes_(1) {}
+
+    void Add(const char* prefix, size_t len, unsigned mode, unsigned uid, unsigned gid,
+             uint64_t capabilities) {
+        Rule rule = {fs_config_pattern(dir_, prefix, len), true, mode, uid, gid, capabilities};
+        size_t literal_len = rule.pattern.find_first_of("*?[");
+        if (literal_len != std::string::npos) {
+            rule.literal = false;
+        } else {
+            literal_len = rule.pattern.size();
+        }
+
+        uint32_t node = 0;
+        for (size_t i = 0; i < literal_len; ++i) {
+            uint32_t child = Child(node, rule.pattern[i]);
+            if (child == 0) {
+                child = nodes_.size();
+                nodes_[node].children.emplace_back(rule.pattern[i], child);
+                nodes_.emplace_back();
+            }
+            node = child;
+        }
+        nodes_[node].rules.push_back(rules_.size());
+        rules_.push_back(std::move(rule));
+    }
+
+    void SetDefault(unsigned mode, unsigned uid, unsigned gid, uint64_t capabilities) {
+        default_ = {"", true, mode, uid, gid, capabilities};
+    }
+
+    const Rule& Find(const char* path, size_t plen) const {
+        std::string input = fs_config_input(dir_, path, plen);
+        std::string input_in_partition = fs_config_alias(input);
+
+        std::vector<uint32_t> candidates;
+        Collect(input, &candidates);
+        if (!input_in_partition.empty()) Collect(input_in_partition, &candidates);
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        for (uint32_t index : candidates) {
+            const Rule& rule = rules_[index];
+            if (Matches(rule, input)) return rule;
+            if (!input_in_partition.empty() && Matches(rule, input_in_partition)) return rule;
+        }
+        return default_;
     }
 
-    plen = strlen(path);
+  private:
+    struct Node {
+        std::vector<std::pair<char, uint32_t>> children;
+        std::vector<uint32_t> rules;
+    };
 
-    for (which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+    uint32_t Child(uint32_t node, char c) const {
+        for (const auto& [key, child] : nodes_[node].children) {
+            if (key == c) return child;
+        }
+        return 0;
+    }
+
+    // Appends the rules whose literal prefix is a prefix of input.
+    void Collect(const std::string& input, std::vector<uint32_t>* candidates) const {
+        uint32_t node = 0;
+        for (size_t i = 0;; ++i) {
+            const auto& rules = nodes_[node].rules;
+            candidates->insert(candidates->end(), rules.begin(), rules.end());
+            if (i == input.size() || (node = Child(node, input[i])) == 0) break;
+        }
+    }
+
+    static bool Matches(const Rule& rule, const std::string& input) {
+        if (rule.literal) return rule.pattern == input;
+        return fnmatch(rule.pattern.c_str(), input.c_str(), fnm_flags) == 0;
+    }
+
+    bool dir_;
+    std::vector<Rule> rules_;
+    std::vector<Node> nodes_;
+    Rule default_;
+};
+
+// Identifies the version of an override file a table was compiled from.
+struct FsConfigFileStamp {
+    std::string name;
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = 0;
+    struct timespec mtime = {};
+
+    FsConfigFileStamp() = default;
+    FsConfigFileStamp(std::string name, const struct stat& st)
+        : name(std::move(name)),
+          dev(st.st_dev),
+          ino(st.st_ino),
+          size(st.st_size),
+          mtime(st.st_mtim) {}
+
+    bool operator==(const FsConfigFileStamp& rhs) const {
+        return name == rhs.name && dev == rhs.dev && ino == rhs.ino && size == rhs.size &&
+               mtime.tv_sec == rhs.mtime.tv_sec && mtime.tv_nsec == rhs.mtime.tv_nsec;
+    }
+};
+
+static constexpr size_t kNumConfFiles = sizeof(conf) / sizeof(conf[0]);
+
+struct FsConfigCacheEntry {
+    std::string target_out_path;
+    int dir;
+    FsConfigFileStamp stamps[kNumConfFiles];
+    std::shared_ptr<const FsConfigTable> table;
+};
+
+}  // namespace
+
+// Adds the rules of the override file open as fd to table, reading it through
+// a private mapping. Entries are parsed up to the first corrupted one, as they
+// have always been.
+static void fs_config_compile_file(int dir, int which, int fd, size_t size,
+                                   FsConfigTable* table) {
+    void* map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) return;
+
+    const char* data = static_cast<const char*>(map);
+    size_t offset = 0;
+    while (size - offset >= sizeof(fs_path_config_from_file)) {
         struct fs_path_config_from_file header;
+        memcpy(&header, data + offset, sizeof(header));
+        ssize_t remainder = static_cast<ssize_t>(header.len) - static_cast<ssize_t>(sizeof(header));
+        if (remainder <= 0) {
+            ALOGE("%s len is corrupted", conf[which][dir]);
+            break;
+        }
+        if (static_cast<size_t>(remainder) > size - offset - sizeof(header)) {
+            ALOGE("%s prefix is truncated", conf[which][dir]);
+            break;
+        }
+        const char* prefix = data + offset + sizeof(header);
+        ssize_t len = strnlen(prefix, remainder);
+        if (len >= remainder) {  // missing a terminating null
+            ALOGE("%s is corrupted", conf[which][dir]);
+            break;
+        }
+        table->Add(prefix, len, header.mode, header.uid, header.gid, header.capabilities);
+        offset += header.len;
+    }
+    munmap(map, size);
+}
 
-        int fd = fs_config_open(dir, which, target_out_path);
-        if (fd < 0) continue;
+// Returns the table for files or directories, compiling it again if any of
+// the override files has changed since the last call.
+static std::shared_ptr<const FsConfigTable> fs_config_table(int dir, const char* target_out_path) {
+    static std::mutex lock;
+    static auto& cache = *new std::vector<FsConfigCacheEntry>();
+    static constexpr size_t kMaxCacheEntries = 8;
+
+    if (!target_out_path) target_out_path = "";
+
+    // The stamps are taken from the files as opened, and the table compiled
+    // from those same files, so a cached table always matches its stamps.
+    unique_fd fds[kNumConfFiles];
+    FsConfigFileStamp stamps[kNumConfFiles];
+    for (size_t which = 0; which < kNumConfFiles; ++which) {
+        std::string name;
+        unique_fd fd(fs_config_open(dir, which, target_out_path, &name));
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) continue;
+        stamps[which] = FsConfigFileStamp(std::move(name), st);
+        fds[which] = std::move(fd);
+    }
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
-            uint16_t host_len = header.len;
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
-                break;
-            }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
-                break;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (const auto& entry : cache) {
+            if (entry.dir == dir && entry.target_out_path == target_out_path &&
+                std::equal(stamps, stamps + kNumConfFiles, entry.stamps)) {
+                return entry.table;
             }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
-                close(fd);
-                *uid = header.uid;
-                *gid = header.gid;
-                *mode = (*mode & (~07777)) | header.mode;
-                *capabilities = header.capabilities;
-                return;
-            }
-            free(prefix);
         }
-        close(fd);
     }
 
+    FsConfigCacheEntry entry;
+    entry.target_out_path = target_out_path;
+    entry.dir = dir;
+    auto table = std::make_shared<FsConfigTable>(dir);
+    for (size_t which = 0; which < kNumConfFiles; ++which) {
+        entry.stamps[which] = stamps[which];
+        if (fds[which] == -1) continue;
+        fs_config_compile_file(dir, which, fds[which], stamps[which].size, table.get());
+    }
+    const struct fs_path_config* pc;
     for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
-        if (fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path, plen)) {
-            break;
-        }
+        table->Add(pc->prefix, strlen(pc->prefix), pc->mode, pc->uid, pc->gid, pc->capabilities);
+    }
+    table->SetDefault(pc->mode, pc->uid, pc->gid, pc->capabilities);
+    entry.table = std::move(table);
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = std::find_if(cache.begin(), cache.end(), [&](const FsConfigCacheEntry& e) {
+        return e.dir == dir && e.target_out_path == target_out_path;
+    });
+    if (it != cache.end()) {
+        *it = entry;
+    } else {
+        if (cache.size() >= kMaxCacheEntries) cache.erase(cache.begin());
+        cache.push_back(entry);
+    }
+    return entry.table;
+}
+
+static void fs_config_apply(const FsConfigTable& table, const char* path, unsigned* uid,
+                            unsigned* gid, unsigned* mode, uint64_t* capabilities) {
+    if (path[0] == '/') {
+        path++;
+    }
+
+    const FsConfigTable::Rule& rule = table.Find(path, strlen(path));
+    *uid = rule.uid;
+    *gid = rule.gid;
+    *mode = (*mode & (~07777)) | rule.mode;
+    *capabilities = rule.capabilities;
+}
+
+void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
+               unsigned* mode, uint64_t* capabilities) {
+    auto table = fs_config_table(dir ? 1 : 0, target_out_path);
+    fs_config_apply(*table, path, uid, gid, mode, capabilities);
+}
+
+void fs_config_batch(struct fs_config_batch_entry* entries, size_t count,
+                     const char* target_out_path) {
+    std::shared_ptr<const FsConfigTable> tables[2];
+    for (size_t i = 0; i < count; ++i) {
+        struct fs_config_batch_entry* entry = &entries[i];
+        int dir = entry->dir ? 1 : 0;
+        if (!tables[dir]) tables[dir] = fs_config_table(dir, target_out_path);
+        fs_config_apply(*tables[dir], entry->path, &entry->uid, &entry->gid, &entry->mode,
+                        &entry->capabilities);
     }
-    *uid = pc->uid;
-    *gid = pc->gid;
-    *mode = (*mode & (~07777)) | pc->mode;
-    *capabilities = pc->capabilities;
 }
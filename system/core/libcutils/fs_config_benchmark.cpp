@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <benchmark/benchmark.h>
+#include <private/android_filesystem_config.h>
+#include <private/fs_config.h>
+
+#include "fs_config.h"
+
+using android::base::StringPrintf;
+
+namespace {
+
+struct ImagePath {
+    std::string path;
+    bool dir;
+};
+
+// Reads the paths to resolve from $FS_CONFIG_BENCHMARK_PATHS if set, one per
+// line with directories ending in '/' (the first column of an
+// installed-files.txt or canned fs_config file works too). Otherwise returns
+// the layout of a typical system image: the partitions with their bin, lib,
+// etc, app and apex trees.
+const std::vector<ImagePath>& GetImagePaths() {
+    static std::vector<ImagePath> paths = [] {
+        std::vector<ImagePath> paths;
+        const char* list = getenv("FS_CONFIG_BENCHMARK_PATHS");
+        std::string content;
+        if (list && android::base::ReadFileToString(list, &content)) {
+            for (const auto& line : android::base::Split(content, "\n")) {
+                std::string path = line.substr(0, line.find(' '));
+                if (path.empty()) continue;
+                bool dir = android::base::EndsWith(path, "/");
+                if (dir) path.pop_back();
+                paths.push_back({path, dir});
+            }
+            return paths;
+        }
+
+        auto add_dir = [&](const std::string& dir) { paths.push_back({dir, true}); };
+        auto add_files = [&](const std::string& dir, const char* format, int count) {
+            add_dir(dir);
+            for (int i = 0; i < count; ++i) {
+                paths.push_back({dir + "/" + StringPrintf(format, i), false});
+            }
+        };
+        for (const char* partition : {"system", "system/product", "system/system_ext", "vendor",
+                                      "vendor/odm"}) {
+            std::string root(partition);
+            add_dir(root);
+            add_files(root + "/bin", "tool%d", 400);
+            add_files(root + "/bin/hw", "android.hardware.service%d", 60);
+            add_files(root + "/xbin", "debug%d", 20);
+            add_files(root + "/lib", "lib%d.so", 600);
+            add_files(root + "/lib64", "lib%d.so", 700);
+            add_files(root + "/lib64/hw", "android.hardware.impl%d.so", 80);
+            add_files(root + "/etc", "config%d.xml", 100);
+            add_files(root + "/etc/init", "service%d.rc", 250);
+            add_files(root + "/etc/permissions", "feature%d.xml", 150);
+            add_files(root + "/framework", "framework%d.jar", 60);
+            add_files(root + "/framework/oat/arm64", "framework%d.odex", 60);
+            for (int app = 0; app < 60; ++app) {
+                std::string name = StringPrintf("App%d", app);
+                add_files(root + "/app/" + name, (name + "%d.apk").c_str(), 1);
+                add_files(root + "/priv-app/Priv" + name, (name + "%d.apk").c_str(), 1);
+            }
+            for (int apex = 0; apex < 20; ++apex) {
+                std::string dir = StringPrintf("%s/apex/com.android.module%d", partition, apex);
+                add_files(dir + "/bin", "tool%d", 5);
+                add_files(dir + "/lib64", "lib%d.so", 15);
+                add_files(dir + "/etc", "config%d.txt", 3);
+            }
+        }
+        add_files("first_stage_ramdisk/system/bin", "tool%d", 10);
+        return paths;
+    }();
+    return paths;
+}
+
+// Writes override files for the system and vendor partitions like the ones
+// generated from a device's config.fs.
+bool WriteOverrides(const std::string& root) {
+    std::string data;
+    for (int i = 0; i < 64; ++i) {
+        std::string prefix = i % 4 ? StringPrintf("vendor/bin/hw/android.hardware.service%d", i)
+                                   : StringPrintf("system/apex/com.android.module%d/bin/*", i);
+        size_t len = sizeof(fs_path_config_from_file) + prefix.size() + 1;
+        len = (len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        std::string entry(len, '\0');
+        auto pc = reinterpret_cast<fs_path_config_from_file*>(entry.data());
+        pc->len = len;
+        pc->mode = 00750;
+        pc->uid = AID_SYSTEM;
+        pc->gid = AID_SHELL;
+        pc->capabilities = 0;
+        memcpy(pc->prefix, prefix.c_str(), prefix.size());
+        data += entry;
+    }
+    for (const char* partition : {"system", "vendor"}) {
+        std::string dir = root + "/" + partition;
+        mkdir(dir.c_str(), 0755);
+        dir += "/etc";
+        mkdir(dir.c_str(), 0755);
+        for (const char* type : {"fs_config_dirs", "fs_config_files"}) {
+            if (!android::base::WriteStringToFile(data, dir + "/" + type)) return false;
+        }
+    }
+    return true;
+}
+
+// Arg 0 resolves against the built in tables only, arg 1 with override files
+// in the target out directory as well.
+void BM_fs_config(benchmark::State& state) {
+    const std::vector<ImagePath>& paths = GetImagePaths();
+    TemporaryDir root;
+    std::string target_out_path;
+    if (state.range(0)) {
+        if (!WriteOverrides(root.path)) {
+            state.SkipWithError("failed to write override files");
+            return;
+        }
+        target_out_path = std::string(root.path) + "/system";
+    }
+
+    for (auto _ : state) {
+        for (const auto& path : paths) {
+            unsigned uid, gid, mode = path.dir ? S_IFDIR : S_IFREG;
+            uint64_t capabilities;
+            fs_config(path.path.c_str(), path.dir, target_out_path.c_str(), &uid, &gid, &mode,
+                      &capabilities);
+            benchmark::DoNotOptimize(mode);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(BM_fs_config)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+void BM_fs_config_batch(benchmark::State& state) {
+    const std::vector<ImagePath>& paths = GetImagePaths();
+    TemporaryDir root;
+    std::string target_out_path;
+    if (state.range(0)) {
+        if (!WriteOverrides(root.path)) {
+            state.SkipWithError("failed to write override files");
+            return;
+        }
+        target_out_path = std::string(root.path) + "/system";
+    }
+
+    std::vector<fs_config_batch_entry> entries;
+    for (const auto& path : paths) {
+        entries.push_back({path.path.c_str(), path.dir, 0, 0, 0, 0});
+    }
+    for (auto _ : state) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            entries[i].mode = paths[i].dir ? S_IFDIR : S_IFREG;
+        }
+        fs_config_batch(entries.data(), entries.size(), target_out_path.c_str());
+        benchmark::DoNotOptimize(entries.data());
+    }
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(BM_fs_config_batch)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+}  // namespace
@@ -15,8 +15,11 @@
  */
 
 #include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -25,6 +28,7 @@
 #include <android-base/strings.h>
 
 #include <private/android_filesystem_config.h>
+#include <private/fs_config.h>
 
 #include "fs_config.h"
 
@@ -258,3 +262,200 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+// Serializes entries the way build/tools/fs_config/fs_config_generate.c does.
+static std::string make_config(const std::vector<fs_path_config>& entries) {
+    std::string data;
+    for (const auto& entry : entries) {
+        size_t len = offsetof(fs_path_config_from_file, prefix) + strlen(entry.prefix) + 1;
+        len = (len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        std::string buf(len, '\0');
+        auto pc = reinterpret_cast<fs_path_config_from_file*>(buf.data());
+        pc->len = len;
+        pc->mode = entry.mode;
+        pc->uid = entry.uid;
+        pc->gid = entry.gid;
+        pc->capabilities = entry.capabilities;
+        strcpy(pc->prefix, entry.prefix);
+        data += buf;
+    }
+    return data;
+}
+
+static bool write_config(const std::string& root, const std::string& partition, const char* type,
+                         const std::vector<fs_path_config>& entries) {
+    std::string dir = root + "/" + partition;
+    mkdir(dir.c_str(), 0755);
+    dir += "/etc";
+    mkdir(dir.c_str(), 0755);
+    return android::base::WriteStringToFile(make_config(entries), dir + "/fs_config_" + type);
+}
+
+// The rules fs_config() is documented to apply: the override files in order,
+// then the built in table, first match wins.
+static fs_path_config reference_fs_config(const std::vector<std::vector<fs_path_config>>& overrides,
+                                          bool dir, const char* path) {
+    if (path[0] == '/') path++;
+    for (const auto& entries : overrides) {
+        for (const auto& entry : entries) {
+            if (__for_testing_only__fs_config_cmp(dir, entry.prefix, strlen(entry.prefix), path,
+                                                  strlen(path))) {
+                return entry;
+            }
+        }
+    }
+    const fs_path_config* pc =
+            dir ? __for_testing_only__android_dirs : __for_testing_only__android_files;
+    for (; pc->prefix; ++pc) {
+        if (__for_testing_only__fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path,
+                                              strlen(path))) {
+            break;
+        }
+    }
+    return *pc;
+}
+
+static const char* const fs_config_lookup_paths[] = {
+        "",
+        "/",
+        "init",
+        "init.rc",
+        "fstab.device",
+        "bin/foo",
+        "data",
+        "data/local/tmp",
+        "data/local/tmp/foo",
+        "system",
+        "system/bin",
+        "/system/bin/sh",
+        "system/bin/run-as",
+        "system/bin/foo",
+        "system/bin/foo.sh",
+        "system/lib64/libc.so",
+        "system/xbin/su",
+        "system/apex/com.android.foo/bin/bar",
+        "system/vendor/bin/wifi",
+        "system/vendor/lib/libwifi.so",
+        "system/vendor/etc/a.conf",
+        "system/product/app/Foo/Foo.apk",
+        "system/system_ext/bin/foo",
+        "vendor",
+        "vendor/bin",
+        "vendor/bin/wifi",
+        "vendor/lib/libwifi.so",
+        "vendor/odm/etc/a.conf",
+        "vendor/odm/bin/foo",
+        "odm/bin/foo",
+        "odm/etc/b.conf",
+        "product/app/Foo/Foo.apk",
+        "product/apex/com.android.foo/bin/bar",
+        "first_stage_ramdisk/system/bin/e2fsck",
+};
+
+static void check_fs_config(const char* target_out_path,
+                            const std::vector<std::vector<fs_path_config>>& overrides) {
+    for (int dir = 0; dir <= 1; ++dir) {
+        std::vector<fs_config_batch_entry> batch;
+        for (const char* path : fs_config_lookup_paths) {
+            fs_path_config expected = reference_fs_config(overrides, dir, path);
+
+            unsigned uid = -1, gid = -1, mode = 0170000;
+            uint64_t capabilities = -1;
+            fs_config(path, dir, target_out_path, &uid, &gid, &mode, &capabilities);
+            EXPECT_EQ(expected.uid, uid) << path << " dir=" << dir;
+            EXPECT_EQ(expected.gid, gid) << path << " dir=" << dir;
+            EXPECT_EQ(0170000 | expected.mode, mode) << path << " dir=" << dir;
+            EXPECT_EQ(expected.capabilities, capabilities) << path << " dir=" << dir;
+
+            batch.push_back({path, dir, uid, gid, mode, capabilities});
+        }
+
+        std::vector<fs_config_batch_entry> results = batch;
+        for (auto& entry : results) {
+            entry.uid = entry.gid = -1;
+            entry.mode = 0170000;
+            entry.capabilities = -1;
+        }
+        fs_config_batch(results.data(), results.size(), target_out_path);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            EXPECT_EQ(batch[i].uid, results[i].uid) << batch[i].path;
+            EXPECT_EQ(batch[i].gid, results[i].gid) << batch[i].path;
+            EXPECT_EQ(batch[i].mode, results[i].mode) << batch[i].path;
+            EXPECT_EQ(batch[i].capabilities, results[i].capabilities) << batch[i].path;
+        }
+    }
+}
+
+TEST(fs_config, lookup_matches_rules) {
+    TemporaryDir root;
+
+    // Rules which shadow, extend and alias the built in ones, with all kinds
+    // of wildcards.
+    std::vector<fs_path_config> system_overrides = {
+            {00700, AID_SYSTEM, AID_SYSTEM, 1ULL << CAP_NET_RAW, "system/bin/foo*"},
+            {00644, AID_MEDIA, AID_MEDIA, 0, "vendor/lib/*.so"},
+            {00600, AID_RADIO, AID_RADIO, 0, "odm/etc/[ab]*"},
+            {00711, AID_SHELL, AID_SHELL, 0, "product/app/Foo/Foo.apk"},
+            {00750, AID_ROOT, AID_SHELL, 0, "data/local"},
+            {00555, AID_BLUETOOTH, AID_BLUETOOTH, 0, "?nit*"},
+    };
+    std::vector<fs_path_config> vendor_overrides = {
+            {00750, AID_WIFI, AID_WIFI, 0, "vendor/bin/wifi"},
+            {00640, AID_SYSTEM, AID_SYSTEM, 0, "system/bin/foo.sh"},
+    };
+    for (const char* type : {"files", "dirs"}) {
+        ASSERT_TRUE(write_config(root.path, "system", type, system_overrides));
+        ASSERT_TRUE(write_config(root.path, "vendor", type, vendor_overrides));
+    }
+
+    std::string target_out_path = std::string(root.path) + "/system";
+    check_fs_config(target_out_path.c_str(), {system_overrides, vendor_overrides});
+}
+
+TEST(fs_config, lookup_sees_changed_overrides) {
+    TemporaryDir root;
+    std::string target_out_path = std::string(root.path) + "/system";
+
+    std::vector<fs_path_config> overrides = {
+            {00700, AID_SYSTEM, AID_SYSTEM, 0, "system/bin/foo"},
+    };
+    for (const char* type : {"files", "dirs"}) {
+        ASSERT_TRUE(write_config(root.path, "system", type, overrides));
+    }
+    check_fs_config(target_out_path.c_str(), {overrides});
+
+    overrides.insert(overrides.begin(), {00755, AID_SHELL, AID_SHELL, 0, "system/bin/*"});
+    for (const char* type : {"files", "dirs"}) {
+        ASSERT_TRUE(write_config(root.path, "system", type, overrides));
+    }
+    check_fs_config(target_out_path.c_str(), {overrides});
+
+    for (const char* type : {"files", "dirs"}) {
+        std::string config = target_out_path + "/etc/fs_config_" + type;
+        ASSERT_EQ(0, unlink(config.c_str()));
+    }
+    check_fs_config(target_out_path.c_str(), {});
+}
+
+TEST(fs_config, lookup_skips_unreadable_overrides) {
+    if (getuid() == 0) GTEST_SKIP() << "root can read any override file";
+    if (access("/system/etc/fs_config_files", F_OK) == 0 ||
+        access("/system/etc/fs_config_dirs", F_OK) == 0) {
+        GTEST_SKIP() << "the running system has override files of its own";
+    }
+
+    TemporaryDir root;
+    std::string target_out_path = std::string(root.path) + "/system";
+
+    std::vector<fs_path_config> overrides = {
+            {00700, AID_SYSTEM, AID_SYSTEM, 0, "system/bin/foo"},
+    };
+    for (const char* type : {"files", "dirs"}) {
+        ASSERT_TRUE(write_config(root.path, "system", type, overrides));
+        std::string config = target_out_path + "/etc/fs_config_" + type;
+        ASSERT_EQ(0, chmod(config.c_str(), 0));
+    }
+    // Overrides which can't be read are passed over, every time.
+    check_fs_config(target_out_path.c_str(), {});
+    check_fs_config(target_out_path.c_str(), {});
+}
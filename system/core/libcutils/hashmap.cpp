@@ -19,29 +19,116 @@
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
-typedef struct Entry Entry;
-struct Entry {
+/*
+ * Open addressing. All entries of a table live in one array of slots which
+ * also caches each key's hash, next to an array with one control byte per
+ * slot: empty, deleted, or 7 more bits of the hash. Slots are probed in groups
+ * of 8 by comparing all 8 control bytes at once, so a lookup usually touches
+ * a single control word and only the slots of likely candidates, and only
+ * calls equals() when the whole hash matches. Growing never calls hash()
+ * again.
+ *
+ * Removing an entry leaves a tombstone behind instead of moving other entries
+ * around, so a hashmapForEach() callback can still remove the current entry.
+ *
+ * Growing is incremental: a new array is allocated and each hashmapPut() moves
+ * a few slots of the old array over, so no single call rehashes the whole map.
+ * Lookups check both arrays until the old one has been emptied.
+ */
+
+typedef struct Slot Slot;
+struct Slot {
     void* key;
-    int hash;
     void* value;
-    Entry* next;
+    int hash;
+};
+
+// Control bytes. Full slots have the top bit set.
+static const uint8_t kCtrlEmpty = 0;
+static const uint8_t kCtrlDeleted = 1;
+static const uint8_t kCtrlFull = 0x80;
+
+// Number of slots probed at once, as a word of control bytes.
+static const size_t kGroupSize = sizeof(uint64_t);
+static const uint64_t kGroupLsbs = 0x0101010101010101ULL;
+static const uint64_t kGroupMsbs = 0x8080808080808080ULL;
+
+typedef struct Table Table;
+struct Table {
+    Slot* slots;
+    uint8_t* ctrl;    // allocated along with slots
+    size_t capacity;  // power of 2
+};
+
+typedef struct Stripe Stripe;
+struct Stripe {
+    Table table;
+    size_t used;  // full and deleted slots in table
+    size_t size;  // full slots, including the ones still in oldTable
+
+    // The array being moved into table, if any. Slots before oldIndex have
+    // been moved already.
+    Table oldTable;
+    size_t oldIndex;
+
+    // Only used by concurrent maps.
+    pthread_mutex_t lock;
 };
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    Stripe* stripes;
+    size_t stripeCount;  // power of 2
+    bool concurrent;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
     pthread_mutex_t lock;
-    size_t size;
 };
 
-Hashmap* hashmapCreate(size_t initialCapacity,
-        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+// Number of stripes of a concurrent map, selected by the top bits of the hash.
+static const size_t kConcurrentStripes = 16;
+static const int kConcurrentStripeShift = 28;
+
+// Old slots moved over by each hashmapPut() while growing. Growth at 0.75 load
+// factor doubles the capacity, so at this rate the old array is empty long
+// before the new one fills up.
+static const size_t kMigrateSlotsPerPut = 8;
+
+static size_t bucketCountFor(size_t capacity) {
+    // 0.75 load factor.
+    size_t minimumBucketCount = capacity * 4 / 3;
+    size_t bucketCount = kGroupSize;
+    while (bucketCount <= minimumBucketCount) {
+        // Bucket count must be power of 2.
+        bucketCount <<= 1;
+    }
+    return bucketCount;
+}
+
+static bool allocateTable(Table* table, size_t capacity) {
+    void* memory = calloc(capacity, sizeof(Slot) + 1);
+    if (memory == NULL) {
+        return false;
+    }
+    table->slots = static_cast<Slot*>(memory);
+    table->ctrl = reinterpret_cast<uint8_t*>(table->slots + capacity);
+    table->capacity = capacity;
+    return true;
+}
+
+static void freeTable(Table* table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->ctrl = NULL;
+    table->capacity = 0;
+}
+
+static Hashmap* createHashmap(size_t initialCapacity, int (*hash)(void* key),
+                              bool (*equals)(void* keyA, void* keyB), bool concurrent) {
     assert(hash != NULL);
     assert(equals != NULL);
 
@@ -50,30 +137,55 @@ Hashmap* hashmapCreate(size_t initialCapacity,
         return NULL;
     }
 
-    // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1;
-    }
-
-    map->buckets = static_cast<Entry**>(calloc(map->bucketCount, sizeof(Entry*)));
-    if (map->buckets == NULL) {
+    map->stripeCount = concurrent ? kConcurrentStripes : 1;
+    map->stripes = static_cast<Stripe*>(calloc(map->stripeCount, sizeof(Stripe)));
+    if (map->stripes == NULL) {
         free(map);
         return NULL;
     }
 
-    map->size = 0;
+    size_t bucketCount = bucketCountFor(initialCapacity / map->stripeCount);
+    for (size_t i = 0; i < map->stripeCount; i++) {
+        if (!allocateTable(&map->stripes[i].table, bucketCount)) {
+            while (i-- > 0) {
+                freeTable(&map->stripes[i].table);
+            }
+            free(map->stripes);
+            free(map);
+            return NULL;
+        }
+    }
 
+    map->concurrent = concurrent;
     map->hash = hash;
     map->equals = equals;
 
     pthread_mutex_init(&map->lock, nullptr);
+    if (concurrent) {
+        // Recursive, so that a thread holding hashmapLock() can still call
+        // the functions which lock a single stripe.
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        for (size_t i = 0; i < map->stripeCount; i++) {
+            pthread_mutex_init(&map->stripes[i].lock, &attr);
+        }
+        pthread_mutexattr_destroy(&attr);
+    }
 
     return map;
 }
 
+Hashmap* hashmapCreate(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createHashmap(initialCapacity, hash, equals, false);
+}
+
+Hashmap* hashmapCreateConcurrent(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createHashmap(initialCapacity, hash, equals, true);
+}
+
 /**
  * Hashes the given key.
  */
@@ -93,60 +205,212 @@ static inline int hashKey(Hashmap* map, void* key) {
     return h;
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+// The low bits of the hash pick the first group to probe.
+static inline size_t calculateGroup(size_t bucketCount, int hash) {
+    return ((size_t) hash) & (bucketCount / kGroupSize - 1);
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = static_cast<Entry**>(calloc(newBucketCount, sizeof(Entry*)));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
-        }
+// The top bits of the hash barely depend on its low bits, so the control byte
+// takes them from the hash multiplied by the golden ratio instead. Otherwise
+// keys that only differ at the end would all look alike.
+#ifdef __clang__
+__attribute__((no_sanitize("integer")))
+#endif
+static inline uint8_t calculateCtrl(int hash) {
+    return kCtrlFull | ((((unsigned int) hash) * 0x9e3779b1u) >> 25);
+}
+
+static inline Stripe* lockStripe(Hashmap* map, int hash) {
+    Stripe* stripe = &map->stripes[0];
+    if (map->concurrent) {
+        stripe = &map->stripes[(((unsigned int) hash) >> kConcurrentStripeShift) &
+                               (map->stripeCount - 1)];
+        pthread_mutex_lock(&stripe->lock);
+    }
+    return stripe;
+}
+
+static inline void unlockStripe(Hashmap* map, Stripe* stripe) {
+    if (map->concurrent) {
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
+        bool (*equals)(void*, void*)) {
+    if (keyA == keyB) {
+        return true;
+    }
+    if (hashA != hashB) {
+        return false;
+    }
+    return equals(keyA, keyB);
+}
+
+static inline uint64_t loadGroup(const Table* table, size_t group) {
+    uint64_t ctrl;
+    memcpy(&ctrl, &table->ctrl[group * kGroupSize], sizeof(ctrl));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    ctrl = __builtin_bswap64(ctrl);
+#endif
+    return ctrl;
+}
 
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
+// Returns a mask with the top bit of each control byte equal to c set. Bytes
+// after a real match may show up as false positives, the callers either
+// check the slot anyway or only care whether there is any match at all.
+static inline uint64_t matchGroup(uint64_t group, uint8_t c) {
+    uint64_t x = group ^ (kGroupLsbs * c);
+    return (x - kGroupLsbs) & ~x & kGroupMsbs;
+}
+
+static inline size_t firstInMask(uint64_t mask) {
+    return __builtin_ctzll(mask) / 8;
+}
+
+// Inlined into the lookups, the call overhead shows on small maps.
+static inline __attribute__((always_inline)) Slot* findSlot(const Table* table, void* key, int hash,
+        bool (*equals)(void*, void*)) {
+    uint8_t ctrl = calculateCtrl(hash);
+    size_t groupMask = table->capacity / kGroupSize - 1;
+    // There is always at least one empty slot to end the probe.
+    for (size_t group = calculateGroup(table->capacity, hash);;
+         group = (group + 1) & groupMask) {
+        uint64_t c = loadGroup(table, group);
+        for (uint64_t match = matchGroup(c, ctrl); match != 0; match &= match - 1) {
+            Slot* slot = &table->slots[group * kGroupSize + firstInMask(match)];
+            if (equalKeys(slot->key, slot->hash, key, hash, equals)) {
+                return slot;
             }
         }
+        if (matchGroup(c, kCtrlEmpty) != 0) {
+            return NULL;
+        }
+    }
+}
+
+// Returns the control byte of a slot found by findSlot().
+static inline uint8_t* ctrlOf(Table* table, Slot* slot) {
+    return &table->ctrl[slot - table->slots];
+}
+
+// Stores an entry known not to be in the stripe yet, reusing the first
+// tombstone on its probe sequence.
+static void insertSlot(Stripe* stripe, void* key, int hash, void* value) {
+    Table* table = &stripe->table;
+    size_t groupMask = table->capacity / kGroupSize - 1;
+    size_t group = calculateGroup(table->capacity, hash);
+    uint64_t notFull;
+    while ((notFull = ~loadGroup(table, group) & kGroupMsbs) == 0) {
+        group = (group + 1) & groupMask;
+    }
+    size_t index = group * kGroupSize + firstInMask(notFull);
+    if (table->ctrl[index] == kCtrlEmpty) {
+        stripe->used++;
+    }
+    table->ctrl[index] = calculateCtrl(hash);
+    Slot* slot = &table->slots[index];
+    slot->key = key;
+    slot->value = value;
+    slot->hash = hash;
+}
+
+static void migrateSlots(Stripe* stripe, size_t count) {
+    Table* old = &stripe->oldTable;
+    if (old->slots == NULL) {
+        return;
+    }
+    while (count-- > 0 && stripe->oldIndex < old->capacity) {
+        size_t index = stripe->oldIndex++;
+        if (old->ctrl[index] & kCtrlFull) {
+            Slot* slot = &old->slots[index];
+            insertSlot(stripe, slot->key, slot->hash, slot->value);
+            // Keep the old probe sequences intact for the entries not yet moved.
+            old->ctrl[index] = kCtrlDeleted;
+        }
+    }
+    if (stripe->oldIndex == old->capacity) {
+        freeTable(old);
+        stripe->oldIndex = 0;
+    }
+}
+
+// Makes room for one more entry. Returns false if the stripe is full and a
+// bigger array can not be allocated.
+static bool expandIfNecessary(Stripe* stripe) {
+    // If the load factor (counting tombstones) would exceed 0.75...
+    size_t capacity = stripe->table.capacity;
+    if (stripe->used + 1 <= capacity * 3 / 4) {
+        return true;
+    }
+
+    // Only one array can be moved at a time.
+    migrateSlots(stripe, SIZE_MAX);
+
+    // Start off with a 0.375 load factor. If it's mostly tombstones that
+    // filled up the array, start over with a clean array of the same size.
+    size_t newCapacity = capacity;
+    if (stripe->size + 1 > newCapacity * 3 / 8) {
+        newCapacity <<= 1;
+    }
+    Table newTable;
+    if (!allocateTable(&newTable, newCapacity)) {
+        // Abort expansion, the entry still fits as long as one slot stays empty.
+        return stripe->used + 1 < capacity;
+    }
+
+    stripe->oldTable = stripe->table;
+    stripe->oldIndex = 0;
+    stripe->table = newTable;
+    stripe->used = 0;
+    return true;
+}
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+// Finds the slot of key, and its control byte, in either array.
+static inline __attribute__((always_inline)) Slot* findEntry(Hashmap* map, Stripe* stripe, void* key, int hash, uint8_t** ctrl) {
+    Table* table = &stripe->table;
+    Slot* slot = findSlot(table, key, hash, map->equals);
+    if (slot == NULL && stripe->oldTable.slots != NULL) {
+        table = &stripe->oldTable;
+        slot = findSlot(table, key, hash, map->equals);
     }
+    if (slot != NULL && ctrl != NULL) {
+        *ctrl = ctrlOf(table, slot);
+    }
+    return slot;
 }
 
 void hashmapLock(Hashmap* map) {
-    pthread_mutex_lock(&map->lock);
+    if (map->concurrent) {
+        for (size_t i = 0; i < map->stripeCount; i++) {
+            pthread_mutex_lock(&map->stripes[i].lock);
+        }
+    } else {
+        pthread_mutex_lock(&map->lock);
+    }
 }
 
 void hashmapUnlock(Hashmap* map) {
-    pthread_mutex_unlock(&map->lock);
+    if (map->concurrent) {
+        for (size_t i = map->stripeCount; i-- > 0;) {
+            pthread_mutex_unlock(&map->stripes[i].lock);
+        }
+    } else {
+        pthread_mutex_unlock(&map->lock);
+    }
 }
 
 void hashmapFree(Hashmap* map) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
+    for (i = 0; i < map->stripeCount; i++) {
+        Stripe* stripe = &map->stripes[i];
+        freeTable(&stripe->table);
+        freeTable(&stripe->oldTable);
+        if (map->concurrent) {
+            pthread_mutex_destroy(&stripe->lock);
         }
     }
-    free(map->buckets);
+    free(map->stripes);
     pthread_mutex_destroy(&map->lock);
     free(map);
 }
@@ -166,109 +430,86 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = static_cast<Entry*>(malloc(sizeof(Entry)));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
-        }
-
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
-        }
+    Stripe* stripe = lockStripe(map, hash);
+
+    // Replace existing entry.
+    Slot* slot = findEntry(map, stripe, key, hash, NULL);
+    if (slot != NULL) {
+        void* oldValue = slot->value;
+        slot->value = value;
+        unlockStripe(map, stripe);
+        return oldValue;
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!expandIfNecessary(stripe)) {
+        unlockStripe(map, stripe);
+        errno = ENOMEM;
+        return NULL;
     }
+    insertSlot(stripe, key, hash, value);
+    stripe->size++;
+    migrateSlots(stripe, kMigrateSlotsPerPut);
+
+    unlockStripe(map, stripe);
+    return NULL;
 }
 
 void* hashmapGet(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
+    Stripe* stripe = lockStripe(map, hash);
 
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
-        }
-        entry = entry->next;
-    }
+    Slot* slot = findEntry(map, stripe, key, hash, NULL);
+    void* value = slot != NULL ? slot->value : NULL;
 
-    return NULL;
+    unlockStripe(map, stripe);
+    return value;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
     int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
-        }
-
-        p = &current->next;
+    Stripe* stripe = lockStripe(map, hash);
+
+    void* value = NULL;
+    uint8_t* ctrl;
+    Slot* slot = findEntry(map, stripe, key, hash, &ctrl);
+    if (slot != NULL) {
+        value = slot->value;
+        *ctrl = kCtrlDeleted;
+        stripe->size--;
     }
 
-    return NULL;
+    unlockStripe(map, stripe);
+    return value;
 }
 
 void hashmapForEach(Hashmap* map, bool (*callback)(void* key, void* value, void* context),
                     void* context) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
-                return;
+    for (i = 0; i < map->stripeCount; i++) {
+        Stripe* stripe = &map->stripes[i];
+        if (map->concurrent) {
+            pthread_mutex_lock(&stripe->lock);
+        }
+
+        // Only walk a single array.
+        migrateSlots(stripe, SIZE_MAX);
+
+        bool keepGoing = true;
+        for (size_t j = 0; keepGoing && j < stripe->table.capacity; j++) {
+            if (stripe->table.ctrl[j] & kCtrlFull) {
+                Slot* slot = &stripe->table.slots[j];
+                keepGoing = callback(slot->key, slot->value, context);
             }
-            entry = next;
+        }
+
+        if (map->concurrent) {
+            pthread_mutex_unlock(&stripe->lock);
+        }
+        if (!keepGoing) {
+            return;
         }
     }
 }
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+
+#include <malloc.h>
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+namespace {
+
+// String keys, like the ones str_parms and the native daemons use.
+int StringHash(void* key) {
+    return hashmapHash(key, strlen(static_cast<char*>(key)));
+}
+
+bool StringEquals(void* a, void* b) {
+    return strcmp(static_cast<char*>(a), static_cast<char*>(b)) == 0;
+}
+
+size_t AllocatedBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return mallinfo().uordblks;
+#endif
+}
+
+// Enough for the largest map plus as many missing keys.
+const std::vector<std::string>& Keys() {
+    static const std::vector<std::string> keys = [] {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < 2 * 65536; i++) {
+            keys.push_back(android::base::StringPrintf("vendor.audio.param%zu", i));
+        }
+        return keys;
+    }();
+    return keys;
+}
+
+void* KeyAt(const std::vector<std::string>& keys, size_t i) {
+    return const_cast<char*>(keys[i].c_str());
+}
+
+// Lookups in insertion order would favor tables which happen to lay entries
+// out in that order, so shuffle them.
+std::vector<size_t> LookupOrder(size_t count) {
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937(count));
+    return order;
+}
+
+Hashmap* CreateFilledMap(size_t count, bool concurrent) {
+    const auto& keys = Keys();
+    Hashmap* map = concurrent ? hashmapCreateConcurrent(0, StringHash, StringEquals)
+                              : hashmapCreate(0, StringHash, StringEquals);
+    for (size_t i = 0; i < count; i++) {
+        hashmapPut(map, KeyAt(keys, i), KeyAt(keys, i));
+    }
+    return map;
+}
+
+void BM_hashmap_put(benchmark::State& state) {
+    size_t count = state.range(0);
+    const auto& keys = Keys();
+    size_t bytes = 0;
+    for (auto _ : state) {
+        size_t before = AllocatedBytes();
+        Hashmap* map = hashmapCreate(0, StringHash, StringEquals);
+        for (size_t i = 0; i < count; i++) {
+            hashmapPut(map, KeyAt(keys, i), KeyAt(keys, i));
+        }
+        state.PauseTiming();
+        bytes = AllocatedBytes() - before;
+        hashmapFree(map);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.counters["bytes_per_entry"] = static_cast<double>(bytes) / count;
+}
+BENCHMARK(BM_hashmap_put)->Arg(16)->Arg(1024)->Arg(65536);
+
+void BM_hashmap_get_hit(benchmark::State& state) {
+    size_t count = state.range(0);
+    const auto& keys = Keys();
+    Hashmap* map = CreateFilledMap(count, false);
+    std::vector<size_t> order = LookupOrder(count);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashmapGet(map, KeyAt(keys, order[i])));
+        if (++i == count) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_get_hit)->Arg(16)->Arg(1024)->Arg(65536);
+
+void BM_hashmap_get_miss(benchmark::State& state) {
+    size_t count = state.range(0);
+    const auto& keys = Keys();
+    Hashmap* map = CreateFilledMap(count, false);
+    std::vector<size_t> order = LookupOrder(count);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashmapGet(map, KeyAt(keys, count + order[i])));
+        if (++i == count) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_get_miss)->Arg(16)->Arg(1024)->Arg(65536);
+
+void BM_hashmap_put_remove(benchmark::State& state) {
+    size_t count = state.range(0);
+    const auto& keys = Keys();
+    Hashmap* map = CreateFilledMap(count, false);
+    size_t i = 0;
+    for (auto _ : state) {
+        hashmapPut(map, KeyAt(keys, count + i), KeyAt(keys, i));
+        hashmapRemove(map, KeyAt(keys, count + i));
+        if (++i == count) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    hashmapFree(map);
+}
+BENCHMARK(BM_hashmap_put_remove)->Arg(16)->Arg(1024)->Arg(65536);
+
+// Readers and writers sharing one map, either through hashmapLock() or by
+// relying on the striped locks of a concurrent map (arg 1).
+Hashmap* shared_map;
+
+void BM_hashmap_shared(benchmark::State& state) {
+    static constexpr size_t kCount = 4096;
+    bool concurrent = state.range(0);
+    const auto& keys = Keys();
+    if (state.thread_index() == 0) {
+        shared_map = CreateFilledMap(kCount, concurrent);
+    }
+    size_t i = state.thread_index() * 997;
+    for (auto _ : state) {
+        i = (i + 1) % kCount;
+        if (!concurrent) hashmapLock(shared_map);
+        if (i % 8 == 0) {
+            hashmapPut(shared_map, KeyAt(keys, i), KeyAt(keys, i));
+        } else {
+            benchmark::DoNotOptimize(hashmapGet(shared_map, KeyAt(keys, i)));
+        }
+        if (!concurrent) hashmapUnlock(shared_map);
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        hashmapFree(shared_map);
+    }
+}
+BENCHMARK(BM_hashmap_shared)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+}  // namespace
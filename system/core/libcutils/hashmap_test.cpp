@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+// Keys and values are small integers smuggled through the pointers.
+static void* to_ptr(uintptr_t n) {
+    return reinterpret_cast<void*>(n);
+}
+
+static int int_hash(void* key) {
+    return static_cast<int>(reinterpret_cast<uintptr_t>(key));
+}
+
+// Makes every key collide, to exercise the probing.
+static int bad_hash(void*) {
+    return 42;
+}
+
+static bool int_equals(void* a, void* b) {
+    return a == b;
+}
+
+static void check_contents(Hashmap* map, const std::map<uintptr_t, uintptr_t>& expected) {
+    for (const auto& [key, value] : expected) {
+        EXPECT_EQ(to_ptr(value), hashmapGet(map, to_ptr(key))) << key;
+    }
+
+    std::map<uintptr_t, uintptr_t> seen;
+    hashmapForEach(
+            map,
+            [](void* key, void* value, void* context) {
+                auto seen = static_cast<std::map<uintptr_t, uintptr_t>*>(context);
+                EXPECT_TRUE(seen->emplace(reinterpret_cast<uintptr_t>(key),
+                                          reinterpret_cast<uintptr_t>(value))
+                                    .second);
+                return true;
+            },
+            &seen);
+    EXPECT_EQ(expected, seen);
+}
+
+static void check_put_get_remove(Hashmap* map) {
+    ASSERT_NE(nullptr, map);
+    std::map<uintptr_t, uintptr_t> expected;
+
+    for (uintptr_t i = 1; i <= 5000; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, to_ptr(i), to_ptr(i * 10)));
+        expected[i] = i * 10;
+        // Entries must stay reachable while the map grows.
+        if (i % 97 == 0) check_contents(map, expected);
+    }
+    EXPECT_EQ(nullptr, hashmapGet(map, to_ptr(5001)));
+
+    for (uintptr_t i = 1; i <= 5000; i += 3) {
+        ASSERT_EQ(to_ptr(i * 10), hashmapPut(map, to_ptr(i), to_ptr(i * 20)));
+        expected[i] = i * 20;
+    }
+    for (uintptr_t i = 2; i <= 5000; i += 2) {
+        ASSERT_EQ(to_ptr(expected[i]), hashmapRemove(map, to_ptr(i)));
+        expected.erase(i);
+    }
+    EXPECT_EQ(nullptr, hashmapRemove(map, to_ptr(2)));
+    check_contents(map, expected);
+
+    // Reuse the removed slots.
+    for (uintptr_t i = 2; i <= 5000; i += 4) {
+        ASSERT_EQ(nullptr, hashmapPut(map, to_ptr(i), to_ptr(i)));
+        expected[i] = i;
+    }
+    check_contents(map, expected);
+
+    hashmapFree(map);
+}
+
+TEST(hashmap, put_get_remove) {
+    check_put_get_remove(hashmapCreate(0, int_hash, int_equals));
+}
+
+TEST(hashmap, put_get_remove_presized) {
+    check_put_get_remove(hashmapCreate(10000, int_hash, int_equals));
+}
+
+TEST(hashmap, put_get_remove_concurrent) {
+    check_put_get_remove(hashmapCreateConcurrent(0, int_hash, int_equals));
+}
+
+TEST(hashmap, collisions) {
+    Hashmap* map = hashmapCreate(0, bad_hash, int_equals);
+    std::map<uintptr_t, uintptr_t> expected;
+    for (uintptr_t i = 1; i <= 200; i++) {
+        ASSERT_EQ(nullptr, hashmapPut(map, to_ptr(i), to_ptr(i + 1)));
+        expected[i] = i + 1;
+    }
+    for (uintptr_t i = 1; i <= 200; i += 2) {
+        ASSERT_EQ(to_ptr(i + 1), hashmapRemove(map, to_ptr(i)));
+        expected.erase(i);
+    }
+    check_contents(map, expected);
+    hashmapFree(map);
+}
+
+TEST(hashmap, remove_while_iterating) {
+    Hashmap* map = hashmapCreate(0, int_hash, int_equals);
+    for (uintptr_t i = 1; i <= 1000; i++) {
+        hashmapPut(map, to_ptr(i), to_ptr(i));
+    }
+
+    // str_parms removes the current entry from its callback.
+    size_t visited = 0;
+    hashmapForEach(
+            map,
+            [](void* key, void*, void* context) {
+                auto map = *static_cast<Hashmap**>(context);
+                EXPECT_EQ(key, hashmapRemove(map, key));
+                return true;
+            },
+            &map);
+    hashmapForEach(
+            map,
+            [](void*, void*, void* context) {
+                ++*static_cast<size_t*>(context);
+                return true;
+            },
+            &visited);
+    EXPECT_EQ(0u, visited);
+    hashmapFree(map);
+}
+
+TEST(hashmap, stop_iterating) {
+    Hashmap* map = hashmapCreateConcurrent(0, int_hash, int_equals);
+    for (uintptr_t i = 1; i <= 1000; i++) {
+        hashmapPut(map, to_ptr(i), to_ptr(i));
+    }
+    size_t visited = 0;
+    hashmapForEach(
+            map,
+            [](void*, void*, void* context) {
+                return ++*static_cast<size_t*>(context) < 10;
+            },
+            &visited);
+    EXPECT_EQ(10u, visited);
+    hashmapFree(map);
+}
+
+TEST(hashmap, concurrent_threads) {
+    Hashmap* map = hashmapCreateConcurrent(0, int_hash, int_equals);
+    static constexpr uintptr_t kThreads = 8;
+    static constexpr uintptr_t kKeysPerThread = 10000;
+
+    std::vector<std::thread> threads;
+    for (uintptr_t t = 0; t < kThreads; t++) {
+        threads.emplace_back([map, t] {
+            for (uintptr_t i = 1; i <= kKeysPerThread; i++) {
+                uintptr_t key = t * kKeysPerThread + i;
+                EXPECT_EQ(nullptr, hashmapPut(map, to_ptr(key), to_ptr(key)));
+                EXPECT_EQ(to_ptr(key), hashmapGet(map, to_ptr(key)));
+                if (i % 2) {
+                    EXPECT_EQ(to_ptr(key), hashmapRemove(map, to_ptr(key)));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // hashmapLock() still gives exclusive access to the whole map.
+    hashmapLock(map);
+    std::map<uintptr_t, uintptr_t> expected;
+    for (uintptr_t key = 1; key <= kThreads * kKeysPerThread; key++) {
+        if (key % 2 == 0) expected[key] = key;
+    }
+    check_contents(map, expected);
+    hashmapUnlock(map);
+
+    hashmapFree(map);
+}
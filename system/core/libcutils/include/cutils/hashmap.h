@@ -44,6 +44,16 @@ typedef struct Hashmap Hashmap;
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
 
+/**
+ * Creates a new hash map which hashmapGet(), hashmapPut() and hashmapRemove()
+ * can be called on from several threads without hashmapLock(). Entries are
+ * spread over independently locked stripes, so threads using different keys
+ * rarely wait for each other. hashmapLock() still locks the whole map, and
+ * hashmapForEach() locks one stripe at a time.
+ */
+Hashmap* hashmapCreateConcurrent(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
+
 /**
  * Frees the hash map. Does not free the keys or values themselves.
  */
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 
@@ -43,4 +44,25 @@ __BEGIN_DECLS
 void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
                unsigned* mode, uint64_t* capabilities);
 
+/*
+ * One path for fs_config_batch(). path and dir are inputs, the other fields
+ * are updated the same way fs_config() updates its arguments.
+ */
+struct fs_config_batch_entry {
+    const char* path;
+    int dir;
+    unsigned uid;
+    unsigned gid;
+    unsigned mode;
+    uint64_t capabilities;
+};
+
+/*
+ * Equivalent to calling fs_config() for each entry, but the override files
+ * are only checked for changes once for the whole batch. Meant for image
+ * builders that resolve every path of a partition.
+ */
+void fs_config_batch(struct fs_config_batch_entry* entries, size_t count,
+                     const char* target_out_path);
+
 __END_DECLS
@@ -20,8 +20,12 @@
 #include <limits.h>
 #include <utils/Unicode.h>
 
+#include <algorithm>
+
 #include <log/log.h>
 
+#include "UnicodeSimd.h"
+
 extern "C" {
 
 static const char32_t kByteMask = 0x000000BF;
@@ -52,6 +56,22 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// The conversion loops below alternate between the vector helpers from
+// UnicodeSimd.h, which stop at the first block they can't handle, and the
+// scalar code, which then runs for at least this many code units before the
+// vector helpers are tried again. Each time the vector helpers fail straight
+// away the scalar run is doubled, up to kMaxScalarRunLength, so that text
+// they can't help with doesn't pay for trying every 16 code units.
+static const size_t kScalarRunLength = 16;
+static const size_t kMaxScalarRunLength = 1024;
+
+static inline size_t next_scalar_run_length(size_t run_length, size_t simd_consumed) {
+    if (simd_consumed != 0) {
+        return kScalarRunLength;
+    }
+    return run_length < kMaxScalarRunLength ? run_length * 2 : run_length;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -301,27 +321,36 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     const char16_t* const end = src + src_len;
     const char16_t* in = src;
     size_t utf8_len = 0;
+    size_t run_length = kScalarRunLength;
 
     while (in < end) {
-        char16_t w = *in++;
-        if (LIKELY(w < 0x0080)) {
-            utf8_len += 1;
-            continue;
+        if (end - in >= (ptrdiff_t)android::kUnicodeSimdMinLength) {
+            size_t consumed = android::utf16_to_utf8_length_simd(in, end - in, &utf8_len);
+            in += consumed;
+            run_length = next_scalar_run_length(run_length, consumed);
         }
-        if (LIKELY(w < 0x0800)) {
-            utf8_len += 2;
-            continue;
-        }
-        if (LIKELY(!is_any_surrogate(w))) {
-            utf8_len += 3;
-            continue;
-        }
-        if (in < end && is_surrogate_pair(w, *in)) {
-            utf8_len += 4;
-            in++;
-            continue;
+        const char16_t* const run_end = in + std::min<size_t>(end - in, run_length);
+        while (in < run_end) {
+            char16_t w = *in++;
+            if (LIKELY(w < 0x0080)) {
+                utf8_len += 1;
+                continue;
+            }
+            if (LIKELY(w < 0x0800)) {
+                utf8_len += 2;
+                continue;
+            }
+            if (LIKELY(!is_any_surrogate(w))) {
+                utf8_len += 3;
+                continue;
+            }
+            if (in < end && is_surrogate_pair(w, *in)) {
+                utf8_len += 4;
+                in++;
+                continue;
+            }
+            /* skip if at the end of the string or invalid surrogate pair */
         }
-        /* skip if at the end of the string or invalid surrogate pair */
     }
     return (in == end && utf8_len < SSIZE_MAX) ? utf8_len : -1;
 }
@@ -337,6 +366,7 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst, size_t dst_le
     char* out = dst;
     const char* const out_end = dst + dst_len;
     char16_t w2;
+    size_t run_length = kScalarRunLength;
 
     auto err_out = [&out, &out_end, &dst_len]() {
         LOG_ALWAYS_FATAL_IF(out >= out_end,
@@ -344,44 +374,54 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst, size_t dst_le
     };
 
     while (in < in_end) {
-        char16_t w = *in++;
-        if (LIKELY(w < 0x0080)) {
-            if (out + 1 > out_end)
-                return err_out();
-            *out++ = (char)(w & 0xff);
-            continue;
-        }
-        if (LIKELY(w < 0x0800)) {
-            if (out + 2 > out_end)
-                return err_out();
-            *out++ = (char)(0xc0 | ((w >> 6) & 0x1f));
-            *out++ = (char)(0x80 | ((w >> 0) & 0x3f));
-            continue;
+        size_t simd_len = std::min<size_t>(in_end - in, out_end - out);
+        if (simd_len >= android::kUnicodeSimdMinLength && *in < 0x80) {
+            size_t converted = android::utf16_ascii_to_utf8_simd(in, simd_len, out);
+            in += converted;
+            out += converted;
+            run_length = next_scalar_run_length(run_length, converted);
         }
-        if (LIKELY(!is_any_surrogate(w))) {
-            if (out + 3 > out_end)
-                return err_out();
-            *out++ = (char)(0xe0 | ((w >> 12) & 0xf));
-            *out++ = (char)(0x80 | ((w >> 6) & 0x3f));
-            *out++ = (char)(0x80 | ((w >> 0) & 0x3f));
-            continue;
-        }
-        /* surrogate pair */
-        if (in < in_end && (w2 = *in, is_surrogate_pair(w, w2))) {
-            if (out + 4 > out_end)
-                return err_out();
-            char32_t dw = (char32_t)(0x10000 + ((w - 0xd800) << 10) + (w2 - 0xdc00));
-            *out++ = (char)(0xf0 | ((dw >> 18) & 0x07));
-            *out++ = (char)(0x80 | ((dw >> 12) & 0x3f));
-            *out++ = (char)(0x80 | ((dw >> 6)  & 0x3f));
-            *out++ = (char)(0x80 | ((dw >> 0)  & 0x3f));
-            in++;
+        const char16_t* const run_end = in + std::min<size_t>(in_end - in, run_length);
+        while (in < run_end) {
+            char16_t w = *in++;
+            if (LIKELY(w < 0x0080)) {
+                if (out + 1 > out_end)
+                    return err_out();
+                *out++ = (char)(w & 0xff);
+                continue;
+            }
+            if (LIKELY(w < 0x0800)) {
+                if (out + 2 > out_end)
+                    return err_out();
+                *out++ = (char)(0xc0 | ((w >> 6) & 0x1f));
+                *out++ = (char)(0x80 | ((w >> 0) & 0x3f));
+                continue;
+            }
+            if (LIKELY(!is_any_surrogate(w))) {
+                if (out + 3 > out_end)
+                    return err_out();
+                *out++ = (char)(0xe0 | ((w >> 12) & 0xf));
+                *out++ = (char)(0x80 | ((w >> 6) & 0x3f));
+                *out++ = (char)(0x80 | ((w >> 0) & 0x3f));
+                continue;
+            }
+            /* surrogate pair */
+            if (in < in_end && (w2 = *in, is_surrogate_pair(w, w2))) {
+                if (out + 4 > out_end)
+                    return err_out();
+                char32_t dw = (char32_t)(0x10000 + ((w - 0xd800) << 10) + (w2 - 0xdc00));
+                *out++ = (char)(0xf0 | ((dw >> 18) & 0x07));
+                *out++ = (char)(0x80 | ((dw >> 12) & 0x3f));
+                *out++ = (char)(0x80 | ((dw >> 6)  & 0x3f));
+                *out++ = (char)(0x80 | ((dw >> 0)  & 0x3f));
+                in++;
+            }
+            /* We reach here in two cases:
+             *  1) (in == in_end), which means end of the input string
+             *  2) (w2 & 0xfc00) != 0xdc00, which means invalid surrogate pair
+             * In either case, we intentionally do nothing and skip
+             */
         }
-        /* We reach here in two cases:
-         *  1) (in == in_end), which means end of the input string
-         *  2) (w2 & 0xfc00) != 0xdc00, which means invalid surrogate pair
-         * In either case, we intentionally do nothing and skip
-         */
     }
     *out = '\0';
     return;
@@ -416,37 +456,46 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len, bool overreadIs
     const uint8_t* const in_end = u8str + u8len;
     const uint8_t* in = u8str;
     size_t utf16_len = 0;
+    size_t run_length = kScalarRunLength;
 
     while (in < in_end) {
-        uint8_t c = *in;
-        utf16_len++;
-        if (LIKELY((c & 0x80) == 0)) {
-            in++;
-            continue;
-        }
-        if (UNLIKELY(c < 0xc0)) {
-            ALOGW("Invalid UTF-8 leading byte: 0x%02x", c);
-            in++;
-            continue;
+        if (in_end - in >= (ptrdiff_t)android::kUnicodeSimdMinLength) {
+            size_t consumed = android::utf8_to_utf16_length_simd(in, in_end - in, &utf16_len);
+            in += consumed;
+            run_length = next_scalar_run_length(run_length, consumed);
         }
-        if (LIKELY(c < 0xe0)) {
-            in += 2;
-            continue;
-        }
-        if (LIKELY(c < 0xf0)) {
-            in += 3;
-            continue;
-        } else {
-            uint8_t c2, c3, c4;
-            if (UNLIKELY(c >= 0xf8)) {
+        const uint8_t* const run_end = in + std::min<size_t>(in_end - in, run_length);
+        while (in < run_end) {
+            uint8_t c = *in;
+            utf16_len++;
+            if (LIKELY((c & 0x80) == 0)) {
+                in++;
+                continue;
+            }
+            if (UNLIKELY(c < 0xc0)) {
                 ALOGW("Invalid UTF-8 leading byte: 0x%02x", c);
+                in++;
+                continue;
             }
-            c2 = in[1]; c3 = in[2]; c4 = in[3];
-            if (utf8_4b_to_utf32(c, c2, c3, c4) >= 0x10000) {
-                utf16_len++;
+            if (LIKELY(c < 0xe0)) {
+                in += 2;
+                continue;
+            }
+            if (LIKELY(c < 0xf0)) {
+                in += 3;
+                continue;
+            } else {
+                uint8_t c2, c3, c4;
+                if (UNLIKELY(c >= 0xf8)) {
+                    ALOGW("Invalid UTF-8 leading byte: 0x%02x", c);
+                }
+                c2 = in[1]; c3 = in[2]; c4 = in[3];
+                if (utf8_4b_to_utf32(c, c2, c3, c4) >= 0x10000) {
+                    utf16_len++;
+                }
+                in += 4;
+                continue;
             }
-            in += 4;
-            continue;
         }
     }
     if (in == in_end) {
@@ -479,6 +528,7 @@ char16_t* utf8_to_utf16_no_null_terminator(
     char16_t* out = dst;
     uint8_t c, c2, c3, c4;
     char32_t w;
+    size_t run_length = kScalarRunLength;
 
     auto err_in = [&c, &out]() {
         ALOGW("Unended UTF-8 byte: 0x%02x", c);
@@ -486,53 +536,63 @@ char16_t* utf8_to_utf16_no_null_terminator(
     };
 
     while (in < in_end && out < out_end) {
-        c = *in++;
-        if (LIKELY((c & 0x80) == 0)) {
-            *out++ = (char16_t)(c);
-            continue;
+        size_t simd_len = std::min<size_t>(in_end - in, out_end - out);
+        if (simd_len >= android::kUnicodeSimdMinLength && *in < 0x80) {
+            size_t converted = android::utf8_ascii_to_utf16_simd(in, simd_len, out);
+            in += converted;
+            out += converted;
+            run_length = next_scalar_run_length(run_length, converted);
         }
-        if (UNLIKELY(c < 0xc0)) {
-            ALOGW("Invalid UTF-8 leading byte: 0x%02x", c);
-            *out++ = (char16_t)(c);
-            continue;
-        }
-        if (LIKELY(c < 0xe0)) {
-            if (UNLIKELY(in + 1 > in_end)) {
-                return err_in();
+        const uint8_t* const run_end = in + std::min<size_t>(in_end - in, run_length);
+        while (in < run_end && out < out_end) {
+            c = *in++;
+            if (LIKELY((c & 0x80) == 0)) {
+                *out++ = (char16_t)(c);
+                continue;
             }
-            c2 = *in++;
-            *out++ = (char16_t)(((c & 0x1f) << 6) | (c2 & 0x3f));
-            continue;
-        }
-        if (LIKELY(c < 0xf0)) {
-            if (UNLIKELY(in + 2 > in_end)) {
-                return err_in();
-            }
-            c2 = *in++; c3 = *in++;
-            *out++ = (char16_t)(((c & 0x0f) << 12) |
-                                ((c2 & 0x3f) << 6) | (c3 & 0x3f));
-            continue;
-        } else {
-            if (UNLIKELY(in + 3 > in_end)) {
-                return err_in();
-            }
-            if (UNLIKELY(c >= 0xf8)) {
+            if (UNLIKELY(c < 0xc0)) {
                 ALOGW("Invalid UTF-8 leading byte: 0x%02x", c);
+                *out++ = (char16_t)(c);
+                continue;
+            }
+            if (LIKELY(c < 0xe0)) {
+                if (UNLIKELY(in + 1 > in_end)) {
+                    return err_in();
+                }
+                c2 = *in++;
+                *out++ = (char16_t)(((c & 0x1f) << 6) | (c2 & 0x3f));
+                continue;
             }
-            // Multiple UTF16 characters with surrogates
-            c2 = *in++; c3 = *in++; c4 = *in++;
-            w = utf8_4b_to_utf32(c, c2, c3, c4);
-            if (UNLIKELY(w < 0x10000)) {
-                *out++ = (char16_t)(w);
+            if (LIKELY(c < 0xf0)) {
+                if (UNLIKELY(in + 2 > in_end)) {
+                    return err_in();
+                }
+                c2 = *in++; c3 = *in++;
+                *out++ = (char16_t)(((c & 0x0f) << 12) |
+                                    ((c2 & 0x3f) << 6) | (c3 & 0x3f));
+                continue;
             } else {
-                if (UNLIKELY(out + 2 > out_end)) {
-                    // Ooops.... not enough room for this surrogate pair.
-                    return out;
+                if (UNLIKELY(in + 3 > in_end)) {
+                    return err_in();
+                }
+                if (UNLIKELY(c >= 0xf8)) {
+                    ALOGW("Invalid UTF-8 leading byte: 0x%02x", c);
+                }
+                // Multiple UTF16 characters with surrogates
+                c2 = *in++; c3 = *in++; c4 = *in++;
+                w = utf8_4b_to_utf32(c, c2, c3, c4);
+                if (UNLIKELY(w < 0x10000)) {
+                    *out++ = (char16_t)(w);
+                } else {
+                    if (UNLIKELY(out + 2 > out_end)) {
+                        // Ooops.... not enough room for this surrogate pair.
+                        return out;
+                    }
+                    *out++ = (char16_t)(((w - 0x10000) >> 10) + 0xd800);
+                    *out++ = (char16_t)(((w - 0x10000) & 0x3ff) + 0xdc00);
                 }
-                *out++ = (char16_t)(((w - 0x10000) >> 10) + 0xd800);
-                *out++ = (char16_t)(((w - 0x10000) & 0x3ff) + 0xdc00);
+                continue;
             }
-            continue;
         }
     }
     return out;
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UnicodeSimd.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define UNICODE_SIMD_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define UNICODE_SIMD_NEON 1
+#endif
+
+namespace android {
+
+namespace {
+
+// Bitmasks describing a block of UTF-8, one bit per byte.
+struct Utf8Masks {
+    uint64_t cont;   // 10xxxxxx continuation bytes
+    uint64_t ge_c0;  // leading bytes of 2, 3 and 4 byte sequences
+    uint64_t ge_e0;  // leading bytes of 3 and 4 byte sequences
+    uint64_t ge_f0;  // leading bytes of 4 byte sequences
+    uint64_t ge_f8;  // invalid leading bytes
+    uint64_t eq_f0;  // 0xf0 leading bytes, which need a second byte >= 0x90
+    uint64_t ge_90;  // bytes >= 0x90
+};
+
+// Computes the UTF-16 length of consecutive blocks of UTF-8 for as long as
+// they are well-formed, in which case the scalar code would step through them
+// one sequence at a time: the continuation bytes are exactly the ones
+// following each leading byte, there are no invalid leading bytes, and every
+// 4 byte sequence decodes to at least U+10000 (the scalar code only adds a
+// surrogate for those). Each non-continuation byte is then one UTF-16 code
+// unit and each 4 byte sequence adds a second one.
+//
+// Sequences may straddle two blocks; the continuation bytes expected in the
+// next block are carried over. If the last block that was accepted ends in
+// the middle of a sequence, Finish() backs up to its leading byte so that the
+// scalar code can carry on from there.
+class Utf8LengthCounter {
+  public:
+    explicit Utf8LengthCounter(size_t width)
+        : width_(width), block_mask_(width == 64 ? ~0ULL : (1ULL << width) - 1) {}
+
+    bool AddAscii() {
+        if (carry_ != 0 || pending_f0_) {
+            return false;
+        }
+        last_ = {};
+        last_count_ = count_;
+        count_ += width_;
+        return true;
+    }
+
+    bool Add(const Utf8Masks& m) {
+        uint64_t expected = (m.ge_c0 << 1) | (m.ge_e0 << 2) | (m.ge_f0 << 3) | carry_;
+        // An 0xf0 in the last byte is checked against the next block.
+        uint64_t bad = m.ge_f8 | (m.eq_f0 & ~(m.ge_90 >> 1) & (block_mask_ >> 1));
+        if ((expected & block_mask_) != m.cont || bad != 0 || (pending_f0_ && !(m.ge_90 & 1))) {
+            return false;
+        }
+        carry_ = expected >> width_;
+        pending_f0_ = (m.eq_f0 >> (width_ - 1)) & 1;
+        last_ = m;
+        last_count_ = count_;
+        count_ += width_ - __builtin_popcountll(m.cont) + __builtin_popcountll(m.ge_f0);
+        return true;
+    }
+
+    // Adds the UTF-16 length to *utf16_len and returns the number of bytes
+    // it covers, given that end is the end of the last block accepted.
+    size_t Finish(size_t end, size_t* utf16_len) {
+        if (carry_ != 0 || pending_f0_) {
+            // Cut the last block before the first sequence that continues
+            // past its end. Its leading byte is in the last three bytes.
+            uint64_t straddle = (last_.ge_c0 & (1ULL << (width_ - 1))) |
+                                (last_.ge_e0 & (1ULL << (width_ - 2))) |
+                                (last_.ge_f0 & (1ULL << (width_ - 3)));
+            size_t cut = __builtin_ctzll(straddle);
+            uint64_t prefix = (1ULL << cut) - 1;
+            count_ = last_count_ + cut - __builtin_popcountll(last_.cont & prefix) +
+                     __builtin_popcountll(last_.ge_f0 & prefix);
+            end = end - width_ + cut;
+        }
+        *utf16_len += count_;
+        return end;
+    }
+
+  private:
+    const size_t width_;
+    const uint64_t block_mask_;
+    uint64_t carry_ = 0;
+    bool pending_f0_ = false;
+    size_t count_ = 0;
+    Utf8Masks last_ = {};
+    size_t last_count_ = 0;
+};
+
+#if defined(UNICODE_SIMD_X86)
+
+inline __m128i ge_u8(__m128i v, uint8_t bound) {
+    __m128i b = _mm_set1_epi8(static_cast<char>(bound));
+    return _mm_cmpeq_epi8(_mm_max_epu8(v, b), v);
+}
+
+inline uint32_t movemask(__m128i v) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
+
+size_t utf8_to_utf16_length_sse2(const uint8_t* src, size_t len, size_t* utf16_len) {
+    const __m128i kContMask = _mm_set1_epi8(static_cast<char>(0xc0));
+    const __m128i kContBits = _mm_set1_epi8(static_cast<char>(0x80));
+    const __m128i kF0 = _mm_set1_epi8(static_cast<char>(0xf0));
+    Utf8LengthCounter counter(16);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v) == 0) {
+            if (!counter.AddAscii()) break;
+            continue;
+        }
+        Utf8Masks masks = {
+                .cont = movemask(_mm_cmpeq_epi8(_mm_and_si128(v, kContMask), kContBits)),
+                .ge_c0 = movemask(ge_u8(v, 0xc0)),
+                .ge_e0 = movemask(ge_u8(v, 0xe0)),
+                .ge_f0 = movemask(ge_u8(v, 0xf0)),
+                .ge_f8 = movemask(ge_u8(v, 0xf8)),
+                .eq_f0 = movemask(_mm_cmpeq_epi8(v, kF0)),
+                .ge_90 = movemask(ge_u8(v, 0x90)),
+        };
+        if (!counter.Add(masks)) break;
+    }
+    return counter.Finish(i, utf16_len);
+}
+
+size_t utf16_to_utf8_length_sse2(const char16_t* src, size_t len, size_t* utf8_len) {
+    const __m128i kZero = _mm_setzero_si128();
+    const __m128i kMask80 = _mm_set1_epi16(static_cast<short>(0xff80));
+    const __m128i kMask800 = _mm_set1_epi16(static_cast<short>(0xf800));
+    const __m128i kSurrogate = _mm_set1_epi16(static_cast<short>(0xd800));
+    size_t i = 0;
+    size_t count = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i high = _mm_and_si128(v, kMask800);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, kSurrogate)) != 0) {
+            break;
+        }
+        // Each 16-bit lane sets two bits in the mask, so the popcounts below
+        // are twice the number of lanes that need a second and third byte.
+        uint32_t one_byte = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, kMask80), kZero));
+        uint32_t le_two_bytes = _mm_movemask_epi8(_mm_cmpeq_epi16(high, kZero));
+        count += 8 + (16 - __builtin_popcount(one_byte)) / 2 +
+                 (16 - __builtin_popcount(le_two_bytes)) / 2;
+    }
+    *utf8_len += count;
+    return i;
+}
+
+size_t utf8_ascii_to_utf16_sse2(const uint8_t* src, size_t len, char16_t* dst) {
+    const __m128i kZero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v) != 0) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, kZero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, kZero));
+    }
+    return i;
+}
+
+size_t utf16_ascii_to_utf8_sse2(const char16_t* src, size_t len, char* dst) {
+    const __m128i kMask80 = _mm_set1_epi16(static_cast<short>(0xff80));
+    const __m128i kZero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+        __m128i non_ascii = _mm_and_si128(_mm_or_si128(lo, hi), kMask80);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(non_ascii, kZero)) != 0xffff) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET inline __m256i ge_u8_avx2(__m256i v, uint8_t bound) {
+    __m256i b = _mm256_set1_epi8(static_cast<char>(bound));
+    return _mm256_cmpeq_epi8(_mm256_max_epu8(v, b), v);
+}
+
+AVX2_TARGET inline uint32_t movemask_avx2(__m256i v) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+
+AVX2_TARGET size_t utf8_to_utf16_length_avx2(const uint8_t* src, size_t len, size_t* utf16_len) {
+    const __m256i kContMask = _mm256_set1_epi8(static_cast<char>(0xc0));
+    const __m256i kContBits = _mm256_set1_epi8(static_cast<char>(0x80));
+    const __m256i kF0 = _mm256_set1_epi8(static_cast<char>(0xf0));
+    Utf8LengthCounter counter(32);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (_mm256_movemask_epi8(v) == 0) {
+            if (!counter.AddAscii()) break;
+            continue;
+        }
+        Utf8Masks masks = {
+                .cont = movemask_avx2(
+                        _mm256_cmpeq_epi8(_mm256_and_si256(v, kContMask), kContBits)),
+                .ge_c0 = movemask_avx2(ge_u8_avx2(v, 0xc0)),
+                .ge_e0 = movemask_avx2(ge_u8_avx2(v, 0xe0)),
+                .ge_f0 = movemask_avx2(ge_u8_avx2(v, 0xf0)),
+                .ge_f8 = movemask_avx2(ge_u8_avx2(v, 0xf8)),
+                .eq_f0 = movemask_avx2(_mm256_cmpeq_epi8(v, kF0)),
+                .ge_90 = movemask_avx2(ge_u8_avx2(v, 0x90)),
+        };
+        if (!counter.Add(masks)) break;
+    }
+    i = counter.Finish(i, utf16_len);
+    // Finish off with SSE2 so that strings shorter than 32 bytes, and the
+    // tail of longer ones, still get some vector help.
+    return i + utf8_to_utf16_length_sse2(src + i, len - i, utf16_len);
+}
+
+AVX2_TARGET size_t utf16_to_utf8_length_avx2(const char16_t* src, size_t len, size_t* utf8_len) {
+    const __m256i kZero = _mm256_setzero_si256();
+    const __m256i kMask80 = _mm256_set1_epi16(static_cast<short>(0xff80));
+    const __m256i kMask800 = _mm256_set1_epi16(static_cast<short>(0xf800));
+    const __m256i kSurrogate = _mm256_set1_epi16(static_cast<short>(0xd800));
+    size_t i = 0;
+    size_t count = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i high = _mm256_and_si256(v, kMask800);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(high, kSurrogate)) != 0) {
+            break;
+        }
+        uint32_t one_byte = _mm256_movemask_epi8(
+                _mm256_cmpeq_epi16(_mm256_and_si256(v, kMask80), kZero));
+        uint32_t le_two_bytes = _mm256_movemask_epi8(_mm256_cmpeq_epi16(high, kZero));
+        count += 16 + (32 - __builtin_popcount(one_byte)) / 2 +
+                 (32 - __builtin_popcount(le_two_bytes)) / 2;
+    }
+    *utf8_len += count;
+    return i + utf16_to_utf8_length_sse2(src + i, len - i, utf8_len);
+}
+
+AVX2_TARGET size_t utf8_ascii_to_utf16_avx2(const uint8_t* src, size_t len, char16_t* dst) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if (_mm256_movemask_epi8(v) != 0) {
+            break;
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16),
+                            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+    }
+    return i + utf8_ascii_to_utf16_sse2(src + i, len - i, dst + i);
+}
+
+AVX2_TARGET size_t utf16_ascii_to_utf8_avx2(const char16_t* src, size_t len, char* dst) {
+    const __m256i kMask80 = _mm256_set1_epi16(static_cast<short>(0xff80));
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16));
+        if (!_mm256_testz_si256(_mm256_or_si256(lo, hi), kMask80)) {
+            break;
+        }
+        // packus works within 128-bit lanes, so put the quadwords back in order.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    return i + utf16_ascii_to_utf8_sse2(src + i, len - i, dst + i);
+}
+
+#undef AVX2_TARGET
+
+struct Kernels {
+    size_t (*utf8_to_utf16_length)(const uint8_t*, size_t, size_t*);
+    size_t (*utf16_to_utf8_length)(const char16_t*, size_t, size_t*);
+    size_t (*utf8_ascii_to_utf16)(const uint8_t*, size_t, char16_t*);
+    size_t (*utf16_ascii_to_utf8)(const char16_t*, size_t, char*);
+};
+
+const Kernels& GetKernels() {
+    static const Kernels kernels = []() -> Kernels {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return {utf8_to_utf16_length_avx2, utf16_to_utf8_length_avx2,
+                    utf8_ascii_to_utf16_avx2, utf16_ascii_to_utf8_avx2};
+        }
+        return {utf8_to_utf16_length_sse2, utf16_to_utf8_length_sse2, utf8_ascii_to_utf16_sse2,
+                utf16_ascii_to_utf8_sse2};
+    }();
+    return kernels;
+}
+
+#elif defined(UNICODE_SIMD_NEON)
+
+// NEON has no movemask, so build one from a per-lane bit and horizontal adds.
+inline uint32_t movemask_neon(uint8x16_t v) {
+    static const uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t bits = vandq_u8(v, vld1q_u8(kBits));
+    return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+inline uint32_t ge_u8_neon(uint8x16_t v, uint8_t bound) {
+    return movemask_neon(vcgeq_u8(v, vdupq_n_u8(bound)));
+}
+
+size_t utf8_to_utf16_length_neon(const uint8_t* src, size_t len, size_t* utf16_len) {
+    Utf8LengthCounter counter(16);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        if (vmaxvq_u8(v) < 0x80) {
+            if (!counter.AddAscii()) break;
+            continue;
+        }
+        Utf8Masks masks = {
+                .cont = movemask_neon(vceqq_u8(vandq_u8(v, vdupq_n_u8(0xc0)), vdupq_n_u8(0x80))),
+                .ge_c0 = ge_u8_neon(v, 0xc0),
+                .ge_e0 = ge_u8_neon(v, 0xe0),
+                .ge_f0 = ge_u8_neon(v, 0xf0),
+                .ge_f8 = ge_u8_neon(v, 0xf8),
+                .eq_f0 = movemask_neon(vceqq_u8(v, vdupq_n_u8(0xf0))),
+                .ge_90 = ge_u8_neon(v, 0x90),
+        };
+        if (!counter.Add(masks)) break;
+    }
+    return counter.Finish(i, utf16_len);
+}
+
+size_t utf16_to_utf8_length_neon(const char16_t* src, size_t len, size_t* utf8_len) {
+    size_t i = 0;
+    size_t count = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        uint16x8_t high = vandq_u16(v, vdupq_n_u16(0xf800));
+        if (vmaxvq_u16(vceqq_u16(high, vdupq_n_u16(0xd800))) != 0) {
+            break;
+        }
+        uint16x8_t extra = vaddq_u16(vandq_u16(vcgeq_u16(v, vdupq_n_u16(0x80)), vdupq_n_u16(1)),
+                                     vandq_u16(vcgeq_u16(v, vdupq_n_u16(0x800)), vdupq_n_u16(1)));
+        count += 8 + vaddvq_u16(extra);
+    }
+    *utf8_len += count;
+    return i;
+}
+
+size_t utf8_ascii_to_utf16_neon(const uint8_t* src, size_t len, char16_t* dst) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        if (vmaxvq_u8(v) >= 0x80) {
+            break;
+        }
+        uint16_t* out = reinterpret_cast<uint16_t*>(dst + i);
+        vst1q_u16(out, vmovl_u8(vget_low_u8(v)));
+        vst1q_u16(out + 8, vmovl_high_u8(v));
+    }
+    return i;
+}
+
+size_t utf16_ascii_to_utf8_neon(const char16_t* src, size_t len, char* dst) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint16x8_t lo = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        uint16x8_t hi = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i + 8));
+        if (vmaxvq_u16(vorrq_u16(lo, hi)) >= 0x80) {
+            break;
+        }
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + i), vmovn_high_u16(vmovn_u16(lo), hi));
+    }
+    return i;
+}
+
+#endif
+
+}  // namespace
+
+#if defined(UNICODE_SIMD_X86)
+
+size_t utf8_to_utf16_length_simd(const uint8_t* src, size_t len, size_t* utf16_len) {
+    return GetKernels().utf8_to_utf16_length(src, len, utf16_len);
+}
+
+size_t utf16_to_utf8_length_simd(const char16_t* src, size_t len, size_t* utf8_len) {
+    return GetKernels().utf16_to_utf8_length(src, len, utf8_len);
+}
+
+size_t utf8_ascii_to_utf16_simd(const uint8_t* src, size_t len, char16_t* dst) {
+    return GetKernels().utf8_ascii_to_utf16(src, len, dst);
+}
+
+size_t utf16_ascii_to_utf8_simd(const char16_t* src, size_t len, char* dst) {
+    return GetKernels().utf16_ascii_to_utf8(src, len, dst);
+}
+
+#elif defined(UNICODE_SIMD_NEON)
+
+size_t utf8_to_utf16_length_simd(const uint8_t* src, size_t len, size_t* utf16_len) {
+    return utf8_to_utf16_length_neon(src, len, utf16_len);
+}
+
+size_t utf16_to_utf8_length_simd(const char16_t* src, size_t len, size_t* utf8_len) {
+    return utf16_to_utf8_length_neon(src, len, utf8_len);
+}
+
+size_t utf8_ascii_to_utf16_simd(const uint8_t* src, size_t len, char16_t* dst) {
+    return utf8_ascii_to_utf16_neon(src, len, dst);
+}
+
+size_t utf16_ascii_to_utf8_simd(const char16_t* src, size_t len, char* dst) {
+    return utf16_ascii_to_utf8_neon(src, len, dst);
+}
+
+#else
+
+size_t utf8_to_utf16_length_simd(const uint8_t*, size_t, size_t*) {
+    return 0;
+}
+
+size_t utf16_to_utf8_length_simd(const char16_t*, size_t, size_t*) {
+    return 0;
+}
+
+size_t utf8_ascii_to_utf16_simd(const uint8_t*, size_t, char16_t*) {
+    return 0;
+}
+
+size_t utf16_ascii_to_utf8_simd(const char16_t*, size_t, char*) {
+    return 0;
+}
+
+#endif
+
+}  // namespace android
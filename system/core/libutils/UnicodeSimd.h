@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorized helpers for the UTF-8/UTF-16 conversions in Unicode.cpp.
+//
+// Each helper consumes whole vector-sized blocks from the start of its input
+// and stops at the first block it can not handle exactly like the scalar code
+// would, returning the number of input code units consumed (possibly 0). The
+// caller is expected to continue with the scalar code from that point, so the
+// helpers only ever take blocks where the result is unambiguous: ASCII for the
+// conversions, well-formed UTF-8 and UTF-16 without surrogates for the length
+// functions. Everything involving invalid input, surrogates, overreads or
+// truncated output is left to the scalar code.
+//
+// The implementation is chosen at runtime: AVX2 when the CPU supports it and
+// SSE2 otherwise on x86 (where SSE2 is available), NEON on arm64, and none
+// (all helpers return 0) on other architectures.
+
+namespace android {
+
+// Inputs shorter than this are never worth handing to the vector code.
+static constexpr size_t kUnicodeSimdMinLength = 16;
+
+// Adds the UTF-16 length of the consumed prefix of src to *utf16_len.
+size_t utf8_to_utf16_length_simd(const uint8_t* src, size_t len, size_t* utf16_len);
+
+// Adds the UTF-8 length of the consumed prefix of src to *utf8_len.
+size_t utf16_to_utf8_length_simd(const char16_t* src, size_t len, size_t* utf8_len);
+
+// Converts an ASCII prefix of src into dst, which must have room for len
+// code units.
+size_t utf8_ascii_to_utf16_simd(const uint8_t* src, size_t len, char16_t* dst);
+
+// Converts an ASCII prefix of src into dst, which must have room for len
+// bytes.
+size_t utf16_ascii_to_utf8_simd(const char16_t* src, size_t len, char* dst);
+
+}  // namespace android
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <utils/Unicode.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+enum class Text {
+    kAscii,
+    kLatin1,
+    kCjk,
+    kEmoji,
+};
+
+// Builds a UTF-16 string of roughly the given length made up of code points
+// typical for each kind of text. The Latin-1 and CJK samples mix in ASCII
+// spaces and punctuation the way real text does.
+std::u16string MakeText(Text text, size_t length) {
+    static const char16_t kAscii[] = u"The quick brown fox jumps over the lazy dog. ";
+    static const char16_t kLatin1[] = u"Voix ambiguë d'un cœur qui, au zéphyr, préfère les jattes de kiwis. ";
+    static const char16_t kCjk[] = u"敏捷的棕色狐狸跳过了懒狗。色は匂へど散りぬるを、";
+    static const char16_t kEmoji[] = u"😀 😃 😄 😁 🚀 🌍 👍 🎉 ";
+
+    const char16_t* sample;
+    switch (text) {
+        case Text::kAscii:
+            sample = kAscii;
+            break;
+        case Text::kLatin1:
+            sample = kLatin1;
+            break;
+        case Text::kCjk:
+            sample = kCjk;
+            break;
+        case Text::kEmoji:
+        default:
+            sample = kEmoji;
+            break;
+    }
+    std::u16string sample_str(sample);
+    std::u16string result;
+    while (result.size() < length) {
+        result += sample_str;
+    }
+    result.resize(length);
+    // Don't leave half a surrogate pair at the end.
+    if (!result.empty() && (result.back() & 0xfc00) == 0xd800) {
+        result.pop_back();
+    }
+    return result;
+}
+
+std::string ToUtf8(const std::u16string& utf16) {
+    ssize_t len = utf16_to_utf8_length(utf16.data(), utf16.size());
+    std::string utf8(len, '\0');
+    utf16_to_utf8(utf16.data(), utf16.size(), utf8.data(), len + 1);
+    return utf8;
+}
+
+void BM_utf8_to_utf16_length(benchmark::State& state, Text text) {
+    std::string utf8 = ToUtf8(MakeText(text, state.range(0)));
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(utf8.data());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utf8_to_utf16_length(data, utf8.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * utf8.size());
+}
+
+void BM_utf8_to_utf16(benchmark::State& state, Text text) {
+    std::string utf8 = ToUtf8(MakeText(text, state.range(0)));
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(utf8.data());
+    std::vector<char16_t> out(state.range(0) + 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utf8_to_utf16(data, utf8.size(), out.data(), out.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * utf8.size());
+}
+
+void BM_utf16_to_utf8_length(benchmark::State& state, Text text) {
+    std::u16string utf16 = MakeText(text, state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utf16_to_utf8_length(utf16.data(), utf16.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * utf16.size() * sizeof(char16_t));
+}
+
+void BM_utf16_to_utf8(benchmark::State& state, Text text) {
+    std::u16string utf16 = MakeText(text, state.range(0));
+    std::vector<char> out(utf16_to_utf8_length(utf16.data(), utf16.size()) + 1);
+    for (auto _ : state) {
+        utf16_to_utf8(utf16.data(), utf16.size(), out.data(), out.size());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * utf16.size() * sizeof(char16_t));
+}
+
+#define UNICODE_BENCHMARK(fn)                                                        \
+    BENCHMARK_CAPTURE(fn, ascii, Text::kAscii)->Arg(16)->Arg(256)->Arg(4096);       \
+    BENCHMARK_CAPTURE(fn, latin1, Text::kLatin1)->Arg(16)->Arg(256)->Arg(4096);     \
+    BENCHMARK_CAPTURE(fn, cjk, Text::kCjk)->Arg(16)->Arg(256)->Arg(4096);           \
+    BENCHMARK_CAPTURE(fn, emoji, Text::kEmoji)->Arg(16)->Arg(256)->Arg(4096)
+
+UNICODE_BENCHMARK(BM_utf8_to_utf16_length);
+UNICODE_BENCHMARK(BM_utf8_to_utf16);
+UNICODE_BENCHMARK(BM_utf16_to_utf8_length);
+UNICODE_BENCHMARK(BM_utf16_to_utf8);
+
+}  // namespace
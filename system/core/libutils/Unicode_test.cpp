@@ -19,6 +19,9 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <string>
+#include <vector>
+
 #include <log/log.h>
 #include <utils/Unicode.h>
 
@@ -308,4 +311,162 @@ TEST_F(UnicodeTest, InvalidUtf8OverreadDetected) {
             true /* overreadIsFatal */), "" /* regex for ASSERT_DEATH */);
 }
 
+// The conversions hand blocks of 16 or 32 code units to vectorized helpers
+// and fall back to the scalar code for the rest. The tests below place every
+// kind of code point, and invalid input, at every offset around those block
+// boundaries and check the results against straightforward encoders.
+
+static void AppendUtf8(std::string* out, char32_t c) {
+    if (c < 0x80) {
+        *out += (char)c;
+    } else if (c < 0x800) {
+        *out += (char)(0xc0 | (c >> 6));
+        *out += (char)(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        *out += (char)(0xe0 | (c >> 12));
+        *out += (char)(0x80 | ((c >> 6) & 0x3f));
+        *out += (char)(0x80 | (c & 0x3f));
+    } else {
+        *out += (char)(0xf0 | (c >> 18));
+        *out += (char)(0x80 | ((c >> 12) & 0x3f));
+        *out += (char)(0x80 | ((c >> 6) & 0x3f));
+        *out += (char)(0x80 | (c & 0x3f));
+    }
+}
+
+static void AppendUtf16(std::u16string* out, char32_t c) {
+    if (c < 0x10000) {
+        *out += (char16_t)c;
+    } else {
+        *out += (char16_t)(((c - 0x10000) >> 10) + 0xd800);
+        *out += (char16_t)(((c - 0x10000) & 0x3ff) + 0xdc00);
+    }
+}
+
+static void CheckRoundTrip(const std::vector<char32_t>& codepoints) {
+    std::string utf8;
+    std::u16string utf16;
+    for (char32_t c : codepoints) {
+        AppendUtf8(&utf8, c);
+        AppendUtf16(&utf16, c);
+    }
+    const uint8_t* u8 = reinterpret_cast<const uint8_t*>(utf8.data());
+
+    ASSERT_EQ((ssize_t)utf16.size(), utf8_to_utf16_length(u8, utf8.size()));
+    std::vector<char16_t> out16(utf16.size() + 1, 0xffff);
+    utf8_to_utf16(u8, utf8.size(), out16.data(), out16.size());
+    ASSERT_EQ(utf16, std::u16string(out16.data(), utf16.size()));
+    ASSERT_EQ(0, out16[utf16.size()]);
+
+    if (utf16.empty()) return;
+    ASSERT_EQ((ssize_t)utf8.size(), utf16_to_utf8_length(utf16.data(), utf16.size()));
+    std::vector<char> out8(utf8.size() + 1, '\xff');
+    utf16_to_utf8(utf16.data(), utf16.size(), out8.data(), out8.size());
+    ASSERT_EQ(utf8, std::string(out8.data(), utf8.size()));
+    ASSERT_EQ(0, out8[utf8.size()]);
+}
+
+TEST_F(UnicodeTest, ConversionAtBlockBoundaries) {
+    static const char32_t kSamples[] = {0x00a3, 0x0939, 0xd55c, 0x10437, 0x7f, 0x80, 0x7ff,
+                                        0x800, 0xffff, 0x10000, 0x10ffff};
+    for (char32_t sample : kSamples) {
+        for (size_t len = 0; len < 80; len++) {
+            for (size_t pos = 0; pos < len; pos++) {
+                std::vector<char32_t> codepoints(len, 'a');
+                codepoints[pos] = sample;
+                CheckRoundTrip(codepoints);
+            }
+        }
+    }
+}
+
+TEST_F(UnicodeTest, ConversionLongMixedText) {
+    std::vector<char32_t> codepoints;
+    for (size_t i = 0; i < 4096; i++) {
+        switch ((i / 37) % 4) {
+            case 0: codepoints.push_back('a' + i % 26); break;
+            case 1: codepoints.push_back(0xc0 + i % 0x40); break;
+            case 2: codepoints.push_back(0x4e00 + i % 0x100); break;
+            case 3: codepoints.push_back(0x1f600 + i % 0x40); break;
+        }
+        ASSERT_NO_FATAL_FAILURE(CheckRoundTrip(codepoints)) << i;
+    }
+}
+
+// Mirrors the documented quirks of utf8_to_utf16_length() for malformed input.
+static ssize_t ExpectedUtf8ToUtf16Length(const uint8_t* s, size_t size) {
+    size_t i = 0, len = 0;
+    while (i < size) {
+        uint8_t c = s[i];
+        len++;
+        if (c < 0xc0) {
+            i++;
+        } else if (c < 0xe0) {
+            i += 2;
+        } else if (c < 0xf0) {
+            i += 3;
+        } else {
+            char32_t w = ((c & 0x07) << 18) | ((s[i + 1] & 0x3f) << 12) |
+                         ((s[i + 2] & 0x3f) << 6) | (s[i + 3] & 0x3f);
+            if (w >= 0x10000) len++;
+            i += 4;
+        }
+    }
+    return i == size ? (ssize_t)len : -1;
+}
+
+TEST_F(UnicodeTest, UTF8toUTF16LengthInvalidAtBlockBoundaries) {
+    static const std::string kInvalid[] = {
+        "\x80",              // stray continuation byte
+        "\xc4\x41",          // invalid trailing byte
+        "\xe2\x8c\x41",      // invalid trailing byte
+        "\xe2\x41\xa3",      // invalid trailing byte
+        "\xf8\x80\x80\x80",  // invalid leading byte
+        "\xc4",              // truncated
+        "\xe2\x8c",          // truncated
+    };
+    for (const std::string& invalid : kInvalid) {
+        for (size_t len = 0; len < 80; len++) {
+            for (size_t pos = 0; pos <= len; pos++) {
+                std::string s(len, 'a');
+                s.insert(pos, invalid);
+                // Any overread of a truncated sequence stays within the padding.
+                std::string padded = s + std::string(4, '\0');
+                const uint8_t* u8 = reinterpret_cast<const uint8_t*>(padded.data());
+                ASSERT_EQ(ExpectedUtf8ToUtf16Length(u8, s.size()),
+                          utf8_to_utf16_length(u8, s.size()))
+                        << "len " << len << " pos " << pos;
+            }
+        }
+    }
+}
+
+TEST_F(UnicodeTest, UTF16toUTF8UnpairedSurrogateAtBlockBoundaries) {
+    static const char16_t kSurrogates[] = {0xd800, 0xdc00, 0xdbff, 0xdfff};
+    for (char16_t surrogate : kSurrogates) {
+        for (size_t len = 1; len < 80; len++) {
+            for (size_t pos = 0; pos < len; pos++) {
+                // Half of the text is non-ASCII so that the vector code
+                // handles a mix of one, two and three byte sequences.
+                std::u16string utf16;
+                std::string expected;
+                for (size_t i = 0; i < len; i++) {
+                    char16_t c = (i % 2) ? u'a' : (char16_t)(0x100 << (i % 6));
+                    if (i == pos) {
+                        utf16 += surrogate;
+                    } else {
+                        utf16 += c;
+                        AppendUtf8(&expected, c);
+                    }
+                }
+                ASSERT_EQ((ssize_t)expected.size(), utf16_to_utf8_length(utf16.data(), len))
+                        << "len " << len << " pos " << pos;
+                std::vector<char> out8(expected.size() + 1, '\xff');
+                utf16_to_utf8(utf16.data(), len, out8.data(), out8.size());
+                ASSERT_EQ(expected, std::string(out8.data(), expected.size()));
+            }
+        }
+    }
+}
+
 }
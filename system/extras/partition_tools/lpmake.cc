@@ -25,6 +25,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <thread>
 
 #include <android-base/parseint.h>
 #include <android-base/result.h>
@@ -85,6 +86,9 @@ static int usage(int /* argc */, char* argv[]) {
             "                                house the super partition.\n"
             "  -x,--auto-slot-suffixing      Mark the block device and partition names needing\n"
             "                                slot suffixes before being used.\n"
+            "  -j,--jobs=N                   Number of partition images to read at once when\n"
+            "                                building an image. 0 uses one per CPU. Defaults\n"
+            "                                to 1.\n"
             "  -F,--force-full-image         Force a full image to be written even if no\n"
             "                                partition images were specified. Normally, this\n"
             "                                would produce a minimal super_empty.img which\n"
@@ -129,6 +133,7 @@ enum class Option : int {
     kSuperName = 'n',
     kAutoSlotSuffixing = 'x',
     kForceFullImage = 'F',
+    kJobs = 'j',
 };
 
 struct PartitionInfo {
@@ -231,6 +236,7 @@ int main(int argc, char* argv[]) {
         { "auto-slot-suffixing", no_argument, nullptr, (int)Option::kAutoSlotSuffixing },
         { "force-full-image", no_argument, nullptr, (int)Option::kForceFullImage },
         { "virtual-ab", no_argument, nullptr, (int)Option::kVirtualAB },
+        { "jobs", required_argument, nullptr, (int)Option::kJobs },
         { nullptr, 0, nullptr, 0 },
     };
 
@@ -252,10 +258,11 @@ int main(int argc, char* argv[]) {
     bool force_full_image = false;
     bool virtual_ab = false;
     bool auto_blockdevice_size = false;
+    uint32_t jobs = 1;
 
     int rv;
     int index;
-    while ((rv = getopt_long_only(argc, argv, "d:m:s:p:o:h:FSx", options, &index)) != -1) {
+    while ((rv = getopt_long_only(argc, argv, "d:m:s:p:o:h:FSxj:", options, &index)) != -1) {
         switch ((Option)rv) {
             case Option::kHelp:
                 return usage(argc, argv);
@@ -372,6 +379,15 @@ int main(int argc, char* argv[]) {
             case Option::kVirtualAB:
                 virtual_ab = true;
                 break;
+            case Option::kJobs:
+                if (!android::base::ParseUint(optarg, &jobs)) {
+                    fprintf(stderr, "Invalid argument to --jobs.\n");
+                    return EX_USAGE;
+                }
+                if (!jobs) {
+                    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+                }
+                break;
             default:
                 break;
         }
@@ -493,12 +509,12 @@ int main(int argc, char* argv[]) {
     if (!images.empty() || force_full_image) {
         if (block_devices.size() == 1) {
             if (!WriteToImageFile(output_path.c_str(), *metadata.get(), block_size, images,
-                                  output_sparse)) {
+                                  output_sparse, jobs)) {
                 return EX_CANTCREAT;
             }
         } else {
             if (!WriteSplitImageFiles(output_path, *metadata.get(), block_size, images,
-                                      output_sparse)) {
+                                      output_sparse, jobs)) {
                 return EX_CANTCREAT;
             }
         }
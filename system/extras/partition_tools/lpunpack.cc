@@ -17,15 +17,24 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdio.h>
+#include <string.h>
 #include <sysexits.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/parseint.h>
@@ -37,10 +46,14 @@ using android::base::unique_fd;
 using android::base::borrowed_fd;
 using SparsePtr = std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)>;
 
+// Extents are read this much at a time.
+static constexpr size_t kReadChunkSize = 1024 * 1024;
+
 class ImageExtractor final {
   public:
     ImageExtractor(std::vector<unique_fd>&& image_fds, std::unique_ptr<LpMetadata>&& metadata,
-                   std::unordered_set<std::string>&& partitions, const std::string& output_dir);
+                   std::unordered_set<std::string>&& partitions, const std::string& output_dir,
+                   uint32_t max_jobs);
 
     bool Extract();
 
@@ -48,16 +61,24 @@ class ImageExtractor final {
     bool BuildPartitionList();
     bool ExtractPartition(const LpMetadataPartition* partition);
     bool ExtractExtent(const LpMetadataExtent& extent, int output_fd);
+    void Print(const std::string& message);
 
     std::vector<unique_fd> image_fds_;
     std::unique_ptr<LpMetadata> metadata_;
     std::unordered_set<std::string> partitions_;
     std::string output_dir_;
+    uint32_t max_jobs_;
     std::unordered_map<std::string, const LpMetadataPartition*> partition_map_;
+    std::mutex output_lock_;
 };
 
 // Note that "sparse" here refers to filesystem sparse, not the Android sparse
 // file format.
+//
+// Blocks of zeroes are left as holes in the output. Other blocks are copied
+// with copy_file_range where possible, so that the file system can share them
+// with the super image rather than duplicate them. The image is only read with
+// pread, so several writers can share an image fd.
 class SparseWriter final {
   public:
     SparseWriter(borrowed_fd output_fd, uint32_t block_size);
@@ -66,11 +87,16 @@ class SparseWriter final {
     bool Finish();
 
   private:
-    bool WriteBlock(const uint8_t* data);
+    bool WriteData(borrowed_fd image_fd, uint64_t image_offset, const uint8_t* data,
+                   size_t length);
 
     borrowed_fd output_fd_;
     uint32_t block_size_;
-    off_t hole_size_ = 0;
+    uint64_t output_offset_ = 0;
+    std::vector<uint8_t> buffer_;
+#if defined(__linux__)
+    bool copy_file_range_ok_ = true;
+#endif
 };
 
 /* Prints program usage to |where|. */
@@ -91,7 +117,9 @@ static int usage(int /* argc */, char* argv[]) {
             "                           This can be specified multiple times.\n"
             "  -p, --partition=NAME     Extract the named partition. This can\n"
             "                           be specified multiple times.\n"
-            "  -S, --slot=NUM           Slot number (default is 0).\n",
+            "  -S, --slot=NUM           Slot number (default is 0).\n"
+            "  -j, --jobs=N             Number of partitions to extract at once. 0 uses\n"
+            "                           one per CPU (default is 1).\n",
             argv[0], argv[0]);
     return EX_USAGE;
 }
@@ -102,16 +130,18 @@ int main(int argc, char* argv[]) {
         { "image",      required_argument,  nullptr, 'i' },
         { "partition",  required_argument,  nullptr, 'p' },
         { "slot",       required_argument,  nullptr, 'S' },
+        { "jobs",       required_argument,  nullptr, 'j' },
         { nullptr,      0,                  nullptr, 0 },
     };
     // clang-format on
 
     uint32_t slot_num = 0;
+    uint32_t jobs = 1;
     std::unordered_set<std::string> partitions;
     std::vector<std::string> image_files;
 
     int rv, index;
-    while ((rv = getopt_long_only(argc, argv, "+p:sh", options, &index)) != -1) {
+    while ((rv = getopt_long_only(argc, argv, "+p:shj:", options, &index)) != -1) {
         switch (rv) {
             case 'h':
                 usage(argc, argv);
@@ -125,6 +155,15 @@ int main(int argc, char* argv[]) {
                     return usage(argc, argv);
                 }
                 break;
+            case 'j':
+                if (!android::base::ParseUint(optarg, &jobs)) {
+                    std::cerr << "Jobs must be a valid unsigned number.\n";
+                    return usage(argc, argv);
+                }
+                if (!jobs) {
+                    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+                }
+                break;
             case 'i':
                 image_files.push_back(optarg);
                 break;
@@ -187,7 +226,8 @@ int main(int argc, char* argv[]) {
     }
 
     // Now do actual extraction.
-    ImageExtractor extractor(std::move(fds), std::move(metadata), std::move(partitions), output_dir);
+    ImageExtractor extractor(std::move(fds), std::move(metadata), std::move(partitions), output_dir,
+                             jobs);
     if (!extractor.Extract()) {
         return EX_SOFTWARE;
     }
@@ -196,24 +236,51 @@ int main(int argc, char* argv[]) {
 
 ImageExtractor::ImageExtractor(std::vector<unique_fd>&& image_fds, std::unique_ptr<LpMetadata>&& metadata,
                                std::unordered_set<std::string>&& partitions,
-                               const std::string& output_dir)
+                               const std::string& output_dir, uint32_t max_jobs)
     : image_fds_(std::move(image_fds)),
       metadata_(std::move(metadata)),
       partitions_(std::move(partitions)),
-      output_dir_(output_dir) {}
+      output_dir_(output_dir),
+      max_jobs_(std::max(max_jobs, 1u)) {}
 
 bool ImageExtractor::Extract() {
     if (!BuildPartitionList()) {
         return false;
     }
 
-    for (const auto& [name, info] : partition_map_) {
-        std::cout << "Attempting to extract partition '" << name << "'...\n";
-        if (!ExtractPartition(info)) {
-            return false;
+    std::vector<std::pair<std::string, const LpMetadataPartition*>> work(partition_map_.begin(),
+                                                                         partition_map_.end());
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> ok = true;
+    auto worker = [&]() {
+        while (ok) {
+            size_t i = next++;
+            if (i >= work.size()) {
+                break;
+            }
+            const auto& [name, info] = work[i];
+            Print("Attempting to extract partition '" + name + "'...\n");
+            if (!ExtractPartition(info)) {
+                ok = false;
+            }
         }
+    };
+
+    size_t num_threads = std::min<size_t>(max_jobs_, work.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
     }
-    return true;
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
+
+void ImageExtractor::Print(const std::string& message) {
+    std::lock_guard<std::mutex> lock(output_lock_);
+    std::cout << message;
 }
 
 bool ImageExtractor::BuildPartitionList() {
@@ -240,7 +307,8 @@ bool ImageExtractor::ExtractPartition(const LpMetadataPartition* partition) {
     for (uint32_t i = 0; i < partition->num_extents; i++) {
         uint32_t index = partition->first_extent_index + i;
         const LpMetadataExtent& extent = metadata_->extents[index];
-        std::cout << "  Dealing with extent " << i << " from target source " << extent.target_source << "...\n";
+        Print("  Dealing with extent " + std::to_string(i) + " from target source " +
+              std::to_string(extent.target_source) + "...\n");
 
         if (extent.target_type != LP_TARGET_TYPE_LINEAR) {
             std::cerr << "Unsupported target type in extent: " << extent.target_type << "\n";
@@ -278,56 +346,97 @@ bool ImageExtractor::ExtractPartition(const LpMetadataPartition* partition) {
 SparseWriter::SparseWriter(borrowed_fd output_fd, uint32_t block_size)
     : output_fd_(output_fd), block_size_(block_size) {}
 
-bool SparseWriter::WriteExtent(borrowed_fd image_fd, const LpMetadataExtent& extent) {
-    auto buffer = std::make_unique<uint8_t[]>(block_size_);
+static bool IsZeroBlock(const uint8_t* data, size_t len) {
+    // memcmp is vectorized, unlike a loop over the bytes.
+    return data[0] == 0 && memcmp(data, data + 1, len - 1) == 0;
+}
 
-    off_t super_offset = extent.target_data * LP_SECTOR_SIZE;
-    if (lseek(image_fd.get(), super_offset, SEEK_SET) < 0) {
-        std::cerr << "image lseek failed: " << strerror(errno) << "\n";
+bool SparseWriter::WriteExtent(borrowed_fd image_fd, const LpMetadataExtent& extent) {
+    uint64_t image_offset = extent.target_data * LP_SECTOR_SIZE;
+    uint64_t remaining_bytes = extent.num_sectors * LP_SECTOR_SIZE;
+    if (remaining_bytes % block_size_) {
+        std::cerr << "extent is not block-aligned\n";
         return false;
     }
 
-    uint64_t remaining_bytes = extent.num_sectors * LP_SECTOR_SIZE;
+    size_t chunk_size = kReadChunkSize - kReadChunkSize % block_size_;
+    buffer_.resize(std::max<size_t>(chunk_size, block_size_));
+
     while (remaining_bytes) {
-        if (remaining_bytes < block_size_) {
-            std::cerr << "extent is not block-aligned\n";
-            return false;
+#if defined(SEEK_DATA)
+        // Holes in the super image are zeroes; skip them without reading.
+        off_t data = lseek(image_fd.get(), image_offset, SEEK_DATA);
+        if (data < 0 && errno == ENXIO) {
+            data = image_offset + remaining_bytes;
         }
-        if (!android::base::ReadFully(image_fd, buffer.get(), block_size_)) {
-            std::cerr << "read failed: " << strerror(errno) << "\n";
-            return false;
+        if (data > static_cast<off_t>(image_offset)) {
+            uint64_t skip = std::min<uint64_t>(data - image_offset, remaining_bytes);
+            skip -= skip % block_size_;
+            image_offset += skip;
+            output_offset_ += skip;
+            remaining_bytes -= skip;
+            if (!remaining_bytes) {
+                break;
+            }
         }
-        if (!WriteBlock(buffer.get())) {
+#endif
+
+        size_t size = std::min<uint64_t>(remaining_bytes, buffer_.size());
+        if (!android::base::ReadFullyAtOffset(image_fd, buffer_.data(), size, image_offset)) {
+            std::cerr << "read failed: " << strerror(errno) << "\n";
             return false;
         }
-        remaining_bytes -= block_size_;
-    }
-    return true;
-}
 
-static bool ShouldSkipChunk(const uint8_t* data, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        if (data[i] != 0) {
-            return false;
+        // Write each run of non-zero blocks at once.
+        size_t run_start = 0;
+        for (size_t pos = 0; pos <= size; pos += block_size_) {
+            if (pos < size && !IsZeroBlock(buffer_.data() + pos, block_size_)) {
+                continue;
+            }
+            if (pos > run_start &&
+                !WriteData(image_fd, image_offset + run_start, buffer_.data() + run_start,
+                           pos - run_start)) {
+                return false;
+            }
+            output_offset_ += pos - run_start;
+            if (pos < size) {
+                output_offset_ += block_size_;
+            }
+            run_start = pos + block_size_;
         }
+
+        image_offset += size;
+        remaining_bytes -= size;
     }
     return true;
 }
 
-bool SparseWriter::WriteBlock(const uint8_t* data) {
-    if (ShouldSkipChunk(data, block_size_)) {
-        hole_size_ += block_size_;
-        return true;
-    }
-
-    if (hole_size_) {
-        if (lseek(output_fd_.get(), hole_size_, SEEK_CUR) < 0) {
-            std::cerr << "lseek failed: " << strerror(errno) << "\n";
-            return false;
+// |data| holds the |length| bytes at |image_offset| in the image, to write at
+// the current output offset.
+bool SparseWriter::WriteData(borrowed_fd image_fd, uint64_t image_offset, const uint8_t* data,
+                             size_t length) {
+    uint64_t output_offset = output_offset_;
+#if defined(__linux__) && defined(__NR_copy_file_range)
+    while (copy_file_range_ok_ && length) {
+        loff_t in = image_offset;
+        loff_t out = output_offset;
+        ssize_t rv = syscall(__NR_copy_file_range, image_fd.get(), &in, output_fd_.get(), &out,
+                             length, 0);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            // e.g. EXDEV or ENOSYS; don't try again for this output.
+            copy_file_range_ok_ = false;
+            break;
         }
-        hole_size_ = 0;
+        image_offset += rv;
+        output_offset += rv;
+        data += rv;
+        length -= rv;
     }
-    if (!android::base::WriteFully(output_fd_, data, block_size_)) {
+#endif
+    if (length && !android::base::WriteFullyAtOffset(output_fd_, data, length, output_offset)) {
         std::cerr << "write failed: " << strerror(errno) << "\n";
         return false;
     }
@@ -335,16 +444,10 @@ bool SparseWriter::WriteBlock(const uint8_t* data) {
 }
 
 bool SparseWriter::Finish() {
-    if (hole_size_) {
-        off_t offset = lseek(output_fd_.get(), 0, SEEK_CUR);
-        if (offset < 0) {
-            std::cerr << "lseek failed: " << strerror(errno) << "\n";
-            return false;
-        }
-        if (ftruncate(output_fd_.get(), offset + hole_size_) < 0) {
-            std::cerr << "ftruncate failed: " << strerror(errno) << "\n";
-            return false;
-        }
+    // Extend the file over any trailing holes.
+    if (ftruncate(output_fd_.get(), output_offset_) < 0) {
+        std::cerr << "ftruncate failed: " << strerror(errno) << "\n";
+        return false;
     }
     return true;
 }
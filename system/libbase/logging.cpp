@@ -32,12 +32,14 @@
 #include <errno.h>
 #endif
 
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <sstream>
+#include <streambuf>
 #include <string>
 #include <utility>
 #include <vector>
@@ -186,17 +188,101 @@ static int32_t LogSeverityToPriority(LogSeverity severity) {
   }
 }
 
-static LogFunction& Logger() {
+// The logger and aborter are called for every message, from any thread, but
+// are rarely replaced. Callers count themselves in and load the current
+// function without taking a lock. A replaced function is freed as soon as no
+// call is in progress: straight away by Exchange() if it can, otherwise by the
+// next Exchange() or by the last call to finish. Nothing here locks, so a child
+// forked mid-replacement can still set its own logger.
+template <typename F>
+class ReadMostlyFunction {
+ public:
+  explicit ReadMostlyFunction(F&& function) : current_(new Node{std::move(function), nullptr}) {}
+
+  template <typename... Args>
+  void Call(Args&&... args) {
+    CallGuard guard(this);
+    current_.load()->function(std::forward<Args>(args)...);
+  }
+
+  F Exchange(F&& function) {
+    Node* old = current_.exchange(new Node{std::move(function), nullptr});
+    if (calls_.load() == 0) {
+      // Nobody can still be running |old|, so it can be moved out and freed.
+      F result = std::move(old->function);
+      delete old;
+      Reclaim();
+      return result;
+    }
+    // Another thread may be running |old|: hand back a copy, and leave the
+    // original to be freed once that call is done.
+    F result = old->function;
+    Retire(old, old);
+    Reclaim();
+    return result;
+  }
+
+ private:
+  struct Node {
+    F function;
+    Node* next;
+  };
+
+  class CallGuard {
+   public:
+    explicit CallGuard(ReadMostlyFunction* owner) : owner_(owner) { owner_->calls_++; }
+    ~CallGuard() {
+      if (--owner_->calls_ == 0 && owner_->retired_.load() != nullptr) owner_->Reclaim();
+    }
+
+   private:
+    ReadMostlyFunction* owner_;
+  };
+
+  // Adds the list from |head| to |tail| to the replaced functions to free.
+  void Retire(Node* head, Node* tail) {
+    tail->next = retired_.load();
+    while (!retired_.compare_exchange_weak(tail->next, head)) {
+    }
+  }
+
+  // Frees the replaced functions if no call is in progress. Any call that
+  // could have loaded one of them started before it was retired, so if none
+  // is in progress after taking the list, none of them can still be running.
+  void Reclaim() {
+    Node* head = retired_.exchange(nullptr);
+    if (head == nullptr) return;
+    if (calls_.load() != 0) {
+      Node* tail = head;
+      while (tail->next != nullptr) tail = tail->next;
+      Retire(head, tail);
+      return;
+    }
+    while (head != nullptr) {
+      Node* next = head->next;
+      delete head;
+      head = next;
+    }
+  }
+
+  std::atomic<Node*> current_;
+  std::atomic<Node*> retired_ = nullptr;
+  std::atomic<size_t> calls_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(ReadMostlyFunction);
+};
+
+static ReadMostlyFunction<LogFunction>& Logger() {
 #ifdef __ANDROID__
-  static auto& logger = *new LogFunction(LogdLogger());
+  static auto& logger = *new ReadMostlyFunction<LogFunction>(LogdLogger());
 #else
-  static auto& logger = *new LogFunction(StderrLogger);
+  static auto& logger = *new ReadMostlyFunction<LogFunction>(StderrLogger);
 #endif
   return logger;
 }
 
-static AbortFunction& Aborter() {
-  static auto& aborter = *new AbortFunction(DefaultAborter);
+static ReadMostlyFunction<AbortFunction>& Aborter() {
+  static auto& aborter = *new ReadMostlyFunction<AbortFunction>(DefaultAborter);
   return aborter;
 }
 
@@ -391,43 +477,118 @@ void InitLogging(char* argv[], LogFunction&& logger, AbortFunction&& aborter) {
 }
 
 LogFunction SetLogger(LogFunction&& logger) {
-  LogFunction old_logger = std::move(Logger());
-  Logger() = std::move(logger);
+  LogFunction old_logger = Logger().Exchange(std::move(logger));
 
 //  if (__builtin_available(android 30, *)) {
     __android_log_set_logger([](const struct __android_log_message* log_message) {
       auto log_id = log_id_tToLogId(log_message->buffer_id);
       auto severity = PriorityToLogSeverity(log_message->priority);
 
-      Logger()(log_id, severity, log_message->tag, log_message->file, log_message->line,
-               log_message->message);
+      Logger().Call(log_id, severity, log_message->tag, log_message->file, log_message->line,
+                    log_message->message);
     });
 //  }
   return old_logger;
 }
 
 AbortFunction SetAborter(AbortFunction&& aborter) {
-  AbortFunction old_aborter = std::move(Aborter());
-  Aborter() = std::move(aborter);
+  AbortFunction old_aborter = Aborter().Exchange(std::move(aborter));
 
 //  if (__builtin_available(android 30, *)) {
-    __android_log_set_aborter([](const char* abort_message) { Aborter()(abort_message); });
+    __android_log_set_aborter([](const char* abort_message) { Aborter().Call(abort_message); });
 //  }
   return old_aborter;
 }
 
+// The text of a log message, written straight into a string which is kept
+// from one message to the next.
+class LogMessageBuffer : private std::streambuf {
+ public:
+  LogMessageBuffer() : stream_(this) {}
+
+  std::ostream& GetStream() {
+    return stream_;
+  }
+
+  // Returns the message so far as a C string.
+  const char* c_str() {
+    sputc('\0');
+    pbump(-1);
+    return pbase();
+  }
+
+  // Empties the buffer and undoes any formatting changes made through the
+  // stream, ready for the next message.
+  void Reset() {
+    if (buffer_.size() > kMaxRetainedSize) {
+      std::string().swap(buffer_);
+    }
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    stream_.clear();
+    stream_.flags(std::ios_base::skipws | std::ios_base::dec);
+    stream_.precision(6);
+    stream_.width(0);
+    stream_.fill(' ');
+  }
+
+ private:
+  // Don't hold on to the memory for the odd huge message.
+  static constexpr size_t kMaxRetainedSize = 64 * 1024;
+
+  int_type overflow(int_type ch) override {
+    size_t used = pptr() - pbase();
+    buffer_.resize(std::max<size_t>(256, buffer_.size() * 2));
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    pbump(static_cast<int>(used));
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+      return traits_type::not_eof(ch);
+    }
+    return sputc(traits_type::to_char_type(ch));
+  }
+
+  std::string buffer_;
+  std::ostream stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogMessageBuffer);
+};
+
+// Each thread reuses the buffer of its last message, which saves setting up a
+// stream and growing a string for every message. A message logged while
+// another is being formatted or logged on the same thread gets a new buffer.
+static thread_local std::unique_ptr<LogMessageBuffer> gCachedLogMessageBuffer;
+
+static std::unique_ptr<LogMessageBuffer> TakeLogMessageBuffer() {
+  std::unique_ptr<LogMessageBuffer> buffer = std::move(gCachedLogMessageBuffer);
+  if (buffer == nullptr) {
+    buffer.reset(new LogMessageBuffer());
+  }
+  return buffer;
+}
+
+static void ReturnLogMessageBuffer(std::unique_ptr<LogMessageBuffer> buffer) {
+  if (gCachedLogMessageBuffer == nullptr) {
+    buffer->Reset();
+    gCachedLogMessageBuffer = std::move(buffer);
+  }
+}
+
 // This indirection greatly reduces the stack impact of having lots of
 // checks/logging in a function.
 class LogMessageData {
  public:
   LogMessageData(const char* file, unsigned int line, LogSeverity severity, const char* tag,
                  int error)
-      : file_(GetFileBasename(file)),
+      : buffer_(TakeLogMessageBuffer()),
+        file_(GetFileBasename(file)),
         line_number_(line),
         severity_(severity),
         tag_(tag),
         error_(error) {}
 
+  ~LogMessageData() {
+    ReturnLogMessageBuffer(std::move(buffer_));
+  }
+
   const char* GetFile() const {
     return file_;
   }
@@ -447,15 +608,15 @@ class LogMessageData {
   }
 
   std::ostream& GetBuffer() {
-    return buffer_;
+    return buffer_->GetStream();
   }
 
-  std::string ToString() const {
-    return buffer_.str();
+  const char* GetMessage() {
+    return buffer_->c_str();
   }
 
  private:
-  std::ostringstream buffer_;
+  std::unique_ptr<LogMessageBuffer> buffer_;
   const char* const file_;
   const unsigned int line_number_;
   const LogSeverity severity_;
@@ -483,26 +644,25 @@ LogMessage::~LogMessage() {
   if (data_->GetError() != -1) {
     data_->GetBuffer() << ": " << strerror(data_->GetError());
   }
-  std::string msg(data_->ToString());
+  const char* msg = data_->GetMessage();
 
   if (data_->GetSeverity() == FATAL) {
 #ifdef __ANDROID__
     // Set the bionic abort message early to avoid liblog doing it
     // with the individual lines, so that we get the whole message.
-    android_set_abort_message(msg.c_str());
+    android_set_abort_message(msg);
 #endif
   }
 
-  LogLine(data_->GetFile(), data_->GetLineNumber(), data_->GetSeverity(), data_->GetTag(),
-          msg.c_str());
+  LogLine(data_->GetFile(), data_->GetLineNumber(), data_->GetSeverity(), data_->GetTag(), msg);
 
   // Abort if necessary.
   if (data_->GetSeverity() == FATAL) {
 //    if (__builtin_available(android 30, *)) {
-      __android_log_call_aborter(msg.c_str());
+      __android_log_call_aborter(msg);
 #if 0
     } else {
-      Aborter()(msg.c_str());
+      Aborter().Call(msg);
     }
 #endif
   }
@@ -527,9 +687,9 @@ void LogMessage::LogLine(const char* file, unsigned int line, LogSeverity severi
         gDefaultTag = new std::string(getprogname());
       }
 
-      Logger()(DEFAULT, severity, gDefaultTag->c_str(), file, line, message);
+      Logger().Call(DEFAULT, severity, gDefaultTag->c_str(), file, line, message);
     } else {
-      Logger()(DEFAULT, severity, tag, file, line, message);
+      Logger().Call(DEFAULT, severity, tag, file, line, message);
     }
   }
 #endif
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/logging.h"
+
+#include <errno.h>
+
+#include <atomic>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+using android::base::LogId;
+using android::base::LogSeverity;
+
+// Counts the messages instead of writing them out, so that the benchmarks
+// measure the cost of LOG itself rather than that of stderr or logd.
+static std::atomic<size_t> gMessageCount;
+
+static void CountingLogger(LogId, LogSeverity, const char*, const char*, unsigned int,
+                           const char*) {
+  gMessageCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void InstallCountingLogger() {
+  static const bool installed = [] {
+    android::base::SetLogger(CountingLogger);
+    android::base::SetMinimumLogSeverity(android::base::INFO);
+    return true;
+  }();
+  UNUSED(installed);
+}
+
+// LOG(INFO) from several threads at once, the way adb and fastboot log.
+static void BenchmarkLogInfo(benchmark::State& state) {
+  InstallCountingLogger();
+  int i = 0;
+  for (auto _ : state) {
+    LOG(INFO) << "thread " << state.thread_index() << " message " << i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkLogInfo)->ThreadRange(1, 8)->UseRealTime();
+
+// A LOG(INFO) which formats a longer message, checking the buffer is reused.
+static void BenchmarkLogInfoLong(benchmark::State& state) {
+  InstallCountingLogger();
+  std::string payload(512, 'x');
+  for (auto _ : state) {
+    LOG(INFO) << "payload: " << payload << " (" << payload.size() << " bytes)";
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkLogInfoLong)->ThreadRange(1, 8)->UseRealTime();
+
+// PLOG appends strerror() to the message.
+static void BenchmarkPLogError(benchmark::State& state) {
+  InstallCountingLogger();
+  for (auto _ : state) {
+    errno = ENOENT;
+    PLOG(ERROR) << "open failed";
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkPLogError);
+
+// The cost of logging that is compiled in but disabled, as for verbose
+// logging in release builds.
+static void BenchmarkLogVerboseDisabled(benchmark::State& state) {
+  InstallCountingLogger();
+  int i = 0;
+  for (auto _ : state) {
+    LOG(VERBOSE) << "message " << i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkLogVerboseDisabled)->ThreadRange(1, 8)->UseRealTime();
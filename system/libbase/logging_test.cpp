@@ -22,10 +22,13 @@
 #include <signal.h>
 #endif
 
+#include <atomic>
+#include <iomanip>
 #include <memory>
 #include <regex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "android-base/file.h"
 #include "android-base/scopeguard.h"
@@ -657,6 +660,101 @@ TEST(logging, SetLoggerReturnsOldFunction) {
   EXPECT_TRUE(old_function);
 }
 
+static std::vector<std::string>* gLoggedMessages;
+
+static void RecordingLogger(android::base::LogId, android::base::LogSeverity, const char*,
+                            const char*, unsigned int, const char* message) {
+  gLoggedMessages->push_back(message);
+}
+
+struct LogsWhenPrinted {};
+
+static std::ostream& operator<<(std::ostream& os, const LogsWhenPrinted&) {
+  LOG(ERROR) << "inner";
+  return os << "outer";
+}
+
+TEST(logging, MessagesDoNotShareState) {
+  std::vector<std::string> messages;
+  gLoggedMessages = &messages;
+  auto old_logger = android::base::SetLogger(RecordingLogger);
+  auto guard = android::base::make_scope_guard([&] {
+    android::base::SetLogger(std::move(old_logger));
+    gLoggedMessages = nullptr;
+  });
+
+  // Formatting changes made by one message don't apply to the next.
+  LOG(ERROR) << std::hex << std::setfill('0') << std::setw(4) << 255 << std::boolalpha << true;
+  LOG(ERROR) << 255 << " " << true;
+  // A message logged while formatting another one doesn't clobber it.
+  LOG(ERROR) << "before " << LogsWhenPrinted() << " after";
+  // Nor does a long message carry over into a short one.
+  LOG(ERROR) << std::string(100000, 'x');
+  LOG(ERROR) << "short";
+
+  ASSERT_EQ(6U, messages.size());
+  EXPECT_EQ("00fftrue", messages[0]);
+  EXPECT_EQ("255 1", messages[1]);
+  EXPECT_EQ("inner", messages[2]);
+  EXPECT_EQ("before outer after", messages[3]);
+  EXPECT_EQ(std::string(100000, 'x'), messages[4]);
+  EXPECT_EQ("short", messages[5]);
+}
+
+static std::atomic<size_t> gCountedMessages;
+
+static void CountingLogger(android::base::LogId, android::base::LogSeverity, const char*,
+                           const char*, unsigned int, const char*) {
+  gCountedMessages++;
+}
+
+TEST(logging, SetLoggerWhileLogging) {
+  auto old_logger = android::base::SetLogger(CountingLogger);
+  auto guard = android::base::make_scope_guard(
+      [&] { android::base::SetLogger(std::move(old_logger)); });
+
+  gCountedMessages = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([i] {
+      for (int j = 0; j < 1000; ++j) {
+        LOG(ERROR) << "thread " << i << " message " << j;
+      }
+    });
+  }
+  for (int i = 0; i < 100; ++i) {
+    android::base::SetLogger(CountingLogger);
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(4000U, gCountedMessages);
+}
+
+TEST(logging, SetLoggerFreesReplacedLogger) {
+  auto old_logger = android::base::SetLogger(CountingLogger);
+  auto guard = android::base::make_scope_guard(
+      [&] { android::base::SetLogger(std::move(old_logger)); });
+
+  // Replacing an idle logger hands back the logger itself, not a copy.
+  auto state = std::make_shared<int>();
+  std::weak_ptr<int> weak_state = state;
+  android::base::SetLogger([state = std::move(state)](android::base::LogId,
+                                                      android::base::LogSeverity, const char*,
+                                                      const char*, unsigned int, const char*) {});
+  android::base::SetLogger(CountingLogger);
+  EXPECT_TRUE(weak_state.expired());
+
+  // A logger replaced while it is running is freed once it returns.
+  state = std::make_shared<int>();
+  weak_state = state;
+  android::base::SetLogger([state = std::move(state)](android::base::LogId,
+                                                      android::base::LogSeverity, const char*,
+                                                      const char*, unsigned int, const char*) {
+    android::base::SetLogger(CountingLogger);
+  });
+  LOG(ERROR) << "replace yourself";
+  EXPECT_TRUE(weak_state.expired());
+}
+
 TEST(logging, ForkSafe) {
 #if !defined(_WIN32)
   using namespace android::base;
@@ -29,6 +29,7 @@
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include "android-base/macros.h"
 #include "android-base/off64_t.h"
@@ -386,6 +387,43 @@ class Reader : public LowLevelReader {
 int32_t ExtractToWriter(ZipArchiveHandle handle, const ZipEntry64* entry,
                         zip_archive::Writer* writer);
 
+/**
+ * Supplies the Writers that ExtractEntries() sends each entry's data to.
+ * Both methods are called from the extracting threads, so they must be safe
+ * to call concurrently (for different |index| values).
+ */
+class WriterFactory {
+ public:
+  // Returns the writer for entry |index| of the batch, or nullptr to fail
+  // that entry with kIoError.
+  virtual Writer* CreateWriter(size_t index, const ZipEntry64& entry) = 0;
+
+  // Called with every writer returned by CreateWriter() once its entry has
+  // been extracted, with |error| 0 on success or the negative error code.
+  virtual void ReleaseWriter(size_t index, Writer* writer, int32_t error) = 0;
+
+ protected:
+  WriterFactory() = default;
+  ~WriterFactory() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(WriterFactory);
+};
+
+/**
+ * Uncompress each of |entries| to a writer from |factory|, using |threads|
+ * threads (0 for one per CPU) that read the archive concurrently. The calling
+ * thread is one of them. Larger entries are started first; there is no
+ * ordering between entries otherwise.
+ *
+ * Once an entry fails no more entries are started, so the factory may not
+ * see every index.
+ *
+ * Returns 0 on success, or the error of the lowest-indexed entry that failed.
+ */
+int32_t ExtractEntries(ZipArchiveHandle handle, const std::vector<ZipEntry64>& entries,
+                       WriterFactory* factory, size_t threads);
+
 #endif  // !ZIPARCHIVE_DISABLE_CALLBACK_API
 
 /*
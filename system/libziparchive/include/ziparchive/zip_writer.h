@@ -51,6 +51,8 @@ typedef struct z_stream_s z_stream;
  *   writer.Finish();
  *
  *   fclose(file);
+ *
+ * To compress on several threads, call EnableParallelCompression() before the first entry.
  */
 class ZipWriter {
  public:
@@ -103,6 +105,20 @@ class ZipWriter {
   // Move assignment.
   ZipWriter& operator=(ZipWriter&& zipWriter) noexcept;
 
+  ~ZipWriter();
+
+  /**
+   * Compresses entries on `threads` worker threads instead of the calling thread. Entries are
+   * still written in order and aligned as requested, but WriteBytes() and FinishEntry() may
+   * return before their data has been compressed or written; GetLastEntry(),
+   * DiscardLastEntry() and Finish() wait for it, and any error is reported by a later call.
+   * Large entries are split into blocks that are deflated separately, so the compressed data
+   * differs from, and is slightly larger than, that written by a serial ZipWriter.
+   * Must be called before the first entry is started.
+   * Returns 0 on success, and an error value < 0 on failure.
+   */
+  int32_t EnableParallelCompression(size_t threads);
+
   /**
    * Starts a new zip entry with the given path and flags.
    * Flags can be a bitwise OR of ZipWriter::kCompress and ZipWriter::kAlign.
@@ -167,8 +183,14 @@ class ZipWriter {
  private:
   DISALLOW_COPY_AND_ASSIGN(ZipWriter);
 
+  class Pipeline;
+
   int32_t HandleError(int32_t error_code);
   int32_t PrepareDeflate(int compression_level);
+  int32_t WriteLocalFileHeader(FileEntry* file, uint32_t alignment);
+  int32_t WriteEntryTrailer(FileEntry* file);
+  int32_t QueueBlock(bool last);
+  int32_t WritePendingOutput(bool wait_for_all);
   int32_t StoreBytes(FileEntry* file, const void* data, uint32_t len);
   int32_t CompressBytes(FileEntry* file, const void* data, uint32_t len);
   int32_t FlushCompressedBytes(FileEntry* file);
@@ -191,5 +213,8 @@ class ZipWriter {
   std::unique_ptr<z_stream, void (*)(z_stream*)> z_stream_;
   std::vector<uint8_t> buffer_;
 
+  // Set by EnableParallelCompression().
+  std::unique_ptr<Pipeline> pipeline_;
+
   FRIEND_TEST(zipwriter, WriteToUnseekableFile);
 };
@@ -37,9 +37,13 @@
 #include <sys/mman.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <span>
+#include <thread>
 #include <vector>
 
 #if defined(__APPLE__)
@@ -1383,10 +1387,29 @@ static int32_t inflateImpl(const zip_archive::Reader& reader,
                            const uint64_t uncompressed_length,
                            zip_archive::Writer* writer, uint64_t* crc_out) {
   constexpr uint64_t kBufSize = 32768;
+  // The most compressed data we'll copy out of a reader that isn't zero-copy
+  // just to be able to inflate in one shot.
+  constexpr uint64_t kOneShotMaxReadSize = 8 * 1024 * 1024;
+
+  // If the writer has room for the whole entry, and we can get at all of the
+  // compressed data at once too, zlib can inflate it all in a single call.
+  // That spares it keeping a sliding window, and keeps it in its fast loop
+  // instead of stopping at every buffer boundary.
+  std::span<uint8_t> one_shot_span;
+  bool one_shot = false;
+  if (compressed_length <= std::numeric_limits<uint32_t>::max() &&
+      uncompressed_length <= std::numeric_limits<uint32_t>::max() &&
+      (reader.IsZeroCopy() || compressed_length <= kOneShotMaxReadSize)) {
+    one_shot_span = bufferToSpan(writer->GetBuffer(size_t(uncompressed_length)));
+    one_shot = one_shot_span.size() >= uncompressed_length;
+  }
 
   std::vector<uint8_t> read_buf;
   uint64_t max_read_size;
-  if (reader.IsZeroCopy()) {
+  if (one_shot) {
+    max_read_size = compressed_length;
+    if (!reader.IsZeroCopy()) read_buf.resize(static_cast<size_t>(max_read_size));
+  } else if (reader.IsZeroCopy()) {
     max_read_size = std::min<uint64_t>(std::numeric_limits<uint32_t>::max(), compressed_length);
   } else {
     max_read_size = std::min(compressed_length, kBufSize);
@@ -1397,9 +1420,10 @@ static int32_t inflateImpl(const zip_archive::Reader& reader,
   // For some files zlib needs more space than the uncompressed buffer size, e.g. when inflating
   // an empty file.
   const auto min_write_buffer_size = std::max(compressed_length, uncompressed_length);
-  auto write_span = bufferToSpan(writer->GetBuffer(size_t(min_write_buffer_size)));
+  auto write_span = one_shot ? one_shot_span
+                             : bufferToSpan(writer->GetBuffer(size_t(min_write_buffer_size)));
   bool direct_writer;
-  if (write_span.size() >= min_write_buffer_size) {
+  if (one_shot || write_span.size() >= min_write_buffer_size) {
     direct_writer = true;
   } else {
     direct_writer = false;
@@ -1450,6 +1474,40 @@ static int32_t inflateImpl(const zip_archive::Reader& reader,
   });
 
   const bool compute_crc = (crc_out != nullptr);
+
+  if (one_shot) {
+    const auto read_size = static_cast<uint32_t>(compressed_length);
+    zstream.next_in = reader.AccessAtOffset(read_buf.data(), read_size, 0);
+    if (!zstream.next_in) {
+      ALOGW("Zip: inflate read failed, getSize = %u: %s", read_size, strerror(errno));
+      return kIoError;
+    }
+    zstream.avail_in = read_size;
+    // zlib wants somewhere to point next_out even for an empty entry.
+    uint8_t empty;
+    zstream.next_out = write_span.empty() ? &empty : write_span.data();
+    zstream.avail_out = static_cast<uint32_t>(uncompressed_length);
+
+    zerr = inflate(&zstream, Z_FINISH);
+    if (zerr != Z_STREAM_END) {
+      ALOGW("Zip: inflate zerr=%d (nIn=%p aIn=%u nOut=%p aOut=%u)", zerr, zstream.next_in,
+            zstream.avail_in, zstream.next_out, zstream.avail_out);
+      return kZlibError;
+    }
+    if (zstream.avail_out != 0) {
+      // The output is shorter than the entry claims. As in the streaming path
+      // below, any compressed data after the end of the deflate stream is
+      // ignored.
+      ALOGW("Zip: size mismatch on inflated file (%lu vs %" PRIu64 ")", zstream.total_out,
+            uncompressed_length);
+      return kInconsistentInformation;
+    }
+    if (compute_crc) {
+      *crc_out = crc32(0, write_span.data(), static_cast<uint32_t>(uncompressed_length));
+    }
+    return 0;
+  }
+
   uLong crc = 0;
   uint64_t remaining_bytes = compressed_length;
   uint64_t total_output = 0;
@@ -1884,6 +1942,61 @@ int32_t ExtractToWriter(ZipArchiveHandle handle, const ZipEntry64* entry,
   return extractToWriter(handle, entry, writer);
 }
 
+int32_t ExtractEntries(ZipArchiveHandle handle, const std::vector<ZipEntry64>& entries,
+                       WriterFactory* factory, size_t threads) {
+  // Start with the largest entries, so that a big one isn't left inflating
+  // on its own after everything else has finished.
+  std::vector<size_t> order(entries.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&entries](size_t lhs, size_t rhs) {
+    return entries[lhs].uncompressed_length > entries[rhs].uncompressed_length;
+  });
+
+  // Each index is extracted by exactly one thread, so |results| needs no lock.
+  std::vector<int32_t> results(entries.size(), 0);
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  auto work = [&]() {
+    while (!failed.load(std::memory_order_relaxed)) {
+      const size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= order.size()) break;
+      const size_t index = order[i];
+      Writer* writer = factory->CreateWriter(index, entries[index]);
+      int32_t result = kIoError;
+      if (writer != nullptr) {
+        result = extractToWriter(handle, &entries[index], writer);
+        factory->ReleaseWriter(index, writer, result);
+      }
+      if (result != 0) {
+        results[index] = result;
+        failed.store(true, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  threads = std::clamp<size_t>(threads, 1, std::max<size_t>(entries.size(), 1));
+
+  // The reads all go through pread(2), but the file length is cached lazily;
+  // make sure that has happened before there's more than one thread.
+  handle->mapped_zip.GetFileLength();
+
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+  for (size_t i = 1; i < threads; ++i) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (auto& thread : pool) {
+    thread.join();
+  }
+
+  for (int32_t result : results) {
+    if (result != 0) return result;
+  }
+  return 0;
+}
+
 #endif  // !ZIPARCHIVE_DISABLE_CALLBACK_API
 
 }  // namespace zip_archive
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -22,6 +23,7 @@
 #include <string_view>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/test_utils.h>
 #include <benchmark/benchmark.h>
 #include <ziparchive/zip_archive.h>
@@ -172,4 +174,166 @@ static void ExtractStored(benchmark::State& state) {
 
 BENCHMARK(ExtractStored)->Arg(2)->Arg(16)->Arg(64)->Arg(1024)->Arg(4096);
 
+// Args: entry size in KiB, whether to open the archive from memory (which lets
+// the whole entry be inflated straight out of the archive in one go).
+static void ExtractTextEntry(benchmark::State& state) {
+  const auto size = size_t(state.range(0)) * 1024;
+  const bool from_memory = state.range(1) != 0;
+
+  // Something with a realistic compression ratio.
+  std::string contents;
+  for (size_t i = 0; contents.size() < size; i++) {
+    contents += "entry line " + std::to_string(i * 2654435761u % 100003) + "\n";
+  }
+  contents.resize(size);
+
+  TemporaryFile file;
+  FILE* fp = fdopen(file.fd, "w");
+  ZipWriter writer(fp);
+  writer.StartEntry("file0", ZipWriter::kCompress);
+  writer.WriteBytes(contents.data(), contents.size());
+  writer.FinishEntry();
+  writer.Finish();
+  fclose(fp);
+
+  std::string zip_data;
+  ZipArchiveHandle handle;
+  int32_t error;
+  if (from_memory) {
+    android::base::ReadFileToString(file.path, &zip_data);
+    error = OpenArchiveFromMemory(zip_data.data(), zip_data.size(), "ExtractTextEntry", &handle);
+  } else {
+    error = OpenArchive(file.path, &handle);
+  }
+  if (error) {
+    state.SkipWithError("Failed to open archive");
+    return;
+  }
+  ZipEntry64 data;
+  if (FindEntry(handle, "file0", &data)) {
+    state.SkipWithError("Failed to find archive entry");
+  }
+
+  std::vector<uint8_t> buffer(size);
+  for (auto _ : state) {
+    if (ExtractToMemory(handle, &data, buffer.data(), buffer.size())) {
+      state.SkipWithError("Failed to extract archive entry");
+      break;
+    }
+  }
+  CloseArchive(handle);
+  state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(size));
+}
+BENCHMARK(ExtractTextEntry)->ArgsProduct({{2, 16, 64, 1024, 4096}, {0, 1}});
+
+// Args: entry count, entry size in KiB, compression threads (0 to compress on the calling thread).
+static void WriteCompressed(benchmark::State& state) {
+  const auto count = int(state.range(0));
+  const auto size = size_t(state.range(1)) * 1024;
+  const auto threads = size_t(state.range(2));
+
+  // Something with a realistic compression ratio.
+  std::string contents;
+  for (size_t i = 0; contents.size() < size; i++) {
+    contents += "entry line " + std::to_string(i * 2654435761u % 100003) + "\n";
+  }
+  contents.resize(size);
+
+  TemporaryFile file;
+  FILE* fp = fdopen(file.fd, "w");
+  for (auto _ : state) {
+    rewind(fp);
+    ZipWriter writer(fp);
+    if (threads != 0) {
+      writer.EnableParallelCompression(threads);
+    }
+    for (int i = 0; i < count; i++) {
+      writer.StartEntry("file" + std::to_string(i), ZipWriter::kCompress);
+      for (size_t offset = 0; offset < size; offset += 65536) {
+        writer.WriteBytes(contents.data() + offset, std::min<size_t>(65536, size - offset));
+      }
+      writer.FinishEntry();
+    }
+    if (writer.Finish() != 0) {
+      state.SkipWithError("Failed to write archive");
+      break;
+    }
+  }
+  fclose(fp);
+  state.SetBytesProcessed(int64_t(state.iterations()) * count * int64_t(size));
+}
+// Many small entries, and a few huge ones.
+BENCHMARK(WriteCompressed)
+    ->ArgsProduct({{2000}, {4}, {0, 1, 4}})
+    ->ArgsProduct({{4}, {16384}, {0, 1, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+class DiscardWriter final : public zip_archive::Writer {
+ public:
+  bool Append(uint8_t*, size_t) override { return true; }
+};
+
+class DiscardWriterFactory final : public zip_archive::WriterFactory {
+ public:
+  zip_archive::Writer* CreateWriter(size_t, const ZipEntry64&) override { return &writer_; }
+  void ReleaseWriter(size_t, zip_archive::Writer*, int32_t) override {}
+
+ private:
+  // Stateless, so all the threads can share it.
+  DiscardWriter writer_;
+};
+
+// Args: entry count, entry size in KiB, extraction threads (0 for one per CPU).
+static void ExtractEntries(benchmark::State& state) {
+  const auto count = int(state.range(0));
+  const auto size = size_t(state.range(1)) * 1024;
+  const auto threads = size_t(state.range(2));
+
+  std::string contents;
+  for (size_t i = 0; contents.size() < size; i++) {
+    contents += "entry line " + std::to_string(i * 2654435761u % 100003) + "\n";
+  }
+  contents.resize(size);
+
+  TemporaryFile file;
+  FILE* fp = fdopen(file.fd, "w");
+  ZipWriter writer(fp);
+  for (int i = 0; i < count; i++) {
+    writer.StartEntry("file" + std::to_string(i), ZipWriter::kCompress);
+    writer.WriteBytes(contents.data(), contents.size());
+    writer.FinishEntry();
+  }
+  writer.Finish();
+  fflush(fp);
+
+  ZipArchiveHandle handle;
+  if (OpenArchive(file.path, &handle)) {
+    state.SkipWithError("Failed to open archive");
+    fclose(fp);
+    return;
+  }
+  std::vector<ZipEntry64> entries(count);
+  for (int i = 0; i < count; i++) {
+    FindEntry(handle, "file" + std::to_string(i), &entries[i]);
+  }
+
+  DiscardWriterFactory factory;
+  for (auto _ : state) {
+    if (zip_archive::ExtractEntries(handle, entries, &factory, threads)) {
+      state.SkipWithError("Failed to extract archive entries");
+      break;
+    }
+  }
+  CloseArchive(handle);
+  fclose(fp);
+  state.SetBytesProcessed(int64_t(state.iterations()) * count * int64_t(size));
+}
+// Many small entries, and a few huge ones.
+BENCHMARK(ExtractEntries)
+    ->ArgsProduct({{2000}, {4}, {1, 4, 0}})
+    ->ArgsProduct({{4}, {16384}, {1, 4, 0}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
 BENCHMARK_MAIN();
@@ -31,11 +31,13 @@
 #include <android-base/logging.h>
 #include <android-base/mapped_file.h>
 #include <android-base/memory.h>
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 #include <ziparchive/zip_archive.h>
 #include <ziparchive/zip_archive_stream_entry.h>
+#include <ziparchive/zip_writer.h>
 
 #include "zip_archive_common.h"
 #include "zip_archive_private.h"
@@ -983,6 +985,211 @@ TEST(ziparchive, Inflate) {
   }
 }
 
+class VectorWriterFactory final : public zip_archive::WriterFactory {
+ public:
+  explicit VectorWriterFactory(size_t count) : outputs(count), errors(count, 1) {}
+
+  zip_archive::Writer* CreateWriter(size_t index, const ZipEntry64&) override {
+    return index == fail_index ? nullptr : &outputs[index];
+  }
+  void ReleaseWriter(size_t index, zip_archive::Writer*, int32_t error) override {
+    errors[index] = error;
+  }
+
+  std::vector<VectorWriter> outputs;
+  // 1 for entries that were never released.
+  std::vector<int32_t> errors;
+  size_t fail_index = SIZE_MAX;
+};
+
+// Writes an archive of |count| entries of different sizes, alternating between
+// deflated and stored, and returns their names and contents.
+static void WriteTestArchive(int fd, size_t count, std::vector<std::string>* names,
+                             std::vector<std::string>* contents) {
+  FILE* file = fdopen(dup(fd), "w");
+  ASSERT_NE(nullptr, file);
+  ZipWriter writer(file);
+  for (size_t i = 0; i < count; ++i) {
+    names->push_back(android::base::StringPrintf("dir/%zu.txt", i));
+    std::string content;
+    for (size_t j = 0; j < (i * 7919) % 20000; ++j) {
+      content += static_cast<char>('a' + (i + j * j) % 26);
+    }
+    contents->push_back(content);
+    ASSERT_EQ(0, writer.StartEntry(names->back(), i % 2 ? 0 : ZipWriter::kCompress));
+    ASSERT_EQ(0, writer.WriteBytes(content.data(), content.size()));
+    ASSERT_EQ(0, writer.FinishEntry());
+  }
+  ASSERT_EQ(0, writer.Finish());
+  ASSERT_EQ(0, fclose(file));
+}
+
+TEST(ziparchive, ExtractEntries) {
+  TemporaryFile tmp_file;
+  ASSERT_NE(-1, tmp_file.fd);
+  std::vector<std::string> names;
+  std::vector<std::string> contents;
+  ASSERT_NO_FATAL_FAILURE(WriteTestArchive(tmp_file.fd, 64, &names, &contents));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(tmp_file.fd, "ExtractEntries", &handle, false));
+  std::vector<ZipEntry64> entries(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    ASSERT_EQ(0, FindEntry(handle, names[i], &entries[i]));
+  }
+
+  for (size_t threads : {1, 4, 0}) {
+    SCOPED_TRACE(threads);
+    VectorWriterFactory factory(entries.size());
+    ASSERT_EQ(0, zip_archive::ExtractEntries(handle, entries, &factory, threads));
+    for (size_t i = 0; i < entries.size(); ++i) {
+      ASSERT_EQ(0, factory.errors[i]);
+      const std::vector<uint8_t>& output = factory.outputs[i].GetOutput();
+      ASSERT_EQ(contents[i], std::string(output.begin(), output.end()));
+    }
+  }
+
+  // An empty batch is fine too.
+  VectorWriterFactory factory(0);
+  ASSERT_EQ(0, zip_archive::ExtractEntries(handle, {}, &factory, 4));
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractEntriesFailedWriter) {
+  TemporaryFile tmp_file;
+  ASSERT_NE(-1, tmp_file.fd);
+  std::vector<std::string> names;
+  std::vector<std::string> contents;
+  ASSERT_NO_FATAL_FAILURE(WriteTestArchive(tmp_file.fd, 16, &names, &contents));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(tmp_file.fd, "ExtractEntriesFailedWriter", &handle, false));
+  std::vector<ZipEntry64> entries(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    ASSERT_EQ(0, FindEntry(handle, names[i], &entries[i]));
+  }
+
+  VectorWriterFactory factory(entries.size());
+  factory.fail_index = 5;
+  ASSERT_EQ(kIoError, zip_archive::ExtractEntries(handle, entries, &factory, 4));
+  // The failed entry never had a writer to release.
+  ASSERT_EQ(1, factory.errors[5]);
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractEntriesCorruptEntry) {
+  TemporaryFile tmp_file;
+  ASSERT_NE(-1, tmp_file.fd);
+  std::vector<std::string> names;
+  std::vector<std::string> contents;
+  ASSERT_NO_FATAL_FAILURE(WriteTestArchive(tmp_file.fd, 8, &names, &contents));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(tmp_file.fd, "ExtractEntriesCorruptEntry", &handle, false));
+  std::vector<ZipEntry64> entries(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    ASSERT_EQ(0, FindEntry(handle, names[i], &entries[i]));
+  }
+
+  // Zeroing entry 2's deflate stream turns it into a stored block with bad lengths.
+  ASSERT_EQ(kCompressDeflated, entries[2].method);
+  std::vector<uint8_t> zeroes(static_cast<size_t>(entries[2].compressed_length));
+  ASSERT_TRUE(android::base::WriteFullyAtOffset(tmp_file.fd, zeroes.data(), zeroes.size(),
+                                                entries[2].offset));
+
+  VectorWriterFactory factory(entries.size());
+  const int32_t error = zip_archive::ExtractEntries(handle, entries, &factory, 2);
+  ASSERT_LT(error, 0);
+  ASSERT_EQ(error, factory.errors[2]);
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractToMemoryWholeEntry) {
+  TemporaryFile tmp_file;
+  ASSERT_NE(-1, tmp_file.fd);
+  std::vector<std::string> names;
+  std::vector<std::string> contents;
+  ASSERT_NO_FATAL_FAILURE(WriteTestArchive(tmp_file.fd, 16, &names, &contents));
+  std::string zip_data;
+  ASSERT_TRUE(android::base::ReadFileToString(tmp_file.path, &zip_data));
+
+  // Both a file, and memory that the entries can be inflated straight out of.
+  ZipArchiveHandle file_handle;
+  ASSERT_EQ(0, OpenArchiveFd(tmp_file.fd, "ExtractToMemoryWholeEntry", &file_handle, false));
+  ZipArchiveHandle memory_handle;
+  ASSERT_EQ(0, OpenArchiveFromMemory(zip_data.data(), zip_data.size(),
+                                     "ExtractToMemoryWholeEntry", &memory_handle));
+
+  for (ZipArchiveHandle handle : {file_handle, memory_handle}) {
+    for (size_t i = 0; i < names.size(); ++i) {
+      SCOPED_TRACE(names[i]);
+      ZipEntry64 entry;
+      ASSERT_EQ(0, FindEntry(handle, names[i], &entry));
+      std::vector<uint8_t> buffer(contents[i].size());
+      ASSERT_EQ(0, ExtractToMemory(handle, &entry, buffer.data(), buffer.size()));
+      ASSERT_EQ(contents[i], std::string(buffer.begin(), buffer.end()));
+
+      // Entries that claim to be shorter or longer than they are.
+      if (entry.method != kCompressDeflated || entry.uncompressed_length == 0) continue;
+      ZipEntry64 wrong_size = entry;
+      wrong_size.uncompressed_length--;
+      buffer.resize(static_cast<size_t>(wrong_size.uncompressed_length));
+      ASSERT_EQ(kZlibError, ExtractToMemory(handle, &wrong_size, buffer.data(), buffer.size()));
+      wrong_size.uncompressed_length += 2;
+      buffer.resize(static_cast<size_t>(wrong_size.uncompressed_length));
+      ASSERT_EQ(kInconsistentInformation,
+                ExtractToMemory(handle, &wrong_size, buffer.data(), buffer.size()));
+    }
+  }
+
+  CloseArchive(file_handle);
+  CloseArchive(memory_handle);
+}
+
+TEST(ziparchive, ExtractIgnoresDataAfterDeflateStream) {
+  TemporaryFile tmp_file;
+  ASSERT_NE(-1, tmp_file.fd);
+  std::vector<std::string> names;
+  std::vector<std::string> contents;
+  ASSERT_NO_FATAL_FAILURE(WriteTestArchive(tmp_file.fd, 16, &names, &contents));
+  std::string zip_data;
+  ASSERT_TRUE(android::base::ReadFileToString(tmp_file.path, &zip_data));
+
+  ZipArchiveHandle file_handle;
+  ASSERT_EQ(0, OpenArchiveFd(tmp_file.fd, "ExtractIgnoresDataAfterDeflateStream", &file_handle,
+                             false));
+  ZipArchiveHandle memory_handle;
+  ASSERT_EQ(0, OpenArchiveFromMemory(zip_data.data(), zip_data.size(),
+                                     "ExtractIgnoresDataAfterDeflateStream", &memory_handle));
+
+  for (ZipArchiveHandle handle : {file_handle, memory_handle}) {
+    for (size_t i = 0; i < names.size(); ++i) {
+      SCOPED_TRACE(names[i]);
+      ZipEntry64 entry;
+      ASSERT_EQ(0, FindEntry(handle, names[i], &entry));
+      if (entry.method != kCompressDeflated) continue;
+
+      // Claim a few more compressed bytes than the deflate stream uses; they
+      // are the start of whatever follows the entry in the archive. Both the
+      // one-shot path and the streaming path stop at the end of the stream.
+      entry.compressed_length += 4;
+      std::vector<uint8_t> buffer(contents[i].size());
+      ASSERT_EQ(0, ExtractToMemory(handle, &entry, buffer.data(), buffer.size()));
+      ASSERT_EQ(contents[i], std::string(buffer.begin(), buffer.end()));
+
+      TemporaryFile output;
+      ASSERT_EQ(0, ExtractEntryToFile(handle, &entry, output.fd));
+      std::string extracted;
+      ASSERT_TRUE(android::base::ReadFileToString(output.path, &extracted));
+      ASSERT_EQ(contents[i], extracted);
+    }
+  }
+
+  CloseArchive(file_handle);
+  CloseArchive(memory_handle);
+}
+
 // The class constructs a zipfile with zip64 format, and test the parsing logic.
 class Zip64ParseTest : public ::testing::Test {
  protected:
@@ -24,7 +24,12 @@
 #include <cstdio>
 #define DEF_MEM_LEVEL 8  // normally in zutil.h?
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "android-base/logging.h"
@@ -49,6 +54,14 @@ enum {
 // Size of the output buffer used for compression.
 static const size_t kBufSize = 32768u;
 
+// With parallel compression, entry data is cut into blocks of this size. Each block after the
+// first is deflated with the end of the one before as a preset dictionary, as pigz does, so
+// little is lost to the split.
+static const size_t kParallelBlockSize = 128 * 1024u;
+
+// The most history deflate can use.
+static const size_t kDictionarySize = 32768u;
+
 // No error, operation completed successfully.
 static const int32_t kNoError = 0;
 
@@ -86,6 +99,179 @@ static void DeleteZStream(z_stream* stream) {
   delete stream;
 }
 
+namespace {
+
+// A run of entry data, stored or deflated on a worker thread.
+struct Block {
+  std::vector<uint8_t> input;
+  std::vector<uint8_t> dictionary;
+  // Zero to store the data.
+  int compression_level = 0;
+  // Whether this is the last block of its entry, which ends the deflate stream.
+  bool last = false;
+
+  // Filled in by the worker.
+  std::vector<uint8_t> output;
+  uint32_t input_size = 0;
+  uint32_t crc32 = 0;
+  bool ok = false;
+  // Guarded by Pipeline::mutex_.
+  bool done = false;
+};
+
+struct ZStreamDeleter {
+  void operator()(z_stream* stream) const { DeleteZStream(stream); }
+};
+
+}  // namespace
+
+// Compresses blocks on a pool of threads. The ZipWriter writes the results, in order, on the
+// calling thread.
+class ZipWriter::Pipeline {
+ public:
+  // An entry that has been started but not completely written out.
+  struct Entry {
+    FileEntry file;
+    uint32_t alignment;
+    int compression_level;
+    bool header_written = false;
+    // Set by FinishEntry().
+    bool finished = false;
+    std::deque<std::shared_ptr<Block>> blocks = {};
+  };
+
+  explicit Pipeline(size_t threads) : max_queued_blocks(threads * 2 + 2) {
+    for (size_t i = 0; i < threads; i++) {
+      threads_.emplace_back(&Pipeline::WorkerMain, this);
+    }
+  }
+
+  ~Pipeline() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.clear();
+      stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void Submit(std::shared_ptr<Block> block) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(block));
+    }
+    work_cv_.notify_one();
+  }
+
+  bool IsDone(const Block& block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return block.done;
+  }
+
+  void Wait(const Block& block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&block] { return block.done; });
+  }
+
+  // Entries not yet written out, oldest first. Only the last can be unfinished.
+  std::deque<Entry> entries;
+  // The block being filled for the last entry, if any.
+  std::shared_ptr<Block> current_block;
+  // Blocks submitted but not yet written out, and how many of those to allow.
+  size_t queued_blocks = 0;
+  const size_t max_queued_blocks;
+
+ private:
+  void WorkerMain() {
+    // One stream per compression level, reused from block to block.
+    std::unique_ptr<z_stream, ZStreamDeleter> streams[Z_BEST_COMPRESSION + 1];
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      std::shared_ptr<Block> block = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+
+      block->ok = Compress(block.get(), &streams[block->compression_level]);
+
+      lock.lock();
+      block->done = true;
+      done_cv_.notify_all();
+    }
+  }
+
+  static bool Compress(Block* block, std::unique_ptr<z_stream, ZStreamDeleter>* stream) {
+    block->input_size = static_cast<uint32_t>(block->input.size());
+    block->crc32 = static_cast<uint32_t>(crc32(0, block->input.data(), block->input_size));
+    if (block->compression_level == 0) {
+      block->output = std::move(block->input);
+      return true;
+    }
+
+    z_stream* zs = stream->get();
+    if (zs == nullptr) {
+      zs = new z_stream();
+      stream->reset(zs);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+      int zerr = deflateInit2(zs, block->compression_level, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                              Z_DEFAULT_STRATEGY);
+#pragma GCC diagnostic pop
+      if (zerr != Z_OK) {
+        LOG(ERROR) << "deflateInit2 failed (zerr=" << zerr << ")";
+        stream->reset();
+        return false;
+      }
+    } else if (deflateReset(zs) != Z_OK) {
+      return false;
+    }
+
+    if (!block->dictionary.empty() &&
+        deflateSetDictionary(zs, block->dictionary.data(),
+                             static_cast<uInt>(block->dictionary.size())) != Z_OK) {
+      return false;
+    }
+
+    // A block that doesn't end the entry is brought to a byte boundary with Z_SYNC_FLUSH so that
+    // the next block's output can follow it.
+    int flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+    block->output.resize(deflateBound(zs, block->input_size) + 16);
+    zs->next_in = block->input.data();
+    zs->avail_in = block->input_size;
+    size_t produced = 0;
+    while (true) {
+      zs->next_out = block->output.data() + produced;
+      zs->avail_out = static_cast<uInt>(block->output.size() - produced);
+      int zerr = deflate(zs, flush);
+      produced = block->output.size() - zs->avail_out;
+      if (zerr == Z_STREAM_END || (zerr == Z_OK && !block->last && zs->avail_out != 0)) {
+        break;
+      }
+      if (zerr != Z_OK && zerr != Z_BUF_ERROR) {
+        return false;
+      }
+      block->output.resize(block->output.size() * 2);
+    }
+    block->output.resize(produced);
+    block->input = std::vector<uint8_t>();
+    return true;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::deque<std::shared_ptr<Block>> queue_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
 ZipWriter::ZipWriter(FILE* f)
     : file_(f),
       seekable_(false),
@@ -108,7 +294,8 @@ ZipWriter::ZipWriter(ZipWriter&& writer) noexcept
       state_(writer.state_),
       files_(std::move(writer.files_)),
       z_stream_(std::move(writer.z_stream_)),
-      buffer_(std::move(writer.buffer_)) {
+      buffer_(std::move(writer.buffer_)),
+      pipeline_(std::move(writer.pipeline_)) {
   writer.file_ = nullptr;
   writer.state_ = State::kError;
 }
@@ -121,11 +308,25 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) noexcept {
   files_ = std::move(writer.files_);
   z_stream_ = std::move(writer.z_stream_);
   buffer_ = std::move(writer.buffer_);
+  pipeline_ = std::move(writer.pipeline_);
   writer.file_ = nullptr;
   writer.state_ = State::kError;
   return *this;
 }
 
+ZipWriter::~ZipWriter() = default;
+
+int32_t ZipWriter::EnableParallelCompression(size_t threads) {
+  if (state_ != State::kWritingZip || !files_.empty() || pipeline_) {
+    return kInvalidState;
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  pipeline_ = std::make_unique<Pipeline>(threads);
+  return kNoError;
+}
+
 int32_t ZipWriter::HandleError(int32_t error_code) {
   state_ = State::kError;
   z_stream_.reset();
@@ -226,25 +427,23 @@ int32_t ZipWriter::StartAlignedEntryWithTime(std::string_view path, size_t flags
   }
 
   FileEntry file_entry = {};
-  file_entry.local_file_header_offset = current_offset_;
   file_entry.path = path;
-  // No support for larger than 4GB files.
-  if (file_entry.local_file_header_offset > std::numeric_limits<uint32_t>::max()) {
-    return HandleError(kIoError);
-  }
 
   if (!IsValidEntryName(reinterpret_cast<const uint8_t*>(file_entry.path.data()),
                         file_entry.path.size())) {
     return kInvalidEntryName;
   }
 
+  int compression_level = 0;
   if (flags & ZipWriter::kCompress) {
     file_entry.compression_method = kCompressDeflated;
 
-    int compression_level = (flags & ZipWriter::kDefaultCompression) ? 6 : 9;
-    int32_t result = PrepareDeflate(compression_level);
-    if (result != kNoError) {
-      return result;
+    compression_level = (flags & ZipWriter::kDefaultCompression) ? 6 : 9;
+    if (!pipeline_) {
+      int32_t result = PrepareDeflate(compression_level);
+      if (result != kNoError) {
+        return result;
+      }
     }
   } else {
     file_entry.compression_method = kCompressStored;
@@ -252,7 +451,31 @@ int32_t ZipWriter::StartAlignedEntryWithTime(std::string_view path, size_t flags
 
   ExtractTimeAndDate(time, &file_entry.last_mod_time, &file_entry.last_mod_date);
 
-  off_t offset = current_offset_ + sizeof(LocalFileHeader) + file_entry.path.size();
+  if (pipeline_) {
+    // The header is written once everything before it has been.
+    pipeline_->entries.push_back({std::move(file_entry), alignment, compression_level});
+    state_ = State::kWritingEntry;
+    return kNoError;
+  }
+
+  int32_t result = WriteLocalFileHeader(&file_entry, alignment);
+  if (result != kNoError) {
+    return result;
+  }
+
+  current_file_entry_ = std::move(file_entry);
+  state_ = State::kWritingEntry;
+  return kNoError;
+}
+
+int32_t ZipWriter::WriteLocalFileHeader(FileEntry* file, uint32_t alignment) {
+  file->local_file_header_offset = current_offset_;
+  // No support for larger than 4GB files.
+  if (file->local_file_header_offset > std::numeric_limits<uint32_t>::max()) {
+    return HandleError(kIoError);
+  }
+
+  off_t offset = current_offset_ + sizeof(LocalFileHeader) + file->path.size();
   // prepare a pre-zeroed memory page in case when we need to pad some aligned data.
   static constexpr auto kPageSize = 4096;
   static constexpr char kSmallZeroPadding[kPageSize] = {};
@@ -263,7 +486,7 @@ int32_t ZipWriter::StartAlignedEntryWithTime(std::string_view path, size_t flags
   if (alignment != 0 && (offset & (alignment - 1))) {
     // Pad the extra field so the data will be aligned.
     uint16_t padding = static_cast<uint16_t>(alignment - (offset % alignment));
-    file_entry.padding_length = padding;
+    file->padding_length = padding;
     offset += padding;
     if (padding <= std::size(kSmallZeroPadding)) {
         zero_padding = kSmallZeroPadding;
@@ -276,29 +499,36 @@ int32_t ZipWriter::StartAlignedEntryWithTime(std::string_view path, size_t flags
   LocalFileHeader header = {};
   // Always start expecting a data descriptor. When the data has finished being written,
   // if it is possible to seek back, the GPB flag will reset and the sizes written.
-  CopyFromFileEntry(file_entry, true /*use_data_descriptor*/, &header);
+  CopyFromFileEntry(*file, true /*use_data_descriptor*/, &header);
 
   if (fwrite(&header, sizeof(header), 1, file_) != 1) {
     return HandleError(kIoError);
   }
 
-  if (fwrite(path.data(), 1, path.size(), file_) != path.size()) {
+  if (fwrite(file->path.data(), 1, file->path.size(), file_) != file->path.size()) {
     return HandleError(kIoError);
   }
 
-  if (file_entry.padding_length != 0 && fwrite(zero_padding, 1, file_entry.padding_length,
-                                               file_) != file_entry.padding_length) {
+  if (file->padding_length != 0 && fwrite(zero_padding, 1, file->padding_length,
+                                          file_) != file->padding_length) {
     return HandleError(kIoError);
   }
 
-  current_file_entry_ = std::move(file_entry);
   current_offset_ = offset;
-  state_ = State::kWritingEntry;
   return kNoError;
 }
 
 int32_t ZipWriter::DiscardLastEntry() {
-  if (state_ != State::kWritingZip || files_.empty()) {
+  if (state_ != State::kWritingZip) {
+    return kInvalidState;
+  }
+  if (pipeline_) {
+    int32_t result = WritePendingOutput(true);
+    if (result != kNoError) {
+      return result;
+    }
+  }
+  if (files_.empty()) {
     return kInvalidState;
   }
 
@@ -314,6 +544,12 @@ int32_t ZipWriter::DiscardLastEntry() {
 int32_t ZipWriter::GetLastEntry(FileEntry* out_entry) {
   CHECK(out_entry != nullptr);
 
+  if (pipeline_ && state_ != State::kError) {
+    int32_t result = WritePendingOutput(true);
+    if (result != kNoError) {
+      return result;
+    }
+  }
   if (files_.empty()) {
     return kInvalidState;
   }
@@ -353,13 +589,37 @@ int32_t ZipWriter::WriteBytes(const void* data, size_t len) {
   if (state_ != State::kWritingEntry) {
     return HandleError(kInvalidState);
   }
-  // Need to be able to mark down data correctly.
-  if (len + static_cast<uint64_t>(current_file_entry_.uncompressed_size) >
-      std::numeric_limits<uint32_t>::max()) {
+  // Need to be able to mark down data correctly. The entry being written is
+  // the last one in the pipeline, if there is one.
+  FileEntry& file = pipeline_ ? pipeline_->entries.back().file : current_file_entry_;
+  if (len + static_cast<uint64_t>(file.uncompressed_size) > std::numeric_limits<uint32_t>::max()) {
     return HandleError(kIoError);
   }
   uint32_t len32 = static_cast<uint32_t>(len);
 
+  if (pipeline_) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    while (len > 0) {
+      if (!pipeline_->current_block) {
+        pipeline_->current_block = std::make_shared<Block>();
+        pipeline_->current_block->input.reserve(kParallelBlockSize);
+      }
+      std::vector<uint8_t>& input = pipeline_->current_block->input;
+      size_t count = std::min(len, kParallelBlockSize - input.size());
+      input.insert(input.end(), bytes, bytes + count);
+      bytes += count;
+      len -= count;
+      if (input.size() == kParallelBlockSize) {
+        int32_t result = QueueBlock(false /*last*/);
+        if (result != kNoError) {
+          return result;
+        }
+      }
+    }
+    file.uncompressed_size += len32;
+    return kNoError;
+  }
+
   int32_t result = kNoError;
   if (current_file_entry_.compression_method & kCompressDeflated) {
     result = CompressBytes(&current_file_entry_, data, len32);
@@ -461,6 +721,86 @@ int32_t ZipWriter::FlushCompressedBytes(FileEntry* file) {
   return kNoError;
 }
 
+int32_t ZipWriter::QueueBlock(bool last) {
+  Pipeline::Entry& entry = pipeline_->entries.back();
+  std::shared_ptr<Block> block = std::move(pipeline_->current_block);
+  if (!block) {
+    block = std::make_shared<Block>();
+  }
+  block->compression_level = entry.compression_level;
+  block->last = last;
+
+  if (!last && entry.compression_level != 0) {
+    auto next = std::make_shared<Block>();
+    size_t dictionary_size = std::min(block->input.size(), kDictionarySize);
+    next->dictionary.assign(block->input.end() - dictionary_size, block->input.end());
+    next->input.reserve(kParallelBlockSize);
+    pipeline_->current_block = std::move(next);
+  }
+
+  entry.blocks.push_back(block);
+  pipeline_->queued_blocks++;
+  pipeline_->Submit(std::move(block));
+  return WritePendingOutput(false);
+}
+
+int32_t ZipWriter::WritePendingOutput(bool wait_for_all) {
+  std::deque<Pipeline::Entry>& entries = pipeline_->entries;
+  while (!entries.empty()) {
+    Pipeline::Entry& entry = entries.front();
+    if (!entry.header_written) {
+      int32_t result = WriteLocalFileHeader(&entry.file, entry.alignment);
+      if (result != kNoError) {
+        return result;
+      }
+      entry.header_written = true;
+    }
+
+    while (!entry.blocks.empty()) {
+      const Block& block = *entry.blocks.front();
+      if (!pipeline_->IsDone(block)) {
+        // Only block the caller if too much is in flight.
+        if (!wait_for_all && pipeline_->queued_blocks <= pipeline_->max_queued_blocks) {
+          return kNoError;
+        }
+        pipeline_->Wait(block);
+      }
+      if (!block.ok) {
+        return HandleError(kZlibError);
+      }
+
+      if (block.output.size() + static_cast<uint64_t>(entry.file.compressed_size) >
+          std::numeric_limits<uint32_t>::max()) {
+        return HandleError(kIoError);
+      }
+      if (!block.output.empty() &&
+          fwrite(block.output.data(), 1, block.output.size(), file_) != block.output.size()) {
+        return HandleError(kIoError);
+      }
+      entry.file.compressed_size += static_cast<uint32_t>(block.output.size());
+      entry.file.crc32 = static_cast<uint32_t>(
+          crc32_combine(entry.file.crc32, block.crc32, static_cast<z_off_t>(block.input_size)));
+      current_offset_ += block.output.size();
+
+      entry.blocks.pop_front();
+      pipeline_->queued_blocks--;
+    }
+
+    if (!entry.finished) {
+      // Still being written by the caller.
+      return kNoError;
+    }
+
+    int32_t result = WriteEntryTrailer(&entry.file);
+    if (result != kNoError) {
+      return result;
+    }
+    files_.emplace_back(std::move(entry.file));
+    entries.pop_front();
+  }
+  return kNoError;
+}
+
 bool ZipWriter::ShouldUseDataDescriptor() const {
   // Only use a trailing "data descriptor" if the output isn't seekable.
   return !seekable_;
@@ -471,6 +811,16 @@ int32_t ZipWriter::FinishEntry() {
     return kInvalidState;
   }
 
+  if (pipeline_) {
+    int32_t result = QueueBlock(true /*last*/);
+    if (result != kNoError) {
+      return result;
+    }
+    pipeline_->entries.back().finished = true;
+    state_ = State::kWritingZip;
+    return WritePendingOutput(false);
+  }
+
   if (current_file_entry_.compression_method & kCompressDeflated) {
     int32_t result = FlushCompressedBytes(&current_file_entry_);
     if (result != kNoError) {
@@ -478,14 +828,25 @@ int32_t ZipWriter::FinishEntry() {
     }
   }
 
+  int32_t result = WriteEntryTrailer(&current_file_entry_);
+  if (result != kNoError) {
+    return result;
+  }
+
+  files_.emplace_back(std::move(current_file_entry_));
+  state_ = State::kWritingZip;
+  return kNoError;
+}
+
+int32_t ZipWriter::WriteEntryTrailer(FileEntry* file) {
   if (ShouldUseDataDescriptor()) {
     // Some versions of ZIP don't allow STORED data to have a trailing DataDescriptor.
     // If this file is not seekable, or if the data is compressed, write a DataDescriptor.
     // We haven't supported zip64 format yet. Write both uncompressed size and compressed
     // size as uint32_t.
     std::vector<uint32_t> dataDescriptor = {
-        DataDescriptor::kOptSignature, current_file_entry_.crc32,
-        current_file_entry_.compressed_size, current_file_entry_.uncompressed_size};
+        DataDescriptor::kOptSignature, file->crc32,
+        file->compressed_size, file->uncompressed_size};
     if (fwrite(dataDescriptor.data(), dataDescriptor.size() * sizeof(uint32_t), 1, file_) != 1) {
       return HandleError(kIoError);
     }
@@ -493,12 +854,12 @@ int32_t ZipWriter::FinishEntry() {
     current_offset_ += sizeof(uint32_t) * dataDescriptor.size();
   } else {
     // Seek back to the header and rewrite to include the size.
-    if (fseeko(file_, current_file_entry_.local_file_header_offset, SEEK_SET) != 0) {
+    if (fseeko(file_, file->local_file_header_offset, SEEK_SET) != 0) {
       return HandleError(kIoError);
     }
 
     LocalFileHeader header = {};
-    CopyFromFileEntry(current_file_entry_, false /*use_data_descriptor*/, &header);
+    CopyFromFileEntry(*file, false /*use_data_descriptor*/, &header);
 
     if (fwrite(&header, sizeof(header), 1, file_) != 1) {
       return HandleError(kIoError);
@@ -508,9 +869,6 @@ int32_t ZipWriter::FinishEntry() {
       return HandleError(kIoError);
     }
   }
-
-  files_.emplace_back(std::move(current_file_entry_));
-  state_ = State::kWritingZip;
   return kNoError;
 }
 
@@ -519,6 +877,13 @@ int32_t ZipWriter::Finish() {
     return kInvalidState;
   }
 
+  if (pipeline_) {
+    int32_t result = WritePendingOutput(true);
+    if (result != kNoError) {
+      return result;
+    }
+  }
+
   off_t startOfCdr = current_offset_;
   for (FileEntry& file : files_) {
     CentralDirectoryRecord cdr = {};
@@ -17,10 +17,15 @@
 #include "ziparchive/zip_writer.h"
 #include "ziparchive/zip_archive.h"
 
+#include <android-base/file.h>
 #include <android-base/test_utils.h>
 #include <gtest/gtest.h>
 #include <time.h>
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 static ::testing::AssertionResult AssertFileEntryContentsEq(const std::string& expected,
@@ -487,6 +492,148 @@ TEST_F(zipwriter, TruncateFileAfterBackup) {
   ASSERT_GT(before_len, after_len);
 }
 
+TEST_F(zipwriter, WriteZipWithParallelCompression) {
+  // Spans several compression blocks, and isn't a multiple of their size.
+  std::string big;
+  for (size_t i = 0; big.size() < 1000000; i++) {
+    big += "line " + std::to_string(i * i % 7919) + "\n";
+  }
+  const std::vector<std::pair<std::string, size_t>> entries = {
+      {"empty.txt", 0},
+      {"small.txt", ZipWriter::kCompress},
+      {"stored.txt", ZipWriter::kAlign32},
+      {"big.txt", ZipWriter::kCompress},
+      {"big_stored.txt", 0},
+      {"big_default.txt", ZipWriter::kCompress | ZipWriter::kDefaultCompression},
+  };
+
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.EnableParallelCompression(4));
+  for (const auto& [name, flags] : entries) {
+    std::string contents = name.starts_with("big") ? big : name;
+    if (name == "empty.txt") contents.clear();
+    ASSERT_EQ(0, writer.StartEntry(name, flags));
+    // Odd-sized writes, so blocks are filled from several calls.
+    for (size_t i = 0; i < contents.size(); i += 4093) {
+      ASSERT_EQ(0, writer.WriteBytes(contents.data() + i, std::min<size_t>(4093, contents.size() - i)));
+    }
+    ASSERT_EQ(0, writer.FinishEntry());
+  }
+  ASSERT_EQ(0, writer.StartAlignedEntry("aligned.txt", ZipWriter::kCompress, 4096));
+  ASSERT_EQ(0, writer.WriteBytes("aligned", 7));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ZipWriter::FileEntry last;
+  ASSERT_EQ(0, writer.GetLastEntry(&last));
+  EXPECT_EQ("aligned.txt", last.path);
+  EXPECT_EQ(7u, last.uncompressed_size);
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+  for (const auto& [name, flags] : entries) {
+    ZipEntry data;
+    ASSERT_EQ(0, FindEntry(handle, name, &data));
+    std::string contents = name.starts_with("big") ? big : name;
+    if (name == "empty.txt") contents.clear();
+    EXPECT_EQ((flags & ZipWriter::kCompress) ? kCompressDeflated : kCompressStored, data.method);
+    ASSERT_TRUE(AssertFileEntryContentsEq(contents, handle, &data)) << name;
+    if (flags & ZipWriter::kAlign32) {
+      EXPECT_EQ(0, data.offset & 0x03);
+    }
+  }
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, "aligned.txt", &data));
+  EXPECT_EQ(0, data.offset & 4095);
+  ASSERT_TRUE(AssertFileEntryContentsEq("aligned", handle, &data));
+  CloseArchive(handle);
+}
+
+TEST_F(zipwriter, ParallelCompressionLaysOutStoredEntriesLikeSerial) {
+  TemporaryFile serial_file;
+  FILE* serial_fp = fdopen(serial_file.fd, "w");
+  ASSERT_NE(serial_fp, nullptr);
+
+  ZipWriter serial(serial_fp);
+  ZipWriter parallel(file_);
+  ASSERT_EQ(0, parallel.EnableParallelCompression(2));
+  for (ZipWriter* writer : {&serial, &parallel}) {
+    for (int i = 0; i < 50; i++) {
+      std::string contents(i * 3001, static_cast<char>('a' + i % 26));
+      ASSERT_EQ(0, writer->StartAlignedEntry("file" + std::to_string(i), 0, 1u << (i % 13)));
+      ASSERT_EQ(0, writer->WriteBytes(contents.data(), contents.size()));
+      ASSERT_EQ(0, writer->FinishEntry());
+    }
+    ASSERT_EQ(0, writer->Finish());
+  }
+  fclose(serial_fp);
+  serial_file.fd = -1;
+
+  std::string expected;
+  ASSERT_TRUE(android::base::ReadFileToString(serial_file.path, &expected));
+  std::string actual;
+  ASSERT_TRUE(android::base::ReadFileToString(temp_file_->path, &actual));
+  EXPECT_TRUE(expected == actual);
+}
+
+TEST_F(zipwriter, ParallelCompressionBackup) {
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.EnableParallelCompression(2));
+
+  ASSERT_EQ(0, writer.StartEntry("keep.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("keep this", 9));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartEntry("drop.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("drop this", 9));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.DiscardLastEntry());
+  ASSERT_EQ(0, writer.StartEntry("replace.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("replace with this", 17));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, "keep.txt", &data));
+  ASSERT_TRUE(AssertFileEntryContentsEq("keep this", handle, &data));
+  ASSERT_NE(0, FindEntry(handle, "drop.txt", &data));
+  ASSERT_EQ(0, FindEntry(handle, "replace.txt", &data));
+  ASSERT_TRUE(AssertFileEntryContentsEq("replace with this", handle, &data));
+  CloseArchive(handle);
+}
+
+TEST_F(zipwriter, EnableParallelCompressionAfterStartFails) {
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.StartEntry("file.txt", 0));
+  ASSERT_GT(0, writer.EnableParallelCompression(2));
+}
+
+TEST_F(zipwriter, EntriesOver4GiBFail) {
+  // Nothing is read back, so don't use up 4GiB of disk.
+  std::unique_ptr<FILE, decltype(&fclose)> null_file(fopen("/dev/null", "w"), fclose);
+  ASSERT_NE(null_file, nullptr);
+  const std::vector<uint8_t> chunk(1 << 20);
+  for (bool parallel : {false, true}) {
+    ZipWriter writer(null_file.get());
+    if (parallel) ASSERT_EQ(0, writer.EnableParallelCompression(2));
+    ASSERT_EQ(0, writer.StartEntry("big", 0));
+    uint64_t written = 0;
+    int32_t result;
+    while ((result = writer.WriteBytes(chunk.data(), chunk.size())) == 0) {
+      written += chunk.size();
+      ASSERT_LE(written, std::numeric_limits<uint32_t>::max()) << "parallel=" << parallel;
+    }
+    EXPECT_GT(0, result) << "parallel=" << parallel;
+    EXPECT_EQ(4095u << 20, written) << "parallel=" << parallel;
+    EXPECT_GT(0, writer.FinishEntry()) << "parallel=" << parallel;
+  }
+}
+
 static ::testing::AssertionResult AssertFileEntryContentsEq(const std::string& expected,
                                                             ZipArchiveHandle handle,
                                                             ZipEntry* zip_entry) {
@@ -30,8 +30,10 @@
 
 #include <set>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <ziparchive/zip_archive.h>
 #include <zlib.h>
@@ -61,6 +63,7 @@ static bool flag_q = false;
 static bool flag_t = false;
 static bool flag_v = false;
 static bool flag_x = false;
+static size_t jobs = 1;
 static const char* archive_name = nullptr;
 static std::set<std::string> includes;
 static std::set<std::string> excludes;
@@ -69,6 +72,18 @@ static uint64_t total_compressed_length = 0;
 static size_t file_count = 0;
 static size_t bad_crc_count = 0;
 
+// Files waiting to be extracted by ExtractPending() when jobs != 1.
+struct PendingFile {
+  ZipEntry64 entry;
+  // The path to open, relative to the -d directory.
+  std::string name;
+  // The path to show the user.
+  std::string dst;
+  // The permissions CreateOne() gave the file, restored once it's written.
+  mode_t mode;
+};
+static std::vector<PendingFile> pending_files;
+
 static const char* g_progname;
 static int g_exit_code = 0;
 
@@ -255,55 +270,138 @@ static void ExtractToPipe(ZipArchiveHandle zah, const ZipEntry64& entry, const s
   delete[] buffer;
 }
 
-static void ExtractOne(ZipArchiveHandle zah, const ZipEntry64& entry, std::string name) {
+// Creates the file (or directory) for |entry|, returning false if there's
+// nothing to extract. Otherwise |name| and |dst| are set to the path of the
+// file, and |fd| to a descriptor open for writing it.
+static bool CreateOne(const ZipEntry64& entry, std::string* name, std::string* dst, int* fd) {
   // Bad filename?
-  if (StartsWith(name, "/") || StartsWith(name, "../") || name.find("/../") != std::string::npos) {
-    die(0, "bad filename %s", name.c_str());
+  if (StartsWith(*name, "/") || StartsWith(*name, "../") || name->find("/../") != std::string::npos) {
+    die(0, "bad filename %s", name->c_str());
   }
 
   // Junk the path if we were asked to.
-  if (flag_j) name = android::base::Basename(name);
+  if (flag_j) *name = android::base::Basename(*name);
 
   // Where are we actually extracting to (for human-readable output)?
   // flag_d is the empty string if -d wasn't used, or has a trailing '/'
   // otherwise.
-  std::string dst = flag_d + name;
+  *dst = flag_d + *name;
 
   // Ensure the directory hierarchy exists.
-  if (!MakeDirectoryHierarchy(android::base::Dirname(name))) {
-    die(errno, "couldn't create directory hierarchy for %s", dst.c_str());
+  if (!MakeDirectoryHierarchy(android::base::Dirname(*name))) {
+    die(errno, "couldn't create directory hierarchy for %s", dst->c_str());
   }
 
   // An entry in a zip file can just be a directory itself.
-  if (EndsWith(name, "/")) {
-    if (mkdir(name.c_str(), entry.unix_mode) == -1) {
+  if (EndsWith(*name, "/")) {
+    if (mkdir(name->c_str(), entry.unix_mode) == -1) {
       // If the directory already exists, that's fine.
       if (errno == EEXIST) {
         struct stat sb;
-        if (stat(name.c_str(), &sb) != -1 && S_ISDIR(sb.st_mode)) return;
+        if (stat(name->c_str(), &sb) != -1 && S_ISDIR(sb.st_mode)) return false;
       }
-      die(errno, "couldn't extract directory %s", dst.c_str());
+      die(errno, "couldn't extract directory %s", dst->c_str());
     }
-    return;
+    return false;
   }
 
   // Create the file.
-  int fd = open(name.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC | O_EXCL, entry.unix_mode);
-  if (fd == -1 && errno == EEXIST) {
-    if (overwrite_mode == kNever) return;
-    if (overwrite_mode == kPrompt && !PromptOverwrite(dst)) return;
+  *fd = open(name->c_str(), O_CREAT | O_WRONLY | O_CLOEXEC | O_EXCL, entry.unix_mode);
+  if (*fd == -1 && errno == EEXIST) {
+    if (overwrite_mode == kNever) return false;
+    if (overwrite_mode == kPrompt && !PromptOverwrite(*dst)) return false;
     // Either overwrite_mode is kAlways or the user consented to this specific case.
-    fd = open(name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC, entry.unix_mode);
+    *fd = open(name->c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC, entry.unix_mode);
+  }
+  if (*fd == -1) die(errno, "couldn't create file %s", dst->c_str());
+
+  if (!flag_q) printf("  inflating: %s\n", dst->c_str());
+  return true;
+}
+
+static void ExtractOne(ZipArchiveHandle zah, const ZipEntry64& entry, std::string name) {
+  std::string dst;
+  int fd;
+  if (!CreateOne(entry, &name, &dst, &fd)) return;
+
+  if (jobs != 1) {
+    // Leave the actual extraction to ExtractPending(), rather than holding
+    // a descriptor open for every file in the archive. The file has to be
+    // reopened for writing then, so it stays owner-writable until it's been
+    // written, even if the entry is read-only.
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || fchmod(fd, S_IRUSR | S_IWUSR) == -1) {
+      die(errno, "couldn't create file %s", dst.c_str());
+    }
+    close(fd);
+    pending_files.push_back({entry, name, dst, static_cast<mode_t>(sb.st_mode & 07777)});
+    return;
   }
-  if (fd == -1) die(errno, "couldn't create file %s", dst.c_str());
 
   // Actually extract into the file.
-  if (!flag_q) printf("  inflating: %s\n", dst.c_str());
   int err = ExtractEntryToFile(zah, &entry, fd);
   if (err < 0) die(0, "failed to extract %s: %s", dst.c_str(), ErrorCodeString(err));
   close(fd);
 }
 
+class PendingFileWriter final : public zip_archive::Writer {
+ public:
+  PendingFileWriter(int fd, mode_t mode) : fd_(fd), mode_(mode) {}
+  ~PendingFileWriter() {
+    fchmod(fd_, mode_);
+    close(fd_);
+  }
+
+  bool Append(uint8_t* buf, size_t size) override {
+    return android::base::WriteFully(fd_, buf, size);
+  }
+
+ private:
+  int fd_;
+  mode_t mode_;
+};
+
+class PendingFileWriterFactory final : public zip_archive::WriterFactory {
+ public:
+  zip_archive::Writer* CreateWriter(size_t index, const ZipEntry64&) override {
+    // CreateOne() already created (or truncated) the file.
+    const PendingFile& file = pending_files[index];
+    int fd = open(file.name.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+      open_errors[index] = errno;
+      chmod(file.name.c_str(), file.mode);
+      return nullptr;
+    }
+    return new PendingFileWriter(fd, file.mode);
+  }
+
+  void ReleaseWriter(size_t index, zip_archive::Writer* writer, int32_t error) override {
+    delete static_cast<PendingFileWriter*>(writer);
+    extract_errors[index] = error;
+  }
+
+  // Each file's errno if it couldn't be opened, or its extraction error.
+  std::vector<int> open_errors = std::vector<int>(pending_files.size());
+  std::vector<int32_t> extract_errors = std::vector<int32_t>(pending_files.size());
+};
+
+static void ExtractPending(ZipArchiveHandle zah) {
+  std::vector<ZipEntry64> entries;
+  entries.reserve(pending_files.size());
+  for (const auto& file : pending_files) entries.push_back(file.entry);
+
+  PendingFileWriterFactory factory;
+  if (zip_archive::ExtractEntries(zah, entries, &factory, jobs) == 0) return;
+
+  // Report the first file that failed, as the sequential path would have.
+  for (size_t i = 0; i < pending_files.size(); ++i) {
+    const char* dst = pending_files[i].dst.c_str();
+    if (factory.open_errors[i] != 0) die(factory.open_errors[i], "couldn't open file %s", dst);
+    int err = factory.extract_errors[i];
+    if (err < 0) die(0, "failed to extract %s: %s", dst, ErrorCodeString(err));
+  }
+}
+
 static void ListOne(const ZipEntry64& entry, const std::string& name) {
   tm t = entry.GetModificationTime();
   char time[32];
@@ -424,6 +522,8 @@ static void ProcessAll(ZipArchiveHandle zah) {
   if (err < -1) die(0, "failed iterating %s: %s", archive_name, ErrorCodeString(err));
   EndIteration(cookie);
 
+  if (!pending_files.empty()) ExtractPending(zah);
+
   MaybeShowFooter();
 }
 
@@ -439,6 +539,7 @@ static void ShowHelp(bool full) {
         "\n"
         "-d DIR	Extract into DIR\n"
         "-j	Junk (ignore) file paths\n"
+        "--jobs N	Extract N files at a time (0: one per CPU; default 1)\n"
         "-l	List contents (-lq excludes archive name, -lv is verbose)\n"
         "-n	Never overwrite files (default: prompt)\n"
         "-o	Always overwrite files\n"
@@ -462,6 +563,11 @@ static void ShowHelp(bool full) {
   exit(EXIT_SUCCESS);
 }
 
+// getopt_long value for options that only have a long form.
+enum {
+  kOptJobs = 0x100,
+};
+
 static void HandleCommonOption(int opt) {
   switch (opt) {
     case 'h':
@@ -501,6 +607,7 @@ int main(int argc, char* argv[]) {
 
   static const struct option opts[] = {
       {"help", no_argument, 0, 'h'},
+      {"jobs", required_argument, 0, kOptJobs},
       {},
   };
 
@@ -549,6 +656,9 @@ int main(int argc, char* argv[]) {
         case 'v':
           flag_v = true;
           break;
+        case kOptJobs:
+          if (!android::base::ParseUint(optarg, &jobs)) die(0, "bad job count %s", optarg);
+          break;
         default:
           HandleCommonOption(opt);
           break;
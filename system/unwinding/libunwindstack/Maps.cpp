@@ -43,6 +43,19 @@ std::shared_ptr<MapInfo> Maps::Find(uint64_t pc) {
   if (maps_.empty()) {
     return nullptr;
   }
+  if (starts_.size() == maps_.size()) {
+    // Find the last map that starts at or below pc.
+    auto it = std::upper_bound(starts_.begin(), starts_.end(), pc);
+    if (it == starts_.begin()) {
+      return nullptr;
+    }
+    size_t index = it - starts_.begin() - 1;
+    if (pc < ends_[index]) {
+      return maps_[index];
+    }
+    return nullptr;
+  }
+
   size_t first = 0;
   size_t last = maps_.size();
   while (first < last) {
@@ -59,26 +72,51 @@ std::shared_ptr<MapInfo> Maps::Find(uint64_t pc) {
   return nullptr;
 }
 
+void Maps::BuildIndex() {
+  starts_.resize(maps_.size());
+  ends_.resize(maps_.size());
+  for (size_t i = 0; i < maps_.size(); i++) {
+    starts_[i] = maps_[i]->start();
+    ends_[i] = maps_[i]->end();
+  }
+}
+
+void Maps::AddToIndex(uint64_t start, uint64_t end) {
+  // If the index is already out of date, leave it for the next BuildIndex().
+  if (starts_.size() == maps_.size()) {
+    starts_.push_back(start);
+    ends_.push_back(end);
+  }
+}
+
+static inline uint64_t GetMapFlags(const android::procinfo::MapInfo& mapinfo) {
+  // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
+  auto flags = mapinfo.flags;
+  if (strncmp(mapinfo.name.c_str(), "/dev/", 5) == 0 &&
+      strncmp(mapinfo.name.c_str() + 5, "ashmem/", 7) != 0) {
+    flags |= unwindstack::MAPS_FLAGS_DEVICE_MAP;
+  }
+  return flags;
+}
+
 bool Maps::Parse() {
   std::shared_ptr<MapInfo> prev_map;
-  return android::procinfo::ReadMapFile(GetMapsFile(),
+  bool parsed = android::procinfo::ReadMapFile(GetMapsFile(),
                       [&](const android::procinfo::MapInfo& mapinfo) {
-    // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
-    auto flags = mapinfo.flags;
-    if (strncmp(mapinfo.name.c_str(), "/dev/", 5) == 0 &&
-        strncmp(mapinfo.name.c_str() + 5, "ashmem/", 7) != 0) {
-      flags |= unwindstack::MAPS_FLAGS_DEVICE_MAP;
-    }
+    auto flags = GetMapFlags(mapinfo);
     maps_.emplace_back(
         MapInfo::Create(prev_map, mapinfo.start, mapinfo.end, mapinfo.pgoff, flags, mapinfo.name));
     prev_map = maps_.back();
   });
+  BuildIndex();
+  return parsed;
 }
 
 void Maps::Add(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
                const std::string& name) {
   std::shared_ptr<MapInfo> prev_map(maps_.empty() ? nullptr : maps_.back());
   auto map_info = MapInfo::Create(prev_map, start, end, offset, flags, name);
+  AddToIndex(start, end);
   maps_.emplace_back(std::move(map_info));
 }
 
@@ -87,6 +125,7 @@ void Maps::Add(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
   std::shared_ptr<MapInfo> prev_map(maps_.empty() ? nullptr : maps_.back());
   auto map_info = MapInfo::Create(prev_map, start, end, offset, flags, name);
   map_info->set_load_bias(load_bias);
+  AddToIndex(start, end);
   maps_.emplace_back(std::move(map_info));
 }
 
@@ -111,23 +150,21 @@ void Maps::Sort() {
     }
     prev_map = map_info;
   }
+  BuildIndex();
 }
 
 bool BufferMaps::Parse() {
   std::string content(buffer_);
   std::shared_ptr<MapInfo> prev_map;
-  return android::procinfo::ReadMapFileContent(
+  bool parsed = android::procinfo::ReadMapFileContent(
       &content[0], [&](const android::procinfo::MapInfo& mapinfo) {
-        // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
-        auto flags = mapinfo.flags;
-        if (strncmp(mapinfo.name.c_str(), "/dev/", 5) == 0 &&
-            strncmp(mapinfo.name.c_str() + 5, "ashmem/", 7) != 0) {
-          flags |= unwindstack::MAPS_FLAGS_DEVICE_MAP;
-        }
+        auto flags = GetMapFlags(mapinfo);
         maps_.emplace_back(MapInfo::Create(prev_map, mapinfo.start, mapinfo.end, mapinfo.pgoff,
                                            flags, mapinfo.name));
         prev_map = maps_.back();
       });
+  BuildIndex();
+  return parsed;
 }
 
 const std::string RemoteMaps::GetMapsFile() const {
@@ -168,87 +205,64 @@ bool LocalUpdatableMaps::Parse() {
 }
 
 bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
-  // New maps will be added at the end without deleting the old ones.
-  size_t last_map_idx = maps_.size();
-  if (!Maps::Parse()) {
-    maps_.resize(last_map_idx);
-    return false;
+  // Both the current maps and the maps file are sorted by start address, so
+  // merge the two in a single pass while the file is parsed. Any entry that
+  // is unchanged keeps its existing MapInfo object (and any Elf object
+  // already created for it); only new or modified entries are allocated.
+  // Old entries that disappear are simply dropped from the list. Since these
+  // are all shared_ptrs, any code still holding on to one will still have a
+  // valid pointer after this.
+  if (starts_.size() != maps_.size()) {
+    BuildIndex();
   }
-
-  size_t search_map_idx = 0;
-  size_t num_deleted_old_entries = 0;
-  size_t num_deleted_new_entries = 0;
-  for (size_t new_map_idx = last_map_idx; new_map_idx < maps_.size(); new_map_idx++) {
-    auto& new_map_info = maps_[new_map_idx];
-    uint64_t start = new_map_info->start();
-    uint64_t end = new_map_info->end();
-    uint64_t flags = new_map_info->flags();
-    const SharedString& name = new_map_info->name();
-    for (size_t old_map_idx = search_map_idx; old_map_idx < last_map_idx; old_map_idx++) {
-      auto& info = maps_[old_map_idx];
-      if (start == info->start() && end == info->end() && flags == info->flags() &&
-          name == info->name()) {
-        search_map_idx = old_map_idx + 1;
-        // Since we are throwing away a map from the new list, need to
-        // adjust the next/prev pointers in the old map entry.
-        auto prev = new_map_info->prev_map();
-        auto next = new_map_info->next_map();
-        info->set_prev_map(prev);
-        info->set_next_map(next);
-
-        // Fix up the pointers in the prev and next entries.
-        if (prev != nullptr) {
-          prev->set_next_map(info);
+  std::vector<std::shared_ptr<MapInfo>> new_maps;
+  new_maps.reserve(maps_.size());
+  size_t old_map_idx = 0;
+  size_t num_reused_entries = 0;
+  bool parsed = android::procinfo::ReadMapFile(
+      GetMapsFile(), [&](const android::procinfo::MapInfo& mapinfo) {
+        uint16_t flags = GetMapFlags(mapinfo);
+        while (old_map_idx < maps_.size() && starts_[old_map_idx] < mapinfo.start) {
+          old_map_idx++;
         }
-        if (next != nullptr) {
-          next->set_prev_map(info);
+        if (old_map_idx < maps_.size() && starts_[old_map_idx] == mapinfo.start) {
+          auto& info = maps_[old_map_idx];
+          if (mapinfo.end == info->end() && flags == info->flags() &&
+              mapinfo.name == info->name()) {
+            new_maps.emplace_back(info);
+            old_map_idx++;
+            num_reused_entries++;
+            return;
+          }
         }
-
-        maps_[new_map_idx] = nullptr;
-        num_deleted_new_entries++;
-        break;
-      } else if (info->start() > start) {
-        // Stop, there isn't going to be a match.
-        search_map_idx = old_map_idx;
-        break;
-      }
-
-      // Never delete these maps, they may be in use. The assumption is
-      // that there will only every be a handful of these so waiting
-      // to destroy them is not too expensive.
-      // Since these are all shared_ptrs, we can just remove the references.
-      // Any code still holding on to the pointer, will still have a
-      // valid pointer after this.
-      search_map_idx = old_map_idx + 1;
-      maps_[old_map_idx] = nullptr;
-      num_deleted_old_entries++;
-    }
-    if (search_map_idx >= last_map_idx) {
-      break;
-    }
+        new_maps.emplace_back(
+            MapInfo::Create(mapinfo.start, mapinfo.end, mapinfo.pgoff, flags, mapinfo.name));
+      });
+  if (!parsed) {
+    return false;
   }
 
-  for (size_t i = search_map_idx; i < last_map_idx; i++) {
-    maps_[i] = nullptr;
-    num_deleted_old_entries++;
+  if (any_changed != nullptr) {
+    *any_changed = num_reused_entries != maps_.size() || new_maps.size() != maps_.size();
   }
 
-  // Sort all of the values such that the nullptrs wind up at the end, then
-  // resize them away.
-  std::sort(maps_.begin(), maps_.end(), [](const auto& a, const auto& b) {
-    if (a == nullptr) {
-      return false;
-    } else if (b == nullptr) {
-      return true;
+  // Set prev_map and next_map on the info objects. Reused entries may have
+  // gained or lost neighbours, so every entry is updated.
+  std::shared_ptr<MapInfo> prev_map;
+  for (auto& map_info : new_maps) {
+    map_info->set_prev_map(prev_map);
+    if (prev_map) {
+      prev_map->set_next_map(map_info);
     }
-    return a->start() < b->start();
-  });
-  maps_.resize(maps_.size() - num_deleted_old_entries - num_deleted_new_entries);
-
-  if (any_changed != nullptr) {
-    *any_changed = num_deleted_old_entries != 0 || maps_.size() != last_map_idx;
+    prev_map = map_info;
+  }
+  if (!new_maps.empty()) {
+    std::shared_ptr<MapInfo> no_map;
+    new_maps.back()->set_next_map(no_map);
   }
 
+  maps_ = std::move(new_maps);
+  BuildIndex();
   return true;
 }
 
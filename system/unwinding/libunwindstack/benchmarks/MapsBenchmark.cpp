@@ -15,9 +15,11 @@
  */
 
 #include <err.h>
+#include <inttypes.h>
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -41,6 +43,8 @@ class BenchmarkLocalUpdatableMaps : public unwindstack::LocalUpdatableMaps {
 
 static constexpr size_t kNumSmallMaps = 100;
 static constexpr size_t kNumLargeMaps = 10000;
+// Roughly the number of maps in a large app process with a busy JIT.
+static constexpr size_t kNumJitMaps = 50000;
 
 static void CreateMap(const char* filename, size_t num_maps, size_t increment = 1) {
   std::string maps;
@@ -53,6 +57,39 @@ static void CreateMap(const char* filename, size_t num_maps, size_t increment =
   }
 }
 
+// Models a JIT heavy process: groups of file backed maps for a library
+// (r--p, r-xp, rw-p) interleaved with runs of small anonymous jit cache maps.
+// Every map whose index is a multiple of skip_every is left out, which
+// simulates the jit having created or released maps between two reads.
+static std::string CreateJitMapsContent(size_t num_maps, size_t skip_every = 0) {
+  static constexpr const char* kPerms[] = {"r--p", "r-xp", "rw-p"};
+  std::string maps;
+  maps.reserve(num_maps * 64);
+  uint64_t addr = 0x10000000;
+  for (size_t i = 0; i < num_maps; i++) {
+    uint64_t size = (i % 16 < 3) ? 0x10000 : 0x1000;
+    if (skip_every == 0 || i % skip_every != 0) {
+      if (i % 16 < 3) {
+        maps += android::base::StringPrintf(
+            "%" PRIx64 "-%" PRIx64 " %s %08zx fd:00 %zu /system/lib64/lib%zu.so\n", addr,
+            addr + size, kPerms[i % 16], (i % 16) * 0x10000, i / 16, i / 16);
+      } else {
+        maps += android::base::StringPrintf("%" PRIx64 "-%" PRIx64
+                                            " rwxp 00000000 00:00 0 [anon:dalvik-jit-code-cache]\n",
+                                            addr, addr + size);
+      }
+    }
+    addr += size;
+  }
+  return maps;
+}
+
+static void CreateJitMap(const char* filename, size_t num_maps, size_t skip_every = 0) {
+  if (!android::base::WriteStringToFile(CreateJitMapsContent(num_maps, skip_every), filename)) {
+    errx(1, "WriteStringToFile failed");
+  }
+}
+
 static void ReparseBenchmark(benchmark::State& state, const char* maps1, size_t maps1_total,
                              const char* maps2, size_t maps2_total) {
   for (const auto& _ : state) {
@@ -158,3 +195,74 @@ void BM_local_updatable_maps_reparse_few_less_large(benchmark::State& state) {
   ReparseBenchmark(state, maps1.path, kNumLargeMaps, maps2.path, kNumLargeMaps - 4);
 }
 BENCHMARK(BM_local_updatable_maps_reparse_few_less_large);
+
+void BM_local_updatable_maps_reparse_same_maps_jit(benchmark::State& state) {
+  TemporaryFile maps;
+  CreateJitMap(maps.path, kNumJitMaps);
+
+  ReparseBenchmark(state, maps.path, kNumJitMaps, maps.path, kNumJitMaps);
+}
+BENCHMARK(BM_local_updatable_maps_reparse_same_maps_jit);
+
+void BM_local_updatable_maps_reparse_churn_jit(benchmark::State& state) {
+  // One in every hundred maps appears between the two reads.
+  TemporaryFile maps1;
+  CreateJitMap(maps1.path, kNumJitMaps, 100);
+
+  TemporaryFile maps2;
+  CreateJitMap(maps2.path, kNumJitMaps);
+
+  ReparseBenchmark(state, maps1.path, kNumJitMaps - kNumJitMaps / 100, maps2.path, kNumJitMaps);
+}
+BENCHMARK(BM_local_updatable_maps_reparse_churn_jit);
+
+// Only measures the incremental reparse, the initial parse is done once.
+void BM_local_updatable_maps_reparse_unchanged_jit(benchmark::State& state) {
+  TemporaryFile maps_file;
+  CreateJitMap(maps_file.path, kNumJitMaps);
+
+  BenchmarkLocalUpdatableMaps maps;
+  maps.BenchmarkSetMapsFile(maps_file.path);
+  if (!maps.Parse()) {
+    errx(1, "Internal Error: parse of initial maps failed.");
+  }
+  for (const auto& _ : state) {
+    bool any_changed;
+    if (!maps.Reparse(&any_changed)) {
+      errx(1, "Internal Error: reparse of maps failed.");
+    }
+    if (any_changed) {
+      errx(1, "Internal Error: reparse of identical maps reported a change.");
+    }
+  }
+}
+BENCHMARK(BM_local_updatable_maps_reparse_unchanged_jit);
+
+void BM_maps_find_jit(benchmark::State& state) {
+  std::string content = CreateJitMapsContent(kNumJitMaps);
+  unwindstack::BufferMaps maps(content.c_str());
+  if (!maps.Parse()) {
+    errx(1, "Internal Error: parse of maps failed.");
+  }
+  if (maps.Total() != kNumJitMaps) {
+    errx(1, "Internal Error: Incorrect total number of maps %zu, expected %zu.", maps.Total(),
+         kNumJitMaps);
+  }
+
+  // Visit the maps in a scattered order so that consecutive lookups do not
+  // hit the same cache lines.
+  std::vector<uint64_t> pcs;
+  pcs.reserve(kNumJitMaps);
+  for (size_t i = 0; i < kNumJitMaps; i++) {
+    auto map_info = maps.Get((i * 7919) % kNumJitMaps);
+    pcs.push_back(map_info->start() + (map_info->end() - map_info->start()) / 2);
+  }
+
+  for (const auto& _ : state) {
+    for (uint64_t pc : pcs) {
+      benchmark::DoNotOptimize(maps.Find(pc));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+BENCHMARK(BM_maps_find_jit);
@@ -77,7 +77,22 @@ class Maps {
   }
 
  protected:
+  // Rebuild the interval index used by Find(). Add(), Parse(), Sort() and
+  // LocalUpdatableMaps::Reparse() keep the index current; anything else
+  // that modifies maps_ directly must call this afterwards.
+  void BuildIndex();
+
+  // Append an entry to the index for a map about to be added at the end of maps_.
+  void AddToIndex(uint64_t start, uint64_t end);
+
   std::vector<std::shared_ptr<MapInfo>> maps_;
+
+  // Start and end of every entry in maps_, stored as separate contiguous
+  // arrays so that the binary search in Find() does not touch a MapInfo
+  // object until it has found a candidate. The index is only used while its
+  // size matches maps_, otherwise Find() falls back to searching maps_.
+  std::vector<uint64_t> starts_;
+  std::vector<uint64_t> ends_;
 };
 
 class RemoteMaps : public Maps {